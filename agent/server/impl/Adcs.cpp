@@ -7,8 +7,13 @@
  */
 #include "Adcs.h"
 #include "Adaptor.h"
+#include <unistd.h>
 #include <cmath>
+#include <memory>
 #include <string>
+#include <vector>
+
+#include "nlohmann/json.hpp"
 
 using namespace std;
 using namespace org::openapitools::server::model;
@@ -61,82 +66,59 @@ static double get_gha(const double unix_timestamp) {
     return gha;
 }
 
-const double xyz_norm(const ussp::payload::XyzFloatT& v) {
-    return sqrt(pow(v.x, 2) + pow(v.y, 2) + pow(v.z, 2));
-}
-
-const double xyz_norm(const org::openapitools::server::model::Adcs_xyz_float_t& v) {
-    return sqrt(pow(v.getX(), 2) + pow(v.getY(), 2) + pow(v.getZ(), 2));
-}
-
-static double DeriveControlErrorAngleDeg(
-    org::openapitools::server::model::AdcsHk& oapi_hk,
-    const ussp::payload::PayloadAdcsFeed& ucan_adcs) {
+static double DeriveControlErrorAngleDeg(const ussp::payload::PayloadAdcsFeed& ucan_adcs) {
     return 2.0 * rad2deg(acos_safe(ucan_adcs.control_error_q.q4));
 }
 
 static org::openapitools::server::model::Adcs_euler_t DeriveEulerAngles(
-    org::openapitools::server::model::AdcsHk& oapi_hk,
     const ussp::payload::PayloadAdcsFeed& ucan_adcs) {
     org::openapitools::server::model::Adcs_euler_t value;
-    auto q = ucan_adcs.q_bo_est;
-    const double dcm_00 = pow(q.q4, 2) + pow(q.q1, 2) - pow(q.q2, 2) - pow(q.q3, 2);
+    const auto &q = ucan_adcs.q_bo_est;
+    const double q1q1 = q.q1 * q.q1, q2q2 = q.q2 * q.q2, q3q3 = q.q3 * q.q3, q4q4 = q.q4 * q.q4;
+    const double dcm_00 = q4q4 + q1q1 - q2q2 - q3q3;
     const double dcm_01 = 2.0 * (q.q1 * q.q2 + q.q3 * q.q4);
     const double dcm_02 = 2.0 * (q.q1 * q.q3 - q.q2 * q.q4);
     const double dcm_12 = 2.0 * (q.q2 * q.q3 + q.q1 * q.q4);
-    const double dcm_22 = pow(q.q4, 2) - pow(q.q1, 2) - pow(q.q2, 2) + pow(q.q3, 2);
+    const double dcm_22 = q4q4 - q1q1 - q2q2 + q3q3;
     value.setRoll(rad2deg(atan2(dcm_12, dcm_22)));
     value.setPitch(rad2deg(asin_safe(-dcm_02)));
     value.setYaw(rad2deg(atan2(dcm_01, dcm_00)));
     return value;
 }
 
-static double DeriveLatDeg(
-    org::openapitools::server::model::AdcsHk& oapi_hk,
-    const ussp::payload::PayloadAdcsFeed& ucan_adcs) {
-    auto r_ecef = oapi_hk.getREcef();
-    double r_sat = xyz_norm(r_ecef);
-    if (r_sat > R_EARTH) {
-        return rad2deg(asin_safe(r_ecef.getZ() / r_sat));
-    } else {
-        return 0.0;
-    }
-}
-
-static double DeriveLonDeg(
+/**
+ * \brief ECEF position, and the latitude, longitude and altitude derived
+ * from it
+ *
+ * The hour angle is rotated through once, and the radius is shared by all
+ * three geodetic fields.
+ */
+static void DerivePosition(
     org::openapitools::server::model::AdcsHk& oapi_hk,
     const ussp::payload::PayloadAdcsFeed& ucan_adcs) {
-    auto r_ecef = oapi_hk.getREcef();
-    double r_sat = xyz_norm(r_ecef);
-    if (r_sat > R_EARTH) {
-        return rad2deg(atan2(r_ecef.getY() / r_sat, r_ecef.getX() / r_sat));
-    } else {
-        return 0.0;
-    }
-}
+    const double gha = get_gha(ucan_adcs.unix_timestamp);
+    const double c = cos(gha), s = sin(gha);
+    const double x = c * ucan_adcs.r_eci.x + s * ucan_adcs.r_eci.y;
+    const double y = -s * ucan_adcs.r_eci.x + c * ucan_adcs.r_eci.y;
+    const double z = ucan_adcs.r_eci.z;
+    org::openapitools::server::model::Adcs_xyz_float_t ecef;
+    ecef.setX(x);
+    ecef.setY(y);
+    ecef.setZ(z);
+    oapi_hk.setREcef(ecef);
 
-static double DeriveAltitude(
-    org::openapitools::server::model::AdcsHk& oapi_hk,
-    const ussp::payload::PayloadAdcsFeed& ucan_adcs) {
-    double r_sat = xyz_norm(oapi_hk.getREcef());
+    const double r_sat = sqrt(x * x + y * y + z * z);
     if (r_sat > R_EARTH) {
-        return r_sat - R_EARTH;
+        oapi_hk.setLatDeg(rad2deg(asin_safe(z / r_sat)));
+        oapi_hk.setLonDeg(rad2deg(atan2(y, x)));
+        oapi_hk.setAltitude(r_sat - R_EARTH);
     } else {
-        return 0.0;
+        oapi_hk.setLatDeg(0.0);
+        oapi_hk.setLonDeg(0.0);
+        oapi_hk.setAltitude(0.0);
     }
 }
 
-static org::openapitools::server::model::Adcs_xyz_float_t DeriveREcef(
-    org::openapitools::server::model::AdcsHk& oapi_hk,
-    const ussp::payload::PayloadAdcsFeed& ucan_adcs) {
-    org::openapitools::server::model::Adcs_xyz_float_t ecef;
-    const double gha = get_gha(ucan_adcs.unix_timestamp);
-    ecef.setX(cos(gha) * ucan_adcs.r_eci.x + sin(gha) * ucan_adcs.r_eci.y);
-    ecef.setY(-sin(gha) * ucan_adcs.r_eci.x + cos(gha) * ucan_adcs.r_eci.y);
-    ecef.setZ(ucan_adcs.r_eci.z);
-    return ecef;
-}
-
 static void convert(
     org::openapitools::server::model::AdcsHk& oapi_hk,
     const ussp::payload::PayloadAdcsFeed& ucan_adcs) {
@@ -160,43 +142,292 @@ static void convert(
     oapi_hk.setEclipseFlag(Adapt(ucan_adcs.eclipse_flag));
     oapi_hk.setLeaseActive(Adapt(ucan_adcs.lease_active));
 
-    oapi_hk.setREcef(DeriveREcef(oapi_hk, ucan_adcs));
-    oapi_hk.setControlErrorAngleDeg(DeriveControlErrorAngleDeg(oapi_hk, ucan_adcs));
-    oapi_hk.setEulerAngles(DeriveEulerAngles(oapi_hk, ucan_adcs));
-    oapi_hk.setLatDeg(DeriveLatDeg(oapi_hk, ucan_adcs));
-    oapi_hk.setLonDeg(DeriveLonDeg(oapi_hk, ucan_adcs));
-    oapi_hk.setAltitude(DeriveAltitude(oapi_hk, ucan_adcs));
+    DerivePosition(oapi_hk, ucan_adcs);
+    oapi_hk.setControlErrorAngleDeg(DeriveControlErrorAngleDeg(ucan_adcs));
+    oapi_hk.setEulerAngles(DeriveEulerAngles(ucan_adcs));
+}
+
+static double unixTime(chrono::system_clock::time_point t) {
+    return chrono::duration<double>(t.time_since_epoch()).count();
+}
+
+static double lerp(double a, double b, double f) {
+    return a + (b - a) * f;
+}
+
+static ussp::payload::XyzFloatT lerp(
+    const ussp::payload::XyzFloatT& a, const ussp::payload::XyzFloatT& b, double f) {
+    ussp::payload::XyzFloatT v;
+    v.x = lerp(a.x, b.x, f);
+    v.y = lerp(a.y, b.y, f);
+    v.z = lerp(a.z, b.z, f);
+    return v;
+}
+
+/**
+ * \brief spherical interpolation between attitude quaternions
+ *
+ * q and -q are the same attitude, so b is flipped if needed to take the
+ * shorter arc.  Nearly equal quaternions are blended linearly, where
+ * slerp would divide by ~0.
+ */
+static ussp::payload::QuatT slerp(
+    const ussp::payload::QuatT& a, const ussp::payload::QuatT& b, double f) {
+    double dot = a.q1 * b.q1 + a.q2 * b.q2 + a.q3 * b.q3 + a.q4 * b.q4;
+    double sign = 1.0;
+    if (dot < 0) {
+        dot = -dot;
+        sign = -1.0;
+    }
+    double wa = 1.0 - f, wb = f;
+    if (dot < 0.9995) {
+        double theta = acos(dot);
+        double s = sin(theta);
+        wa = sin((1.0 - f) * theta) / s;
+        wb = sin(f * theta) / s;
+    }
+    wb *= sign;
+    double q1 = wa * a.q1 + wb * b.q1;
+    double q2 = wa * a.q2 + wb * b.q2;
+    double q3 = wa * a.q3 + wb * b.q3;
+    double q4 = wa * a.q4 + wb * b.q4;
+    double norm = sqrt(q1 * q1 + q2 * q2 + q3 * q3 + q4 * q4);
+    if (norm == 0) {
+        norm = 1;
+    }
+    ussp::payload::QuatT q;
+    q.q1 = q1 / norm;
+    q.q2 = q2 / norm;
+    q.q3 = q3 / norm;
+    q.q4 = q4 / norm;
+    return q;
+}
+
+static TfrsResponse tfrsResponse(
+    const ussp::tfrs::ReceiverNavigationState& tfrs, double time, double now) {
+    TfrsResponse result;
+    result.setUtcTime(tfrs.utc_time);
+    result.setEcefPosX(tfrs.ecef_pos_x);
+    result.setEcefPosY(tfrs.ecef_pos_y);
+    result.setEcefPosZ(tfrs.ecef_pos_z);
+    result.setEcefVelX(tfrs.ecef_vel_x);
+    result.setEcefVelY(tfrs.ecef_vel_y);
+    result.setEcefVelZ(tfrs.ecef_vel_z);
+    result.setTime(time);
+    result.setAge(now - time);
+    return result;
+}
+
+static AdcsResponse adcsResponse(const AdcsHk& hk, double time, double now) {
+    AdcsResponse result;
+    result.setMode(hk.getAcsModeActive());
+    result.setHk(hk);
+    result.setTime(time);
+    result.setAge(now - time);
+    return result;
+}
+
+static AdcsResponse adcsResponse(
+    const ussp::payload::PayloadAdcsFeed& adcs, double time, double now) {
+    AdcsHk hk;
+    convert(hk, adcs);
+    return adcsResponse(hk, time, now);
+}
+
+void AdcsManager::notify() {
+    int fd = m_notifyFd;
+    if (fd >= 0) {
+        uint64_t one = 1;
+        // a full counter already means "something changed"
+        ssize_t n = write(fd, &one, sizeof(one));
+        (void) n;
+    }
 }
 
 void AdcsManager::setTfrs(const ussp::tfrs::ReceiverNavigationState& tfrs)  {
-    m_tfrs.setUtcTime(tfrs.utc_time);
-    m_tfrs.setEcefPosX(tfrs.ecef_pos_x);
-    m_tfrs.setEcefPosY(tfrs.ecef_pos_y);
-    m_tfrs.setEcefPosZ(tfrs.ecef_pos_z);
-    m_tfrs.setEcefVelX(tfrs.ecef_vel_x);
-    m_tfrs.setEcefVelY(tfrs.ecef_vel_y);
-    m_tfrs.setEcefVelZ(tfrs.ecef_vel_z);
-    m_tfrs.setAge(0);
-    m_tfrs_mtime = chrono::system_clock::now();
+    setTfrs(tfrs, chrono::system_clock::now());
 }
 
-TfrsResponse AdcsManager::getTfrs() {
-    chrono::duration<double> since = chrono::system_clock::now() - m_tfrs_mtime;
-    m_tfrs.setAge(since.count());
-    return m_tfrs;
+void AdcsManager::setTfrs(const ussp::tfrs::ReceiverNavigationState& tfrs,
+                          chrono::system_clock::time_point received)  {
+    m_tfrs.store(TfrsSample{tfrs, received});
+    m_tfrsHistory.push(unixTime(received), tfrs);
+    notify();
+}
+
+TfrsResponse AdcsManager::getTfrs() const {
+    uint64_t version;
+    auto sample = m_tfrs.load(&version);
+    auto now = chrono::system_clock::now();
+    if (version > 0) {
+        return tfrsResponse(sample.msg, unixTime(sample.mtime), unixTime(now));
+    }
+    TfrsResponse result;
+    chrono::duration<double> since = now - sample.mtime;
+    result.setAge(since.count());
+    return result;
 }
 
 void AdcsManager::setAdcs(const ussp::payload::PayloadAdcsFeed& adcs) {
-    AdcsHk hk = m_adcs.getHk();
-    convert(hk, adcs);
-    m_adcs.setMode(hk.getAcsModeActive());
-    m_adcs.setHk(hk);
-    m_adcs.setAge(0);
-    m_adcs_mtime = chrono::system_clock::now();
+    setAdcs(adcs, chrono::system_clock::now());
+}
+
+void AdcsManager::setAdcs(const ussp::payload::PayloadAdcsFeed& adcs,
+                          chrono::system_clock::time_point received) {
+    m_adcs.store(AdcsSample{adcs, received});
+    m_adcsHistory.push(unixTime(received), adcs);
+    notify();
 }
 
-AdcsResponse AdcsManager::getAdcs() {
-    chrono::duration<double> since = chrono::system_clock::now() - m_adcs_mtime;
-    m_adcs.setAge(since.count());
-    return m_adcs;
+/**
+ * The derived fields cost a few dozen transcendental calls, so they are
+ * left to the first reader of each message, not the CAN thread, and kept
+ * for the readers after it.  Readers that race both convert; either
+ * result is correct.
+ */
+shared_ptr<const AdcsManager::Converted> AdcsManager::convertedAdcs() const {
+    auto cached = atomic_load(&m_adcsHk);
+    if (!cached || cached->version != m_adcs.version()) {
+        uint64_t version;
+        auto sample = m_adcs.load(&version);
+        auto fresh = make_shared<Converted>();
+        fresh->version = version;
+        fresh->mtime = sample.mtime;
+        if (version > 0) {
+            convert(fresh->hk, sample.msg);
+        }
+        cached = fresh;
+        atomic_store(&m_adcsHk, cached);
+    }
+    return cached;
+}
+
+AdcsResponse AdcsManager::getAdcs() const {
+    auto converted = convertedAdcs();
+    auto now = chrono::system_clock::now();
+    if (converted->version > 0) {
+        return adcsResponse(converted->hk, unixTime(converted->mtime), unixTime(now));
+    }
+    AdcsResponse result;
+    chrono::duration<double> since = now - converted->mtime;
+    result.setAge(since.count());
+    return result;
+}
+
+/// a serialized response, less its opening brace and "age" (which sorts first)
+static string jsonTail(nlohmann::json j) {
+    j.erase("age");
+    return j.dump().substr(1);
+}
+
+static string withAge(const string &tail, chrono::system_clock::time_point mtime) {
+    chrono::duration<double> age = chrono::system_clock::now() - mtime;
+    string json = "{\"age\":" + nlohmann::json(age.count()).dump();
+    if (tail != "}") {
+        json += ',';
+    }
+    return json + tail;
+}
+
+/**
+ * Readers that find the cache out of date rebuild it themselves; if two
+ * race, both results are correct and the later store wins.
+ */
+string AdcsManager::getTfrsJson() const {
+    auto cached = atomic_load(&m_tfrsJson);
+    if (!cached || cached->version != m_tfrs.version()) {
+        uint64_t version;
+        auto sample = m_tfrs.load(&version);
+        nlohmann::json j;
+        to_json(j, version > 0 ? tfrsResponse(sample.msg, unixTime(sample.mtime), 0)
+                               : TfrsResponse());
+        cached = make_shared<const Serialized>(Serialized{version, sample.mtime, jsonTail(j)});
+        atomic_store(&m_tfrsJson, cached);
+    }
+    return withAge(cached->tail, cached->mtime);
+}
+
+string AdcsManager::getAdcsJson() const {
+    auto cached = atomic_load(&m_adcsJson);
+    if (!cached || cached->version != m_adcs.version()) {
+        auto converted = convertedAdcs();
+        nlohmann::json j;
+        to_json(j, converted->version > 0
+                   ? adcsResponse(converted->hk, unixTime(converted->mtime), 0)
+                   : AdcsResponse());
+        cached = make_shared<const Serialized>(
+            Serialized{converted->version, converted->mtime, jsonTail(j)});
+        atomic_store(&m_adcsJson, cached);
+    }
+    return withAge(cached->tail, cached->mtime);
+}
+
+vector<TfrsResponse> AdcsManager::getTfrsHistory(double start, double end) const {
+    double now = unixTime(chrono::system_clock::now());
+    vector<TfrsResponse> result;
+    for (auto &e : m_tfrsHistory.range(start, end)) {
+        result.push_back(tfrsResponse(e.msg, e.time, now));
+    }
+    return result;
+}
+
+vector<AdcsResponse> AdcsManager::getAdcsHistory(double start, double end) const {
+    double now = unixTime(chrono::system_clock::now());
+    vector<AdcsResponse> result;
+    for (auto &e : m_adcsHistory.range(start, end)) {
+        result.push_back(adcsResponse(e.msg, e.time, now));
+    }
+    return result;
+}
+
+bool AdcsManager::getTfrsAt(double time, bool interpolate, TfrsResponse *result) const {
+    TelemetryHistory<ussp::tfrs::ReceiverNavigationState>::Entry before, after;
+    if (!m_tfrsHistory.bracket(time, &before, &after)) {
+        return false;
+    }
+    double now = unixTime(chrono::system_clock::now());
+    double f = before.time == after.time ? 0 : (time - before.time) / (after.time - before.time);
+    if (!interpolate || f == 0) {
+        auto &nearest = f < 0.5 ? before : after;
+        *result = tfrsResponse(nearest.msg, nearest.time, now);
+        return true;
+    }
+    ussp::tfrs::ReceiverNavigationState tfrs = f < 0.5 ? before.msg : after.msg;
+    tfrs.utc_time = lround(lerp(before.msg.utc_time, after.msg.utc_time, f));
+    tfrs.ecef_pos_x = lerp(before.msg.ecef_pos_x, after.msg.ecef_pos_x, f);
+    tfrs.ecef_pos_y = lerp(before.msg.ecef_pos_y, after.msg.ecef_pos_y, f);
+    tfrs.ecef_pos_z = lerp(before.msg.ecef_pos_z, after.msg.ecef_pos_z, f);
+    tfrs.ecef_vel_x = lerp(before.msg.ecef_vel_x, after.msg.ecef_vel_x, f);
+    tfrs.ecef_vel_y = lerp(before.msg.ecef_vel_y, after.msg.ecef_vel_y, f);
+    tfrs.ecef_vel_z = lerp(before.msg.ecef_vel_z, after.msg.ecef_vel_z, f);
+    *result = tfrsResponse(tfrs, time, now);
+    return true;
+}
+
+/**
+ * Interpolation blends the attitude estimates (slerp), the ECI position
+ * and velocity and the ADCS timestamp; everything else, such as the mode,
+ * comes from the nearer sample.  Derived fields are then computed from
+ * the blended message.
+ */
+bool AdcsManager::getAdcsAt(double time, bool interpolate, AdcsResponse *result) const {
+    TelemetryHistory<ussp::payload::PayloadAdcsFeed>::Entry before, after;
+    if (!m_adcsHistory.bracket(time, &before, &after)) {
+        return false;
+    }
+    double now = unixTime(chrono::system_clock::now());
+    double f = before.time == after.time ? 0 : (time - before.time) / (after.time - before.time);
+    if (!interpolate || f == 0) {
+        auto &nearest = f < 0.5 ? before : after;
+        *result = adcsResponse(nearest.msg, nearest.time, now);
+        return true;
+    }
+    ussp::payload::PayloadAdcsFeed adcs = f < 0.5 ? before.msg : after.msg;
+    adcs.q_bo_est = slerp(before.msg.q_bo_est, after.msg.q_bo_est, f);
+    adcs.q_bi_est = slerp(before.msg.q_bi_est, after.msg.q_bi_est, f);
+    adcs.r_eci = lerp(before.msg.r_eci, after.msg.r_eci, f);
+    adcs.v_eci = lerp(before.msg.v_eci, after.msg.v_eci, f);
+    adcs.unix_timestamp = lerp(before.msg.unix_timestamp, after.msg.unix_timestamp, f);
+    *result = adcsResponse(adcs, time, now);
+    return true;
 }
@@ -7,21 +7,102 @@
  */
 #pragma once
 
+#include <atomic>
 #include <chrono>  // NOLINT(build/c++11)
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
 
 #include <ussp/payload/PayloadAdcsFeed.hpp>
 #include <ussp/tfrs/ReceiverNavigationState.hpp>
 #include "AdcsResponse.h"
+#include "SeqLock.h"
+#include "TelemetryHistory.h"
 #include "TfrsResponse.h"
 
+/**
+ * \brief Latest ADCS and TFRS telemetry.
+ *
+ * The set methods are called from the UAVCAN server thread and the get
+ * methods from HTTP workers.  The raw messages are published through
+ * SeqLocks, so readers never block the CAN thread and never see a
+ * half-written message.  The CAN thread only copies the raw message; the
+ * derived ADCS fields are computed by the first reader of each message and
+ * kept for the rest, and the JSON bodies are cached the same way, so
+ * polling readers only splice in the age.
+ *
+ * Every message is also kept in a TelemetryHistory, indexed by receive
+ * time, so payloads can look up the state at a past moment (e.g. image
+ * capture) instead of polling.  Derived fields are only computed for the
+ * samples a query returns.
+ */
 class AdcsManager {
-    org::openapitools::server::model::AdcsResponse m_adcs;
-    std::chrono::time_point<std::chrono::system_clock> m_adcs_mtime;
-    org::openapitools::server::model::TfrsResponse m_tfrs;
-    std::chrono::time_point<std::chrono::system_clock> m_tfrs_mtime;
+    template <class M>
+    struct Sample {
+        M msg;
+        std::chrono::system_clock::time_point mtime;
+    };
+    typedef Sample<ussp::payload::PayloadAdcsFeed> AdcsSample;
+    typedef Sample<ussp::tfrs::ReceiverNavigationState> TfrsSample;
+
+    SeqLock<AdcsSample> m_adcs;
+    SeqLock<TfrsSample> m_tfrs;
+    TelemetryHistory<ussp::payload::PayloadAdcsFeed> m_adcsHistory;
+    TelemetryHistory<ussp::tfrs::ReceiverNavigationState> m_tfrsHistory;
+    std::atomic<int> m_notifyFd{-1};
+
+    /// a response serialized once per message, less its age
+    struct Serialized {
+        uint64_t version;
+        std::chrono::system_clock::time_point mtime;
+        std::string tail;  ///< the members after "age", and the closing brace
+    };
+    mutable std::shared_ptr<const Serialized> m_adcsJson;
+    mutable std::shared_ptr<const Serialized> m_tfrsJson;
+
+    /// the latest ADCS message with its derived fields, converted once
+    struct Converted {
+        uint64_t version = 0;
+        std::chrono::system_clock::time_point mtime;
+        org::openapitools::server::model::AdcsHk hk;
+    };
+    mutable std::shared_ptr<const Converted> m_adcsHk;
+
+    void notify();
+    std::shared_ptr<const Converted> convertedAdcs() const;
+
  public:
     void setAdcs(const ussp::payload::PayloadAdcsFeed& adcs);
     void setTfrs(const ussp::tfrs::ReceiverNavigationState& tfrs);
-    org::openapitools::server::model::AdcsResponse getAdcs();
-    org::openapitools::server::model::TfrsResponse getTfrs();
+    /// as above, received at `received` (the CAN frame's timestamp) rather than now
+    void setAdcs(const ussp::payload::PayloadAdcsFeed& adcs,
+                 std::chrono::system_clock::time_point received);
+    void setTfrs(const ussp::tfrs::ReceiverNavigationState& tfrs,
+                 std::chrono::system_clock::time_point received);
+    org::openapitools::server::model::AdcsResponse getAdcs() const;
+    org::openapitools::server::model::TfrsResponse getTfrs() const;
+    /// getAdcs()/getTfrs() as JSON, serialized once per message
+    std::string getAdcsJson() const;
+    std::string getTfrsJson() const;
+    /// number of messages received so far
+    uint64_t adcsVersion() const { return m_adcs.version(); }
+    uint64_t tfrsVersion() const { return m_tfrs.version(); }
+    /// eventfd to signal after each message, or -1 for none
+    void setNotifyFd(int fd) { m_notifyFd = fd; }
+
+    /// samples received between `start` and `end`, in unix epoch seconds
+    std::vector<org::openapitools::server::model::AdcsResponse> getAdcsHistory(
+        double start, double end) const;
+    std::vector<org::openapitools::server::model::TfrsResponse> getTfrsHistory(
+        double start, double end) const;
+    /**
+     * \brief the state at `time`: the nearest sample or, with
+     * `interpolate`, a blend of the samples either side of it
+     * \return false if there is no history
+     */
+    bool getAdcsAt(double time, bool interpolate,
+                   org::openapitools::server::model::AdcsResponse *result) const;
+    bool getTfrsAt(double time, bool interpolate,
+                   org::openapitools::server::model::TfrsResponse *result) const;
 };
@@ -0,0 +1,123 @@
+/**
+ * AdcsCommands.cpp
+ *
+ * Tracking of ADCS commands that complete in the background.
+ *
+ * Copyright (c) 2023 Spire Global, Inc.
+ */
+
+#include "AdcsCommands.h"
+
+#include <string>
+
+#include "Utils.h"
+
+using namespace std;
+using org::openapitools::server::model::AdcsCommandResponse;
+using org::openapitools::server::model::AdcsCommandStatus;
+
+AdcsCommandTable::Waiter::Waiter(Waiter &&other) : m_table(other.m_table) {
+    other.m_table = nullptr;
+}
+
+AdcsCommandTable::Waiter& AdcsCommandTable::Waiter::operator=(Waiter &&other) {
+    if (this != &other) {
+        release();
+        m_table = other.m_table;
+        other.m_table = nullptr;
+    }
+    return *this;
+}
+
+AdcsCommandTable::Waiter::~Waiter() {
+    release();
+}
+
+void AdcsCommandTable::Waiter::release() {
+    if (m_table != nullptr) {
+        const lock_guard<mutex> guard{m_table->m_lock};
+        m_table->m_waiters--;
+        m_table = nullptr;
+    }
+}
+
+void AdcsCommandTable::setMaxWaiters(size_t max) {
+    const lock_guard<mutex> guard{m_lock};
+    m_max_waiters = max;
+}
+
+AdcsCommandTable::Waiter AdcsCommandTable::waiter() {
+    const lock_guard<mutex> guard{m_lock};
+    if (m_waiters >= m_max_waiters) {
+        return Waiter();
+    }
+    m_waiters++;
+    return Waiter(this);
+}
+
+string AdcsCommandTable::add() {
+    const lock_guard<mutex> guard{m_lock};
+    if (m_pending >= ADCS_COMMAND_MAX_PENDING) {
+        return "";
+    }
+    string id = mkUUID();
+    m_commands[id];
+    m_pending++;
+    return id;
+}
+
+void AdcsCommandTable::complete(const string &id, const AdcsCommandResponse &result) {
+    {
+        const lock_guard<mutex> guard{m_lock};
+        auto cmd = m_commands.find(id);
+        if (cmd == m_commands.end() || cmd->second.done) {
+            return;
+        }
+        cmd->second.done = true;
+        cmd->second.result = result;
+        m_pending--;
+        m_completed.push_back(id);
+        if (m_completed.size() > ADCS_COMMAND_RETAIN) {
+            m_commands.erase(m_completed.front());
+            m_completed.pop_front();
+        }
+    }
+    m_done.notify_all();
+}
+
+bool AdcsCommandTable::get(const string &id, chrono::milliseconds wait,
+                           AdcsCommandStatus *status, const Waiter *waiter) {
+    Waiter own;
+    if (wait.count() > 0 && (waiter == nullptr || !*waiter)) {
+        own = this->waiter();
+        if (!own) {
+            wait = chrono::milliseconds(0);
+        }
+    }
+    unique_lock<mutex> guard{m_lock};
+    auto deadline = chrono::steady_clock::now() + wait;
+    auto cmd = m_commands.find(id);
+    // the iterator is looked up again after each wakeup, since other
+    // completions may have dropped this command from the table
+    while (cmd != m_commands.end() && !cmd->second.done
+           && m_done.wait_until(guard, deadline) != cv_status::timeout) {
+        cmd = m_commands.find(id);
+    }
+    cmd = m_commands.find(id);
+    if (cmd == m_commands.end()) {
+        return false;
+    }
+    status->setId(id);
+    if (cmd->second.done) {
+        status->setState("done");
+        status->setResult(cmd->second.result);
+    } else {
+        status->setState("pending");
+    }
+    return true;
+}
+
+size_t AdcsCommandTable::pending() const {
+    const lock_guard<mutex> guard{m_lock};
+    return m_pending;
+}
@@ -0,0 +1,111 @@
+/**
+ * AdcsCommands.h
+ *
+ * Tracking of ADCS commands that complete in the background.
+ *
+ * Copyright (c) 2023 Spire Global, Inc.
+ */
+#pragma once
+
+#include <chrono>  // NOLINT(build/c++11)
+#include <condition_variable>  // NOLINT(build/c++11)
+#include <deque>
+#include <mutex>  // NOLINT(build/c++11)
+#include <string>
+#include <unordered_map>
+
+#include "AdcsCommandResponse.h"
+#include "AdcsCommandStatus.h"
+
+/// commands that may be waiting for a response at once
+#define ADCS_COMMAND_MAX_PENDING 16
+/// completed commands whose results are kept for polling
+#define ADCS_COMMAND_RETAIN 64
+/// longest a status query may wait for a command to complete
+#define ADCS_COMMAND_MAX_WAIT_MS 5000
+/// callers that may block waiting for commands at once, unless set otherwise
+#define ADCS_COMMAND_MAX_WAITERS 2
+
+/**
+ * \brief Table of submitted ADCS commands, by command id.
+ *
+ * HTTP handlers \ref add a command and hand its id to the caller; the
+ * UAVCAN client thread \ref complete%s it when the response (or timeout)
+ * comes in.  Callers poll with \ref get, optionally waiting for the
+ * result, without holding up the CAN side.
+ *
+ * Results are kept for the most recent ADCS_COMMAND_RETAIN completed
+ * commands.
+ *
+ * The command routes are not gated by WorkerLanes, so a waiting caller
+ * holds an HTTP worker that could be serving realtime reads.  Only
+ * \ref setMaxWaiters callers may block at once; the rest get the current
+ * state straight away.
+ */
+class AdcsCommandTable {
+ public:
+    /**
+     * \brief RAII handle for one of the blocking waits.
+     *
+     * An empty waiter (the cap was reached) evaluates to false.
+     */
+    class Waiter {
+        AdcsCommandTable *m_table = nullptr;
+
+     public:
+        Waiter() = default;
+        explicit Waiter(AdcsCommandTable *table) : m_table(table) {}
+        Waiter(const Waiter&) = delete;
+        Waiter& operator=(const Waiter&) = delete;
+        Waiter(Waiter &&other);
+        Waiter& operator=(Waiter &&other);
+        ~Waiter();
+
+        void release();
+        explicit operator bool() const { return m_table != nullptr; }
+    };
+
+    /// callers that may block in \ref get at once; 0 for none
+    void setMaxWaiters(size_t max);
+
+    /// claim a blocking wait, for a caller that must not be turned away once it starts
+    Waiter waiter();
+
+    /**
+     * \brief register a new pending command
+     * \return its id, or "" if ADCS_COMMAND_MAX_PENDING are already pending
+     */
+    std::string add();
+
+    /// record the result of a pending command; unknown ids are ignored
+    void complete(const std::string &id,
+                  const org::openapitools::server::model::AdcsCommandResponse &result);
+
+    /**
+     * \brief state of a command, after waiting up to `wait` for it to
+     * complete
+     *
+     * The wait is made with `waiter` if it is given, else with a waiter of
+     * its own; if none is free, the state is returned without waiting.
+     * \return false if the id is unknown (or its result has been dropped)
+     */
+    bool get(const std::string &id, std::chrono::milliseconds wait,
+             org::openapitools::server::model::AdcsCommandStatus *status,
+             const Waiter *waiter = nullptr);
+
+    size_t pending() const;
+
+ private:
+    struct Command {
+        bool done = false;
+        org::openapitools::server::model::AdcsCommandResponse result;
+    };
+
+    mutable std::mutex m_lock;
+    std::condition_variable m_done;
+    std::unordered_map<std::string, Command> m_commands;
+    std::deque<std::string> m_completed;  ///< oldest first
+    size_t m_pending = 0;
+    size_t m_waiters = 0;
+    size_t m_max_waiters = ADCS_COMMAND_MAX_WAITERS;
+};
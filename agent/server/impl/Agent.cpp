@@ -15,12 +15,16 @@
 #include <sys/stat.h>
 #include <sys/statvfs.h>
 #include <sys/utsname.h>
+#include <zlib.h>
 
 #include <algorithm>
+#include <chrono>  // NOLINT(build/c++11)
+#include <cmath>
+#include <cstdlib>
 #include <fstream>
 #include <functional>
+#include <limits>
 #include <string>
-#include <regex>  // NOLINT(build/c++11)
 #include <system_error>  // NOLINT(build/c++11)
 #include <utility>
 #include <vector>
@@ -34,7 +38,45 @@
 
 using namespace std;
 
-Agent::Agent(const AgentConfig &cfg) : cleaner(this) {
+namespace {
+
+/// fill in the response for a file refused by its topic's quota
+void refuse(ResponseCode<SendFileResponse> &resp, const string &topic,
+            const TopicQuotas::Admission &admission) {
+    resp.code = Code::Too_Many_Requests;
+    resp.err.setMessage(admission.reason() + " for " + topic);
+    resp.err.setRetryAfter(admission.retryAfter());
+}
+
+/// parse a history time; absent times take `dflt`
+bool parseTime(const string &value, double dflt, double *time) {
+    if (value.empty()) {
+        *time = dflt;
+        return true;
+    }
+    char *end;
+    *time = strtod(value.c_str(), &end);
+    return end != value.c_str() && *end == '\0' && std::isfinite(*time);
+}
+
+/// parse a history query; on failure fill in the error response
+template <class T>
+bool parseHistory(const HistoryQuery &query, double *start, double *end, double *at,
+                  ResponseCode<T> &resp) {
+    if (parseTime(query.start, 0, start)
+        && parseTime(query.end, numeric_limits<double>::max(), end)
+        && parseTime(query.at, 0, at)) {
+        return true;
+    }
+    resp.code = Code::Bad_Request;
+    resp.err.setMessage("Invalid time");
+    return false;
+}
+
+}  // namespace
+
+Agent::Agent(const AgentConfig &cfg)
+    : cleaner(this) {
     if (!cfg.initialized) {
         throw runtime_error("configuration not initialized");
     }
@@ -46,6 +88,7 @@ Agent::Agent(const AgentConfig &cfg) : cleaner(this) {
     machine = buf.machine;
 
     workdir = cfg.workdir;
+    uuid_version = cfg.uuidVersion;
     transfer_dir = workdir + "/transfers";
     upload_dir = workdir + "/uploads";
     upgrade_dir = workdir + "/upgrades";
@@ -53,6 +96,19 @@ Agent::Agent(const AgentConfig &cfg) : cleaner(this) {
     vector<string> all_dirs = {transfer_dir, upload_dir, upgrade_dir, deadletter_dir};
     create_dirs(all_dirs);
 
+    for (const auto &q : cfg.quotas) {
+        quotas.setLimits(q.first, q.second);
+    }
+    // callers waiting on ADCS commands may not take the last bulk worker,
+    // but one may always wait, so the synchronous command keeps working
+    adcs_commands.setMaxWaiters(max(1, cfg.workerThreads - cfg.reservedThreads - 1));
+    // watch before counting, so that nothing counted can leave unseen
+    transfer_watch.reset(new DirWatch(transfer_dir,
+                                      bind(&Agent::transfer_gone, this, placeholders::_1),
+                                      bind(&Agent::recount_quota_usage, this)));
+    transfer_watch->start();
+    load_quota_usage();
+
     cleaner.setCleanupDirs(all_dirs);
     cleaner.setCleanupInterval(cfg.cleanupInterval);
     cleaner.setMaxAge(cfg.maxAge);
@@ -65,6 +121,7 @@ Agent::Agent(const AgentConfig &cfg) : cleaner(this) {
 Agent::~Agent() {
     Log::warn("stopping cleanup worker");
     cleaner.stopWorker();
+    transfer_watch->stop();
 }
 
 Cleaner& Agent::getCleaner() {
@@ -87,6 +144,14 @@ void Agent::create_dirs(const std::vector<string> &dirs) {
     }
 }
 
+/**
+ * \brief id for a new transfer; time-ordered ids make the transfer files
+ * sort by creation time
+ */
+string Agent::new_id() const {
+    return uuid_version == 7 ? mkUUIDv7() : mkUUID();
+}
+
 ResponseCode<AvailableFilesResponse> Agent::query_available(
     const string &topic
     ) {
@@ -102,6 +167,28 @@ ResponseCode<AvailableFilesResponse> Agent::query_available(
     return resp;
 }
 
+/**
+ * \brief like query_available, but with pre-serialized file entries
+ *
+ * The entries are cached per meta file, so unchanged files are not
+ * re-serialized on every query.
+ */
+ResponseCode<AvailableFragments> Agent::query_available_fragments(const string &topic) {
+    ResponseCode<AvailableFragments> resp;
+    auto &files = resp.result.files;
+    scan_files(upload_dir, topic, [this, &files](const string &meta, const TransferMeta &tm) {
+        files.push_back(fragment_cache.get(meta, [&tm](const string&) {
+            return make_shared<const string>(to_jsonstr(tm.getFileInfo()));
+        }));
+    });
+    if (files.size() > max_query) {
+        resp.result.overflow = true;
+        files.pop_back();
+    }
+    resp.code = Code::Ok;
+    return resp;
+}
+
 /**
  * \brief read .meta files and filter based on topic
  * 
@@ -111,8 +198,23 @@ ResponseCode<AvailableFilesResponse> Agent::query_available(
  * correct maximum length.
  */
 vector<FileInfo> Agent::files_info(const string &dir, const string &topic) {
-  auto meta_files = metafile_cache.get(dir, bind(&Files::list_files, placeholders::_1, META_EXT));
   vector<FileInfo> flist;
+  scan_files(dir, topic, [&flist](const string&, const TransferMeta &tm) {
+      flist.push_back(tm.getFileInfo());
+  });
+  return flist;
+}
+
+/**
+ * \brief call `fn` for each valid file in `dir` on `topic`
+ *
+ * Files whose data does not match the stored CRC, or whose meta cannot
+ * be read, are endeadened and skipped.  Stops after `max_query + 1`
+ * files.
+ */
+void Agent::scan_files(const string &dir, const string &topic, const ScanFn &fn) {
+  auto meta_files = metafile_cache.get(dir, bind(&Files::list_files, placeholders::_1, META_EXT));
+  size_t count = 0;
   for (auto it = meta_files.begin(); it != meta_files.end(); ++it) {
     try {
         auto tm = read_transfer_meta_cached(dir + "/" + *it);
@@ -127,7 +229,8 @@ vector<FileInfo> Agent::files_info(const string &dir, const string &topic) {
             endeaden(dir + "/" + *it);
             continue;
         }
-        flist.push_back(tm.getFileInfo());
+        fn(dir + "/" + *it, tm);
+        ++count;
     } catch (const runtime_error &e) {
         // errors from file_info could be a missing file, or a non-file file
         // error reading the transfer meta could be a corrupt or non-schema
@@ -135,11 +238,10 @@ vector<FileInfo> Agent::files_info(const string &dir, const string &topic) {
         Log::error("Error in files_info handling ?: ?", *it, e.what());
         endeaden(dir + "/" + *it);
     }
-    if (flist.size() > max_query) {
+    if (count > max_query) {
         break;
     }
   }
-  return flist;
 }
 
 TransferMeta Agent::transfer_meta(const SendFileRequest &req, const FileInfo &fi) {
@@ -192,6 +294,19 @@ ResponseCode<PingResponse> Agent::ping() {
     return resp;
 }
 
+ResponseCode<UAVCANStats> Agent::uavcan_stats() {
+    ResponseCode<UAVCANStats> resp;
+
+    if (uavcan_node == nullptr) {
+        resp.code = Code::Bad_Request;
+        resp.err.setMessage("UAVCAN interface is unavailable");
+        return resp;
+    }
+    resp.code = Code::Ok;
+    resp.result = uavcan_node->getStats();
+    return resp;
+}
+
 ResponseCode<TransferMeta> Agent::meta(const std::string &uuid) {
     ResponseCode<TransferMeta> resp;
 
@@ -209,7 +324,7 @@ ResponseCode<TransferMeta> Agent::meta(const std::string &uuid) {
 
 ResponseCode<SendFileResponse> Agent::send_file(const SendFileRequest &req) {
     string src = req.getFilepath();
-    string id = mkUUID();
+    string id = new_id();
     string dest = transfer_dir + "/" + id + DATA_EXT;
     string destmeta = transfer_dir + "/" + id + META_EXT;
     FileInfo fi;
@@ -235,9 +350,15 @@ ResponseCode<SendFileResponse> Agent::send_file(const SendFileRequest &req) {
         return resp;
     }
 
+    TopicQuotas::Admission admission;
     try {
         fi = Files::file_info(src);
         fi.setId(id);
+        admission = quotas.admit(topic, fi.getSize());
+        if (!admission) {
+            refuse(resp, topic, admission);
+            return resp;
+        }
         TransferMeta tm = transfer_meta(req, fi);
         sync_ofstream meta{destmeta};
 
@@ -263,6 +384,102 @@ ResponseCode<SendFileResponse> Agent::send_file(const SendFileRequest &req) {
         resp.err.setMessage(e.what());
         return resp;
     }
+    commit_transfer(&admission, id);
+
+    resp.code = Code::Ok;
+    resp.result.setUUID(id);
+    return resp;
+}
+
+/**
+ * \brief queue a file whose content arrived in an HTTP request body
+ *
+ * `spool` is the file the HTTP server wrote the body to; it is consumed.
+ * The topic and destination come from `req`, and `req.getFilepath()` is
+ * recorded as the file path (it is informational only).
+ * The data file is complete and its CRC known before the meta file is
+ * written.
+ */
+ResponseCode<SendFileResponse> Agent::check_upload(const string &topic, int64_t size) {
+    ResponseCode<SendFileResponse> resp;
+    if (!checkTopic(topic)) {
+        resp.code = Code::Bad_Request;
+        resp.err.setMessage("Topic " + topic + " is not allowed");
+        return resp;
+    }
+    auto admission = quotas.check(topic, size);
+    if (!admission) {
+        refuse(resp, topic, admission);
+        return resp;
+    }
+    resp.code = Code::Ok;
+    return resp;
+}
+
+ResponseCode<SendFileResponse> Agent::receive_file(
+    const SendFileRequest &req, const string &spool, const string &crc
+    ) {
+    ResponseCode<SendFileResponse> resp;
+    string id = new_id();
+    string dest = transfer_dir + "/" + id + DATA_EXT;
+    string destmeta = transfer_dir + "/" + id + META_EXT;
+    string topic = req.getTopic();
+
+    if (spool.empty()) {
+        resp.code = Code::Bad_Request;
+        resp.err.setMessage("No file content received");
+        return resp;
+    }
+    if (req.getDestination().empty()) {
+        resp.code = Code::Bad_Request;
+        resp.err.setMessage("Destination is required");
+        return resp;
+    }
+    if (!checkTopic(topic)) {
+        resp.code = Code::Bad_Request;
+        resp.err.setMessage("Topic " + topic + " is not allowed");
+        return resp;
+    }
+    struct stat sbuf;
+    if (stat(spool.c_str(), &sbuf) != 0) {
+        resp.code = Code::Bad_Request;
+        resp.err.setMessage(OSError("Error reading upload: "));
+        return resp;
+    }
+    auto admission = quotas.admit(topic, sbuf.st_size);
+    if (!admission) {
+        refuse(resp, topic, admission);
+        return resp;
+    }
+
+    // dot-prefixed so that directory listings skip it while incomplete
+    string tmpname = transfer_dir + "/.upload." + id;
+    try {
+        FileInfo fi = take_spool(spool, tmpname, crc);
+        fi.setId(id);
+        fi.setPath(req.getFilepath().empty() ? dest : req.getFilepath());
+
+        if (rename(tmpname.c_str(), dest.c_str()) != 0) {
+            throw system_error(errno, generic_category(), "rename error (upload)");
+        }
+        TransferMeta tm = transfer_meta(req, fi);
+        sync_ofstream meta{destmeta};
+        meta << to_jsonstr(tm);
+        if (meta.fail()) {
+            Log::error("Error writing metadata file ?: ?", destmeta, OSError());
+            unlink(destmeta.c_str());
+            unlink(dest.c_str());
+            throw runtime_error("error writing metadata");
+        }
+        commit_transfer(&admission, id);
+    } catch (const runtime_error &e) {
+        // system_error is a runtime_error
+        unlink(tmpname.c_str());
+        Log::error("error in receive_file: ?", e.what());
+        resp.code = Code::Bad_Request;
+        resp.err.setMessage(e.what());
+        return resp;
+    }
 
     resp.code = Code::Ok;
     resp.result.setUUID(id);
@@ -316,6 +533,45 @@ ResponseCode<FileInfo> Agent::retrieve_file(
     return resp;
 }
 
+/**
+ * \brief look up an upload for streaming to a client
+ *
+ * On success the result is the FileInfo from the upload's meta file
+ * and `datafile` is set to the path of its data file.
+ */
+ResponseCode<FileInfo> Agent::upload_info(const string &id, string *datafile) {
+    ResponseCode<FileInfo> resp;
+    string src_meta = upload_dir + "/" + id + META_EXT;
+    *datafile = upload_dir + "/" + id + DATA_EXT;
+
+    if (access(src_meta.c_str(), R_OK) != 0 || access(datafile->c_str(), R_OK) != 0) {
+        resp.code = Code::Bad_Request;
+        resp.err.setMessage(OSError("upload unreadable for " + id + ": "));
+        return resp;
+    }
+    try {
+        resp.result = read_transfer_meta_cached(src_meta).getFileInfo();
+    } catch (const runtime_error &err) {
+        resp.code = Code::Bad_Request;
+        resp.err.setMessage(err.what());
+        return resp;
+    }
+    resp.code = Code::Ok;
+    return resp;
+}
+
+/**
+ * \brief remove an upload after it has been delivered in full
+ */
+void Agent::consume_upload(const string &id) {
+    string datafile = upload_dir + "/" + id + DATA_EXT;
+    string metafile = upload_dir + "/" + id + META_EXT;
+    // meta first, so the upload is never listed without its data
+    unlink(metafile.c_str());
+    unlink(datafile.c_str());
+    Log::info("consumed upload ?", id);
+}
+
 ResponseCode<AdcsResponse> Agent::adcs_get() {
     ResponseCode<AdcsResponse> resp;
 
@@ -329,27 +585,111 @@ ResponseCode<AdcsResponse> Agent::adcs_get() {
     return resp;
 }
 
-ResponseCode<AdcsCommandResponse> Agent::adcs_command(const AdcsCommandRequest &req) {
-    ResponseCode<AdcsCommandResponse> resp;
-    static BinSemaphore latch;
-    sem_guard guard(latch);
+ResponseCode<string> Agent::adcs_serialized() {
+    ResponseCode<string> resp;
+
+    if (adcs == nullptr) {
+        resp.code = Code::Bad_Request;
+        resp.err.setMessage("Adcs interface is unavailable");
+        return resp;
+    }
+    resp.code = Code::Ok;
+    resp.result = adcs->getAdcsJson();
+    return resp;
+}
+
+/**
+ * The command is queued to the UAVCAN client thread, which completes it
+ * in adcs_commands when the response arrives; the caller polls or waits
+ * on the returned id.
+ */
+ResponseCode<AdcsCommandStatus> Agent::adcs_command_submit(const AdcsCommandRequest &req) {
+    ResponseCode<AdcsCommandStatus> resp;
 
     if (uavcan_client == nullptr) {
         resp.code = Code::Bad_Request;
         resp.err.setMessage("Adcs interface is unavailable");
         return resp;
     }
-    if (guard.trywait()) {
-        uavcan_client->AdcsCommand(req, resp.result);
-        if (resp.result.getStatus() == Adaptor::Status::OK) {
-            resp.code = Code::Ok;
-        } else {
+    string id = adcs_commands.add();
+    if (id.empty()) {
+        resp.code = Code::Too_Many_Requests;
+        resp.err.setMessage("Too many ADCS commands in progress");
+        resp.err.setRetryAfter(1);
+        return resp;
+    }
+    uavcan_client->AdcsCommand(req, [this, id](const AdcsCommandResponse &result) {
+        adcs_commands.complete(id, result);
+    });
+    resp.code = Code::Ok;
+    resp.result.setId(id);
+    resp.result.setState("pending");
+    return resp;
+}
+
+ResponseCode<AdcsCommandStatus> Agent::adcs_command_status(const string &id,
+                                                           const string &wait) {
+    ResponseCode<AdcsCommandStatus> resp;
+    double seconds = 0;
+
+    if (!wait.empty()) {
+        char *end;
+        seconds = strtod(wait.c_str(), &end);
+        if (end == wait.c_str() || *end != '\0' || !(seconds >= 0)) {
             resp.code = Code::Bad_Request;
-            resp.err.setMessage(resp.result.getReason());
+            resp.err.setMessage("Invalid wait");
+            return resp;
         }
+    }
+    auto ms = chrono::milliseconds(static_cast<int64_t>(
+        min(seconds * 1000, static_cast<double>(ADCS_COMMAND_MAX_WAIT_MS))));
+    if (!adcs_commands.get(id, ms, &resp.result)) {
+        resp.code = Code::Bad_Request;
+        resp.err.setMessage("Unknown ADCS command " + id);
+        return resp;
+    }
+    resp.code = Code::Ok;
+    return resp;
+}
+
+ResponseCode<AdcsCommandResponse> Agent::adcs_command(const AdcsCommandRequest &req) {
+    ResponseCode<AdcsCommandResponse> resp;
+
+    if (uavcan_client == nullptr) {
+        resp.code = Code::Bad_Request;
+        resp.err.setMessage("Adcs interface is unavailable");
+        return resp;
+    }
+    // claim the wait before submitting, so a command isn't left behind
+    // for a caller that was turned away
+    auto waiter = adcs_commands.waiter();
+    if (!waiter) {
+        resp.code = Code::Too_Many_Requests;
+        resp.err.setMessage("Too many callers waiting for ADCS commands");
+        resp.err.setRetryAfter(1);
+        return resp;
+    }
+    auto submitted = adcs_command_submit(req);
+    if (submitted.code != Code::Ok) {
+        resp.code = submitted.code;
+        resp.err = submitted.err;
+        return resp;
+    }
+    // the client always completes a command within its call timeout
+    AdcsCommandStatus status;
+    auto wait = chrono::milliseconds(UAVCLIENT_TIMEOUT + 1000);
+    if (!adcs_commands.get(submitted.result.getId(), wait, &status, &waiter)
+        || status.getState() != "done") {
+        resp.code = Code::Bad_Request;
+        resp.err.setMessage("Timed out waiting for ADCS command");
+        return resp;
+    }
+    resp.result = status.getResult();
+    if (resp.result.getStatus() == Adaptor::Status::OK) {
+        resp.code = Code::Ok;
     } else {
         resp.code = Code::Bad_Request;
-        resp.err.setMessage("Request in progress");
+        resp.err.setMessage(resp.result.getReason());
     }
     return resp;
 }
@@ -367,6 +707,71 @@ ResponseCode<TfrsResponse> Agent::tfrs_get() {
     return resp;
 }
 
+ResponseCode<AdcsHistoryResponse> Agent::adcs_history(const HistoryQuery &query) {
+    ResponseCode<AdcsHistoryResponse> resp;
+    double start, end, at;
+
+    if (adcs == nullptr) {
+        resp.code = Code::Bad_Request;
+        resp.err.setMessage("Adcs interface is unavailable");
+        return resp;
+    }
+    if (!parseHistory(query, &start, &end, &at, resp)) {
+        return resp;
+    }
+    resp.code = Code::Ok;
+    vector<AdcsResponse> samples;
+    if (query.at.empty()) {
+        samples = adcs->getAdcsHistory(start, end);
+    } else {
+        AdcsResponse sample;
+        if (adcs->getAdcsAt(at, query.interpolate, &sample)) {
+            samples.push_back(sample);
+        }
+    }
+    resp.result.setSamples(samples);
+    return resp;
+}
+
+ResponseCode<string> Agent::tfrs_serialized() {
+    ResponseCode<string> resp;
+
+    if (adcs == nullptr) {
+        resp.code = Code::Bad_Request;
+        resp.err.setMessage("Tfrs interface is unavailable");
+        return resp;
+    }
+    resp.code = Code::Ok;
+    resp.result = adcs->getTfrsJson();
+    return resp;
+}
+
+ResponseCode<TfrsHistoryResponse> Agent::tfrs_history(const HistoryQuery &query) {
+    ResponseCode<TfrsHistoryResponse> resp;
+    double start, end, at;
+
+    if (adcs == nullptr) {
+        resp.code = Code::Bad_Request;
+        resp.err.setMessage("Tfrs interface is unavailable");
+        return resp;
+    }
+    if (!parseHistory(query, &start, &end, &at, resp)) {
+        return resp;
+    }
+    resp.code = Code::Ok;
+    vector<TfrsResponse> samples;
+    if (query.at.empty()) {
+        samples = adcs->getTfrsHistory(start, end);
+    } else {
+        TfrsResponse sample;
+        if (adcs->getTfrsAt(at, query.interpolate, &sample)) {
+            samples.push_back(sample);
+        }
+    }
+    resp.result.setSamples(samples);
+    return resp;
+}
+
 int64_t Agent::getDiskfree() {
     struct statvfs vfs;
 
@@ -389,7 +794,7 @@ int Agent::diskFreePct(const struct statvfs &vfs) {
 
 bool Agent::checkDiskFree(int64_t sz) {
     struct statvfs vfs;
-    if (min_free_pct == -1 && min_free_pct == -1) {
+    if (min_free_disk == -1 && min_free_pct == -1) {
         // if no limits have been set, just return true and skip the statvfs
         return true;
     }
@@ -466,41 +871,115 @@ SystemInfo Agent::getSysinfo() {
 
 ResponseCode<InfoResponse> Agent::collector_info(InfoRequest &req) {
     ResponseCode<InfoResponse> resp;
+    auto listing = collector_listing(req);
+
+    resp.result.setSysinfo(listing.result.sysinfo);
+    resp.result.setTopics(listing.result.topics);
+
+    InfoResponse_available available;
+    available.setFiles(listing.result.files);
+    available.setDead(listing.result.dead);
+    resp.result.setAvailable(available);
+
+    resp.code = listing.code;
+    return resp;
+}
+
+ResponseCode<InfoListing> Agent::collector_listing(InfoRequest &req) {
+    ResponseCode<InfoListing> resp;
 
     if (req.topicsIsSet()) {
         m_allowedTopics = move(req.getTopics());
+        m_topicSet = unordered_set<string>(m_allowedTopics.begin(), m_allowedTopics.end());
+    }
+    if (req.quotasIsSet()) {
+        for (const auto &q : req.getQuotas()) {
+            if (q.getTopic() != "*" && !isTopicName(q.getTopic())) {
+                Log::warn("Ignoring quota for invalid topic ?", q.getTopic());
+                continue;
+            }
+            QuotaLimits limits;
+            limits.maxBytes = q.maxBytesIsSet() ? q.getMaxBytes() : 0;
+            limits.maxFiles = q.maxFilesIsSet() ? q.getMaxFiles() : 0;
+            limits.rate = q.rateIsSet() ? q.getRate() : 0;
+            limits.burst = q.burstIsSet() ? q.getBurst() : 0;
+            quotas.setLimits(q.getTopic(), limits);
+        }
     }
 
-    resp.result.setSysinfo(getSysinfo());
-    resp.result.setTopics(m_allowedTopics);
-
-    InfoResponse_available available;
-    available.setFiles(dir_cache.get(transfer_dir));
-    available.setDead(dir_cache.get(deadletter_dir));
-    resp.result.setAvailable(available);
+    resp.result.sysinfo = getSysinfo();
+    resp.result.topics = m_allowedTopics;
+    resp.result.files = dir_cache.get(transfer_dir);
+    resp.result.dead = dir_cache.get(deadletter_dir);
 
     resp.code = Code::Ok;
     return resp;
 }
 
 
+/**
+ * \brief is transfer `id` still waiting for the collector?
+ */
+bool Agent::transfer_queued(const string &id) {
+    return access((transfer_dir + "/" + id + META_EXT).c_str(), F_OK) == 0;
+}
+
+/**
+ * \brief count a queued transfer against its topic's quota
+ */
+void Agent::commit_transfer(TopicQuotas::Admission *admission, const string &id) {
+    admission->commit(id);
+    // the collector may have taken it before it was counted, and then its
+    // departure went unnoticed
+    if (!transfer_queued(id)) {
+        quotas.remove(id);
+    }
+}
+
+/**
+ * \brief stop counting a file that has left the transfer directory
+ * against its topic's quota
+ */
+void Agent::transfer_gone(const string &name) {
+    if (ends_with(name, META_EXT)) {
+        quotas.remove(chop(name, META_EXT));
+    }
+}
+
+/**
+ * \brief drop transfers that have left from the quota counts, when their
+ * departures may have been missed
+ */
+void Agent::recount_quota_usage() {
+    for (const auto &id : quotas.queued()) {
+        if (!transfer_queued(id)) {
+            quotas.remove(id);
+        }
+    }
+}
+
+/**
+ * \brief count transfers queued before the agent started against their
+ * topics' quotas
+ */
+void Agent::load_quota_usage() {
+    for (const auto &name : Files::list_files(transfer_dir, META_EXT)) {
+        try {
+            auto tm = read_transfer_meta(transfer_dir + "/" + name);
+            quotas.add(tm.getTopic(), chop(name, META_EXT), tm.getFileInfo().getSize());
+        } catch (const runtime_error &e) {
+            // unreadable meta files are endeadened when next scanned
+            Log::warn("Not counting ? against quota: ?", name, e.what());
+        }
+    }
+}
+
 bool Agent::checkTopic(const std::string &topic) {
-    if (!regex_match(topic, topic_re)) {
-        // validate against topic regexp
+    if (!isTopicName(topic)) {
         return false;
-    } else if (m_allowedTopics.empty()) {
-        // no topics set means anything is allowed
-        return true;
-    } else {
-        // linear search of allowed topics.  Assumption is that the list of
-        // allowed topics will be small (less than 10), so it's
-        // not worth using a more complex strategy.
-        if (find(m_allowedTopics.begin(), m_allowedTopics.end(), topic) != m_allowedTopics.end()) {
-            return true;
-        } else {
-            return false;
-        }
     }
+    // no topics set means anything is allowed
+    return m_topicSet.empty() || m_topicSet.count(topic) > 0;
 }
 
 /*
@@ -592,15 +1071,17 @@ void Agent::move_file(const string &src, const string &dest, const FileInfo &fi)
     } else if (errno == EXDEV) {
         // cross-device move.   Copy, with intermediate renaming.
 
-        struct statvfs srcvfs, destvfs;
-        // get vfs info, for free space and block sizing guidance
-        statvfs(dirname(src).c_str(), &srcvfs);
-        statvfs(dirname(dest).c_str(), &destvfs);
-
-        if (!checkDiskFree(fi.getSize(), destvfs)) {
+        // get vfs info, for free space and block sizing guidance.  The
+        // destination space is reserved until it is written so concurrent
+        // moves cannot overcommit the filesystem.
+        struct statvfs srcvfs = disk_ledger.vfs(dirname(src));
+        auto space = disk_ledger.reserve(dirname(dest), fi.getSize(),
+            [this](int64_t sz, const struct statvfs &vfs) { return checkDiskFree(sz, vfs); });
+        if (!space) {
             throw system_error(EDQUOT, generic_category(),
                 "insufficient disk space for destination file");
         }
+        const struct statvfs &destvfs = space.vfs();
 
         string src_tmpdir = dirname(src) + "/file_move_XXXXXX";
         vector<char> s_tmpdirname(src_tmpdir.begin(), src_tmpdir.end());
@@ -639,6 +1120,9 @@ void Agent::move_file(const string &src, const string &dest, const FileInfo &fi)
                 if (wcount != rcount) {
                     Log::error("written bytes differ from read: ? != ?", wcount, rcount);
                 }
+                if (wcount > 0) {
+                    space.wrote(wcount);
+                }
             }
             close(src_fd);
             fsync(dest_fd);
@@ -663,6 +1147,80 @@ void Agent::move_file(const string &src, const string &dest, const FileInfo &fi)
     }
 }
 
+/**
+ * \brief move an HTTP spool file to `tmpname`, computing its FileInfo
+ *
+ * If the spool file is on the same filesystem it is renamed, and read for
+ * the CRC only if `crc`, taken as the spool was written, is empty;
+ * otherwise it is copied in a single pass, with the CRC computed on the
+ * bytes as they are written.  Cross-device copies reserve the destination
+ * space until they have written it.
+ */
+FileInfo Agent::take_spool(const string &spool, const string &tmpname, const string &crc) {
+    struct stat sbuf = Files::file_stat(spool);
+    FileInfo fi;
+    fi.setSize(sbuf.st_size);
+
+    if (rename(spool.c_str(), tmpname.c_str()) == 0) {
+        fi.setCrc32(crc.empty() ? getCrc(tmpname) : crc);
+    } else if (errno == EXDEV) {
+        auto space = disk_ledger.reserve(transfer_dir, sbuf.st_size,
+            [this](int64_t sz, const struct statvfs &vfs) { return checkDiskFree(sz, vfs); });
+        if (!space) {
+            throw system_error(EDQUOT, generic_category(),
+                "insufficient disk space for uploaded file");
+        }
+        int src_fd = open(spool.c_str(), O_RDONLY);
+        if (src_fd == -1) {
+            throw system_error(errno, generic_category(), "open error (upload)");
+        }
+        int dest_fd = open(tmpname.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0600);
+        if (dest_fd == -1) {
+            close(src_fd);
+            throw system_error(errno, generic_category(), "open error (upload)");
+        }
+
+        size_t blksize = space.vfs().f_bsize;
+        vector<char> buffer(blksize);
+        uLong crc = crc32(0L, Z_NULL, 0);
+        int64_t total = 0;
+        ssize_t rcount;
+        while ((rcount = read(src_fd, buffer.data(), blksize)) > 0) {
+            crc = crc32(crc, reinterpret_cast<Bytef*>(buffer.data()), rcount);
+            for (ssize_t off = 0; off < rcount; ) {
+                ssize_t wcount = write(dest_fd, buffer.data() + off, rcount - off);
+                if (wcount < 0) {
+                    int err = errno;
+                    close(src_fd);
+                    close(dest_fd);
+                    throw system_error(err, generic_category(), "write error (upload)");
+                }
+                space.wrote(wcount);
+                off += wcount;
+            }
+            total += rcount;
+        }
+        int read_errno = (rcount < 0) ? errno : 0;
+        close(src_fd);
+        fsync(dest_fd);
+        close(dest_fd);
+        if (read_errno != 0) {
+            throw system_error(read_errno, generic_category(), "read error (upload)");
+        }
+        if (total != sbuf.st_size) {
+            throw runtime_error("upload size changed while copying");
+        }
+        fi.setCrc32(crcString(crc));
+    } else {
+        throw system_error(errno, generic_category(), "rename error (upload)");
+    }
+
+    struct stat dbuf = Files::file_stat(tmpname);
+    fi.setCreated(dbuf.st_ctime);
+    fi.setModified(dbuf.st_mtime);
+    return fi;
+}
+
 string Agent::getBuildVersion() {
     return BUILD_VERSION;
 }
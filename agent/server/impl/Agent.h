@@ -11,18 +11,27 @@
 // for 64-bit vfs fields
 #define _FILE_OFFSET_BITS 64
 
+#include <memory>
 #include <string>
 #include <vector>
-#include <regex>  // NOLINT(build/c++11)
+#include <functional>
+#include <unordered_set>
 
+#include "AdcsCommands.h"
 #include "AgentUAVCANClient.h"
+#include "AgentUAVCANNode.h"
 #include "Cache.h"
 #include "Cleaner.h"
 #include "Config.h"
+#include "DirWatch.h"
+#include "DiskLedger.h"
+#include "Quota.h"
 #include "Adcs.h"
+#include "AdcsHistoryResponse.h"
 #include "AdcsResponse.h"
 #include "AdcsCommandRequest.h"
 #include "AdcsCommandResponse.h"
+#include "AdcsCommandStatus.h"
 #include "AvailableFilesResponse.h"
 #include "Files.h"
 #include "FileInfo.h"
@@ -33,16 +42,40 @@
 #include "SendFileRequest.h"
 #include "SendFileResponse.h"
 #include "SystemInfo.h"
+#include "TfrsHistoryResponse.h"
 #include "TfrsResponse.h"
 #include "TransferMeta.h"
 #include "Utils.h"
 
+/// parameters of an ADCS or TFRS history query, as given; empty if absent
+struct HistoryQuery {
+    std::string start, end;  ///< range, unix epoch seconds
+    std::string at;  ///< single time, unix epoch seconds
+    bool interpolate = false;
+};
+
+/// query_available result with each FileInfo already serialized
+struct AvailableFragments {
+    std::vector<std::shared_ptr<const std::string>> files;
+    bool overflow = false;
+};
+
+/// collector_info result without the model copies, for streaming
+struct InfoListing {
+    SystemInfo sysinfo;
+    std::vector<std::string> topics;
+    std::vector<std::string> files;
+    std::vector<std::string> dead;
+};
+
 class Agent {
     Cleaner cleaner;
     friend class Cleaner;
 
     AgentUAVCANClient *uavcan_client;
+    AgentUAVCANNode *uavcan_node = nullptr;
     AdcsManager *adcs = nullptr;
+    AdcsCommandTable adcs_commands;
 
     const std::string META_EXT = ".meta.oort";
     const std::string DATA_EXT = ".data.oort";
@@ -52,22 +85,37 @@ class Agent {
     std::string data_file(const std::string &metafile) const {
         return chop(metafile, META_EXT) + DATA_EXT;
     }
-    const std::regex topic_re = std::regex("^[-_[:alnum:]]+$", std::regex_constants::extended);
     // file caches
     Cache<std::vector<std::string>> dir_cache{"Directory", Files::file_names};
     // get function is Files::list_files
     Cache<std::vector<std::string>> metafile_cache{"Metafile"};
     // get function is Agent::read_transfer_meta
     Cache<TransferMeta> meta_cache{"Metainfo", 10000};
+    // serialized FileInfo, keyed by meta file like meta_cache
+    Cache<std::shared_ptr<const std::string>> fragment_cache{"Fragment", 10000};
 
     // config values
     std::string workdir;
     int max_query = 50;
+    int uuid_version = 4;
 
+    // as given by the collector, and as a set for lookups
     std::vector<std::string> m_allowedTopics;
+    std::unordered_set<std::string> m_topicSet;
 
     int min_free_disk = -1;
     int min_free_pct = -1;
+    // space promised to in-flight cross-device copies
+    DiskLedger disk_ledger;
+    // per-topic limits on queued transfers
+    TopicQuotas quotas;
+    // tells the quotas of transfers leaving the transfer directory
+    std::unique_ptr<DirWatch> transfer_watch;
+    bool transfer_queued(const std::string &id);
+    void load_quota_usage();
+    void recount_quota_usage();
+    void transfer_gone(const std::string &name);
+    void commit_transfer(TopicQuotas::Admission *admission, const std::string &id);
 
     std::string transfer_dir;
     std::string upload_dir;
@@ -78,7 +126,10 @@ class Agent {
     std::string machine;
 
     void create_dirs(const std::vector<std::string> &dirs);
+    std::string new_id() const;
 
+    typedef std::function<void(const std::string&, const TransferMeta&)> ScanFn;
+    void scan_files(const std::string &dir, const std::string &topic, const ScanFn &fn);
     std::vector<FileInfo> files_info(const std::string &dir, const std::string &topic);
     TransferMeta read_transfer_meta_cached(const std::string &file);
     TransferMeta read_transfer_meta(const std::string &file);
@@ -96,6 +147,8 @@ class Agent {
     bool checkDiskFree(int64_t sz, const struct statvfs &vfs);
 
     void move_file(const std::string &src, const std::string &dest, const FileInfo &fi);
+    FileInfo take_spool(const std::string &spool, const std::string &tmpname,
+                        const std::string &crc);
     void endeaden(const std::string &filepath);
 
     SystemInfo getSysinfo();
@@ -117,6 +170,7 @@ class Agent {
 
     void setUavClient(AgentUAVCANClient *client);
     void setAdcsMgr(AdcsManager *mgr) {adcs = mgr;}
+    void setUavNode(AgentUAVCANNode *node) {uavcan_node = node;}
 
     void setMinFreeMb(int mb);
     void setMinFreePct(int pct);
@@ -129,20 +183,41 @@ class Agent {
 
     // SDK methods
     ResponseCode<AvailableFilesResponse> query_available(const std::string &topic);
+    ResponseCode<AvailableFragments> query_available_fragments(const std::string &topic);
     ResponseCode<SendFileResponse> send_file(const SendFileRequest &req);
+    /// `crc` is the spool's CRC, if it was taken as the spool was written
+    ResponseCode<SendFileResponse> receive_file(const SendFileRequest &req,
+                                                const std::string &spool,
+                                                const std::string &crc = "");
+    /// refuse an upload from its topic and size alone, before its body is read
+    ResponseCode<SendFileResponse> check_upload(const std::string &topic, int64_t size);
     ResponseCode<FileInfo> retrieve_file(const RetrieveFileRequest &req);
+    ResponseCode<FileInfo> upload_info(const std::string &id, std::string *datafile);
+    void consume_upload(const std::string &id);
 
     // SDK ADCS methods
     ResponseCode<AdcsResponse> adcs_get();
+    /// adcs_get() already serialized
+    ResponseCode<std::string> adcs_serialized();
+    /// adcs_command_submit() and wait for the result
     ResponseCode<AdcsCommandResponse> adcs_command(const AdcsCommandRequest &req);
+    ResponseCode<AdcsCommandStatus> adcs_command_submit(const AdcsCommandRequest &req);
+    /// `wait` is seconds as given in the query, empty if absent
+    ResponseCode<AdcsCommandStatus> adcs_command_status(const std::string &id,
+                                                        const std::string &wait);
+    ResponseCode<AdcsHistoryResponse> adcs_history(const HistoryQuery &query);
 
     // SDK TFRS methods
     ResponseCode<TfrsResponse> tfrs_get();
+    ResponseCode<std::string> tfrs_serialized();
+    ResponseCode<TfrsHistoryResponse> tfrs_history(const HistoryQuery &query);
 
     // Collector methods
     ResponseCode<InfoResponse> collector_info(InfoRequest &req);  // model not defined const
+    ResponseCode<InfoListing> collector_listing(InfoRequest &req);
     ResponseCode<TransferMeta> meta(const std::string &uuid);
     ResponseCode<PingResponse> ping();
+    ResponseCode<UAVCANStats> uavcan_stats();
 
     // version strings
     std::string getBuildVersion();
@@ -8,10 +8,8 @@
 
 #include <unistd.h>
 #include <sys/types.h>
-#include <algorithm>
-#include <sstream>
-#include <system_error>  // NOLINT(build/c++11)
-#include <vector>
+#include <string>
+#include <utility>
 
 #include "Adaptor.h"
 #include "Adcs.h"
@@ -21,49 +19,92 @@
 
 using namespace std;
 
-// can we use use same node as server?
-void AgentUAVCANClient::initNode() {
-    std::vector<std::string> ifaces(1);
-    ifaces[0] = config.getCANInterface();
-    unsigned int uavcan_node_id = config.getUAVCANNodeID();
-    node = uavcan_linux::makeNode(ifaces, "com.spire.linux_agent",
-                                  uavcan::protocol::SoftwareVersion(),
-                                  uavcan::protocol::HardwareVersion(),
-                                  static_cast<uavcan::NodeID>(uavcan_node_id));
-    node->getScheduler().setDeadlineResolution(uavcan::MonotonicDuration::fromMSec(100));
-    node->setModeOperational();
+namespace {
+
+AdcsCommandResponse failure(const string &reason) {
+    AdcsCommandResponse rsp;
+    rsp.setStatus("FAIL");
+    rsp.setReason(reason);
+    return rsp;
 }
 
-AgentUAVCANClient::AgentUAVCANClient(AgentConfig& config) : config(config) {
-    initNode();
-    adcscommand_client = node->makeBlockingServiceClient<ussp::payload::PayloadAdcsCommand>();
+unsigned callKey(const uavcan::ServiceCallID &id) {
+    return static_cast<unsigned>(id.server_node_id.get()) << 8 | id.transfer_id.get();
 }
 
-void AgentUAVCANClient::AdcsCommand(const AdcsCommandRequest& req, AdcsCommandResponse& rsp) {
-    ussp::payload::PayloadAdcsCommand::Request can_req;
-    int can_stat;
+}  // namespace
+
+AgentUAVCANClient::AgentUAVCANClient(AgentConfig& config, AgentUAVCANNode& node)
+    : config(config), node(node) {
+    node.addRole(this);
+}
+
+AgentUAVCANClient::~AgentUAVCANClient() {
+    node.removeRole(this);
+}
 
-    auto timeout = uavcan::MonotonicDuration::fromMSec(UAVCLIENT_TIMEOUT);
+void AgentUAVCANClient::attach(uavcan_linux::Node &can_node) {
+    adcscommand_client = can_node.makeServiceClient<ussp::payload::PayloadAdcsCommand>(
+        [this](const AdcsCommandResult &res) { adcsCommandResult(res); });
+    adcscommand_client->setRequestTimeout(uavcan::MonotonicDuration::fromMSec(UAVCLIENT_TIMEOUT));
+}
+
+void AgentUAVCANClient::detach() {
+    // nothing will answer the calls still in flight
+    for (auto &call : in_flight) {
+        call.second(failure("UAVCAN node unavailable"));
+    }
+    in_flight.clear();
+    adcscommand_client.reset();
+}
+
+void AgentUAVCANClient::addPoolDemand(UAVCANPoolDemand &demand) const {
+    demand.addClient<ussp::payload::PayloadAdcsCommand>();
+}
 
+void AgentUAVCANClient::AdcsCommand(const AdcsCommandRequest& req, AdcsCommandDone done) {
+    ussp::payload::PayloadAdcsCommand::Request can_req;
     try {
         can_req = Adapt(req);
-    } catch (const runtime_error e) {
+    } catch (const runtime_error &e) {
         // the conversion failed
         Log::error("Failed creating UAVCAN request from OAPI request: ?", e.what());
-        rsp.setStatus("FAIL");
-        rsp.setReason(e.what());
+        done(failure(e.what()));
         return;
     }
+    node.post([this, can_req, done] { send(can_req, done); });
+}
 
-    can_stat = adcscommand_client->blockingCall(config.getShimNodeID(), can_req, timeout);
-    if (can_stat <= 0 || !adcscommand_client->wasSuccessful()) {
-        // call failed
+/**
+ * \brief start a call; runs on the event loop thread
+ */
+void AgentUAVCANClient::send(const ussp::payload::PayloadAdcsCommand::Request &req,
+                             AdcsCommandDone done) {
+    if (!adcscommand_client) {
+        done(failure("UAVCAN node unavailable"));
+        return;
+    }
+    uavcan::ServiceCallID call_id;
+    int can_stat = adcscommand_client->call(config.getShimNodeID(), req, call_id);
+    if (can_stat < 0) {
         Log::error("Failed contacting UAVCAN PayloadAdcsCommand service: ?", can_stat);
-        rsp.setStatus("FAIL");
-        rsp.setReason("Error contacting service: " + to_string(can_stat));
+        done(failure("Error contacting service: " + to_string(can_stat)));
         return;
     }
-    ussp::payload::PayloadAdcsCommand::Response can_rsp = adcscommand_client->getResponse();
+    in_flight[callKey(call_id)] = move(done);
+}
 
-    rsp = Adapt(can_rsp);
+void AgentUAVCANClient::adcsCommandResult(const AdcsCommandResult& res) {
+    auto call = in_flight.find(callKey(res.getCallID()));
+    if (call == in_flight.end()) {
+        return;
+    }
+    auto done = move(call->second);
+    in_flight.erase(call);
+    if (!res.isSuccessful()) {
+        Log::error("UAVCAN PayloadAdcsCommand call timed out");
+        done(failure("Error contacting service: timeout"));
+        return;
+    }
+    done(Adapt(res.getResponse()));
 }
@@ -1,16 +1,20 @@
 /**
  * AgentUAVCANClient.h
  *
- * Agent UAVCAN client task.  
+ * Agent UAVCAN client task.
  *
  * Copyright (c) 2021 Spire Global, Inc.
  */
 #pragma once
 
+#include <cstdint>
+#include <functional>
 #include <string>
+#include <unordered_map>
 
 #include <uavcan_linux/uavcan_linux.hpp>
 #include <ussp/payload/PayloadAdcsCommand.hpp>
+#include "AgentUAVCANNode.h"
 #include "Config.h"
 #include "AdcsResponse.h"
 #include "AdcsCommandRequest.h"
@@ -20,21 +24,45 @@ static const unsigned UAVCLIENT_TIMEOUT = 2000;
 
 /**
  * \brief Agent UAVCAN client
- * 
+ *
  * The UAVCAN client makes calls over UAVCAN to other services (generally
  * SBrain) and allows those services to be called from Agent handlers.
- * 
+ *
+ * Calls are asynchronous: handlers queue a request with a completion
+ * callback and return.  The request is posted to the node's event loop,
+ * which sends it and runs the callback (on the event loop thread) when the
+ * response arrives or the call times out.  Several calls may be
+ * outstanding at once; they are told apart by transfer id.
  */
-class AgentUAVCANClient {
-    AgentConfig& config;
-    uavcan_linux::NodePtr node;
-
-    void initNode();
-    uavcan_linux::BlockingServiceClientPtr<ussp::payload::PayloadAdcsCommand> adcscommand_client;
-
+class AgentUAVCANClient : public AgentUAVCANNode::Role {
  public:
-    explicit AgentUAVCANClient(AgentConfig& config);
+    typedef std::function<void(const org::openapitools::server::model::AdcsCommandResponse&)>
+        AdcsCommandDone;
+
+    AgentUAVCANClient(AgentConfig& config, AgentUAVCANNode& node);
+    ~AgentUAVCANClient();
 
+    /**
+     * \brief queue an ADCS command; `done` is called exactly once with its
+     * response, or a FAIL response if it could not be sent or timed out.
+     */
     void AdcsCommand(const org::openapitools::server::model::AdcsCommandRequest& req,
-                     org::openapitools::server::model::AdcsCommandResponse& rsp);
+                     AdcsCommandDone done);
+
+    void attach(uavcan_linux::Node &node) override;
+    void detach() override;
+    void addPoolDemand(UAVCANPoolDemand &demand) const override;
+
+ private:
+    typedef uavcan::ServiceCallResult<ussp::payload::PayloadAdcsCommand> AdcsCommandResult;
+
+    AgentConfig& config;
+    AgentUAVCANNode& node;
+    uavcan_linux::ServiceClientPtr<ussp::payload::PayloadAdcsCommand> adcscommand_client;
+
+    /// callbacks of calls in flight, by (server node id << 8 | transfer id)
+    std::unordered_map<unsigned, AdcsCommandDone> in_flight;
+
+    void send(const ussp::payload::PayloadAdcsCommand::Request &req, AdcsCommandDone done);
+    void adcsCommandResult(const AdcsCommandResult& res);
 };
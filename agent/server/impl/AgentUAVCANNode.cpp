@@ -0,0 +1,575 @@
+/**
+ * AgentUAVCANNode.cpp
+ *
+ * The agent's UAVCAN node and its event loop.
+ *
+ * Copyright (c) 2023 Spire Global, Inc.
+ */
+
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <net/if.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <future>  // NOLINT(build/c++11)
+#include <sstream>
+#include <system_error>  // NOLINT(build/c++11)
+#include <utility>
+#include <vector>
+
+#include "AgentUAVCANNode.h"
+#include "Log.h"
+
+using namespace std;
+
+namespace {
+
+/// CLOCK_MONOTONIC in us, the clock libuavcan's deadlines are in
+uint64_t monotonicUs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+/// netlink socket for link up/down notifications, or -1
+int openLinkMonitor() {
+    int fd = socket(AF_NETLINK, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_ROUTE);
+    if (fd < 0) {
+        return -1;
+    }
+    struct sockaddr_nl addr = {};
+    addr.nl_family = AF_NETLINK;
+    addr.nl_groups = RTMGRP_LINK;
+    if (bind(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/// records the frames a node receives to a capture, until writing fails
+class CaptureListener : public uavcan::IRxFrameListener {
+    CanCaptureWriter &writer;
+    bool failed = false;
+
+ public:
+    explicit CaptureListener(CanCaptureWriter &writer) : writer(writer) {}
+    void handleRxFrame(const uavcan::CanRxFrame &frame, uavcan::CanIOFlags flags) override {
+        if (failed || (flags & uavcan::CanIOFlagLoopback)) {
+            return;
+        }
+        if (!writer.write(frame.ts_mono.toUSec(), frame, frame.iface_index)) {
+            failed = true;
+            Log::error("CAN capture stopped after ? frames: ?",
+                       static_cast<int64_t>(writer.getFrames()), strerror(errno));
+        }
+    }
+};
+
+void watch(int epoll_fd, int fd, uint32_t events, int op = EPOLL_CTL_ADD) {
+    struct epoll_event ev = {};
+    ev.events = events;
+    ev.data.fd = fd;
+    epoll_ctl(epoll_fd, op, fd, &ev);
+}
+
+}  // namespace
+
+AgentUAVCANNode::AgentUAVCANNode(const string &iface, unsigned int node_id, size_t pool_size)
+    : can_interface(iface), uavcan_node_id(node_id), pool_size(pool_size) {
+    openEvents();
+}
+
+AgentUAVCANNode::AgentUAVCANNode(shared_ptr<VirtualCanDriver> driver, const string &name,
+                                 unsigned int node_id, size_t pool_size)
+    : can_interface(name), uavcan_node_id(node_id), pool_size(pool_size),
+      virtual_can(std::move(driver)) {
+    openEvents();
+}
+
+void AgentUAVCANNode::openEvents() {
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (epoll_fd < 0 || wake_fd < 0 || timer_fd < 0) {
+        throw system_error(errno, generic_category(), "uavcan epoll");
+    }
+    watch(epoll_fd, wake_fd, EPOLLIN);
+    watch(epoll_fd, timer_fd, EPOLLIN);
+    link_fd = openLinkMonitor();
+    if (link_fd >= 0) {
+        watch(epoll_fd, link_fd, EPOLLIN);
+    }
+}
+
+AgentUAVCANNode::~AgentUAVCANNode() {
+    stop();
+    ::close(epoll_fd);
+    ::close(wake_fd);
+    ::close(timer_fd);
+    if (link_fd >= 0) {
+        ::close(link_fd);
+    }
+}
+
+void AgentUAVCANNode::initNode() {
+    const auto clock_mode = uavcan_linux::SystemClock::detectPreferredClockAdjustmentMode();
+    if (virtual_can) {
+        node = uavcan_linux::makeNode(std::shared_ptr<uavcan::ICanDriver>(virtual_can),
+                                      "com.spire.linux_agent",
+                                      uavcan::protocol::SoftwareVersion(),
+                                      uavcan::protocol::HardwareVersion(),
+                                      static_cast<uavcan::NodeID>(uavcan_node_id),
+                                      uavcan::TransferPriority::Default, clock_mode, pool_size);
+    } else {
+        std::vector<std::string> ifaces(1);
+        ifaces[0] = can_interface;
+        node = uavcan_linux::makeNode(ifaces, "com.spire.linux_agent",
+                                      uavcan::protocol::SoftwareVersion(),
+                                      uavcan::protocol::HardwareVersion(),
+                                      static_cast<uavcan::NodeID>(uavcan_node_id),
+                                      uavcan::TransferPriority::Default, clock_mode, pool_size);
+    }
+    node->getScheduler().setDeadlineResolution(uavcan::MonotonicDuration::fromMSec(100));
+    node->setModeOperational();
+    socketcan = dynamic_cast<uavcan_linux::SocketCanDriver *>(node->getDriverPack()->can.get());
+    for (unsigned i = 0; socketcan != nullptr && i < socketcan->getNumIfaces(); i++) {
+        int fd = socketcan->getIface(i)->getFileDescriptor();
+        watch(epoll_fd, fd, EPOLLIN);
+        can_fds.emplace_back(fd, false);
+    }
+    if (virtual_can) {
+        // readable when a frame is due or the wire is free for a waiting one
+        watch(epoll_fd, virtual_can->getFileDescriptor(), EPOLLIN);
+        can_fds.emplace_back(virtual_can->getFileDescriptor(), false);
+    }
+    if (capture) {
+        node->installRxFrameListener(capture.get());
+    }
+    for (auto role : roles) {
+        role->attach(*node);
+    }
+    checkPool();
+}
+
+void AgentUAVCANNode::resetNode() {
+    for (auto role : roles) {
+        role->detach();
+    }
+    if (node) {
+        addNodeStats(retired);
+    }
+    for (auto &fd : can_fds) {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd.first, nullptr);
+    }
+    can_fds.clear();
+    socketcan = nullptr;
+    node.reset();
+}
+
+/**
+ * \brief start the node on the calling thread, so that a bad interface
+ * is reported to the caller, then hand it to the event loop.
+ */
+void AgentUAVCANNode::start() {
+    if (!thread_running && loop_thread.joinable()) {
+        // a loop that gave up on its own
+        loop_thread.join();
+    }
+    const lock_guard<mutex> guard{lock};
+    if (thread_running) {
+        return;
+    }
+    Log::info("UAVCAN node starting on ? with node ID ?", can_interface, uavcan_node_id);
+    try {
+        initNode();
+    } catch (uavcan_linux::Exception &e) {
+        resetNode();
+        throw;
+    }
+    stopped = false;
+    thread_running = true;
+    thread worker(&AgentUAVCANNode::eventLoop, this);
+    ostringstream s("");
+    s << worker.get_id();
+    Log::info("UAVCAN event loop thread id = ?", s.str());
+    loop_thread = std::move(worker);
+}
+
+void AgentUAVCANNode::stop() {
+    if (thread_running.exchange(false)) {
+        wake();
+    }
+    if (loop_thread.joinable()) {
+        loop_thread.join();
+    }
+    finishTasks();
+}
+
+/**
+ * \brief mark the loop stopped and run what was queued for it, so that
+ * nothing waits on a loop that has gone; later tasks run on their caller
+ */
+void AgentUAVCANNode::finishTasks() {
+    vector<function<void()>> batch;
+    {
+        const lock_guard<mutex> guard{lock};
+        thread_running = false;
+        stopped = true;
+        batch.swap(tasks);
+    }
+    for (auto &task : batch) {
+        task();
+    }
+}
+
+void AgentUAVCANNode::setCapture(CanCaptureWriter *writer) {
+    capture.reset(writer != nullptr ? new CaptureListener(*writer) : nullptr);
+}
+
+void AgentUAVCANNode::addRole(Role *role) {
+    const lock_guard<mutex> guard{lock};
+    if (!thread_running) {
+        roles.push_back(role);
+        return;
+    }
+    tasks.push_back([this, role] {
+        roles.push_back(role);
+        if (node) {
+            role->attach(*node);
+            checkPool();
+        }
+    });
+    wake();
+}
+
+void AgentUAVCANNode::removeRole(Role *role) {
+    auto remove = [this, role] {
+        auto it = find(roles.begin(), roles.end(), role);
+        if (it != roles.end()) {
+            if (node) {
+                role->detach();
+            }
+            roles.erase(it);
+        }
+    };
+    promise<void> removed;
+    {
+        const lock_guard<mutex> guard{lock};
+        if (!thread_running) {
+            remove();
+            return;
+        }
+        tasks.push_back([&remove, &removed] {
+            remove();
+            removed.set_value();
+        });
+        wake();
+    }
+    removed.get_future().wait();
+}
+
+void AgentUAVCANNode::post(function<void()> task) {
+    {
+        const lock_guard<mutex> guard{lock};
+        if (!stopped) {
+            tasks.push_back(std::move(task));
+            wake();
+            return;
+        }
+    }
+    task();
+}
+
+UAVCANStats AgentUAVCANNode::getStats() {
+    UAVCANStats stats;
+    promise<void> collected;
+    {
+        const lock_guard<mutex> guard{lock};
+        if (!thread_running) {
+            collectStats(stats);
+            return stats;
+        }
+        tasks.push_back([this, &stats, &collected] {
+            collectStats(stats);
+            collected.set_value();
+        });
+        wake();
+    }
+    collected.get_future().wait();
+    return stats;
+}
+
+/**
+ * \brief add the current node's counters to `stats`
+ */
+void AgentUAVCANNode::addNodeStats(UAVCANStats &stats) const {
+    auto &perf = node->getDispatcher().getTransferPerfCounter();
+    stats.transfers_tx += perf.getTxTransferCount();
+    stats.transfers_rx += perf.getRxTransferCount();
+    stats.transfer_errors += perf.getErrorCount();
+
+    // blocks the pool has taken from the heap are kept, so they are its peak
+    auto &pool = node->getMemPool();
+    stats.pool.block_size = uavcan::MemPoolBlockSize;
+    stats.pool.capacity = pool.getBlockCapacity();
+    stats.pool.used = pool.getNumAllocatedBlocks();
+    stats.pool.peak = max<uint64_t>(stats.pool.peak, pool.getNumReservedBlocks());
+
+    auto &io = node->getDispatcher().getCanIOManager();
+    if (stats.ifaces.size() < io.getNumIfaces()) {
+        stats.ifaces.resize(io.getNumIfaces());
+    }
+    for (unsigned i = 0; i < io.getNumIfaces(); i++) {
+        auto &iface = stats.ifaces[i];
+        auto counters = io.getIfacePerfCounters(i);
+        iface.name = can_interface;
+        iface.frames_tx += counters.frames_tx;
+        iface.frames_rx += counters.frames_rx;
+        // the driver's own errors are counted below, by kind
+        iface.tx_rejected += counters.errors - io.getCanDriver().getIface(i)->getErrorCount();
+        if (socketcan == nullptr) {
+            continue;
+        }
+        auto sock = socketcan->getIface(i);
+        iface.rx_overflows += sock->getRxQueueOverflowCount();
+        for (auto &kv : sock->getErrors()) {
+            switch (kv.first) {
+                case uavcan_linux::SocketCanError::SocketReadFailure:
+                    iface.read_failures += kv.second;
+                    break;
+                case uavcan_linux::SocketCanError::SocketWriteFailure:
+                    iface.write_failures += kv.second;
+                    break;
+                case uavcan_linux::SocketCanError::TxTimeout:
+                    iface.tx_timeouts += kv.second;
+                    break;
+            }
+        }
+    }
+}
+
+/**
+ * \brief estimate what the node and its roles need of the memory pool, and
+ * warn if it may be too small.  A shortage shows up as transfers that are
+ * dropped, partly sent, or never answered, so it's worth finding early.
+ */
+void AgentUAVCANNode::checkPool() {
+    UAVCANPoolDemand demand;
+    // the services every node starts with
+    demand.addPublisher<uavcan::protocol::NodeStatus>();
+    demand.addPublisher<uavcan::protocol::debug::LogMessage>();
+    demand.addServer<uavcan::protocol::GetNodeInfo>();
+    demand.addServer<uavcan::protocol::GetDataTypeInfo>();
+    demand.addServer<uavcan::protocol::RestartNode>();
+    demand.addServer<uavcan::protocol::GetTransportStats>();
+    for (auto role : roles) {
+        role->addPoolDemand(demand);
+    }
+    uint64_t needed = demand.blocks(node->getDispatcher().getCanIOManager().getNumIfaces());
+    if (needed == pool_needed) {
+        return;
+    }
+    pool_needed = needed;
+    const unsigned capacity = node->getMemPool().getBlockCapacity();
+    if (needed > capacity) {
+        Log::warn("UAVCAN memory pool of ? blocks may be too small for the ? needed; "
+                  "make it at least ?K", capacity, static_cast<int64_t>(needed),
+                  static_cast<int64_t>((needed * uavcan::MemPoolBlockSize + 1023) / 1024));
+    } else {
+        Log::info("UAVCAN memory pool of ? blocks, ? needed", capacity,
+                  static_cast<int64_t>(needed));
+    }
+}
+
+void AgentUAVCANNode::collectStats(UAVCANStats &stats) const {
+    stats = retired;
+    stats.up = node != nullptr;
+    stats.pool.used = 0;
+    stats.pool.needed = pool_needed;
+    if (node) {
+        addNodeStats(stats);
+    }
+    if (stats.ifaces.empty()) {
+        stats.ifaces.resize(1);
+        stats.ifaces[0].name = can_interface;
+    }
+    for (auto role : roles) {
+        role->addStats(stats);
+    }
+}
+
+void AgentUAVCANNode::runTasks() {
+    vector<function<void()>> batch;
+    {
+        const lock_guard<mutex> guard{lock};
+        batch.swap(tasks);
+    }
+    for (auto &task : batch) {
+        task();
+    }
+}
+
+void AgentUAVCANNode::wake() {
+    uint64_t one = 1;
+    ssize_t n = write(wake_fd, &one, sizeof(one));
+    (void) n;
+}
+
+/**
+ * \brief handle whatever the node has to do now: received frames, expired
+ * deadlines, queued transmissions
+ */
+void AgentUAVCANNode::spinNode() {
+    try {
+        int res = node->spinOnce();
+        if (res < 0) {
+            Log::warn("UAVCAN spin failed: ?", res);
+        }
+    } catch (uavcan_linux::AllIfacesDownException &e) {
+        resetNode();
+        Log::warn("? interface went down; waiting for it to come back", can_interface);
+        scheduleRetry();
+        return;
+    } catch (uavcan_linux::Exception &e) {
+        // bring the node up again later rather than sleeping here, which
+        // would hold up posted tasks and everything else on the loop
+        resetNode();
+        Log::warn("UAVCAN spin failed: ?; restarting the node", e.what());
+        scheduleRetry();
+        return;
+    }
+    // frames the socket couldn't take yet wait in the driver
+    for (unsigned i = 0; socketcan != nullptr && i < can_fds.size(); i++) {
+        bool pending = socketcan->getIface(i)->hasReadyTx();
+        if (pending != can_fds[i].second) {
+            watch(epoll_fd, can_fds[i].first, pending ? EPOLLIN | EPOLLOUT : EPOLLIN,
+                  EPOLL_CTL_MOD);
+            can_fds[i].second = pending;
+        }
+    }
+}
+
+/**
+ * \brief read the pending link notifications
+ * \return true if the last one for our interface says it is up
+ */
+bool AgentUAVCANNode::linkCameUp() {
+    bool up = false;
+    char buf[8192];
+    int len;
+    while ((len = static_cast<int>(recv(link_fd, buf, sizeof(buf), 0))) > 0) {
+        for (auto nh = reinterpret_cast<struct nlmsghdr *>(buf); NLMSG_OK(nh, len);
+             nh = NLMSG_NEXT(nh, len)) {
+            if (nh->nlmsg_type != RTM_NEWLINK) {
+                continue;
+            }
+            auto ifi = static_cast<struct ifinfomsg *>(NLMSG_DATA(nh));
+            int attrlen = IFLA_PAYLOAD(nh);
+            for (auto rta = IFLA_RTA(ifi); RTA_OK(rta, attrlen); rta = RTA_NEXT(rta, attrlen)) {
+                if (rta->rta_type == IFLA_IFNAME
+                    && can_interface == static_cast<const char *>(RTA_DATA(rta))) {
+                    up = (ifi->ifi_flags & IFF_UP) != 0;
+                }
+            }
+        }
+    }
+    return up;
+}
+
+void AgentUAVCANNode::reconnect() {
+    retry_at = 0;
+    try {
+        initNode();
+        retired.reconnects++;
+        Log::warn("reconnected to ?", can_interface);
+    } catch (uavcan_linux::Exception &e) {
+        resetNode();
+        Log::debug("? still down", can_interface);
+        scheduleRetry();
+    }
+}
+
+/**
+ * \brief try the node again in a while if the link is up, or if we
+ * won't be told when it comes up.  A link that's down costs no wakeups.
+ */
+void AgentUAVCANNode::scheduleRetry() {
+    struct ifreq ifr = {};
+    can_interface.copy(ifr.ifr_name, IFNAMSIZ - 1);
+    if (link_fd < 0 || (ioctl(link_fd, SIOCGIFFLAGS, &ifr) == 0 && (ifr.ifr_flags & IFF_UP))) {
+        retry_at = monotonicUs() + UAVNODE_RETRY_MS * 1000;
+    }
+}
+
+/**
+ * \brief set the timer for the scheduler's next deadline, or for the
+ * next reconnection attempt while the node is down
+ */
+void AgentUAVCANNode::armTimer() {
+    uint64_t at = retry_at;
+    if (node) {
+        auto earliest = node->getScheduler().getDeadlineScheduler().getEarliestDeadline();
+        at = earliest == uavcan::MonotonicTime::getMax() ? 0 : max<uint64_t>(earliest.toUSec(), 1);
+    }
+    struct itimerspec its = {};
+    its.it_value.tv_sec = at / 1000000;
+    its.it_value.tv_nsec = (at % 1000000) * 1000;
+    timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &its, nullptr);
+}
+
+void AgentUAVCANNode::eventLoop() {
+    Log::setThreadName("uavcan");
+    if (link_fd < 0) {
+        Log::warn("no link notifications; a down ? will be retried every ?ms",
+                  can_interface, UAVNODE_RETRY_MS);
+    }
+
+    struct epoll_event events[8];
+    bool link_up = false;
+    bool failed = false;
+    while (thread_running) {
+        runTasks();
+        if (!node && (link_up || (retry_at != 0 && monotonicUs() >= retry_at))) {
+            reconnect();
+        }
+        link_up = false;
+        if (node) {
+            spinNode();
+        }
+        armTimer();
+
+        int n = epoll_wait(epoll_fd, events, 8, -1);
+        if (n < 0 && errno != EINTR) {
+            Log::error("uavcan epoll: ?", errno);
+            failed = true;
+            break;
+        }
+        wakeups++;
+        for (int i = 0; i < n; i++) {
+            int fd = events[i].data.fd;
+            if (fd == wake_fd || fd == timer_fd) {
+                uint64_t count;
+                ssize_t r = ::read(fd, &count, sizeof(count));
+                (void) r;
+            } else if (fd == link_fd) {
+                link_up = linkCameUp() || link_up;
+            }
+        }
+    }
+    Log::info("UAVCAN event loop exiting after ? wakeups", static_cast<int64_t>(wakeups.load()));
+    resetNode();
+    if (failed) {
+        // stop() may not come for a while; don't leave callers waiting
+        finishTasks();
+    }
+}
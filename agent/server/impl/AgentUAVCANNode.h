@@ -0,0 +1,177 @@
+/**
+ * AgentUAVCANNode.h
+ *
+ * The agent's UAVCAN node and its event loop.
+ *
+ * Copyright (c) 2023 Spire Global, Inc.
+ */
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>  // NOLINT(build/c++11)
+#include <string>
+#include <thread>  // NOLINT(build/c++11)
+#include <utility>
+#include <vector>
+
+#include <uavcan_linux/uavcan_linux.hpp>
+
+#include "CanCapture.h"
+#include "UAVCANStats.h"
+#include "VirtualCan.h"
+
+/// how soon to try again after failing to bring the node back up
+static const unsigned UAVNODE_RETRY_MS = 500;
+/// default bytes of memory pool for the node
+static const size_t UAVNODE_POOL_SIZE = 192 * 1024;
+
+/**
+ * \brief The agent's one UAVCAN node
+ *
+ * The node is owned by a single event-loop thread, which spins it and runs
+ * every callback: subscriptions, service servers and service clients all
+ * share its CAN socket, memory pool and scheduler.
+ *
+ * Users of the node are Roles.  A role creates its subscriptions, servers
+ * and clients in attach(), and drops them in detach(); both run on the
+ * event loop thread.  If the interface goes down the node is recreated,
+ * and every role is detached and attached again.
+ *
+ * Other threads hand work to the loop with post().
+ *
+ * The node's memory pool is capped at a size given at construction, and
+ * taken from the heap as it is first used.  Once roles are attached, their
+ * demand on the pool is estimated, and a pool that may be too small for
+ * it is warned about.
+ *
+ * The loop sleeps in epoll on the CAN sockets, a timerfd set to the
+ * scheduler's next deadline, an eventfd for post() and a netlink socket
+ * for link changes, so it only wakes for frames, real deadlines, posted
+ * work, or the interface coming back up.
+ *
+ * For tests and benchmarks the node can run on a VirtualCanBus instead,
+ * waiting on its driver's timer rather than a socket.
+ *
+ * The frames the node receives can be recorded to a CanCaptureWriter, to
+ * be replayed later with replayCapture().
+ */
+class AgentUAVCANNode {
+ public:
+    class Role {
+     public:
+        virtual ~Role() {}
+        /// create subscriptions, servers and clients on a new node
+        virtual void attach(uavcan_linux::Node &node) = 0;
+        /// the node is going away; drop everything created on it
+        virtual void detach() = 0;
+        /// add the role's own counters, such as its subscriptions'
+        virtual void addStats(UAVCANStats &stats) const { (void) stats; }
+        /// add what the role's subscriptions, servers and clients need of the pool
+        virtual void addPoolDemand(UAVCANPoolDemand &demand) const { (void) demand; }
+    };
+
+    AgentUAVCANNode(const std::string &iface, unsigned int node_id,
+                    size_t pool_size = UAVNODE_POOL_SIZE);
+    /// a node on a virtual bus; `name` stands in for the interface's
+    AgentUAVCANNode(std::shared_ptr<VirtualCanDriver> driver, const std::string &name,
+                    unsigned int node_id, size_t pool_size = UAVNODE_POOL_SIZE);
+    AgentUAVCANNode(const AgentUAVCANNode&) = delete;
+    AgentUAVCANNode& operator=(const AgentUAVCANNode&) = delete;
+    ~AgentUAVCANNode();
+
+    void start();
+    void stop();
+
+    /**
+     * \brief add a role; it is attached on the event loop thread
+     * while the loop is running, or when it starts.
+     */
+    void addRole(Role *role);
+    /**
+     * \brief detach and remove a role; once this returns no more of its
+     * callbacks will run.  Not to be called from the event loop thread.
+     */
+    void removeRole(Role *role);
+
+    /**
+     * \brief run `task` on the event loop thread.  Tasks posted before
+     * start() run once the node is up; once the loop has stopped they run
+     * on the calling thread, with every role detached.
+     */
+    void post(std::function<void()> task);
+
+    /**
+     * \brief record the frames received, other than the node's own, to
+     * `writer`.  Called before start(); the writer must outlive the node.
+     */
+    void setCapture(CanCaptureWriter *writer);
+
+    const std::string &getInterface() const { return can_interface; }
+    /// times the event loop has woken up
+    uint64_t getWakeups() const { return wakeups; }
+    /**
+     * \brief transport counters of the node and its roles, read on the
+     * event loop thread.  Not to be called from it.
+     */
+    UAVCANStats getStats();
+
+ private:
+    // for testing
+    friend class SecretNode;
+
+    std::string can_interface;
+    unsigned int uavcan_node_id;
+    size_t pool_size;
+    /// the virtual bus driver, or null for SocketCAN
+    std::shared_ptr<VirtualCanDriver> virtual_can;
+    uavcan_linux::NodePtr node;
+    /// hands received frames to the capture, if any
+    std::unique_ptr<uavcan::IRxFrameListener> capture;
+
+    std::thread loop_thread;
+    std::atomic<bool> thread_running{false};
+    /// protects tasks, roles and stopped
+    std::mutex lock;
+    std::vector<std::function<void()>> tasks;
+    /// only changed by the loop while it runs
+    std::vector<Role *> roles;
+    bool stopped = false;
+
+    int epoll_fd = -1;
+    int wake_fd = -1;
+    int timer_fd = -1;
+    /// netlink link notifications; -1 if unavailable, and then the
+    /// loop retries a down interface every UAVNODE_RETRY_MS
+    int link_fd = -1;
+    uavcan_linux::SocketCanDriver *socketcan = nullptr;
+    /// CAN sockets of the node, and whether each is waiting to write; or
+    /// the virtual driver's timer
+    std::vector<std::pair<int, bool>> can_fds;
+    /// CLOCK_MONOTONIC time in us to try bringing the node up again; 0 for never
+    uint64_t retry_at = 0;
+    std::atomic<uint64_t> wakeups{0};
+    /// counters of the nodes that have gone, and how many have
+    UAVCANStats retired;
+    /// pool blocks the roles were last estimated to need
+    uint64_t pool_needed = 0;
+
+    void openEvents();
+    void initNode();
+    void resetNode();
+    void runTasks();
+    void finishTasks();
+    void eventLoop();
+    void wake();
+    void spinNode();
+    bool linkCameUp();
+    void reconnect();
+    void scheduleRetry();
+    void armTimer();
+    void checkPool();
+    void addNodeStats(UAVCANStats &stats) const;
+    void collectStats(UAVCANStats &stats) const;
+};
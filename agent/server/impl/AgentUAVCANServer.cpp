@@ -6,12 +6,8 @@
  * Copyright (c) 2021 Spire Global, Inc.
  */
 
-#include <unistd.h>
-#include <sys/types.h>
-#include <sstream>
-#include <system_error>  // NOLINT(build/c++11)
-#include <utility>
-#include <vector>
+#include <chrono>  // NOLINT(build/c++11)
+#include <string>
 
 #include "Log.h"
 #include "AgentUAVCANServer.h"
@@ -19,198 +15,155 @@
 #include <ussp/payload/PayloadAdcsFeed.hpp>
 #include <ussp/tfrs/ReceiverNavigationState.hpp>
 
-#include "nlohmann/json.hpp"
-
 using namespace std;
-using nlohmann::json;
-
-#define MAX_HEALTHCHECK_OUTPUT_SIZE 65536
-
-#define HEALTHCHECK_CMD "/usr/bin/payload_healthcheck"
-#define HK_COMMAND_TIMEOUT 1
-#define INVALID_OUTPUT_RESPONSE_CODE 22
-#define RUNTIME_ERROR_RESPONSE_CODE 50
-#define SYSTEM_ERROR_RESPONSE_CODE 51
-#define UNKNOWN_ERROR_RESPONSE_CODE 52
-
-#define HK_INTERFACE_VERSION 1
-#define HK_MAX_ARRAY_LEN 255
-
-#define VALIDATE_ARRAY(obj, name) do { \
-        if (!obj.at(name).is_array()) { \
-            throw runtime_error("Invalid type for " name); \
-        } \
-        if (obj.at(name).size() > HK_MAX_ARRAY_LEN) { \
-            throw runtime_error("Invalid array size for " name); \
-        } \
-    } while (0)
-
-void AgentUAVCANServer::parseHealthcheckResponse(std::string hk_output,
-        ussp::payload::PayloadHealthCheck::Response& rsp) {
-    json j = json::parse(hk_output);
-
-    int64_t iface_version;
-    j.at("version").get_to(iface_version);
-    if (iface_version != HK_INTERFACE_VERSION) {
-        throw runtime_error("Invalid version in JSON healthcheck response");
-    }
-    VALIDATE_ARRAY(j, "int_metrics");
-    VALIDATE_ARRAY(j, "float_metrics");
-    VALIDATE_ARRAY(j, "int_metric_counts");
-    VALIDATE_ARRAY(j, "float_metric_counts");
 
-    if (!j.at("schema_version").is_number_unsigned()) {
-        throw runtime_error("Invalid type for schema_version");
-    }
-    if (!j.at("payload_timestamp").is_number_unsigned()) {
-        throw runtime_error("Invalid type for payload_timestamp");
-    }
-    if (!j.at("need_hard_reset").is_boolean()) {
-        throw runtime_error("Invalid type for need_hard_reset");
-    }
-
-    j.at("schema_version").get_to(rsp.schema_version);
-    j.at("payload_timestamp").get_to(rsp.timestamp);
-    j.at("need_hard_reset").get_to(rsp.need_hard_reset);
-
-    for (auto& it : j.at("int_metrics")) {
-        rsp.imetric.push_back(it);
-    }
-    for (auto& it : j.at("int_metric_counts")) {
-        rsp.imetric_feeds.push_back(it);
-    }
-    for (auto& it : j.at("float_metrics")) {
-        rsp.fmetric.push_back(it);
-    }
-    for (auto& it : j.at("float_metric_counts")) {
-        rsp.fmetric_feeds.push_back(it);
-    }
+/// when a transfer's first frame arrived, by the kernel's timestamp
+static chrono::system_clock::time_point receivedAt(const uavcan::UtcTime &ts) {
+    return chrono::system_clock::time_point(chrono::microseconds(ts.toUSec()));
 }
 
 void AgentUAVCANServer::healthCheckHandler(
         const uavcan::ReceivedDataStructure<ussp::payload::PayloadHealthCheck::Request>& req,
         ussp::payload::PayloadHealthCheck::Response& rsp) {
     (void)req;
-
-    std::string hk_output;
-    const char *const argv[2] = { tailname(healthcheck_cmd).c_str(), NULL};
-    try {
-        rsp.health_state = (uint8_t) runProcessGetOutput(healthcheck_cmd, argv,
-                                                        MAX_HEALTHCHECK_OUTPUT_SIZE,
-                                                        HK_COMMAND_TIMEOUT, hk_output);
-        parseHealthcheckResponse(hk_output, rsp);
-    }
-    catch (json::parse_error& e) {
-        rsp.response_code = INVALID_OUTPUT_RESPONSE_CODE;
-        Log::error("HealthCheck parse_error ?: ?", e.id, e.what());
-    }
-    catch (json::type_error& e) {
-        rsp.response_code = INVALID_OUTPUT_RESPONSE_CODE;
-        Log::error("HealthCheck type_error ?: ?", e.id, e.what());
-    }
-    catch (system_error& e) {
-        rsp.response_code = SYSTEM_ERROR_RESPONSE_CODE;
-        Log::error("HealthCheck system_error: ?", e.what());
-    }
-    catch (runtime_error& e) {
-        rsp.response_code = RUNTIME_ERROR_RESPONSE_CODE;
-        Log::error("HealthCheck runtime_error: ?", e.what());
-    }
-    catch (std::exception& e) {
-        rsp.response_code = UNKNOWN_ERROR_RESPONSE_CODE;
-        Log::error("HealthCheck exception: ?", e.what());
-    }
+    healthcheck.respond(rsp);
 }
 
-void AgentUAVCANServer::initNode() {
-    std::vector<std::string> ifaces(1);
-    ifaces[0] = can_interface;
-    node = uavcan_linux::makeNode(ifaces, "com.spire.linux_agent",
-                                       uavcan::protocol::SoftwareVersion(),
-                                       uavcan::protocol::HardwareVersion(),
-                                       (uavcan::NodeID) uavcan_node_id);
-    node->getScheduler().setDeadlineResolution(uavcan::MonotonicDuration::fromMSec(100));
-    node->setModeOperational();
+AgentUAVCANServer::AgentUAVCANServer(AgentUAVCANNode& node) : node(node) {
+    // runs on the healthcheck worker; the answers go out from the loop
+    healthcheck.setListener([this] {
+        if (waiting) {
+            this->node.post([this] { answerDeferred(); });
+        }
+    });
+    node.addRole(this);
 }
 
-AgentUAVCANServer::AgentUAVCANServer(std::string iface, unsigned int node_id) {
-    thread_running = false;
-    can_interface = iface;
-    uavcan_node_id = node_id;
-    setPayloadHealthcheckCommand(HEALTHCHECK_CMD);
+AgentUAVCANServer::~AgentUAVCANServer() {
+    // no more answers get posted; removing the role waits out any already
+    healthcheck.stop();
+    node.removeRole(this);
 }
 
-void AgentUAVCANServer::addServices() {
+void AgentUAVCANServer::attach(uavcan_linux::Node &can_node) {
+    this->can_node = &can_node;
     // HealthCheck
-    health_srv = node->makeServiceServer<ussp::payload::PayloadHealthCheck>(
-        [&](const uavcan::ReceivedDataStructure<ussp::payload::PayloadHealthCheck::Request>& req,
-            ussp::payload::PayloadHealthCheck::Response& rsp) {
+    health_srv = makeDeferredServiceServer<ussp::payload::PayloadHealthCheck>(can_node,
+        [this](const uavcan::ReceivedDataStructure<ussp::payload::PayloadHealthCheck::Request>&,
+               const HealthServer::Caller &caller) {
                 Log::debug("HEALTHCHECK");
-                healthCheckHandler(req, rsp);
+                healthCheckRequest(caller);
             });
-    adcs_sub = node->makeSubscriber<ussp::payload::PayloadAdcsFeed>(
+    adcs_sub = can_node.makeSubscriber<ussp::payload::PayloadAdcsFeed>(
         [this](const uavcan::ReceivedDataStructure<ussp::payload::PayloadAdcsFeed>& msg) {
             Log::debug("Received ADCS broadcast for time ?", msg.unix_timestamp);
-            m_mgr.setAdcs(msg);
+            adcs_rate.add(msg.getMonotonicTimestamp().toUSec(), msg.getSrcNodeID().get(),
+                          msg.getTransferID().get());
+            m_mgr.setAdcs(msg, receivedAt(msg.getUtcTimestamp()));
         });
-    tfrs_sub = node->makeSubscriber<ussp::tfrs::ReceiverNavigationState>(
+    tfrs_sub = can_node.makeSubscriber<ussp::tfrs::ReceiverNavigationState>(
         [this](const uavcan::ReceivedDataStructure<ussp::tfrs::ReceiverNavigationState>& msg) {
             Log::debug("Received TFRS broadcast for time ?", msg.utc_time);
-            m_mgr.setTfrs(msg);
+            tfrs_rate.add(msg.getMonotonicTimestamp().toUSec(), msg.getSrcNodeID().get(),
+                          msg.getTransferID().get());
+            m_mgr.setTfrs(msg, receivedAt(msg.getUtcTimestamp()));
         });
 }
 
-void AgentUAVCANServer::resetServices() {
+void AgentUAVCANServer::detach() {
+    // the callers' transfers went with the node
+    deferred.clear();
+    waiting = false;
+    deferred_timer.reset();
+    can_node = nullptr;
     health_srv.reset();
+    if (adcs_sub) {
+        adcs_rate.addDecodeErrors(adcs_sub->getFailureCount());
+    }
+    if (tfrs_sub) {
+        tfrs_rate.addDecodeErrors(tfrs_sub->getFailureCount());
+    }
     adcs_sub.reset();
     tfrs_sub.reset();
-    node.reset();
 }
 
-void AgentUAVCANServer::serverTask() {
-    Log::setThreadName("uavcan_server");
-    Log::info("UAVCAN server starting on ? with node ID ?", can_interface, uavcan_node_id);
-    initNode();
-    addServices();
-
-    while (thread_running) {
-        try {
-            node->spin(uavcan::MonotonicDuration::fromMSec(1000));
-        } catch (uavcan_linux::AllIfacesDownException &e) {
-            // the interface went down.   sleep and try again?
-            resetServices();
-            Log::warn("? interface went down; trying to reconnect", can_interface);
-            while (thread_running) {
-                this_thread::sleep_for(chrono::milliseconds(500));
-                try {
-                    initNode();
-                    addServices();
-                    Log::warn("reconnected to ?", can_interface);
-                    break;
-                } catch (uavcan_linux::Exception &e) {
-                    Log::debug("? still down", can_interface);
-                }
-            }
-        }
+void AgentUAVCANServer::addStats(UAVCANStats &stats) const {
+    // the same clock as the messages' monotonic timestamps
+    uint64_t now = chrono::duration_cast<chrono::microseconds>(
+        chrono::steady_clock::now().time_since_epoch()).count();
+    auto adcs = adcs_rate.stats(ussp::payload::PayloadAdcsFeed::getDataTypeFullName(), now);
+    auto tfrs = tfrs_rate.stats(ussp::tfrs::ReceiverNavigationState::getDataTypeFullName(), now);
+    if (adcs_sub) {
+        adcs.decode_errors += adcs_sub->getFailureCount();
+    }
+    if (tfrs_sub) {
+        tfrs.decode_errors += tfrs_sub->getFailureCount();
+    }
+    stats.subscriptions.push_back(adcs);
+    stats.subscriptions.push_back(tfrs);
+    stats.healthcheck = healthcheck.stats();
+}
+
+void AgentUAVCANServer::addPoolDemand(UAVCANPoolDemand &demand) const {
+    demand.addServer<ussp::payload::PayloadHealthCheck>();
+    demand.addSubscriber<ussp::payload::PayloadAdcsFeed>();
+    demand.addSubscriber<ussp::tfrs::ReceiverNavigationState>();
+}
+
+void AgentUAVCANServer::healthCheckRequest(const HealthServer::Caller &caller) {
+    if (healthcheck.fresh()) {
+        ussp::payload::PayloadHealthCheck::Response rsp;
+        healthcheck.respond(rsp);
+        health_srv->respond(caller, rsp);
+        return;
+    }
+    deferred.push_back(caller);
+    waiting = true;
+    healthcheck.requestRefresh();
+    if (!deferred_timer) {
+        auto deadline = can_node->getMonotonicTime()
+            + uavcan::MonotonicDuration::fromMSec(HEALTHCHECK_DEFER_MS);
+        deferred_timer = can_node->makeTimer(deadline, [this](const uavcan::TimerEvent &) {
+            answerDeferred();
+        });
     }
-    Log::info("UAVCAN server task exiting");
-    resetServices();
+}
+
+/**
+ * \brief answer the waiting healthcheck requests from the latest result,
+ * once a run has finished or the wait is up
+ */
+void AgentUAVCANServer::answerDeferred() {
+    if (deferred.empty() || !health_srv) {
+        return;
+    }
+    ussp::payload::PayloadHealthCheck::Response rsp;
+    healthcheck.respond(rsp);
+    for (auto &caller : deferred) {
+        health_srv->respond(caller, rsp);
+    }
+    Log::debug("answered ? deferred healthcheck requests", static_cast<int>(deferred.size()));
+    deferred.clear();
+    waiting = false;
+    deferred_timer.reset();
 }
 
 void AgentUAVCANServer::start() {
-    thread_running = true;
-    thread worker(&AgentUAVCANServer::serverTask, this);
-    ostringstream s("");
-    s << worker.get_id();
-    Log::info("UAVCAN server worker thread id = ?", s.str());
-    server_thread = std::move(worker);
+    healthcheck.start();
 }
 
 void AgentUAVCANServer::stop() {
-    thread_running = false;
-    server_thread.join();
+    healthcheck.stop();
 }
 
 void AgentUAVCANServer::setPayloadHealthcheckCommand(std::string cmd) {
-    healthcheck_cmd = cmd;
+    healthcheck.setCommand(cmd);
+}
+
+void AgentUAVCANServer::setHealthcheckFreshness(int seconds) {
+    healthcheck.setFreshness(seconds);
+}
+
+void AgentUAVCANServer::refreshHealthcheck() {
+    healthcheck.refresh();
 }
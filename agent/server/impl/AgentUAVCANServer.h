@@ -7,56 +7,86 @@
  */
 #pragma once
 
-#include <semaphore.h>
 #include <atomic>
 #include <string>
-#include <thread>  // NOLINT(build/c++11)
+#include <vector>
 
 #include "Adcs.h"
+#include "AgentUAVCANNode.h"
+#include "DeferredServiceServer.h"
+#include "Healthcheck.h"
+#include "UAVCANStats.h"
 
 #include <uavcan_linux/uavcan_linux.hpp>
 #include <uavcan/helpers/ostream.hpp>
 #include <ussp/payload/PayloadHealthCheck.hpp>
 
+/// longest a healthcheck request waits for a run before being answered
+/// stale; under libuavcan's default 1000ms ServiceClient request timeout, so
+/// that callers using it still get the answer
+#define HEALTHCHECK_DEFER_MS 900
+
 /**
  * \brief Agent UAVCAN server
  * 
- * The UAVCAN server listens on the specified CAN interface
- * and exposes a UAVCAN interface using the DSDL defined in agent/server/ussp.
+ * The UAVCAN server subscribes to the ADCS and TFRS feeds on the agent's
+ * node and exposes a UAVCAN interface using the DSDL defined in
+ * agent/server/ussp.
+ *
+ * Healthcheck requests are answered from a Healthcheck that runs the
+ * payload's healthcheck command on its own thread.  With a fresh result
+ * at hand the answer goes straight back; otherwise the worker is asked
+ * for a run and the request waits, off the event loop, for it to finish
+ * (or HEALTHCHECK_DEFER_MS at most), so telemetry keeps flowing.
  * 
  */
-class AgentUAVCANServer {
-    std::thread server_thread;
-    std::atomic<bool> thread_running;
-    std::string can_interface;
-    unsigned int uavcan_node_id;
-    std::string healthcheck_cmd;
-
-    uavcan_linux::NodePtr node;
-
-    void initNode();
-    void addServices();
-    void resetServices();
-    void serverTask();
-    void parseHealthcheckResponse(std::string hk_output,
-                                  ussp::payload::PayloadHealthCheck::Response& rsp);
-
-    uavcan_linux::ServiceServerPtr<ussp::payload::PayloadHealthCheck> health_srv;
+class AgentUAVCANServer : public AgentUAVCANNode::Role {
+    typedef DeferredServiceServer<ussp::payload::PayloadHealthCheck> HealthServer;
+
+    AgentUAVCANNode& node;
+    Healthcheck healthcheck;
+    uavcan_linux::Node *can_node = nullptr;
+
+    DeferredServiceServerPtr<ussp::payload::PayloadHealthCheck> health_srv;
+    /// healthcheck requests waiting for a run; event loop thread only
+    std::vector<HealthServer::Caller> deferred;
+    /// whether there are any; read by the healthcheck worker
+    std::atomic<bool> waiting{false};
+    uavcan_linux::TimerPtr deferred_timer;
     uavcan_linux::SubscriberPtr<ussp::payload::PayloadAdcsFeed> adcs_sub;
     uavcan_linux::SubscriberPtr<ussp::tfrs::ReceiverNavigationState> tfrs_sub;
+    /// event loop thread only
+    MessageRate adcs_rate;
+    MessageRate tfrs_rate;
 
  public:
     AdcsManager m_mgr;
-    AgentUAVCANServer(std::string iface, unsigned int node_id);
+    explicit AgentUAVCANServer(AgentUAVCANNode& node);
+    ~AgentUAVCANServer();
 
+    /// start and stop the healthcheck; the node runs the services
     void start();
     void stop();
 
+    void attach(uavcan_linux::Node &can_node) override;
+    void detach() override;
+    void addStats(UAVCANStats &stats) const override;
+    void addPoolDemand(UAVCANPoolDemand &demand) const override;
+
     // Public for testing purposes
+    /// fill `rsp` from the latest healthcheck result
     void healthCheckHandler(
         const uavcan::ReceivedDataStructure<ussp::payload::PayloadHealthCheck::Request>& req,
         ussp::payload::PayloadHealthCheck::Response& rsp);
 
+    /// seconds a healthcheck result is served for
+    void setHealthcheckFreshness(int seconds);
+
     // Only used for testing
     void setPayloadHealthcheckCommand(std::string cmd);
+    void refreshHealthcheck();
+
+ private:
+    void healthCheckRequest(const HealthServer::Caller &caller);
+    void answerDeferred();
 };
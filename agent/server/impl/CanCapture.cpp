@@ -0,0 +1,194 @@
+/**
+ * CanCapture.cpp
+ *
+ * Recording CAN frames to a file, and playing them back.
+ *
+ * Copyright (c) 2023 Spire Global, Inc.
+ */
+
+#include <sys/time.h>
+#include <time.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>  // NOLINT(build/c++11)
+#include <cstring>
+#include <stdexcept>
+#include <system_error>  // NOLINT(build/c++11)
+#include <thread>  // NOLINT(build/c++11)
+
+#include "CanCapture.h"
+
+using namespace std;
+
+/// how long a replayed frame may wait to be sent
+#define CAN_REPLAY_TX_TIMEOUT_US 1000000
+
+namespace {
+
+/// largest data length of a frame
+const uint8_t MAX_DLC = uavcan::CanFrame::MaxDataLen;
+
+uint64_t monotonicUs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+uint64_t utcUs() {
+    struct timeval tv;
+    gettimeofday(&tv, nullptr);
+    return static_cast<uint64_t>(tv.tv_sec) * 1000000 + tv.tv_usec;
+}
+
+uint8_t *putLE(uint8_t *p, uint64_t v, unsigned bytes) {
+    for (unsigned i = 0; i < bytes; i++) {
+        *p++ = static_cast<uint8_t>(v >> (8 * i));
+    }
+    return p;
+}
+
+uint64_t getLE(const uint8_t *p, unsigned bytes) {
+    uint64_t v = 0;
+    for (unsigned i = 0; i < bytes; i++) {
+        v |= static_cast<uint64_t>(p[i]) << (8 * i);
+    }
+    return v;
+}
+
+}  // namespace
+
+CanCaptureWriter::CanCaptureWriter(const string &path) {
+    m_file = fopen(path.c_str(), "wb");
+    if (m_file == nullptr) {
+        throw system_error(errno, generic_category(), path);
+    }
+    m_last_us = m_flushed_us = monotonicUs();
+    uint8_t header[CAN_CAPTURE_HEADER] = {};
+    memcpy(header, CAN_CAPTURE_MAGIC, 4);
+    header[4] = CAN_CAPTURE_VERSION;
+    putLE(putLE(header + 8, utcUs(), 8), m_last_us, 8);
+    if (fwrite(header, sizeof(header), 1, m_file) != 1 || !flush()) {
+        int err = errno;
+        fclose(m_file);
+        throw system_error(err, generic_category(), path);
+    }
+}
+
+CanCaptureWriter::~CanCaptureWriter() {
+    fclose(m_file);
+}
+
+bool CanCaptureWriter::write(uint64_t mono_us, const uavcan::CanFrame &frame, uint8_t iface) {
+    // frames from different interfaces may come a little out of order
+    uint64_t delta = mono_us > m_last_us ? mono_us - m_last_us : 0;
+    m_last_us += delta;
+
+    uint8_t record[10 + 4 + 1 + MAX_DLC];
+    uint8_t *p = record;
+    do {
+        *p++ = static_cast<uint8_t>((delta & 0x7F) | (delta > 0x7F ? 0x80 : 0));
+        delta >>= 7;
+    } while (delta != 0);
+    p = putLE(p, frame.id, 4);
+    const uint8_t dlc = min(frame.dlc, MAX_DLC);
+    *p++ = static_cast<uint8_t>(iface << 4 | dlc);
+    memcpy(p, frame.data, dlc);
+    p += dlc;
+
+    if (fwrite(record, p - record, 1, m_file) != 1) {
+        return false;
+    }
+    m_frames++;
+    if (m_last_us - m_flushed_us >= CAN_CAPTURE_FLUSH_US) {
+        return flush();
+    }
+    return true;
+}
+
+bool CanCaptureWriter::flush() {
+    m_flushed_us = m_last_us;
+    return fflush(m_file) == 0;
+}
+
+CanCaptureReader::CanCaptureReader(const string &path) : m_in(path, ios::binary) {
+    uint8_t header[CAN_CAPTURE_HEADER];
+    if (!m_in.read(reinterpret_cast<char *>(header), sizeof(header))
+        || memcmp(header, CAN_CAPTURE_MAGIC, 4) != 0) {
+        throw runtime_error(path + " is not a CAN capture");
+    }
+    if (header[4] != CAN_CAPTURE_VERSION) {
+        throw runtime_error(path + " is a CAN capture of unknown version "
+                            + to_string(header[4]));
+    }
+    m_start_utc = getLE(header + 8, 8);
+}
+
+bool CanCaptureReader::next(CanCaptureFrame &out) {
+    uint64_t delta = 0;
+    char c;
+    for (unsigned shift = 0; ; shift += 7) {
+        if (!m_in.get(c) || shift > 63) {
+            return false;
+        }
+        delta |= static_cast<uint64_t>(c & 0x7F) << shift;
+        if ((c & 0x80) == 0) {
+            break;
+        }
+    }
+    uint8_t head[5];
+    if (!m_in.read(reinterpret_cast<char *>(head), sizeof(head))) {
+        return false;
+    }
+    const uint8_t dlc = min<uint8_t>(head[4] & 0x0F, MAX_DLC);
+    uint8_t data[MAX_DLC];
+    if (!m_in.read(reinterpret_cast<char *>(data), dlc)) {
+        return false;
+    }
+    m_at_us += delta;
+    out.at_us = m_at_us;
+    out.frame = uavcan::CanFrame(static_cast<uint32_t>(getLE(head, 4)), data, dlc);
+    out.iface = head[4] >> 4;
+    return true;
+}
+
+uint64_t replayCapture(CanCaptureReader &capture, uavcan::ICanDriver &driver, double speed,
+                       uint64_t *dropped) {
+    const uint64_t start = monotonicUs();
+    uint64_t sent = 0;
+    CanCaptureFrame f;
+    while (capture.next(f)) {
+        if (speed > 0) {
+            this_thread::sleep_until(chrono::steady_clock::time_point(
+                chrono::microseconds(start + static_cast<uint64_t>(f.at_us / speed))));
+        }
+        const uint8_t index = min<uint8_t>(f.iface, driver.getNumIfaces() - 1);
+        uavcan::ICanIface *iface = driver.getIface(index);
+        // wait for the interface to take it, but not past the deadline
+        const uint64_t deadline = monotonicUs() + CAN_REPLAY_TX_TIMEOUT_US;
+        bool taken = false;
+        while (!taken && monotonicUs() < deadline) {
+            uavcan::CanSelectMasks masks;
+            masks.write = static_cast<uint8_t>(1 << index);
+            const uavcan::CanFrame *pending[uavcan::MaxCanIfaces] = {};
+            pending[index] = &f.frame;
+            if (driver.select(masks, pending, uavcan::MonotonicTime::fromUSec(deadline)) < 0) {
+                throw runtime_error("CAN select failed");
+            }
+            if ((masks.write & (1 << index)) == 0) {
+                continue;
+            }
+            const int16_t res = iface->send(f.frame, uavcan::MonotonicTime::fromUSec(deadline), 0);
+            if (res < 0) {
+                throw runtime_error("CAN send failed");
+            }
+            taken = res > 0;
+        }
+        if (taken) {
+            sent++;
+        } else if (dropped != nullptr) {
+            (*dropped)++;
+        }
+    }
+    return sent;
+}
@@ -0,0 +1,105 @@
+/**
+ * CanCapture.h
+ *
+ * Recording CAN frames to a file, and playing them back.
+ *
+ * Copyright (c) 2023 Spire Global, Inc.
+ */
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <string>
+
+#include <uavcan/driver/can.hpp>
+
+/// first bytes of a capture file
+#define CAN_CAPTURE_MAGIC "OCAN"
+#define CAN_CAPTURE_VERSION 1
+/// bytes of the file header
+#define CAN_CAPTURE_HEADER 24
+/// microseconds of capture a writer may hold before writing it out
+#define CAN_CAPTURE_FLUSH_US 1000000
+
+/**
+ * \brief A frame read from a capture
+ */
+struct CanCaptureFrame {
+    uint64_t at_us;  ///< microseconds after the capture started
+    uavcan::CanFrame frame;
+    uint8_t iface;  ///< index of the interface it was received on
+};
+
+/**
+ * \brief Records CAN frames to a capture file
+ *
+ * The file starts with a header:
+ *
+ *     "OCAN", version byte, 3 zero bytes,
+ *     u64 UTC and u64 CLOCK_MONOTONIC time in us when it was opened
+ *
+ * followed by one record per frame:
+ *
+ *     LEB128 varint: us since the previous frame (or the header's time)
+ *     u32 CAN id, with uavcan::CanFrame's EFF/RTR/ERR flag bits
+ *     u8 interface index << 4 | data length
+ *     the data
+ *
+ * Numbers are little-endian.  An 8-byte frame takes 15 bytes or so.  A
+ * record cut short by the agent stopping is dropped when the file is read.
+ */
+class CanCaptureWriter {
+    FILE *m_file = nullptr;
+    uint64_t m_last_us;
+    uint64_t m_flushed_us;
+    uint64_t m_frames = 0;
+
+ public:
+    /// create (or replace) the capture at `path`; throws system_error
+    explicit CanCaptureWriter(const std::string &path);
+    CanCaptureWriter(const CanCaptureWriter&) = delete;
+    CanCaptureWriter& operator=(const CanCaptureWriter&) = delete;
+    ~CanCaptureWriter();
+
+    /**
+     * \brief add a frame received at `mono_us`, CLOCK_MONOTONIC in us.
+     * Buffered; written out once CAN_CAPTURE_FLUSH_US of capture is held.
+     * \return false, with errno set, if writing failed
+     */
+    bool write(uint64_t mono_us, const uavcan::CanFrame &frame, uint8_t iface);
+    /// write out what's buffered; false, with errno set, if that failed
+    bool flush();
+    /// frames written
+    uint64_t getFrames() const { return m_frames; }
+};
+
+/**
+ * \brief Reads the frames of a capture file in order
+ */
+class CanCaptureReader {
+    std::ifstream m_in;
+    uint64_t m_start_utc = 0;
+    uint64_t m_at_us = 0;
+
+ public:
+    /// open the capture at `path`; throws runtime_error if it isn't one
+    explicit CanCaptureReader(const std::string &path);
+
+    /// the next frame; false at the end of the capture
+    bool next(CanCaptureFrame &out);
+    /// UTC time in us that the capture started
+    uint64_t getStartUtc() const { return m_start_utc; }
+};
+
+/**
+ * \brief send the frames of `capture` out of `driver`, spaced as they were
+ * received, `speed` times faster; with `speed` 0 as fast as the driver
+ * takes them.  Frames go out of the interface they came in on, or the
+ * driver's last if it has fewer.  A frame the interface doesn't take
+ * within CAN_REPLAY_TX_TIMEOUT_US (1s) is dropped, and counted in
+ * `*dropped` if given.
+ * \return frames sent
+ */
+uint64_t replayCapture(CanCaptureReader &capture, uavcan::ICanDriver &driver, double speed,
+                       uint64_t *dropped = nullptr);
@@ -24,7 +24,7 @@
 
 using namespace std;
 
-Cleaner::Cleaner(const Agent *agent) : m_agent(agent) {
+Cleaner::Cleaner(Agent *agent) : m_agent(agent) {
     workerRunning = false;
 }
 
@@ -78,7 +78,9 @@ void Cleaner::cleanOldFiles(const string &dir) {
         // pass 1: remove old ".meta" files
         if (ends_with(*f, m_agent->META_EXT)) {
             Log::warn("removing old meta file ?", *f);
-            unlink(f->c_str());
+            if (unlink(f->c_str()) == 0) {
+                m_agent->transfer_gone(tailname(*f));
+            }
         }
     }
     for (auto f = flist.begin(); f != flist.end(); ++f) {
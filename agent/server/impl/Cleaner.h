@@ -24,7 +24,7 @@ class Agent;
  * for the agent and is not intended to run on its own.
  */
 class Cleaner {
-    const Agent *m_agent;
+    Agent *m_agent;
     std::vector<std::string> m_cleanupDirs;
 
     int m_cleanupInterval = 3600;
@@ -40,7 +40,7 @@ class Cleaner {
     void cleanOldFiles(const std::string &dir);
 
  public:
-    explicit Cleaner(const Agent *agent);
+    explicit Cleaner(Agent *agent);
 
     void setCleanupDirs(const std::vector<std::string> &cleanupDirs);
     void setCleanupInterval(int interval);
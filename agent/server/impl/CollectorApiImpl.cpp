@@ -7,6 +7,7 @@
 */
 
 #include "CollectorApiImpl.h"
+#include <cstdio>
 #include <string>
 
 #include "Agent.h"
@@ -27,8 +28,76 @@ void CollectorApiImpl::ping(Response &response) {
 }
 
 void CollectorApiImpl::info(InfoRequest &request, Response &response) {
-    auto resp = m_agent->collector_info(request);
-    deliverResponse(response, resp);
+    auto resp = m_agent->collector_listing(request);
+    // the file lists can be long; write them out directly rather than
+    // through a json tree
+    deliverStreamed(response, resp, [](JsonStream &js, const InfoListing &result) {
+        js.beginObject();
+        js.key("available").beginObject();
+        js.key("dead").stringArray(result.dead);
+        js.key("files").stringArray(result.files);
+        js.endObject();
+        js.key("sysinfo").raw(to_jsonstr(result.sysinfo));
+        js.key("topics").stringArray(result.topics);
+        js.endObject();
+    });
+}
+
+void CollectorApiImpl::uavcan(Response &response) {
+    auto resp = m_agent->uavcan_stats();
+    deliverStreamed(response, resp, [](JsonStream &js, const UAVCANStats &stats) {
+        js.beginObject();
+        js.key("up").value(stats.up);
+        js.key("reconnects").value(static_cast<int64_t>(stats.reconnects));
+        js.key("transfers_tx").value(static_cast<int64_t>(stats.transfers_tx));
+        js.key("transfers_rx").value(static_cast<int64_t>(stats.transfers_rx));
+        js.key("transfer_errors").value(static_cast<int64_t>(stats.transfer_errors));
+        js.key("pool").beginObject();
+        js.key("block_size").value(static_cast<int64_t>(stats.pool.block_size));
+        js.key("capacity").value(static_cast<int64_t>(stats.pool.capacity));
+        js.key("used").value(static_cast<int64_t>(stats.pool.used));
+        js.key("peak").value(static_cast<int64_t>(stats.pool.peak));
+        js.key("needed").value(static_cast<int64_t>(stats.pool.needed));
+        js.endObject();
+        js.key("interfaces").beginArray();
+        for (const auto &iface : stats.ifaces) {
+            js.beginObject();
+            js.key("name").value(iface.name);
+            js.key("frames_tx").value(static_cast<int64_t>(iface.frames_tx));
+            js.key("frames_rx").value(static_cast<int64_t>(iface.frames_rx));
+            js.key("tx_rejected").value(static_cast<int64_t>(iface.tx_rejected));
+            js.key("rx_overflows").value(static_cast<int64_t>(iface.rx_overflows));
+            js.key("read_failures").value(static_cast<int64_t>(iface.read_failures));
+            js.key("write_failures").value(static_cast<int64_t>(iface.write_failures));
+            js.key("tx_timeouts").value(static_cast<int64_t>(iface.tx_timeouts));
+            js.endObject();
+        }
+        js.endArray();
+        js.key("subscriptions").beginArray();
+        for (const auto &sub : stats.subscriptions) {
+            char rate[32];
+            snprintf(rate, sizeof(rate), "%.3f", sub.rate);
+            js.beginObject();
+            js.key("name").value(sub.name);
+            js.key("messages").value(static_cast<int64_t>(sub.messages));
+            js.key("lost").value(static_cast<int64_t>(sub.lost));
+            js.key("decode_errors").value(static_cast<int64_t>(sub.decode_errors));
+            js.key("rate").raw(rate);
+            js.key("interval_us").value(sub.interval_us);
+            js.key("jitter_us").value(sub.jitter_us);
+            js.key("age_ms").value(sub.age_ms);
+            js.endObject();
+        }
+        js.endArray();
+        js.key("healthcheck").beginObject();
+        js.key("fresh").value(stats.healthcheck.fresh);
+        js.key("age_ms").value(stats.healthcheck.age_ms);
+        js.key("response_code").value(static_cast<int64_t>(stats.healthcheck.response_code));
+        js.key("health_state").value(static_cast<int64_t>(stats.healthcheck.health_state));
+        js.key("error").value(stats.healthcheck.error);
+        js.endObject();
+        js.endObject();
+    });
 }
 
 void CollectorApiImpl::meta(const std::string &uuid, Onion::Response &response) {
@@ -27,6 +27,7 @@ class CollectorApiImpl : public CollectorApiRouter {
     void ping(Onion::Response &response);
     void info(InfoRequest &request, Onion::Response &response);
     void meta(const std::string &uuid, Onion::Response &response);
+    void uavcan(Onion::Response &response);
 
  private:
     Agent *m_agent;
@@ -161,6 +161,91 @@ bool AgentConfig::parseOptions(int argc, char *const argv[]) {
                     return false;
                 }
                 break;
+            case 'W':
+                try {
+                    workerThreads = stoul(str_arg);
+                    use_defaults.worker_threads = false;
+                }
+                catch (const invalid_argument& e) {
+                    cerr << "Invalid worker thread count " << str_arg << endl;
+                    return false;
+                }
+                break;
+            case 'R':
+                try {
+                    reservedThreads = stoul(str_arg);
+                    use_defaults.reserved_threads = false;
+                }
+                catch (const invalid_argument& e) {
+                    cerr << "Invalid reserved thread count " << str_arg << endl;
+                    return false;
+                }
+                break;
+            case 'C':
+                try {
+                    collectorThreads = stoul(str_arg);
+                }
+                catch (const invalid_argument& e) {
+                    cerr << "Invalid collector thread count " << str_arg << endl;
+                    return false;
+                }
+                break;
+            case 'q': {
+                string topic;
+                QuotaLimits limits;
+                if (!parseQuota(str_arg, &topic, &limits)) {
+                    cerr << "Invalid quota " << str_arg << endl;
+                    return false;
+                }
+                quotas.emplace_back(topic, limits);
+                break;
+            }
+            case 'u':
+                if (str_arg == "4" || str_arg == "7") {
+                    uuidVersion = stoi(str_arg);
+                } else {
+                    cerr << "Unsupported UUID version " << str_arg << endl;
+                    return false;
+                }
+                break;
+            case 'E':
+                try {
+                    streamPort = stoul(str_arg);
+                }
+                catch (const invalid_argument& e) {
+                    cerr << "Invalid stream port " << str_arg << endl;
+                    return false;
+                }
+                break;
+            case 'H':
+                try {
+                    healthcheckFreshness = stoi(str_arg);
+                }
+                catch (const invalid_argument& e) {
+                    cerr << "Invalid healthcheck freshness " << str_arg << endl;
+                    return false;
+                }
+                if (healthcheckFreshness < 1) {
+                    cerr << "Healthcheck freshness must be at least 1 second" << endl;
+                    return false;
+                }
+                break;
+            case 'P':
+                try {
+                    uavcanPoolKb = stoi(str_arg);
+                }
+                catch (const invalid_argument& e) {
+                    cerr << "Invalid UAVCAN pool size " << str_arg << endl;
+                    return false;
+                }
+                if (uavcanPoolKb < 16) {
+                    cerr << "UAVCAN pool size must be at least 16K" << endl;
+                    return false;
+                }
+                break;
+            case 'D':
+                canCapture = str_arg;
+                break;
             case '?':
                 // missing argument
                 wantUsage = true;
@@ -200,6 +285,18 @@ bool AgentConfig::parseOptions(int argc, char *const argv[]) {
     if (use_defaults.shim_node_id) {
         shim_node_id = defaults.shim_node_id;
     }
+    if (use_defaults.worker_threads) {
+        workerThreads = defaults.worker_threads;
+    }
+    if (use_defaults.reserved_threads) {
+        reservedThreads = defaults.reserved_threads;
+    }
+
+    if (workerThreads < 1 || reservedThreads >= workerThreads) {
+        cerr << "At least one worker thread must remain after reserving "
+             << reservedThreads << " of " << workerThreads << endl;
+        return false;
+    }
 
     initialized = true;
     return true;
@@ -212,6 +309,10 @@ void AgentConfig::usage(const char *cmd) {
     cerr << " [-t cleanup-timeout] [-i cleanup-interval] [-f config-file]" << endl;
     cerr << " [-s ident] [-m minfree] [-p port] [-l level]" << endl;
     cerr << " [-c can-interface] [-n can-node-id]" << endl;
+    cerr << " [-W workers] [-R reserved] [-C collector-workers]" << endl;
+    cerr << " [-q topic:max-bytes:max-files:rate[:burst]] ... [-u uuid-version]" << endl;
+    cerr << " [-E stream-port] [-H healthcheck-freshness] [-P uavcan-pool]" << endl;
+    cerr << " [-D can-capture]" << endl;
     cerr << " workdir - base working directory; must be writable" << endl;
     cerr << " cleanup-timeout - age in seconds after which files can be deleted" << endl;
     cerr << " cleanup-interval - how frequently in seconds to run the cleanup task" << endl;
@@ -222,6 +323,19 @@ void AgentConfig::usage(const char *cmd) {
     cerr << " level - logging level (debug, info, warn, error)" << endl;
     cerr << " can-interface - CAN interface name for healthcheck interface (e.g. can0)" << endl;
     cerr << " can-node-id - CAN node ID for healthcheck interface, required if -c is set" << endl;
+    cerr << " workers - number of http worker threads" << endl;
+    cerr << " reserved - workers kept free for adcs and tfrs requests" << endl;
+    cerr << " collector-workers - maximum workers serving collector requests" << endl;
+    cerr << " topic - topic the quota applies to, or * for topics without their own" << endl;
+    cerr << " max-bytes - bytes the topic may have queued; K, M or G suffix allowed" << endl;
+    cerr << " max-files - files the topic may have queued" << endl;
+    cerr << " rate, burst - new files per second, and how many may arrive at once" << endl;
+    cerr << "   (empty or 0 fields are unlimited)" << endl;
+    cerr << " uuid-version - 4 for random transfer ids, 7 for ids that sort by time" << endl;
+    cerr << " stream-port - tcp port for ADCS/TFRS event streams; requires -c" << endl;
+    cerr << " healthcheck-freshness - seconds a payload healthcheck result is served for" << endl;
+    cerr << " uavcan-pool - KiB of memory the UAVCAN node may use for transfers" << endl;
+    cerr << " can-capture - file to record the CAN frames received to; requires -c" << endl;
     cerr << endl;
     cerr << "Defaults: " << endl;
     cerr << " cleanup-timeout = " << defaults.maxage;
@@ -229,6 +343,13 @@ void AgentConfig::usage(const char *cmd) {
     cerr << " minfree = " << defaults.minfree << "%" << endl;
     cerr << " port = " << defaults.port << endl;
     cerr << " level = " << Log::levelNames[defaults.loglevel] << endl;
+    cerr << " workers = " << defaults.worker_threads;
+    cerr << "  reserved = " << defaults.reserved_threads << endl;
+    cerr << " uuid-version = 4" << endl;
+    cerr << " stream-port = none" << endl;
+    cerr << " healthcheck-freshness = 30" << endl;
+    cerr << " uavcan-pool = 192" << endl;
+    cerr << " can-capture = none" << endl;
 }
 
 int AgentConfig::getPort() {
@@ -250,3 +371,31 @@ unsigned int AgentConfig::getUAVCANNodeID() {
 unsigned int AgentConfig::getShimNodeID() {
     return shim_node_id;
 }
+
+int AgentConfig::getWorkerThreads() {
+    return workerThreads;
+}
+
+int AgentConfig::getReservedThreads() {
+    return reservedThreads;
+}
+
+int AgentConfig::getCollectorThreads() {
+    return collectorThreads;
+}
+
+int AgentConfig::getStreamPort() {
+    return streamPort;
+}
+
+int AgentConfig::getHealthcheckFreshness() {
+    return healthcheckFreshness;
+}
+
+size_t AgentConfig::getUAVCANPoolSize() {
+    return static_cast<size_t>(uavcanPoolKb) * 1024;
+}
+
+std::string AgentConfig::getCANCapture() {
+    return canCapture;
+}
@@ -7,9 +7,13 @@
  */
 #pragma once
 
+#include <cstddef>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include "Log.h"
+#include "Quota.h"
 
 /**
  * \brief Configuration for Agent.
@@ -30,6 +34,15 @@ class AgentConfig {
     int maxAge;  ///< Cleaner maximum file age
 
     int port;  ///< tcp port to listen on
+    int workerThreads;  ///< http worker threads
+    int reservedThreads;  ///< workers reserved for adcs/tfrs requests
+    int collectorThreads = 0;  ///< cap on workers serving collector requests
+    std::vector<std::pair<std::string, QuotaLimits>> quotas;  ///< per-topic limits
+    int uuidVersion = 4;  ///< 4 (random) or 7 (time-ordered) transfer ids
+    int streamPort = 0;  ///< port for the telemetry event stream; 0 for none
+    int healthcheckFreshness = 30;  ///< seconds a payload healthcheck result is served for
+    int uavcanPoolKb = 192;  ///< KiB of memory pool for the UAVCAN node
+    std::string canCapture;  ///< file to record received CAN frames to; empty for none
 
     std::string can_interface;
     bool can_interface_enabled;
@@ -47,7 +60,16 @@ class AgentConfig {
     // c - can interface
     // n - uavcan node id
     // N - uavcan payload-shim node id
-    const char *optstring = "w:t:i:f:s:m:p:l:c:n:N:";
+    // W - http worker threads
+    // R - workers reserved for adcs/tfrs
+    // C - maximum workers for collector requests
+    // q - topic quota (repeatable)
+    // u - transfer id UUID version
+    // E - telemetry event stream port
+    // H - payload healthcheck freshness
+    // P - uavcan memory pool size
+    // D - CAN capture file
+    const char *optstring = "w:t:i:f:s:m:p:l:c:n:N:W:R:C:q:u:E:H:P:D:";
 
     struct {
         bool minfree = true;
@@ -56,6 +78,8 @@ class AgentConfig {
         bool port = true;
         bool loglevel = true;
         bool shim_node_id = true;
+        bool worker_threads = true;
+        bool reserved_threads = true;
     } use_defaults;
 
     const struct {
@@ -65,6 +89,8 @@ class AgentConfig {
         int port = 2005;
         Log::levels loglevel = Log::levels::Warn;
         unsigned int shim_node_id = 50;
+        int worker_threads = 4;
+        int reserved_threads = 1;
     } defaults;
 
     void checkDir(const std::string &dir);
@@ -77,4 +103,11 @@ class AgentConfig {
     std::string getCANInterface();
     unsigned int getUAVCANNodeID();
     unsigned int getShimNodeID();
+    int getWorkerThreads();
+    int getReservedThreads();
+    int getCollectorThreads();
+    int getStreamPort();
+    int getHealthcheckFreshness();
+    size_t getUAVCANPoolSize();
+    std::string getCANCapture();
 };
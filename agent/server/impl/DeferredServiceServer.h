@@ -0,0 +1,103 @@
+/**
+ * DeferredServiceServer.h
+ *
+ * UAVCAN service server whose responses may be sent later.
+ *
+ * Copyright (c) 2023 Spire Global, Inc.
+ */
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <string>
+
+#include <uavcan/uavcan.hpp>
+#include <uavcan_linux/uavcan_linux.hpp>
+
+/**
+ * \brief A service server that answers when it's ready
+ *
+ * uavcan::ServiceServer sends its response as soon as the request
+ * callback returns, so the callback has to have the answer at hand.  Here
+ * the callback is given the Caller instead, and the response is sent with
+ * respond(), then or any time later, from the node's event loop thread.
+ * Callers time out on their own, so a request that is never answered
+ * costs nothing.
+ */
+template <typename DataType>
+class DeferredServiceServer
+    : public uavcan::GenericSubscriber<DataType, typename DataType::Request,
+                                       uavcan::TransferListener> {
+ public:
+    typedef typename DataType::Request RequestType;
+    typedef typename DataType::Response ResponseType;
+
+    /// where a response goes
+    struct Caller {
+        uavcan::NodeID node_id;
+        uavcan::TransferID transfer_id;
+        uavcan::TransferPriority priority;
+    };
+
+    typedef std::function<void(const uavcan::ReceivedDataStructure<RequestType>&, const Caller&)>
+        Callback;
+
+    explicit DeferredServiceServer(uavcan::INode &node)
+        : SubscriberType(node),
+          publisher_(node, uavcan::ServiceServer<DataType>::getDefaultTxTimeout()) {}
+
+    int start(const Callback &callback) {
+        SubscriberType::stop();
+        callback_ = callback;
+        const int res = publisher_.init();
+        if (res < 0) {
+            return res;
+        }
+        return SubscriberType::startAsServiceRequestListener();
+    }
+
+    /**
+     * \brief send the response to a request
+     * \return negative libuavcan error code on failure
+     */
+    int respond(const Caller &caller, const ResponseType &rsp) {
+        publisher_.setPriority(caller.priority);
+        const int res = publisher_.publish(rsp, uavcan::TransferTypeServiceResponse,
+                                           caller.node_id, caller.transfer_id);
+        if (res < 0) {
+            publisher_.getNode().getDispatcher().getTransferPerfCounter().addError();
+        }
+        return res;
+    }
+
+ private:
+    typedef uavcan::GenericSubscriber<DataType, RequestType, uavcan::TransferListener>
+        SubscriberType;
+    typedef uavcan::GenericPublisher<DataType, ResponseType> PublisherType;
+
+    PublisherType publisher_;
+    Callback callback_;
+
+    void handleReceivedDataStruct(uavcan::ReceivedDataStructure<RequestType> &request) override {
+        callback_(request, Caller{request.getSrcNodeID(), request.getTransferID(),
+                                  request.getPriority()});
+    }
+};
+
+template <typename DataType>
+using DeferredServiceServerPtr = std::shared_ptr<DeferredServiceServer<DataType>>;
+
+/**
+ * \brief DeferredServiceServer counterpart of uavcan_linux's makeServiceServer()
+ * \throws uavcan_linux::Exception if the server can't be started
+ */
+template <typename DataType>
+DeferredServiceServerPtr<DataType> makeDeferredServiceServer(
+        uavcan::INode &node, const typename DeferredServiceServer<DataType>::Callback &callback) {
+    DeferredServiceServerPtr<DataType> srv(new DeferredServiceServer<DataType>(node));
+    if (srv->start(callback) < 0) {
+        throw uavcan_linux::Exception(std::string("DeferredServiceServer start failure ")
+                                      + DataType::getDataTypeFullName());
+    }
+    return srv;
+}
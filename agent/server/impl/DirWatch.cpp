@@ -0,0 +1,96 @@
+/**
+ * DirWatch.cpp
+ *
+ * Notification of files leaving a directory.
+ *
+ * Copyright (c) 2023 Spire Global, Inc.
+ */
+
+#include "DirWatch.h"
+
+#include <limits.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <system_error>  // NOLINT(build/c++11)
+
+#include "Log.h"
+
+using namespace std;
+
+DirWatch::DirWatch(const string &dir, GoneFn gone, OverflowFn overflow)
+    : m_gone(gone), m_overflow(overflow) {
+    m_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (m_fd < 0) {
+        throw system_error(errno, generic_category(), "inotify_init1");
+    }
+    if (inotify_add_watch(m_fd, dir.c_str(), IN_DELETE | IN_MOVED_FROM | IN_ONLYDIR) < 0) {
+        int err = errno;
+        close(m_fd);
+        throw system_error(err, generic_category(), "watching " + dir);
+    }
+    m_stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (m_stop_fd < 0) {
+        int err = errno;
+        close(m_fd);
+        throw system_error(err, generic_category(), "eventfd");
+    }
+}
+
+DirWatch::~DirWatch() {
+    stop();
+    close(m_stop_fd);
+    close(m_fd);
+}
+
+void DirWatch::start() {
+    if (!m_running.exchange(true)) {
+        m_thread = thread(&DirWatch::run, this);
+    }
+}
+
+void DirWatch::stop() {
+    if (m_running.exchange(false)) {
+        uint64_t one = 1;
+        ssize_t n = write(m_stop_fd, &one, sizeof(one));
+        (void) n;
+        m_thread.join();
+    }
+}
+
+void DirWatch::run() {
+    Log::setThreadName("dirwatch");
+    // room for at least one event with the longest name
+    alignas(struct inotify_event) char buf[sizeof(struct inotify_event) + NAME_MAX + 1 + 4096];
+    while (m_running) {
+        struct pollfd fds[2] = {{m_fd, POLLIN, 0}, {m_stop_fd, POLLIN, 0}};
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            Log::error("Directory watch failed: ?", strerror(errno));
+            return;
+        }
+        if (fds[1].revents != 0) {
+            return;
+        }
+        ssize_t len;
+        while ((len = read(m_fd, buf, sizeof(buf))) > 0) {
+            for (char *p = buf; p < buf + len; ) {
+                auto ev = reinterpret_cast<const struct inotify_event *>(p);
+                if (ev->mask & IN_Q_OVERFLOW) {
+                    Log::warn("Directory watch overflowed");
+                    m_overflow();
+                } else if (ev->len > 0) {
+                    m_gone(ev->name);
+                }
+                p += sizeof(struct inotify_event) + ev->len;
+            }
+        }
+    }
+}
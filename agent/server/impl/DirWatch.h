@@ -0,0 +1,47 @@
+/**
+ * DirWatch.h
+ *
+ * Notification of files leaving a directory.
+ *
+ * Copyright (c) 2023 Spire Global, Inc.
+ */
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <string>
+#include <thread>  // NOLINT(build/c++11)
+
+/**
+ * \brief Watches a directory with inotify, on a thread of its own, and
+ * reports each file deleted from it or renamed out of it.
+ *
+ * If the kernel's event queue overflows, departures may have been missed,
+ * and the overflow callback is called instead so that the owner can check
+ * what it's tracking.
+ */
+class DirWatch {
+ public:
+    /// called with the name, within the directory, of a file that left it
+    typedef std::function<void(const std::string&)> GoneFn;
+    typedef std::function<void()> OverflowFn;
+
+    /// throws system_error if `dir` can't be watched
+    DirWatch(const std::string &dir, GoneFn gone, OverflowFn overflow);
+    DirWatch(const DirWatch&) = delete;
+    DirWatch& operator=(const DirWatch&) = delete;
+    ~DirWatch();
+
+    void start();
+    void stop();
+
+ private:
+    GoneFn m_gone;
+    OverflowFn m_overflow;
+    int m_fd = -1;
+    int m_stop_fd = -1;
+    std::atomic<bool> m_running{false};
+    std::thread m_thread;
+
+    void run();
+};
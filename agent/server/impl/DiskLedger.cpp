@@ -0,0 +1,174 @@
+/**
+ * DiskLedger.cpp
+ *
+ * In-process disk space reservation ledger.
+ *
+ * Copyright (c) 2023 Spire Global, Inc.
+ */
+
+#include "DiskLedger.h"
+
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <algorithm>
+#include <string>
+#include <system_error>  // NOLINT(build/c++11)
+#include <utility>
+
+#include "Log.h"
+
+using namespace std;
+
+DiskLedger::Reservation::Reservation(DiskLedger *ledger, dev_t dev, int64_t size,
+                                     const struct statvfs &vfs)
+    : m_ledger(ledger), m_dev(dev), m_size(size), m_vfs(vfs) {}
+
+DiskLedger::Reservation::Reservation(Reservation &&other)
+    : m_ledger(other.m_ledger), m_dev(other.m_dev), m_size(other.m_size), m_vfs(other.m_vfs) {
+    other.m_ledger = nullptr;
+}
+
+DiskLedger::Reservation& DiskLedger::Reservation::operator=(Reservation &&other) {
+    if (this != &other) {
+        release();
+        m_ledger = other.m_ledger;
+        m_dev = other.m_dev;
+        m_size = other.m_size;
+        m_vfs = other.m_vfs;
+        other.m_ledger = nullptr;
+    }
+    return *this;
+}
+
+DiskLedger::Reservation::~Reservation() {
+    release();
+}
+
+void DiskLedger::Reservation::release() {
+    if (m_ledger != nullptr) {
+        m_ledger->release(m_dev, m_size);
+        m_ledger = nullptr;
+    }
+}
+
+void DiskLedger::Reservation::wrote(int64_t n) {
+    n = min(n, m_size);
+    if (m_ledger != nullptr && n > 0) {
+        m_ledger->wrote(m_dev, n);
+        m_size -= n;
+    }
+}
+
+DiskLedger::DiskLedger(unsigned refresh_ms) : m_refresh(refresh_ms) {}
+
+/**
+ * \brief find the filesystem entry for a directory, refreshing if stale
+ *
+ * Must be called with m_lock held.  Throws system_error if the directory
+ * cannot be examined.
+ */
+DiskLedger::FsEntry &DiskLedger::lookup(const string &dir, dev_t *dev) {
+    auto now = clock::now();
+
+    auto d = m_dirs.find(dir);
+    if (d == m_dirs.end() || d->second.refreshed + m_refresh < now) {
+        struct stat buf;
+        if (stat(dir.c_str(), &buf) != 0) {
+            throw system_error(errno, generic_category(), "stat " + dir);
+        }
+        d = m_dirs.emplace(dir, DirEntry()).first;
+        d->second.dev = buf.st_dev;
+        d->second.refreshed = now;
+    }
+    *dev = d->second.dev;
+
+    auto fs = m_filesystems.find(*dev);
+    if (fs == m_filesystems.end() || fs->second.refreshed + m_refresh < now) {
+        struct statvfs vfs;
+        if (statvfs(dir.c_str(), &vfs) != 0) {
+            throw system_error(errno, generic_category(), "statvfs " + dir);
+        }
+        FsEntry &entry = m_filesystems[*dev];
+        entry.vfs = vfs;
+        entry.refreshed = now;
+        entry.written = 0;
+        return entry;
+    }
+    return fs->second;
+}
+
+/**
+ * \brief reserve space for a file of `size` bytes in `dir`
+ *
+ * `check` is called with the size and a statvfs view whose available
+ * block count has been reduced by all outstanding reservations on the
+ * same filesystem, and by what they have written since the view was
+ * refreshed.  If it returns true the space is reserved and a live
+ * Reservation is returned; otherwise an empty Reservation is returned.
+ */
+DiskLedger::Reservation DiskLedger::reserve(const string &dir, int64_t size,
+                                            const CheckFn &check) {
+    const lock_guard<mutex> guard{m_lock};
+    dev_t dev;
+    FsEntry &entry = lookup(dir, &dev);
+
+    struct statvfs view = entry.vfs;
+    if (view.f_frsize > 0) {
+        auto reserved_blocks = static_cast<fsblkcnt_t>(
+            (entry.reserved + entry.written + view.f_frsize - 1) / view.f_frsize);
+        view.f_bavail -= min(view.f_bavail, reserved_blocks);
+    }
+    if (!check(size, view)) {
+        Log::info("Reservation of ? bytes refused; ? bytes already reserved",
+                  static_cast<int64_t>(size), static_cast<int64_t>(entry.reserved));
+        return Reservation();
+    }
+    entry.reserved += size;
+    return Reservation(this, dev, size, view);
+}
+
+/**
+ * \brief cached statvfs for the filesystem holding `dir`
+ */
+struct statvfs DiskLedger::vfs(const string &dir) {
+    const lock_guard<mutex> guard{m_lock};
+    dev_t dev;
+    return lookup(dir, &dev).vfs;
+}
+
+/**
+ * \brief bytes currently reserved on the filesystem holding `dir`
+ */
+int64_t DiskLedger::reserved(const string &dir) {
+    const lock_guard<mutex> guard{m_lock};
+    dev_t dev;
+    return lookup(dir, &dev).reserved;
+}
+
+/**
+ * \brief force the next lookup to call statvfs
+ */
+void DiskLedger::invalidate() {
+    const lock_guard<mutex> guard{m_lock};
+    m_dirs.clear();
+    for (auto &fs : m_filesystems) {
+        fs.second.refreshed = clock::time_point();
+    }
+}
+
+void DiskLedger::release(dev_t dev, int64_t size) {
+    const lock_guard<mutex> guard{m_lock};
+    auto fs = m_filesystems.find(dev);
+    if (fs != m_filesystems.end()) {
+        fs->second.reserved -= size;
+    }
+}
+
+void DiskLedger::wrote(dev_t dev, int64_t size) {
+    const lock_guard<mutex> guard{m_lock};
+    auto fs = m_filesystems.find(dev);
+    if (fs != m_filesystems.end()) {
+        fs->second.reserved -= size;
+        fs->second.written += size;
+    }
+}
@@ -0,0 +1,104 @@
+/**
+ * DiskLedger.h
+ *
+ * In-process disk space reservation ledger.
+ *
+ * Copyright (c) 2023 Spire Global, Inc.
+ */
+#pragma once
+
+#include <sys/statvfs.h>
+#include <sys/types.h>
+#include <chrono>  // NOLINT(build/c++11)
+#include <cstdint>
+#include <functional>
+#include <mutex>  // NOLINT(build/c++11)
+#include <string>
+#include <unordered_map>
+
+/**
+ * \brief Tracks disk space promised to in-flight copies.
+ *
+ * Free space reported by statvfs does not account for copies that have
+ * been admitted but have not written their data yet, so two concurrent
+ * transfers can both pass a free space check and then both run out of
+ * space halfway through.  The ledger keeps a running total of reserved
+ * bytes per filesystem and subtracts it from the (cached) statvfs result
+ * before making an admission decision.
+ *
+ * statvfs results are cached per filesystem and refreshed at most once
+ * per refresh interval.  A copy shrinks its reservation with
+ * Reservation::wrote as it writes; the bytes written are still counted
+ * against the filesystem until the next refresh, which sees them, so they
+ * are never counted twice or not at all.
+ */
+class DiskLedger {
+ public:
+    /// admission check: (size needed, free space view) -> ok
+    typedef std::function<bool(int64_t, const struct statvfs&)> CheckFn;
+
+    /**
+     * \brief RAII handle for reserved space.
+     *
+     * The space is returned to the ledger when the handle is destroyed
+     * or \ref release is called.  An empty handle evaluates to false.
+     */
+    class Reservation {
+        DiskLedger *m_ledger = nullptr;
+        dev_t m_dev = 0;
+        int64_t m_size = 0;
+        struct statvfs m_vfs;
+
+     public:
+        Reservation() = default;
+        Reservation(DiskLedger *ledger, dev_t dev, int64_t size, const struct statvfs &vfs);
+        Reservation(const Reservation&) = delete;
+        Reservation& operator=(const Reservation&) = delete;
+        Reservation(Reservation &&other);
+        Reservation& operator=(Reservation &&other);
+        ~Reservation();
+
+        void release();
+        /// `n` of the reserved bytes have been written, so no longer need
+        /// reserving
+        void wrote(int64_t n);
+        explicit operator bool() const { return m_ledger != nullptr; }
+        int64_t size() const { return m_size; }
+        /// statvfs view used for the admission decision
+        const struct statvfs &vfs() const { return m_vfs; }
+    };
+
+    explicit DiskLedger(unsigned refresh_ms = 1000);
+    DiskLedger(const DiskLedger&) = delete;
+    DiskLedger& operator=(const DiskLedger&) = delete;
+
+    Reservation reserve(const std::string &dir, int64_t size, const CheckFn &check);
+    struct statvfs vfs(const std::string &dir);
+    /// bytes reserved and not yet written
+    int64_t reserved(const std::string &dir);
+    void invalidate();
+
+ private:
+    typedef std::chrono::steady_clock clock;
+
+    struct FsEntry {
+        struct statvfs vfs;
+        clock::time_point refreshed;
+        int64_t reserved = 0;
+        /// written by reservations since vfs was refreshed, so maybe not in it
+        int64_t written = 0;
+    };
+    struct DirEntry {
+        dev_t dev;
+        clock::time_point refreshed;
+    };
+
+    const std::chrono::milliseconds m_refresh;
+    std::mutex m_lock;
+    std::unordered_map<std::string, DirEntry> m_dirs;
+    std::unordered_map<dev_t, FsEntry> m_filesystems;
+
+    FsEntry &lookup(const std::string &dir, dev_t *dev);
+    void release(dev_t dev, int64_t size);
+    void wrote(dev_t dev, int64_t size);
+};
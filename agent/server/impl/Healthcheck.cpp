@@ -0,0 +1,238 @@
+/**
+ * Healthcheck.cpp
+ *
+ * Periodic payload healthcheck.
+ *
+ * Copyright (c) 2023 Spire Global, Inc.
+ */
+
+#include "Healthcheck.h"
+
+#include <algorithm>
+#include <string>
+#include <system_error>  // NOLINT(build/c++11)
+
+#include "Log.h"
+#include "Utils.h"
+
+#include "nlohmann/json.hpp"
+
+using namespace std;
+using nlohmann::json;
+
+#define MAX_HEALTHCHECK_OUTPUT_SIZE 65536
+#define HK_COMMAND_TIMEOUT 1
+
+#define HK_INTERFACE_VERSION 1
+#define HK_MAX_ARRAY_LEN 255
+
+#define VALIDATE_ARRAY(obj, name) do { \
+        if (!obj.at(name).is_array()) { \
+            throw runtime_error("Invalid type for " name); \
+        } \
+        if (obj.at(name).size() > HK_MAX_ARRAY_LEN) { \
+            throw runtime_error("Invalid array size for " name); \
+        } \
+    } while (0)
+
+/**
+ * \brief parse the healthcheck command's output
+ *
+ * Throws json exceptions for malformed output, and runtime_error for
+ * output of the wrong version or shape.
+ */
+void Healthcheck::parse(const string &output, Response &rsp) {
+    json j = json::parse(output);
+
+    int64_t iface_version;
+    j.at("version").get_to(iface_version);
+    if (iface_version != HK_INTERFACE_VERSION) {
+        throw runtime_error("Invalid version in JSON healthcheck response");
+    }
+    VALIDATE_ARRAY(j, "int_metrics");
+    VALIDATE_ARRAY(j, "float_metrics");
+    VALIDATE_ARRAY(j, "int_metric_counts");
+    VALIDATE_ARRAY(j, "float_metric_counts");
+
+    if (!j.at("schema_version").is_number_unsigned()) {
+        throw runtime_error("Invalid type for schema_version");
+    }
+    if (!j.at("payload_timestamp").is_number_unsigned()) {
+        throw runtime_error("Invalid type for payload_timestamp");
+    }
+    if (!j.at("need_hard_reset").is_boolean()) {
+        throw runtime_error("Invalid type for need_hard_reset");
+    }
+
+    j.at("schema_version").get_to(rsp.schema_version);
+    j.at("payload_timestamp").get_to(rsp.timestamp);
+    j.at("need_hard_reset").get_to(rsp.need_hard_reset);
+
+    for (auto& it : j.at("int_metrics")) {
+        rsp.imetric.push_back(it);
+    }
+    for (auto& it : j.at("int_metric_counts")) {
+        rsp.imetric_feeds.push_back(it);
+    }
+    for (auto& it : j.at("float_metrics")) {
+        rsp.fmetric.push_back(it);
+    }
+    for (auto& it : j.at("float_metric_counts")) {
+        rsp.fmetric_feeds.push_back(it);
+    }
+}
+
+Healthcheck::Healthcheck(const string &cmd, int freshness)
+    : m_cmd(cmd), m_freshness(max(freshness, 1)) {}
+
+Healthcheck::~Healthcheck() {
+    stop();
+}
+
+void Healthcheck::start() {
+    if (!m_running.exchange(true)) {
+        m_thread = thread(&Healthcheck::run, this);
+    }
+}
+
+void Healthcheck::stop() {
+    if (m_running.exchange(false)) {
+        {
+            const lock_guard<mutex> guard{m_lock};
+            m_wake.notify_all();
+        }
+        m_thread.join();
+    }
+}
+
+void Healthcheck::setCommand(const string &cmd) {
+    const lock_guard<mutex> guard{m_lock};
+    m_cmd = cmd;
+    m_result = Result();
+}
+
+void Healthcheck::setFreshness(int seconds) {
+    const lock_guard<mutex> guard{m_lock};
+    m_freshness = chrono::seconds(max(seconds, 1));
+}
+
+void Healthcheck::run() {
+    Log::setThreadName("healthcheck");
+    unique_lock<mutex> guard{m_lock};
+    while (m_running) {
+        m_refresh = false;
+        guard.unlock();
+        refresh();
+        guard.lock();
+        m_wake.wait_for(guard, m_freshness / 2, [this] { return !m_running || m_refresh; });
+    }
+}
+
+void Healthcheck::refresh() {
+    string cmd;
+    {
+        const lock_guard<mutex> guard{m_lock};
+        cmd = m_cmd;
+    }
+    Result result;
+    string hk_output;
+    string name = tailname(cmd);
+    const char *const argv[2] = { name.c_str(), NULL };
+    try {
+        result.rsp.health_state = (uint8_t) runProcessGetOutput(cmd, argv,
+                                                               MAX_HEALTHCHECK_OUTPUT_SIZE,
+                                                               HK_COMMAND_TIMEOUT, hk_output);
+        parse(hk_output, result.rsp);
+    }
+    catch (json::parse_error& e) {
+        result.rsp.response_code = INVALID_OUTPUT_RESPONSE_CODE;
+        result.error = e.what();
+        Log::error("HealthCheck parse_error ?: ?", e.id, e.what());
+    }
+    catch (json::type_error& e) {
+        result.rsp.response_code = INVALID_OUTPUT_RESPONSE_CODE;
+        result.error = e.what();
+        Log::error("HealthCheck type_error ?: ?", e.id, e.what());
+    }
+    catch (system_error& e) {
+        result.rsp.response_code = SYSTEM_ERROR_RESPONSE_CODE;
+        result.error = e.what();
+        Log::error("HealthCheck system_error: ?", e.what());
+    }
+    catch (runtime_error& e) {
+        result.rsp.response_code = RUNTIME_ERROR_RESPONSE_CODE;
+        result.error = e.what();
+        Log::error("HealthCheck runtime_error: ?", e.what());
+    }
+    catch (std::exception& e) {
+        result.rsp.response_code = UNKNOWN_ERROR_RESPONSE_CODE;
+        result.error = e.what();
+        Log::error("HealthCheck exception: ?", e.what());
+    }
+    result.valid = true;
+    result.time = chrono::steady_clock::now();
+
+    function<void()> listener;
+    {
+        const lock_guard<mutex> guard{m_lock};
+        if (cmd == m_cmd) {
+            m_result = result;
+        }
+        listener = m_listener;
+    }
+    if (listener) {
+        listener();
+    }
+}
+
+void Healthcheck::requestRefresh() {
+    const lock_guard<mutex> guard{m_lock};
+    m_refresh = true;
+    m_wake.notify_all();
+}
+
+void Healthcheck::setListener(function<void()> listener) {
+    const lock_guard<mutex> guard{m_lock};
+    m_listener = listener;
+}
+
+Healthcheck::Result Healthcheck::latest() const {
+    const lock_guard<mutex> guard{m_lock};
+    return m_result;
+}
+
+bool Healthcheck::freshLocked() const {
+    return m_result.valid && chrono::steady_clock::now() - m_result.time <= m_freshness;
+}
+
+bool Healthcheck::fresh() const {
+    const lock_guard<mutex> guard{m_lock};
+    return freshLocked();
+}
+
+UAVCANHealthcheckStats Healthcheck::stats() const {
+    const lock_guard<mutex> guard{m_lock};
+    UAVCANHealthcheckStats stats;
+    if (!m_result.valid) {
+        return stats;
+    }
+    stats.fresh = freshLocked();
+    stats.age_ms = chrono::duration_cast<chrono::milliseconds>(
+        chrono::steady_clock::now() - m_result.time).count();
+    stats.response_code = m_result.rsp.response_code;
+    stats.health_state = m_result.rsp.health_state;
+    stats.error = m_result.error;
+    return stats;
+}
+
+void Healthcheck::respond(Response &rsp) const {
+    const lock_guard<mutex> guard{m_lock};
+    if (!freshLocked()) {
+        rsp.response_code = STALE_RESPONSE_CODE;
+        return;
+    }
+    auto age = chrono::steady_clock::now() - m_result.time;
+    rsp = m_result.rsp;
+    Log::debug("HealthCheck result from ?ms ago",
+               static_cast<int64_t>(chrono::duration_cast<chrono::milliseconds>(age).count()));
+}
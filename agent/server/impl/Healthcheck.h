@@ -0,0 +1,101 @@
+/**
+ * Healthcheck.h
+ *
+ * Periodic payload healthcheck.
+ *
+ * Copyright (c) 2023 Spire Global, Inc.
+ */
+#pragma once
+
+#include <atomic>
+#include <chrono>  // NOLINT(build/c++11)
+#include <condition_variable>  // NOLINT(build/c++11)
+#include <functional>
+#include <mutex>  // NOLINT(build/c++11)
+#include <string>
+#include <thread>  // NOLINT(build/c++11)
+
+#include <ussp/payload/PayloadHealthCheck.hpp>
+
+#include "UAVCANStats.h"
+
+#define HEALTHCHECK_CMD "/usr/bin/payload_healthcheck"
+/// default seconds a healthcheck result is served for
+#define HEALTHCHECK_FRESHNESS 30
+
+#define INVALID_OUTPUT_RESPONSE_CODE 22
+#define RUNTIME_ERROR_RESPONSE_CODE 50
+#define SYSTEM_ERROR_RESPONSE_CODE 51
+#define UNKNOWN_ERROR_RESPONSE_CODE 52
+/// no healthcheck has completed within the freshness window
+#define STALE_RESPONSE_CODE 53
+
+/**
+ * \brief Runs the payload healthcheck command in the background and keeps
+ * the most recent result.
+ *
+ * The command is run every half freshness window on a worker thread of
+ * its own, so a slow or hanging command never holds up the UAVCAN node;
+ * a PayloadHealthCheck request is answered from the latest result, or
+ * once requestRefresh() has had a new one made.  A result older than the
+ * window means the worker is stuck, and is answered with
+ * STALE_RESPONSE_CODE instead.
+ */
+class Healthcheck {
+ public:
+    typedef ussp::payload::PayloadHealthCheck::Response Response;
+
+    struct Result {
+        bool valid = false;  ///< false until the first run completes
+        Response rsp;
+        std::chrono::steady_clock::time_point time;  ///< when the run completed
+        std::string error;  ///< why the output was rejected; empty if it wasn't
+    };
+
+    explicit Healthcheck(const std::string &cmd = HEALTHCHECK_CMD,
+                         int freshness = HEALTHCHECK_FRESHNESS);
+    Healthcheck(const Healthcheck&) = delete;
+    Healthcheck& operator=(const Healthcheck&) = delete;
+    ~Healthcheck();
+
+    void start();
+    void stop();
+
+    /// change the command; the previous command's result is dropped
+    void setCommand(const std::string &cmd);
+    void setFreshness(int seconds);
+
+    /// run the command now and keep its result
+    void refresh();
+    /// have the worker run the command now rather than at its next period
+    void requestRefresh();
+    /// called, on the thread that ran it, after each run of the command
+    void setListener(std::function<void()> listener);
+    Result latest() const;
+    /// whether the latest result is within the freshness window
+    bool fresh() const;
+    /// the latest result's age, codes and error, for reporting
+    UAVCANHealthcheckStats stats() const;
+
+    /**
+     * \brief answer a PayloadHealthCheck request from the latest result
+     */
+    void respond(Response &rsp) const;
+
+    /// parse the command's JSON output into `rsp`; throws on invalid output
+    static void parse(const std::string &output, Response &rsp);
+
+ private:
+    mutable std::mutex m_lock;
+    std::condition_variable m_wake;
+    std::string m_cmd;
+    std::chrono::seconds m_freshness;
+    Result m_result;
+    bool m_refresh = false;
+    std::function<void()> m_listener;
+    std::atomic<bool> m_running{false};
+    std::thread m_thread;
+
+    void run();
+    bool freshLocked() const;
+};
@@ -0,0 +1,124 @@
+/**
+ * JsonStream.cpp
+ *
+ * Incremental JSON writer.
+ *
+ * Copyright (c) 2023 Spire Global, Inc.
+ */
+
+#include "JsonStream.h"
+
+#include <string>
+
+using namespace std;
+
+void JsonStream::separator() {
+    if (m_after_key) {
+        m_after_key = false;
+    } else if (!m_first.empty()) {
+        if (m_first.back()) {
+            m_first.back() = false;
+        } else {
+            m_out.put(',');
+        }
+    }
+}
+
+/**
+ * write a quoted string, escaped the same way as nlohmann::json
+ */
+void JsonStream::writeString(const string &s) {
+    static const char hex[] = "0123456789abcdef";
+    m_out.put('"');
+    // copy unescaped runs in one write
+    size_t run = 0;
+    for (size_t i = 0; i < s.size(); i++) {
+        unsigned char c = s[i];
+        const char *esc = nullptr;
+        switch (c) {
+            case '"': esc = "\\\""; break;
+            case '\\': esc = "\\\\"; break;
+            case '\b': esc = "\\b"; break;
+            case '\f': esc = "\\f"; break;
+            case '\n': esc = "\\n"; break;
+            case '\r': esc = "\\r"; break;
+            case '\t': esc = "\\t"; break;
+            default:
+                if (c >= 0x20) {
+                    continue;
+                }
+        }
+        m_out.write(s.data() + run, i - run);
+        run = i + 1;
+        if (esc != nullptr) {
+            m_out << esc;
+        } else {
+            char u[] = {'\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xf]};
+            m_out.write(u, sizeof(u));
+        }
+    }
+    m_out.write(s.data() + run, s.size() - run);
+    m_out.put('"');
+}
+
+JsonStream &JsonStream::beginObject() {
+    separator();
+    m_out.put('{');
+    m_first.push_back(true);
+    return *this;
+}
+
+JsonStream &JsonStream::endObject() {
+    m_first.pop_back();
+    m_out.put('}');
+    return *this;
+}
+
+JsonStream &JsonStream::beginArray() {
+    separator();
+    m_out.put('[');
+    m_first.push_back(true);
+    return *this;
+}
+
+JsonStream &JsonStream::endArray() {
+    m_first.pop_back();
+    m_out.put(']');
+    return *this;
+}
+
+JsonStream &JsonStream::key(const string &k) {
+    separator();
+    writeString(k);
+    m_out.put(':');
+    m_after_key = true;
+    return *this;
+}
+
+JsonStream &JsonStream::value(const string &s) {
+    separator();
+    writeString(s);
+    return *this;
+}
+
+JsonStream &JsonStream::value(const char *s) {
+    return value(string(s));
+}
+
+JsonStream &JsonStream::value(int64_t v) {
+    separator();
+    m_out << v;
+    return *this;
+}
+
+JsonStream &JsonStream::value(bool v) {
+    separator();
+    m_out << (v ? "true" : "false");
+    return *this;
+}
+
+JsonStream &JsonStream::raw(const string &json) {
+    separator();
+    m_out << json;
+    return *this;
+}
@@ -0,0 +1,56 @@
+/**
+ * JsonStream.h
+ *
+ * Incremental JSON writer.
+ *
+ * Copyright (c) 2023 Spire Global, Inc.
+ */
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/**
+ * \brief Writes JSON text directly to an output stream.
+ *
+ * Used for responses that can be large (file listings), so they are
+ * written into the HTTP response as they are produced instead of being
+ * built as a json tree and dumped to a string first.  Commas and colons
+ * are inserted automatically; the caller is responsible for balancing
+ * begin/end calls.  Output matches nlohmann's compact `dump()`.
+ */
+class JsonStream {
+    std::ostream &m_out;
+    // one entry per open container: true until its first element
+    std::vector<bool> m_first;
+    bool m_after_key = false;
+
+    void separator();
+    void writeString(const std::string &s);
+
+ public:
+    explicit JsonStream(std::ostream &out) : m_out(out) {}
+
+    JsonStream &beginObject();
+    JsonStream &endObject();
+    JsonStream &beginArray();
+    JsonStream &endArray();
+    JsonStream &key(const std::string &k);
+    JsonStream &value(const std::string &s);
+    JsonStream &value(const char *s);
+    JsonStream &value(int64_t v);
+    JsonStream &value(bool v);
+    /// write an already serialized JSON value
+    JsonStream &raw(const std::string &json);
+
+    template <class C>
+    JsonStream &stringArray(const C &strings) {
+        beginArray();
+        for (const auto &s : strings) {
+            value(s);
+        }
+        return endArray();
+    }
+};
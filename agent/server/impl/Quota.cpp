@@ -0,0 +1,298 @@
+/**
+ * Quota.cpp
+ *
+ * Per-topic transfer quotas and rate limits.
+ *
+ * Copyright (c) 2023 Spire Global, Inc.
+ */
+
+#include "Quota.h"
+
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "Log.h"
+#include "Utils.h"
+
+using namespace std;
+
+bool parseQuota(const string &spec, string *topic, QuotaLimits *limits) {
+    vector<string> fields;
+    stringstream ss(spec);
+    string field;
+    while (getline(ss, field, ':')) {
+        fields.push_back(field);
+    }
+    if (fields.size() < 4 || fields.size() > 5 || (fields[0] != "*" && !isTopicName(fields[0]))) {
+        return false;
+    }
+    QuotaLimits parsed;
+    try {
+        size_t pos = 0;
+        if (!fields[1].empty()) {
+            parsed.maxBytes = stoll(fields[1], &pos);
+            string unit = fields[1].substr(pos);
+            if (unit == "K") {
+                parsed.maxBytes <<= 10;
+            } else if (unit == "M") {
+                parsed.maxBytes <<= 20;
+            } else if (unit == "G") {
+                parsed.maxBytes <<= 30;
+            } else if (!unit.empty()) {
+                return false;
+            }
+        }
+        if (!fields[2].empty()) {
+            parsed.maxFiles = stoll(fields[2], &pos);
+            if (pos != fields[2].size()) return false;
+        }
+        if (!fields[3].empty()) {
+            parsed.rate = stod(fields[3], &pos);
+            if (pos != fields[3].size()) return false;
+        }
+        if (fields.size() == 5 && !fields[4].empty()) {
+            parsed.burst = stod(fields[4], &pos);
+            if (pos != fields[4].size()) return false;
+        }
+    } catch (const logic_error &e) {
+        // invalid_argument or out_of_range
+        return false;
+    }
+    if (parsed.maxBytes < 0 || parsed.maxFiles < 0 || parsed.rate < 0 || parsed.burst < 0) {
+        return false;
+    }
+    *topic = fields[0];
+    *limits = parsed;
+    return true;
+}
+
+TopicQuotas::Admission::Admission(TopicQuotas *quotas, const string &topic, int64_t size)
+    : m_quotas(quotas), m_topic(topic), m_size(size) {}
+
+TopicQuotas::Admission::Admission(Verdict verdict, int retryAfter)
+    : m_verdict(verdict), m_retryAfter(retryAfter) {}
+
+TopicQuotas::Admission::Admission(Admission &&other)
+    : m_quotas(other.m_quotas), m_topic(move(other.m_topic)), m_size(other.m_size),
+      m_verdict(other.m_verdict), m_retryAfter(other.m_retryAfter) {
+    other.m_quotas = nullptr;
+}
+
+TopicQuotas::Admission& TopicQuotas::Admission::operator=(Admission &&other) {
+    if (this != &other) {
+        release();
+        m_quotas = other.m_quotas;
+        m_topic = move(other.m_topic);
+        m_size = other.m_size;
+        m_verdict = other.m_verdict;
+        m_retryAfter = other.m_retryAfter;
+        other.m_quotas = nullptr;
+    }
+    return *this;
+}
+
+TopicQuotas::Admission::~Admission() {
+    release();
+}
+
+/**
+ * \brief record the admitted file as queued under `id`
+ */
+void TopicQuotas::Admission::commit(const string &id) {
+    if (m_quotas != nullptr) {
+        m_quotas->commit(m_topic, id, m_size);
+        m_quotas = nullptr;
+    }
+}
+
+/**
+ * \brief give back an admission whose file was not queued
+ */
+void TopicQuotas::Admission::release() {
+    if (m_quotas != nullptr) {
+        m_quotas->release(m_topic, m_size);
+        m_quotas = nullptr;
+    }
+}
+
+string TopicQuotas::Admission::reason() const {
+    switch (m_verdict) {
+        case OverBytes:
+            return "Topic byte quota exceeded";
+        case OverFiles:
+            return "Topic file quota exceeded";
+        case OverRate:
+            return "Topic rate limit exceeded";
+        default:
+            return "";
+    }
+}
+
+/**
+ * \brief set the limits for `topic`, or for all other topics if `topic`
+ * is "*".  All-zero limits remove any limit.
+ */
+void TopicQuotas::setLimits(const string &topic, const QuotaLimits &limits) {
+    const lock_guard<mutex> guard{m_lock};
+    vector<QuotaLimits> before;
+    for (const auto &t : m_topics) {
+        before.push_back(this->limits(t.first));
+    }
+    if (limits.unlimited()) {
+        m_limits.erase(topic);
+    } else {
+        m_limits[topic] = limits;
+    }
+    // restart only the rate limit buckets whose parameters changed: the
+    // collector pushes the same limits with every handshake
+    size_t i = 0;
+    for (auto &t : m_topics) {
+        const QuotaLimits &was = before[i++];
+        const QuotaLimits &now = this->limits(t.first);
+        if (now.rate != was.rate || now.burst != was.burst) {
+            t.second.tokens = -1;
+        }
+    }
+}
+
+/**
+ * Must be called with m_lock held.
+ */
+const QuotaLimits &TopicQuotas::limits(const string &topic) const {
+    static const QuotaLimits none;
+    auto l = m_limits.find(topic);
+    if (l == m_limits.end()) {
+        l = m_limits.find("*");
+    }
+    return l == m_limits.end() ? none : l->second;
+}
+
+/**
+ * \brief judge a file of `size` bytes on `topic` against its limits
+ *
+ * Byte and file-count quotas are checked before the rate limit, so a
+ * refusal for space does not use up a rate token.  Refills `state`'s
+ * rate limit bucket, but takes nothing from it.
+ *
+ * Must be called with m_lock held.
+ */
+TopicQuotas::Verdict TopicQuotas::judge(const string &topic, TopicState &state, int64_t size,
+                                        int *retryAfter) {
+    const QuotaLimits &lim = limits(topic);
+    Verdict verdict = Admitted;
+    if (lim.maxFiles > 0 && state.used.files + 1 > lim.maxFiles) {
+        verdict = OverFiles;
+    } else if (lim.maxBytes > 0 && state.used.bytes + size > lim.maxBytes) {
+        verdict = OverBytes;
+    }
+    if (verdict != Admitted) {
+        Log::info("Topic ? over quota: ? files, ? bytes queued", topic,
+                  state.used.files, state.used.bytes);
+        *retryAfter = QUOTA_RETRY_AFTER;
+        return verdict;
+    }
+
+    if (lim.rate > 0) {
+        auto now = clock::now();
+        double burst = lim.burst > 0 ? lim.burst : max(lim.rate, 1.0);
+        if (state.tokens < 0) {
+            state.tokens = burst;
+        } else {
+            double elapsed = chrono::duration<double>(now - state.filled).count();
+            state.tokens = min(burst, state.tokens + elapsed * lim.rate);
+        }
+        state.filled = now;
+        if (state.tokens < 1) {
+            int wait = static_cast<int>(ceil((1 - state.tokens) / lim.rate));
+            *retryAfter = max(wait, 1);
+            return OverRate;
+        }
+    }
+    return Admitted;
+}
+
+/**
+ * \brief admit a file of `size` bytes on `topic`, or refuse it
+ */
+TopicQuotas::Admission TopicQuotas::admit(const string &topic, int64_t size) {
+    const lock_guard<mutex> guard{m_lock};
+    TopicState &state = m_topics[topic];
+    int retryAfter = 0;
+    Verdict verdict = judge(topic, state, size, &retryAfter);
+    if (verdict != Admitted) {
+        return Admission(verdict, retryAfter);
+    }
+    if (limits(topic).rate > 0) {
+        state.tokens -= 1;
+    }
+    state.used.files += 1;
+    state.used.bytes += size;
+    return Admission(this, topic, size);
+}
+
+TopicQuotas::Admission TopicQuotas::check(const string &topic, int64_t size) {
+    const lock_guard<mutex> guard{m_lock};
+    auto t = m_topics.find(topic);
+    TopicState state = t == m_topics.end() ? TopicState() : t->second;
+    int retryAfter = 0;
+    Verdict verdict = judge(topic, state, size, &retryAfter);
+    return verdict == Admitted ? Admission() : Admission(verdict, retryAfter);
+}
+
+void TopicQuotas::add(const string &topic, const string &id, int64_t size) {
+    const lock_guard<mutex> guard{m_lock};
+    if (m_files.emplace(id, Queued{topic, size}).second) {
+        TopicState &state = m_topics[topic];
+        state.used.files += 1;
+        state.used.bytes += size;
+    }
+}
+
+void TopicQuotas::remove(const string &id) {
+    const lock_guard<mutex> guard{m_lock};
+    auto f = m_files.find(id);
+    if (f == m_files.end()) {
+        return;
+    }
+    TopicState &state = m_topics[f->second.topic];
+    state.used.files -= 1;
+    state.used.bytes -= f->second.size;
+    m_files.erase(f);
+}
+
+vector<string> TopicQuotas::queued() {
+    const lock_guard<mutex> guard{m_lock};
+    vector<string> ids;
+    ids.reserve(m_files.size());
+    for (const auto &f : m_files) {
+        ids.push_back(f.first);
+    }
+    return ids;
+}
+
+/**
+ * \brief bytes and files counted against `topic`, including admitted
+ * files that have not been committed yet
+ */
+TopicQuotas::Usage TopicQuotas::usage(const string &topic) {
+    const lock_guard<mutex> guard{m_lock};
+    auto t = m_topics.find(topic);
+    return t == m_topics.end() ? Usage() : t->second.used;
+}
+
+void TopicQuotas::commit(const string &topic, const string &id, int64_t size) {
+    const lock_guard<mutex> guard{m_lock};
+    m_files[id] = Queued{topic, size};
+}
+
+void TopicQuotas::release(const string &topic, int64_t size) {
+    const lock_guard<mutex> guard{m_lock};
+    TopicState &state = m_topics[topic];
+    state.used.files -= 1;
+    state.used.bytes -= size;
+}
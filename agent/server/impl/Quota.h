@@ -0,0 +1,137 @@
+/**
+ * Quota.h
+ *
+ * Per-topic transfer quotas and rate limits.
+ *
+ * Copyright (c) 2023 Spire Global, Inc.
+ */
+#pragma once
+
+#include <chrono>  // NOLINT(build/c++11)
+#include <cstdint>
+#include <mutex>  // NOLINT(build/c++11)
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/// seconds a client should wait after hitting a byte or file-count quota
+#define QUOTA_RETRY_AFTER 60
+
+/**
+ * \brief Limits for one topic.  Zero means unlimited.
+ */
+struct QuotaLimits {
+    int64_t maxBytes = 0;  ///< bytes queued for transfer
+    int64_t maxFiles = 0;  ///< files queued for transfer
+    double rate = 0;  ///< sustained new files per second
+    double burst = 0;  ///< files that may arrive at once; defaults to max(rate, 1)
+
+    bool unlimited() const { return maxBytes <= 0 && maxFiles <= 0 && rate <= 0; }
+};
+
+/**
+ * parse "topic:max-bytes:max-files:rate[:burst]", where max-bytes may have
+ * a K, M or G suffix and empty fields are unlimited.
+ * \return false if the spec is malformed
+ */
+bool parseQuota(const std::string &spec, std::string *topic, QuotaLimits *limits);
+
+/**
+ * \brief Tracks what each topic has queued for transfer and admits or
+ * refuses new files against that topic's limits.
+ *
+ * Usage counters are kept current in O(1): files count from admission,
+ * and are dropped with \ref remove when they leave the transfer directory
+ * (the collector takes them, the cleaner expires them, or they're moved
+ * to the dead-letter box).  The transfer directory is only scanned to
+ * \ref add the files queued before the agent started.
+ *
+ * Limits for the topic "*" apply to topics that have none of their own.
+ */
+class TopicQuotas {
+ public:
+    enum Verdict { Admitted, OverBytes, OverFiles, OverRate };
+
+    /**
+     * \brief RAII handle for an admitted file.
+     *
+     * The file's bytes count against the topic from admission.  Call
+     * \ref commit with the transfer id once the file is queued; if the
+     * handle is destroyed without being committed, the bytes are given
+     * back.  A refused admission evaluates to false.
+     */
+    class Admission {
+        TopicQuotas *m_quotas = nullptr;
+        std::string m_topic;
+        int64_t m_size = 0;
+        Verdict m_verdict = Admitted;
+        int m_retryAfter = 0;
+
+     public:
+        Admission() = default;
+        Admission(TopicQuotas *quotas, const std::string &topic, int64_t size);
+        Admission(Verdict verdict, int retryAfter);
+        Admission(const Admission&) = delete;
+        Admission& operator=(const Admission&) = delete;
+        Admission(Admission &&other);
+        Admission& operator=(Admission &&other);
+        ~Admission();
+
+        void commit(const std::string &id);
+        void release();
+        explicit operator bool() const { return m_verdict == Admitted; }
+        Verdict verdict() const { return m_verdict; }
+        /// seconds until a retry might succeed
+        int retryAfter() const { return m_retryAfter; }
+        /// human-readable reason for a refusal
+        std::string reason() const;
+    };
+
+    struct Usage {
+        int64_t bytes = 0;
+        int64_t files = 0;
+    };
+
+    TopicQuotas() = default;
+    TopicQuotas(const TopicQuotas&) = delete;
+    TopicQuotas& operator=(const TopicQuotas&) = delete;
+
+    void setLimits(const std::string &topic, const QuotaLimits &limits);
+    Admission admit(const std::string &topic, int64_t size);
+    /// whether \ref admit would admit the file now, without counting it
+    /// or taking a rate token; an admitted check holds nothing
+    Admission check(const std::string &topic, int64_t size);
+    /// account for a file that is already queued, e.g. at startup
+    void add(const std::string &topic, const std::string &id, int64_t size);
+    /// account for a queued file having left; unknown ids are ignored
+    void remove(const std::string &id);
+    /// ids of the files counted as queued
+    std::vector<std::string> queued();
+    Usage usage(const std::string &topic);
+
+ private:
+    typedef std::chrono::steady_clock clock;
+
+    struct TopicState {
+        Usage used;  ///< committed and pending
+        double tokens = -1;  ///< rate limit bucket; -1 until first use
+        clock::time_point filled;
+    };
+
+    /// a committed file
+    struct Queued {
+        std::string topic;
+        int64_t size;
+    };
+
+    std::mutex m_lock;
+    std::unordered_map<std::string, QuotaLimits> m_limits;
+    std::unordered_map<std::string, TopicState> m_topics;
+    /// committed files, by id
+    std::unordered_map<std::string, Queued> m_files;
+
+    const QuotaLimits &limits(const std::string &topic) const;
+    Verdict judge(const std::string &topic, TopicState &state, int64_t size, int *retryAfter);
+    void commit(const std::string &topic, const std::string &id, int64_t size);
+    void release(const std::string &topic, int64_t size);
+};
@@ -6,8 +6,20 @@
  * Copyright (c) 2020 Spire Global, Inc.
  */
 #include "SdkApiImpl.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+
+#include "Log.h"
 #include "Utils.h"
 
+#include "onion/shortcuts.h"
+
 using namespace org::openapitools::server::model;
 using namespace Onion;
 
@@ -18,8 +30,19 @@ SdkApiImpl::SdkApiImpl(Agent *agent) {
 void SdkApiImpl::query_available_files(
     const std::string &topic, Response &response
 ) {
-    auto resp = m_agent->query_available(topic);
-    deliverResponse(response, resp);
+    auto resp = m_agent->query_available_fragments(topic);
+    deliverStreamed(response, resp, [](JsonStream &js, const AvailableFragments &result) {
+        js.beginObject();
+        js.key("files").beginArray();
+        for (const auto &f : result.files) {
+            js.raw(*f);
+        }
+        js.endArray();
+        if (result.overflow) {
+            js.key("overflow").value(true);
+        }
+        js.endObject();
+    });
 }
 
 void SdkApiImpl::retrieve_file(
@@ -36,11 +59,134 @@ void SdkApiImpl::send_file(
     deliverResponse(response, resp);
 }
 
+void SdkApiImpl::upload_file(
+    const SendFileRequest &sendFileRequest, const std::string &spool, const std::string &crc,
+    Response &response
+) {
+    auto resp = m_agent->receive_file(sendFileRequest, spool, crc);
+    deliverResponse(response, resp);
+}
+
+// added by patch/onion.patch; null if the patch did not apply
+extern "C" int onion_request_connection_fd(onion_request *req) __attribute__((weak));
+
+namespace {
+
+/// a client that takes nothing for this long is given up on
+const int SEND_STALL_MS = 30000;
+
+/**
+ * \brief sendfile() `size` bytes of `fd` to the connection socket `sock`
+ * \return whether all of it was sent
+ */
+bool sendfile_whole(int fd, off_t size, int sock) {
+    off_t offset = 0;
+    while (offset < size) {
+        ssize_t n = sendfile(sock, fd, &offset, size - offset);
+        if (n > 0 || (n < 0 && errno == EINTR)) {
+            continue;
+        } else if (n == 0) {
+            Log::error("upload shrank while being sent: ? of ? bytes", offset, size);
+            return false;
+        } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            return false;
+        }
+        struct pollfd p = {sock, POLLOUT, 0};
+        if (poll(&p, 1, SEND_STALL_MS) <= 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * \brief write the whole of `fd`, `size` bytes, as the response body
+ *
+ * The body goes straight from the file to the socket with sendfile(),
+ * around onion, once the headers are flushed.  Without the onion patch
+ * that gives the socket, it is copied through onion instead.
+ *
+ * \return whether all of it was written to the connection
+ */
+bool send_whole_file(int fd, off_t size, onion_request *req, onion_response *res) {
+    onion_response_set_length(res, size);
+    onion_response_set_header(res, "Content-Type", "application/octet-stream");
+    onion_response_write_headers(res);
+    if (onion_request_connection_fd != nullptr) {
+        return onion_response_flush(res) >= 0
+            && sendfile_whole(fd, size, onion_request_connection_fd(req));
+    }
+    char buf[16384];
+    off_t sent = 0;
+    while (sent < size) {
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n <= 0) {
+            Log::error("upload shrank while being sent: ? of ? bytes", sent, size);
+            return false;
+        }
+        if (onion_response_write(res, buf, n) != n) {
+            return false;
+        }
+        sent += n;
+    }
+    return onion_response_flush(res) >= 0;
+}
+
+}  // namespace
+
+/**
+ * \brief stream an upload's data file
+ *
+ * onion handles Range and If-Modified-Since and sends the body with
+ * sendfile where it can.  With `consume`, the upload is always sent whole,
+ * as a 200, and is deleted only once every byte of it has been written to
+ * the connection.  The connection is then closed, as onion has not seen
+ * the body go out.
+ *
+ * Either way, the request holds its Sdk lane worker until the client has
+ * taken the whole body, however slowly it reads.
+ */
+onion_connection_status SdkApiImpl::get_upload(
+    const std::string &id, bool consume, Onion::Request &request, Response &response
+) {
+    std::string datafile;
+    auto resp = m_agent->upload_info(id, &datafile);
+    if (resp.code != Code::Ok) {
+        return deliverResponse(response, resp);
+    }
+    response.setHeader("X-Oort-Crc32", resp.result.getCrc32());
+    if (!consume) {
+        return onion_shortcut_response_file(datafile.c_str(), request.c_handler(),
+                                            response.c_handler());
+    }
+
+    struct stat st;
+    int fd = open(datafile.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        resp.code = Code::Bad_Request;
+        resp.err.setMessage(OSError("upload unreadable for " + id + ": "));
+        if (fd >= 0) {
+            close(fd);
+        }
+        return deliverError(response, resp);
+    }
+    bool sent = send_whole_file(fd, st.st_size, request.c_handler(), response.c_handler());
+    close(fd);
+    if (!sent) {
+        Log::warn("upload ? not consumed: it was not sent in full", id);
+        return OCS_CLOSE_CONNECTION;
+    }
+    m_agent->consume_upload(id);
+    return OCS_CLOSE_CONNECTION;
+}
+
 void SdkApiImpl::adcs_get(
     Onion::Response &response
 ) {
-    auto resp = m_agent->adcs_get();
-    deliverResponse(response, resp);
+    auto resp = m_agent->adcs_serialized();
+    deliverStreamed(response, resp, [](JsonStream &js, const std::string &json) {
+        js.raw(json);
+    });
 }
 
 void SdkApiImpl::adcs_post(
@@ -50,9 +196,51 @@ void SdkApiImpl::adcs_post(
     deliverResponse(response, resp);
 }
 
+void SdkApiImpl::adcs_command_submit(
+    const AdcsCommandRequest &adcsCommandRequest, Onion::Response &response
+) {
+    auto resp = m_agent->adcs_command_submit(adcsCommandRequest);
+    deliverResponse(response, resp);
+}
+
+void SdkApiImpl::adcs_command_get(
+    const std::string &id, const std::string &wait, Onion::Response &response
+) {
+    auto resp = m_agent->adcs_command_status(id, wait);
+    deliverResponse(response, resp);
+}
+
 void SdkApiImpl::tfrs_get(
     Onion::Response &response
 ) {
-    auto resp = m_agent->tfrs_get();
+    auto resp = m_agent->tfrs_serialized();
+    deliverStreamed(response, resp, [](JsonStream &js, const std::string &json) {
+        js.raw(json);
+    });
+}
+
+void SdkApiImpl::adcs_history(
+    const std::string &start, const std::string &end, const std::string &at,
+    bool interpolate, Onion::Response &response
+) {
+    HistoryQuery query;
+    query.start = start;
+    query.end = end;
+    query.at = at;
+    query.interpolate = interpolate;
+    auto resp = m_agent->adcs_history(query);
+    deliverResponse(response, resp);
+}
+
+void SdkApiImpl::tfrs_history(
+    const std::string &start, const std::string &end, const std::string &at,
+    bool interpolate, Onion::Response &response
+) {
+    HistoryQuery query;
+    query.start = start;
+    query.end = end;
+    query.at = at;
+    query.interpolate = interpolate;
+    auto resp = m_agent->tfrs_history(query);
     deliverResponse(response, resp);
 }
@@ -19,10 +19,12 @@
 #include "SendFileRequest.h"
 #include "SendFileResponse.h"
 
+#include "AdcsHistoryResponse.h"
 #include "AdcsResponse.h"
 #include "AdcsCommandRequest.h"
 #include "AdcsCommandResponse.h"
 
+#include "TfrsHistoryResponse.h"
 #include "TfrsResponse.h"
 
 #include "Agent.h"
@@ -41,12 +43,28 @@ class SdkApiImpl : public SdkApiRouter {
         const RetrieveFileRequest &retrieveFileRequest, Onion::Response &response);
     void send_file(
         const SendFileRequest &sendFileRequest, Onion::Response &response);
+    void upload_file(
+        const SendFileRequest &sendFileRequest, const std::string &spool,
+        const std::string &crc, Onion::Response &response);
+    onion_connection_status get_upload(
+        const std::string &id, bool consume,
+        Onion::Request &request, Onion::Response &response);
     void adcs_get(
         Onion::Response &response);
     void adcs_post(
         const AdcsCommandRequest &adcsCommandRequest, Onion::Response &response);
+    void adcs_command_submit(
+        const AdcsCommandRequest &adcsCommandRequest, Onion::Response &response);
+    void adcs_command_get(
+        const std::string &id, const std::string &wait, Onion::Response &response);
     void tfrs_get(
         Onion::Response &response);
+    void adcs_history(
+        const std::string &start, const std::string &end, const std::string &at,
+        bool interpolate, Onion::Response &response);
+    void tfrs_history(
+        const std::string &start, const std::string &end, const std::string &at,
+        bool interpolate, Onion::Response &response);
 
  private:
     Agent *m_agent;
@@ -0,0 +1,82 @@
+/**
+ * SeqLock.h
+ *
+ * Single-writer, many-reader snapshot publication.
+ *
+ * Copyright (c) 2023 Spire Global, Inc.
+ */
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+/**
+ * \brief Double-buffered sequence lock.
+ *
+ * One writer thread publishes values with \ref store; any number of
+ * reader threads take consistent copies with \ref load.  Neither side
+ * ever blocks the other.
+ *
+ * The writer always fills the slot that is *not* currently published and
+ * then bumps the sequence number, so a reader only has to retry if the
+ * writer started a second store into the reader's slot while the reader
+ * was still copying it - in practice, only if the reader was preempted
+ * for longer than a whole update period.
+ *
+ * T must be trivially copyable, since readers may copy it while it is
+ * being overwritten and throw the copy away.
+ */
+template <class T>
+class SeqLock {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "SeqLock values must be trivially copyable");
+
+    // even: no store in progress; odd: a store is filling the other slot.
+    // seq / 2 is the number of completed stores.
+    std::atomic<uint64_t> m_seq{0};
+    T m_slots[2];
+
+ public:
+    SeqLock() : m_slots() {}
+    SeqLock(const SeqLock&) = delete;
+    SeqLock& operator=(const SeqLock&) = delete;
+
+    /// publish a value; must only be called from one thread
+    void store(const T &value) {
+        uint64_t seq = m_seq.load(std::memory_order_relaxed);
+        T *slot = &m_slots[((seq >> 1) + 1) & 1];
+        m_seq.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        std::memcpy(static_cast<void*>(slot), &value, sizeof(T));
+        m_seq.store(seq + 2, std::memory_order_release);
+    }
+
+    /**
+     * \brief copy of the latest published value
+     *
+     * \param version if not null, set to the number of stores the value
+     * reflects; 0 means nothing has been stored yet
+     */
+    T load(uint64_t *version = nullptr) const {
+        T out;
+        uint64_t before, after;
+        do {
+            before = m_seq.load(std::memory_order_acquire);
+            std::memcpy(static_cast<void*>(&out), &m_slots[(before >> 1) & 1], sizeof(T));
+            std::atomic_thread_fence(std::memory_order_acquire);
+            after = m_seq.load(std::memory_order_relaxed);
+            // our slot is only rewritten by the store after next
+        } while (after - (before & ~uint64_t{1}) >= 3);
+        if (version != nullptr) {
+            *version = before >> 1;
+        }
+        return out;
+    }
+
+    /// number of completed stores
+    uint64_t version() const {
+        return m_seq.load(std::memory_order_acquire) >> 1;
+    }
+};
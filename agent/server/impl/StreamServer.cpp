@@ -0,0 +1,365 @@
+/**
+ * StreamServer.cpp
+ *
+ * Server-Sent Events stream of ADCS and TFRS telemetry.
+ *
+ * Copyright (c) 2023 Spire Global, Inc.
+ */
+
+#include "StreamServer.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <string>
+#include <system_error>  // NOLINT(build/c++11)
+
+#include "Log.h"
+
+using namespace std;
+
+namespace {
+
+const char *feedNames[] = {"adcs", "tfrs"};
+
+string statusResponse(const string &status) {
+    return "HTTP/1.1 " + status + "\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+}
+
+}  // namespace
+
+StreamServer::StreamServer(AdcsManager *mgr, int port, unsigned header_timeout_ms)
+    : m_mgr(mgr), m_port(port), m_header_timeout(header_timeout_ms) {
+    m_listen = socket(AF_INET6, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (m_listen < 0) {
+        throw system_error(errno, generic_category(), "stream socket");
+    }
+    int on = 1;
+    setsockopt(m_listen, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    struct sockaddr_in6 addr = {};
+    addr.sin6_family = AF_INET6;
+    addr.sin6_addr = in6addr_any;
+    addr.sin6_port = htons(port);
+    if (bind(m_listen, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0
+        || listen(m_listen, 8) != 0) {
+        int err = errno;
+        ::close(m_listen);
+        throw system_error(err, generic_category(), "stream listen");
+    }
+    socklen_t len = sizeof(addr);
+    getsockname(m_listen, reinterpret_cast<struct sockaddr*>(&addr), &len);
+    m_port = ntohs(addr.sin6_port);
+
+    m_event = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    m_epoll = epoll_create1(EPOLL_CLOEXEC);
+    if (m_event < 0 || m_epoll < 0) {
+        throw system_error(errno, generic_category(), "stream epoll");
+    }
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.fd = m_listen;
+    epoll_ctl(m_epoll, EPOLL_CTL_ADD, m_listen, &ev);
+    ev.data.fd = m_event;
+    epoll_ctl(m_epoll, EPOLL_CTL_ADD, m_event, &ev);
+}
+
+StreamServer::~StreamServer() {
+    stop();
+    for (auto &c : m_clients) {
+        ::close(c.first);
+    }
+    ::close(m_listen);
+    ::close(m_epoll);
+    ::close(m_event);
+}
+
+void StreamServer::start() {
+    if (!m_running.exchange(true)) {
+        m_mgr->setNotifyFd(m_event);
+        m_thread = thread(&StreamServer::run, this);
+    }
+}
+
+void StreamServer::stop() {
+    if (m_running.exchange(false)) {
+        m_mgr->setNotifyFd(-1);
+        uint64_t one = 1;
+        ssize_t n = write(m_event, &one, sizeof(one));
+        (void) n;
+        m_thread.join();
+    }
+}
+
+void StreamServer::run() {
+    Log::info("streaming telemetry on port ?", m_port);
+    struct epoll_event events[16];
+    auto keepalive = clock::now() + chrono::milliseconds(STREAM_KEEPALIVE_MS);
+    while (m_running) {
+        auto now = clock::now();
+        auto wake = expire(now, keepalive);
+        // rounded up, so as not to wake just before the time
+        int timeout = static_cast<int>(chrono::duration_cast<chrono::milliseconds>(
+            wake - now + chrono::milliseconds(1) - clock::duration(1)).count());
+        int n = epoll_wait(m_epoll, events, 16, max(timeout, 0));
+        if (n < 0 && errno != EINTR) {
+            Log::error("stream epoll: ?", errno);
+            break;
+        }
+        for (int i = 0; i < n; i++) {
+            int fd = events[i].data.fd;
+            if (fd == m_listen) {
+                accept();
+            } else if (fd == m_event) {
+                uint64_t count;
+                ssize_t r = ::read(m_event, &count, sizeof(count));
+                (void) r;
+                refresh();
+            } else {
+                auto c = m_clients.find(fd);
+                if (c == m_clients.end()) {
+                    continue;
+                }
+                if (events[i].events & (EPOLLHUP | EPOLLERR)) {
+                    close(fd);
+                    continue;
+                }
+                if (events[i].events & EPOLLOUT) {
+                    flush(fd, c->second);
+                }
+                if ((events[i].events & EPOLLIN) && m_clients.count(fd)) {
+                    read(fd, c->second);
+                }
+            }
+        }
+        if (clock::now() >= keepalive) {
+            // lets subscribers and proxies tell a quiet feed from a dead one
+            for (auto it = m_clients.begin(); it != m_clients.end(); ) {
+                int fd = (it++)->first;
+                Client &c = m_clients[fd];
+                if (c.feeds != 0 && c.out.empty()) {
+                    send(fd, c, ":\n\n");
+                }
+            }
+            keepalive = clock::now() + chrono::milliseconds(STREAM_KEEPALIVE_MS);
+        }
+    }
+}
+
+void StreamServer::accept() {
+    int fd;
+    while ((fd = accept4(m_listen, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+        if (m_clients.size() >= STREAM_MAX_CLIENTS) {
+            string busy = statusResponse("503 Service Unavailable");
+            ssize_t n = ::send(fd, busy.data(), busy.size(), MSG_NOSIGNAL);
+            (void) n;
+            ::close(fd);
+            continue;
+        }
+        struct epoll_event ev = {};
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+        epoll_ctl(m_epoll, EPOLL_CTL_ADD, fd, &ev);
+        m_clients[fd].deadline = clock::now() + m_header_timeout;
+    }
+}
+
+/**
+ * \brief close the clients that have not subscribed by their deadline
+ * \return the next deadline, or `until` if that is sooner
+ */
+StreamServer::clock::time_point StreamServer::expire(clock::time_point now,
+                                                     clock::time_point until) {
+    for (auto it = m_clients.begin(); it != m_clients.end(); ) {
+        int fd = (it++)->first;
+        const Client &c = m_clients[fd];
+        if (c.feeds != 0) {
+            continue;
+        } else if (c.deadline <= now) {
+            close(fd);
+        } else {
+            until = min(until, c.deadline);
+        }
+    }
+    return until;
+}
+
+void StreamServer::read(int fd, Client &c) {
+    char buf[1024];
+    ssize_t n;
+    while ((n = recv(fd, buf, sizeof(buf), 0)) > 0) {
+        if (c.feeds != 0 || c.closing) {
+            continue;  // nothing more is expected from a subscriber
+        }
+        c.in.append(buf, n);
+        if (c.in.find("\r\n\r\n") != string::npos) {
+            subscribe(fd, c);
+            return;
+        } else if (c.in.size() > STREAM_MAX_REQUEST) {
+            c.closing = true;
+            send(fd, c, statusResponse("431 Request Header Fields Too Large"));
+            return;
+        }
+    }
+    if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+        close(fd);
+    }
+}
+
+/**
+ * \brief parse the request line and start the stream
+ */
+void StreamServer::subscribe(int fd, Client &c) {
+    string line = c.in.substr(0, c.in.find("\r\n"));
+    c.in.clear();
+    size_t sp1 = line.find(' ');
+    size_t sp2 = line.find(' ', sp1 + 1);
+    if (sp1 == string::npos || sp2 == string::npos || line.compare(0, sp1, "GET") != 0) {
+        c.closing = true;
+        send(fd, c, statusResponse("405 Method Not Allowed"));
+        return;
+    }
+    string target = line.substr(sp1 + 1, sp2 - sp1 - 1);
+    string path = target.substr(0, target.find('?'));
+    string query = target.size() > path.size() ? target.substr(path.size() + 1) : "";
+
+    unsigned feeds = 0;
+    if (path == "/sdk/v1/adcs/stream") {
+        feeds = 1 << Adcs;
+    } else if (path == "/sdk/v1/tfrs/stream") {
+        feeds = 1 << Tfrs;
+    } else if (path == "/sdk/v1/stream") {
+        feeds = (1 << Adcs) | (1 << Tfrs);
+    } else {
+        c.closing = true;
+        send(fd, c, statusResponse("404 Not Found"));
+        return;
+    }
+    // name=value parameters separated by '&'; others than rate are ignored
+    for (size_t pos = 0; pos < query.size(); ) {
+        size_t amp = min(query.find('&', pos), query.size());
+        string param = query.substr(pos, amp - pos);
+        pos = amp + 1;
+        if (param.compare(0, 5, "rate=") != 0) {
+            continue;
+        }
+        char *end;
+        double rate = strtod(param.c_str() + 5, &end);
+        if (end == param.c_str() + 5 || *end != '\0' || !(rate > 0)) {
+            c.closing = true;
+            send(fd, c, statusResponse("400 Bad Request"));
+            return;
+        }
+        c.interval = chrono::duration_cast<clock::duration>(chrono::duration<double>(1 / rate));
+    }
+
+    send(fd, c, "HTTP/1.1 200 OK\r\n"
+                "Content-Type: text/event-stream\r\n"
+                "Cache-Control: no-cache\r\n"
+                "Connection: keep-alive\r\n\r\n");
+    // bring everyone else up to date first, so the new subscriber's first
+    // sample is the current one and is only sent once
+    refresh(true);
+    if (m_clients.count(fd) == 0) {
+        return;
+    }
+    c.feeds = feeds;
+    auto now = clock::now();
+    for (int f = 0; f < NumFeeds; f++) {
+        if (m_version[f] > 0 && m_clients.count(fd)) {
+            deliver(static_cast<Feed>(f), fd, c, now);
+        }
+    }
+}
+
+/**
+ * \brief pick up new samples and pass them to subscribers
+ *
+ * Samples are not serialized while nobody is subscribed, unless `force`.
+ */
+void StreamServer::refresh(bool force) {
+    bool subscribed = force;
+    for (auto &c : m_clients) {
+        subscribed = subscribed || c.second.feeds != 0;
+    }
+    if (!subscribed) {
+        return;
+    }
+    uint64_t versions[NumFeeds] = {m_mgr->adcsVersion(), m_mgr->tfrsVersion()};
+    auto now = clock::now();
+    for (int f = 0; f < NumFeeds; f++) {
+        if (versions[f] == m_version[f]) {
+            continue;
+        }
+        string json = f == Adcs ? m_mgr->getAdcsJson() : m_mgr->getTfrsJson();
+        m_version[f] = versions[f];
+        m_frame[f] = "event: " + string(feedNames[f]) + "\nid: " + to_string(versions[f])
+            + "\ndata: " + json + "\n\n";
+        for (auto it = m_clients.begin(); it != m_clients.end(); ) {
+            int fd = (it++)->first;
+            deliver(static_cast<Feed>(f), fd, m_clients[fd], now);
+        }
+    }
+}
+
+/**
+ * \brief send the latest `feed` sample to a subscriber that wants it
+ *
+ * Samples are dropped for a client that is within its decimation
+ * interval, or too far behind.
+ */
+void StreamServer::deliver(Feed feed, int fd, Client &c, clock::time_point now) {
+    if (!(c.feeds & (1 << feed)) || now < c.next[feed] || c.out.size() > STREAM_MAX_PENDING) {
+        return;
+    }
+    c.next[feed] = now + c.interval;
+    send(fd, c, m_frame[feed]);
+}
+
+void StreamServer::send(int fd, Client &c, const string &data) {
+    bool idle = c.out.empty();
+    c.out += data;
+    if (idle) {
+        flush(fd, c);
+    }
+}
+
+/**
+ * \brief write what the socket will take, and wait for EPOLLOUT if
+ * anything is left.  May close the client.
+ */
+void StreamServer::flush(int fd, Client &c) {
+    size_t sent = 0;
+    while (sent < c.out.size()) {
+        ssize_t n = ::send(fd, c.out.data() + sent, c.out.size() - sent, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            close(fd);
+            return;
+        }
+        sent += n;
+    }
+    c.out.erase(0, sent);
+    if (c.out.empty() && c.closing) {
+        close(fd);
+        return;
+    }
+    struct epoll_event ev = {};
+    ev.events = c.out.empty() ? EPOLLIN : EPOLLIN | EPOLLOUT;
+    ev.data.fd = fd;
+    epoll_ctl(m_epoll, EPOLL_CTL_MOD, fd, &ev);
+}
+
+void StreamServer::close(int fd) {
+    epoll_ctl(m_epoll, EPOLL_CTL_DEL, fd, nullptr);
+    ::close(fd);
+    m_clients.erase(fd);
+}
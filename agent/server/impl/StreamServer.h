@@ -0,0 +1,99 @@
+/**
+ * StreamServer.h
+ *
+ * Server-Sent Events stream of ADCS and TFRS telemetry.
+ *
+ * Copyright (c) 2023 Spire Global, Inc.
+ */
+#pragma once
+
+#include <atomic>
+#include <chrono>  // NOLINT(build/c++11)
+#include <cstdint>
+#include <string>
+#include <thread>  // NOLINT(build/c++11)
+#include <unordered_map>
+
+#include "Adcs.h"
+
+#define STREAM_MAX_CLIENTS 32
+/// a client with this much unsent data skips new samples until it catches up
+#define STREAM_MAX_PENDING 65536
+#define STREAM_MAX_REQUEST 4096
+#define STREAM_KEEPALIVE_MS 15000
+/// a client that has not sent its request headers by then is closed
+#define STREAM_HEADER_TIMEOUT_MS 5000
+
+/**
+ * \brief Pushes ADCS and TFRS samples to subscribers as they arrive.
+ *
+ * Subscribers hold a connection open for as long as they want samples,
+ * so they are served by one epoll thread on a port of their own rather
+ * than by the onion worker pool, where each would tie up a worker.
+ *
+ *     GET /sdk/v1/adcs/stream[?rate=hz]
+ *     GET /sdk/v1/tfrs/stream[?rate=hz]
+ *     GET /sdk/v1/stream[?rate=hz]        (both)
+ *
+ * The response is a text/event-stream.  Each event is named for its feed,
+ * carries the message count as its id and the same JSON as
+ * /sdk/v1/adcs or /sdk/v1/tfrs as its data.  A subscriber gets the
+ * current sample straight away, then each new one; with `rate`, at most
+ * that many per second per feed.  Connections that have not sent their
+ * request headers within the header timeout are closed, so that idle
+ * connections cannot hold every client slot.
+ *
+ * The AdcsManager signals an eventfd after each message, and each new
+ * sample is serialized once, shared with the SDK handlers, however many
+ * subscribers there are.
+ */
+class StreamServer {
+ public:
+    /// listen on `port`; 0 picks a free port
+    StreamServer(AdcsManager *mgr, int port,
+                 unsigned header_timeout_ms = STREAM_HEADER_TIMEOUT_MS);
+    StreamServer(const StreamServer&) = delete;
+    StreamServer& operator=(const StreamServer&) = delete;
+    ~StreamServer();
+
+    void start();
+    void stop();
+    int getPort() const { return m_port; }
+
+ private:
+    enum Feed { Adcs, Tfrs, NumFeeds };
+    typedef std::chrono::steady_clock clock;
+
+    struct Client {
+        std::string in;  ///< request, until the headers are complete
+        std::string out;  ///< unsent data
+        unsigned feeds = 0;  ///< bit per Feed; 0 until subscribed
+        bool closing = false;  ///< close once `out` is sent
+        clock::duration interval{0};
+        clock::time_point next[NumFeeds];
+        clock::time_point deadline;  ///< for the request headers
+    };
+
+    AdcsManager *m_mgr;
+    int m_port;
+    const std::chrono::milliseconds m_header_timeout;
+    int m_listen = -1;
+    int m_epoll = -1;
+    int m_event = -1;
+    std::atomic<bool> m_running{false};
+    std::thread m_thread;
+    std::unordered_map<int, Client> m_clients;
+    uint64_t m_version[NumFeeds] = {0, 0};
+    std::string m_frame[NumFeeds];
+
+    void run();
+    void accept();
+    clock::time_point expire(clock::time_point now, clock::time_point until);
+    void read(int fd, Client &c);
+    void subscribe(int fd, Client &c);
+    void refresh(bool force = false);
+    void deliver(Feed feed, int fd, Client &c, clock::time_point now);
+    void send(int fd, Client &c, const std::string &data);
+    void flush(int fd, Client &c);
+    void close(int fd);
+};
@@ -0,0 +1,218 @@
+/**
+ * TelemetryHistory.h
+ *
+ * Fixed-size history of timestamped telemetry messages.
+ *
+ * Copyright (c) 2023 Spire Global, Inc.
+ */
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <thread>  // NOLINT(build/c++11)
+#include <type_traits>
+#include <vector>
+
+/// samples kept per telemetry feed
+#define TELEMETRY_HISTORY_SAMPLES 1024
+
+/**
+ * \brief Ring buffer of the most recent telemetry messages.
+ *
+ * Storage is allocated once, in columns: the sample times are kept apart
+ * from the messages, so a time lookup binary-searches a dense array of
+ * doubles and only the messages that are returned are touched.
+ *
+ * Times must increase; a sample older than the newest one means the clock
+ * was stepped, and the history is dropped rather than left unsorted.  A
+ * sample with the same time as the newest replaces it.
+ *
+ * One thread pushes; any number may query, and neither side ever blocks
+ * the other.  Samples are numbered in the order they're pushed, and each
+ * slot carries a sequence number, odd while the writer is filling it, as
+ * in SeqLock: a reader copies a slot, retries if the sequence number
+ * moved meanwhile, and skips the sample if the slot has been reused for
+ * a later one.  So a query racing the writer may miss the samples that
+ * fall out of the ring while it runs, but never returns a torn one.
+ *
+ * M must be trivially copyable, since readers may copy it while it is
+ * being overwritten and throw the copy away.
+ */
+template <class M>
+class TelemetryHistory {
+    static_assert(std::is_trivially_copyable<M>::value,
+                  "TelemetryHistory messages must be trivially copyable");
+
+ public:
+    struct Entry {
+        double time;  ///< unix epoch seconds
+        M msg;
+    };
+
+    explicit TelemetryHistory(size_t capacity = TELEMETRY_HISTORY_SAMPLES)
+        : m_capacity(std::max<size_t>(capacity, 1)), m_seq(m_capacity), m_index(m_capacity),
+          m_time(m_capacity), m_msg(m_capacity) {}
+    TelemetryHistory(const TelemetryHistory&) = delete;
+    TelemetryHistory& operator=(const TelemetryHistory&) = delete;
+
+    /// must only be called from one thread
+    void push(double time, const M &msg) {
+        uint64_t first = m_first.load(std::memory_order_relaxed);
+        const uint64_t end = m_end.load(std::memory_order_relaxed);
+        if (end > first) {
+            double newest = m_time[slot(end - 1)].load(std::memory_order_relaxed);
+            if (time == newest) {
+                write(end - 1, time, msg);
+                return;
+            } else if (time < newest) {
+                first = end;
+                m_first.store(first, std::memory_order_release);
+            }
+        }
+        if (end - first == m_capacity) {
+            // the oldest is about to be overwritten
+            m_first.store(first + 1, std::memory_order_release);
+        }
+        write(end, time, msg);
+        m_end.store(end + 1, std::memory_order_release);
+    }
+
+    /// samples with start <= time <= end, oldest first
+    std::vector<Entry> range(double start, double end) const {
+        std::vector<Entry> out;
+        if (end < start) {
+            return out;
+        }
+        uint64_t first, last;
+        bounds(&first, &last);
+        Entry e;
+        for (uint64_t i = lower(start, first, last); i < last; i++) {
+            // skip what fell out of the ring, and what a lookup racing
+            // the writer let in early
+            if (!read(i, &e) || e.time < start) {
+                continue;
+            }
+            if (e.time > end) {
+                break;
+            }
+            out.push_back(e);
+        }
+        return out;
+    }
+
+    /**
+     * \brief the samples either side of `time`
+     *
+     * `before` and `after` are the same sample if one matches `time`
+     * exactly, or if `time` is outside the history.
+     * \return false if the history is empty
+     */
+    bool bracket(double time, Entry *before, Entry *after) const {
+        while (true) {
+            uint64_t first, last;
+            bounds(&first, &last);
+            if (first == last) {
+                return false;
+            }
+            uint64_t i = lower(time, first, last);
+            uint64_t b, a;
+            if (i == last) {
+                b = a = last - 1;
+            } else if (i == first || m_time[slot(i)].load(std::memory_order_relaxed) == time) {
+                b = a = i;
+            } else {
+                b = i - 1;
+                a = i;
+            }
+            // if either fell out of the ring meanwhile, look again
+            if (read(b, before) && read(a, after)) {
+                return true;
+            }
+        }
+    }
+
+    size_t size() const {
+        uint64_t first, last;
+        bounds(&first, &last);
+        return last - first;
+    }
+
+ private:
+    const size_t m_capacity;
+    /// number of the oldest sample kept
+    std::atomic<uint64_t> m_first{0};
+    /// number of the next sample to be pushed
+    std::atomic<uint64_t> m_end{0};
+    /// per slot: even when it's complete, odd while it's being written
+    std::vector<std::atomic<uint64_t>> m_seq;
+    /// per slot: the number of the sample it holds
+    std::vector<std::atomic<uint64_t>> m_index;
+    /// atomic so that lookups racing the writer are well defined; a
+    /// time read that way is only a hint until read() confirms it
+    std::vector<std::atomic<double>> m_time;
+    std::vector<M> m_msg;
+
+    /// slot of sample `n`
+    size_t slot(uint64_t n) const {
+        return static_cast<size_t>(n % m_capacity);
+    }
+
+    /// the numbers of the samples kept, [first, last)
+    void bounds(uint64_t *first, uint64_t *last) const {
+        *first = m_first.load(std::memory_order_acquire);
+        *last = m_end.load(std::memory_order_acquire);
+        // the writer may have moved on between the loads
+        if (*last - *first > m_capacity) {
+            *first = *last - m_capacity;
+        }
+    }
+
+    void write(uint64_t n, double time, const M &msg) {
+        const size_t s = slot(n);
+        const uint64_t seq = m_seq[s].load(std::memory_order_relaxed);
+        m_seq[s].store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        m_index[s].store(n, std::memory_order_relaxed);
+        m_time[s].store(time, std::memory_order_relaxed);
+        std::memcpy(static_cast<void*>(&m_msg[s]), &msg, sizeof(M));
+        m_seq[s].store(seq + 2, std::memory_order_release);
+    }
+
+    /// copy sample `n`; false if its slot has been reused
+    bool read(uint64_t n, Entry *out) const {
+        const size_t s = slot(n);
+        uint64_t before, after, index;
+        while (true) {
+            before = m_seq[s].load(std::memory_order_acquire);
+            if (before & 1) {
+                std::this_thread::yield();
+                continue;
+            }
+            index = m_index[s].load(std::memory_order_relaxed);
+            out->time = m_time[s].load(std::memory_order_relaxed);
+            std::memcpy(static_cast<void*>(&out->msg), &m_msg[s], sizeof(M));
+            std::atomic_thread_fence(std::memory_order_acquire);
+            after = m_seq[s].load(std::memory_order_relaxed);
+            if (after == before) {
+                return index == n;
+            }
+        }
+    }
+
+    /// number of the first sample in [first, last) at or after `time`
+    uint64_t lower(double time, uint64_t first, uint64_t last) const {
+        uint64_t lo = first, hi = last;
+        while (lo < hi) {
+            uint64_t mid = lo + (hi - lo) / 2;
+            if (m_time[slot(mid)].load(std::memory_order_relaxed) < time) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        return lo;
+    }
+};
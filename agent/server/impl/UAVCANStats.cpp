@@ -0,0 +1,88 @@
+/**
+ * UAVCANStats.cpp
+ *
+ * UAVCAN transport counters.
+ *
+ * Copyright (c) 2023 Spire Global, Inc.
+ */
+
+#include "UAVCANStats.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <string>
+
+#include <uavcan/build_config.hpp>
+
+using namespace std;
+
+/// broadcast transfer IDs count modulo this
+#define UAVCAN_TRANSFER_ID_MOD 32
+/// payload bytes of a CAN frame, less the tail byte
+#define UAVCAN_FRAME_PAYLOAD 7
+/// bytes of a multi-frame transfer's CRC
+#define UAVCAN_TRANSFER_CRC 2
+
+void MessageRate::add(uint64_t time_us, int src, unsigned transfer_id) {
+    if (m_messages > 0 && time_us >= m_last_us) {
+        int64_t interval = static_cast<int64_t>(time_us - m_last_us);
+        if (m_messages == 1) {
+            m_interval_us = interval;
+        }
+        m_interval_us += (interval - m_interval_us) / 16;
+        m_jitter_us += (llabs(interval - m_interval_us) - m_jitter_us) / 16;
+    }
+    if (src == m_last_src) {
+        m_lost += (transfer_id - m_last_tid - 1) % UAVCAN_TRANSFER_ID_MOD;
+    }
+    m_messages++;
+    m_last_us = time_us;
+    m_last_src = src;
+    m_last_tid = transfer_id;
+}
+
+UAVCANSubscriptionStats MessageRate::stats(const string &name, uint64_t now_us) const {
+    UAVCANSubscriptionStats s;
+    s.name = name;
+    s.messages = m_messages;
+    s.lost = m_lost;
+    s.decode_errors = m_decode_errors;
+    s.interval_us = m_interval_us;
+    s.jitter_us = m_jitter_us;
+    if (m_messages > 0) {
+        int64_t since = now_us > m_last_us ? static_cast<int64_t>(now_us - m_last_us) : 0;
+        s.age_ms = since / 1000;
+        // once the messages stop, the silence so far bounds the rate
+        int64_t period = max(m_interval_us, since);
+        s.rate = period > 0 ? 1e6 / period : 0;
+    }
+    return s;
+}
+
+void UAVCANPoolDemand::addRx(unsigned bytes) {
+    // the receiver's state
+    m_blocks++;
+    if (bytes > UAVCAN_FRAME_PAYLOAD) {
+        // a buffer, and its blocks, each with a list pointer ahead of the data
+        const unsigned per_block = uavcan::MemPoolBlockSize - sizeof(void *);
+        m_blocks += 1 + (bytes + per_block - 1) / per_block;
+    }
+}
+
+void UAVCANPoolDemand::addTx(unsigned bytes) {
+    // the transfer ID kept for the next transfer
+    m_blocks++;
+    uint64_t frames = 1;
+    if (bytes > UAVCAN_FRAME_PAYLOAD) {
+        frames = (bytes + UAVCAN_TRANSFER_CRC + UAVCAN_FRAME_PAYLOAD - 1) / UAVCAN_FRAME_PAYLOAD;
+    }
+    m_tx_frames = max(m_tx_frames, frames);
+}
+
+uint64_t UAVCANPoolDemand::blocks(unsigned ifaces) const {
+    // a queued frame, and its place in the queue
+    const uint64_t queued = 2 * m_tx_frames;
+    // libuavcan limits each interface's queue to capacity / (ifaces + 1) + 1 blocks
+    const uint64_t share = queued > 1 ? (queued - 1) * (ifaces + 1) : 0;
+    return max(m_blocks + queued * ifaces, share);
+}
@@ -0,0 +1,157 @@
+/**
+ * UAVCANStats.h
+ *
+ * UAVCAN transport counters.
+ *
+ * Copyright (c) 2023 Spire Global, Inc.
+ */
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/// counters of one CAN interface
+struct UAVCANIfaceStats {
+    std::string name;
+    uint64_t frames_tx = 0;
+    uint64_t frames_rx = 0;
+    /// frames libuavcan's TX queue rejected (full) or let expire
+    uint64_t tx_rejected = 0;
+    /// frames the kernel dropped because the socket's receive queue was full
+    uint64_t rx_overflows = 0;
+    /// SocketCAN errors, by SocketCanError kind
+    uint64_t read_failures = 0;
+    uint64_t write_failures = 0;
+    uint64_t tx_timeouts = 0;
+};
+
+/// arrivals on one subscription
+struct UAVCANSubscriptionStats {
+    std::string name;
+    uint64_t messages = 0;
+    /// messages missing from the transfer ID sequence; an estimate
+    uint64_t lost = 0;
+    /// transfers that could not be decoded
+    uint64_t decode_errors = 0;
+    /// per second, over the last few messages; falls off once they stop
+    double rate = 0;
+    /// smoothed time between messages, and its mean deviation, in us
+    int64_t interval_us = 0;
+    int64_t jitter_us = 0;
+    /// ms since the last message; -1 if there hasn't been one
+    int64_t age_ms = -1;
+};
+
+/// the node's memory pool, in blocks
+struct UAVCANPoolStats {
+    unsigned block_size = 0;  ///< bytes
+    uint64_t capacity = 0;
+    uint64_t used = 0;
+    /// most blocks in use at once, over every node the agent has brought up
+    uint64_t peak = 0;
+    /// blocks the registered subscriptions and services may need at once; an estimate
+    uint64_t needed = 0;
+};
+
+/// the payload healthcheck's latest result
+struct UAVCANHealthcheckStats {
+    /// whether requests are answered from it, rather than with STALE_RESPONSE_CODE
+    bool fresh = false;
+    /// ms since the run completed; -1 if none has
+    int64_t age_ms = -1;
+    int response_code = 0;
+    int health_state = 0;
+    /// why the command's output was rejected; empty if it wasn't
+    std::string error;
+};
+
+/**
+ * \brief A snapshot of the agent's UAVCAN transport counters.
+ *
+ * Node and interface counters are totals over every node the agent has
+ * brought up, so they keep counting across reconnects.
+ */
+struct UAVCANStats {
+    bool up = false;  ///< whether the node is running
+    uint64_t reconnects = 0;
+    uint64_t transfers_tx = 0;
+    uint64_t transfers_rx = 0;
+    uint64_t transfer_errors = 0;
+    UAVCANPoolStats pool;
+    std::vector<UAVCANIfaceStats> ifaces;
+    std::vector<UAVCANSubscriptionStats> subscriptions;
+    UAVCANHealthcheckStats healthcheck;
+};
+
+/**
+ * \brief Arrival statistics of one subscription, kept from its callback.
+ *
+ * Costs a few integer operations per message.  Interval and jitter are
+ * exponential averages with a gain of 1/16, as RTP computes jitter.
+ * Messages lost are counted from gaps in the 5-bit transfer ID, so a burst
+ * of 32 or more lost at once, or a publisher restarting, is miscounted.
+ */
+class MessageRate {
+    uint64_t m_messages = 0;
+    uint64_t m_lost = 0;
+    uint64_t m_decode_errors = 0;
+    uint64_t m_last_us = 0;
+    int64_t m_interval_us = 0;
+    int64_t m_jitter_us = 0;
+    int m_last_src = -1;
+    unsigned m_last_tid = 0;
+
+ public:
+    /// a message from `src` with `transfer_id`, received at monotonic `time_us`
+    void add(uint64_t time_us, int src, unsigned transfer_id);
+    /// count decoding failures of a subscriber that's going away
+    void addDecodeErrors(uint64_t n) { m_decode_errors += n; }
+    /// counters as of monotonic `now_us`
+    UAVCANSubscriptionStats stats(const std::string &name, uint64_t now_us) const;
+};
+
+/**
+ * \brief What a node's memory pool must hold at once, added up over its
+ * subscriptions, servers and clients.
+ *
+ * Receiving a multi-frame transfer takes a buffer of blocks until it is
+ * complete, and every receiver and sender keeps some bookkeeping.  Sending
+ * a transfer queues all of its frames at once, taking two blocks each, on
+ * every interface; and each interface's queue may only take its share of
+ * the pool.  Sizes are the DSDL maxima, so the estimate errs on the safe
+ * side.
+ */
+class UAVCANPoolDemand {
+    uint64_t m_blocks = 0;
+    uint64_t m_tx_frames = 0;
+
+ public:
+    /// a transfer of up to `bytes` received
+    void addRx(unsigned bytes);
+    /// a transfer of up to `bytes` sent
+    void addTx(unsigned bytes);
+
+    template <typename DataType> void addSubscriber() {
+        addRx(maxBytes<DataType>());
+    }
+    template <typename DataType> void addPublisher() {
+        addTx(maxBytes<DataType>());
+    }
+    template <typename DataType> void addServer() {
+        addRx(maxBytes<typename DataType::Request>());
+        addTx(maxBytes<typename DataType::Response>());
+    }
+    template <typename DataType> void addClient() {
+        addTx(maxBytes<typename DataType::Request>());
+        addRx(maxBytes<typename DataType::Response>());
+    }
+
+    /// pool blocks needed by a node on `ifaces` interfaces
+    uint64_t blocks(unsigned ifaces) const;
+
+ private:
+    template <typename DataType> static unsigned maxBytes() {
+        return (DataType::MaxBitLen + 7) / 8;
+    }
+};
@@ -7,20 +7,25 @@
  */
 
 #include <zlib.h>
+#include <poll.h>
 #include <signal.h>
+#include <spawn.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <sys/statvfs.h>
+#include <sys/syscall.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <cstdio>
+#include <cstring>
 #include <algorithm>
+#include <atomic>
+#include <chrono>  // NOLINT(build/c++11)
 #include <iomanip>
 #include <fstream>
 #include <sstream>
 #include <string>
 #include <system_error>  // NOLINT(build/c++11)
-#include <thread>  // NOLINT(build/c++11)
 #include <vector>
 
 #include "Log.h"
@@ -31,36 +36,108 @@
 
 using namespace std;
 
+namespace {
+
+/**
+ * fill `out` with random bytes from a per-thread buffer, refilled from the
+ * kernel in bulk so that most calls make no system call at all
+ */
+void randomBytes(uint8_t *out, size_t n) {
+    static thread_local uint8_t buf[4096];
+    static thread_local size_t pos = sizeof(buf);
+    while (n > 0) {
+        if (pos == sizeof(buf)) {
+            size_t got = 0;
+            while (got < sizeof(buf)) {
+#ifdef SYS_getrandom
+                ssize_t r = syscall(SYS_getrandom, buf + got, sizeof(buf) - got, 0);
+#else
+                ssize_t r = -1;
+                errno = ENOSYS;
+#endif
+                if (r < 0 && errno == ENOSYS) {
+                    // kernel too old for getrandom
+                    int fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+                    r = fd < 0 ? -1 : read(fd, buf + got, sizeof(buf) - got);
+                    if (fd >= 0) close(fd);
+                }
+                if (r < 0) {
+                    if (errno == EINTR) continue;
+                    throw system_error(errno, generic_category(), "getrandom");
+                }
+                got += r;
+            }
+            pos = 0;
+        }
+        size_t take = min(n, sizeof(buf) - pos);
+        memcpy(out, buf + pos, take);
+        // don't leave used random bytes lying around
+        memset(buf + pos, 0, take);
+        pos += take;
+        out += take;
+        n -= take;
+    }
+}
+
+/// format 16 bytes as 8-4-4-4-12 lowercase hex
+string formatUUID(const uint8_t bytes[16]) {
+    static const char digits[] = "0123456789abcdef";
+    char out[36];
+    char *p = out;
+    for (int i = 0; i < 16; i++) {
+        if (i == 4 || i == 6 || i == 8 || i == 10) {
+            *p++ = '-';
+        }
+        *p++ = digits[bytes[i] >> 4];
+        *p++ = digits[bytes[i] & 0xf];
+    }
+    return string(out, sizeof(out));
+}
+
+}  // namespace
+
+/**
+ * \brief random (version 4) UUID
+ */
 string mkUUID() {
-    char rand_dat[16];
-
-    ifstream urand("/dev/urandom");
-    urand.read(rand_dat, sizeof(rand_dat));
-    urand.close();
-
-    rand_dat[6] = 0x40 | (rand_dat[6] & 0x0F);
-    rand_dat[8] = 0x80 | (rand_dat[8] & 0x3F);
-
-    stringstream uuid;
-    uuid << hex << setfill('0');
-    int i = 0;
-    // time-low
-    for (int c = 0; c < 4; c++, i++) uuid << setw(2) << (0xFF & rand_dat[i]);
-    uuid << '-';
-    // time-mid
-    for (int c = 0; c < 2; c++, i++) uuid << setw(2) << (0xFF & rand_dat[i]);
-    uuid << '-';
-    // time-high-and-version
-    for (int c = 0; c < 2; c++, i++) uuid << setw(2) << (0xFF & rand_dat[i]);
-    uuid << '-';
-    // clock-seq-and-reserved
-    for (int c = 0; c < 1; c++, i++) uuid << setw(2) << (0xFF & rand_dat[i]);
-    // clock-seq-low
-    for (int c = 0; c < 1; c++, i++) uuid << setw(2) << (0xFF & rand_dat[i]);
-    uuid << '-';
-    // node
-    for (int c = 0; c < 6; c++, i++) uuid << setw(2) << (0xFF & rand_dat[i]);
-    return uuid.str();
+    uint8_t bytes[16];
+    randomBytes(bytes, sizeof(bytes));
+    bytes[6] = 0x40 | (bytes[6] & 0x0F);
+    bytes[8] = 0x80 | (bytes[8] & 0x3F);
+    return formatUUID(bytes);
+}
+
+/**
+ * \brief time-ordered (version 7) UUID
+ *
+ * The first 48 bits are the unix time in milliseconds, so ids - and the
+ * transfer file names made from them - sort by creation time.  The 12
+ * bits after the version are a counter within the millisecond, so ids
+ * from this process are strictly increasing even when several are made
+ * in the same millisecond; the remaining 62 bits are random.
+ */
+string mkUUIDv7() {
+    static atomic<uint64_t> last{0};
+    uint64_t now = chrono::duration_cast<chrono::milliseconds>(
+        chrono::system_clock::now().time_since_epoch()).count();
+    // (ms << 12 | counter), always greater than the previous one; a
+    // counter overflow borrows from the next millisecond
+    uint64_t prev = last.load();
+    uint64_t next;
+    do {
+        next = max(now << 12, prev + 1);
+    } while (!last.compare_exchange_weak(prev, next));
+
+    uint8_t bytes[16];
+    uint64_t ms = next >> 12;
+    for (int i = 0; i < 6; i++) {
+        bytes[i] = ms >> (40 - 8 * i);
+    }
+    bytes[6] = 0x70 | ((next >> 8) & 0x0F);
+    bytes[7] = next & 0xFF;
+    randomBytes(bytes + 8, 8);
+    bytes[8] = 0x80 | (bytes[8] & 0x3F);
+    return formatUUID(bytes);
 }
 
 string OSError(const string &prefix) {
@@ -85,6 +162,13 @@ string getCrc(const string &file) {
         crc = crc32(crc, (unsigned char*)c, ifs.gcount());
     } while (ifs.rdstate() == ios::goodbit);
 
+    return crcString(crc);
+}
+
+/**
+ * format a crc32 value the way it is stored in FileInfo
+ */
+string crcString(uint32_t crc) {
     stringstream crcx;
     crcx << hex << setfill('0') << setw(8) << crc;
     return crcx.str();
@@ -142,6 +226,40 @@ string extension(const string &filepath) {
     }
 }
 
+/**
+ * checks that name is a valid topic: one or more ASCII letters, digits,
+ * '-' or '_'.  Equivalent to ^[-_[:alnum:]]+$ without a regex.
+ */
+bool isTopicName(const string &name) {
+    if (name.empty()) {
+        return false;
+    }
+    for (unsigned char c : name) {
+        if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')
+              || c == '-' || c == '_')) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * checks that id looks like a UUID or other hex identifier: one or more
+ * hex digits or '-'.  Equivalent to ^[-[:xdigit:]]+$ without a regex.
+ */
+bool isHexId(const string &id) {
+    if (id.empty()) {
+        return false;
+    }
+    for (unsigned char c : id) {
+        if (!((c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F') || (c >= '0' && c <= '9')
+              || c == '-')) {
+            return false;
+        }
+    }
+    return true;
+}
+
 /**
  * checks if the given string ends with the tail. 
  * 
@@ -191,122 +309,184 @@ string behead(const string &str, const string &head) {
     }
 }
 
-static bool read_into_string(int fd, char chunk[], size_t chunk_size,
-                             size_t max_output_size, string &output) {
-    ssize_t nbytes;
-    do {
-        nbytes = read(fd, chunk, chunk_size);
-        if (nbytes < 0 || output.length() + static_cast<size_t>(nbytes) > max_output_size) {
+namespace {
+
+/// pidfd for `pid`, or -1 if the kernel is too old (before 5.3)
+int pidfdOpen(pid_t pid) {
+#ifdef SYS_pidfd_open
+    return static_cast<int>(syscall(SYS_pidfd_open, pid, 0));
+#else
+    (void) pid;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+/**
+ * \brief read what is available from the child's stdout
+ * \return false once the pipe is done with: at EOF, on error, or when
+ * the output would exceed `max_output_size`
+ */
+bool readAvailable(int fd, size_t max_output_size, string &output, bool *overflow) {
+    char chunk[PROCESS_OUTPUT_CHUNK_SIZE];
+    while (true) {
+        ssize_t nbytes = read(fd, chunk, sizeof(chunk));
+        if (nbytes < 0) {
+            return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+        } else if (nbytes == 0) {
+            return false;
+        } else if (output.length() + static_cast<size_t>(nbytes) > max_output_size) {
+            *overflow = true;
             return false;
         }
         output.append(chunk, nbytes);
-    } while (nbytes > 0);
-    return true;
+    }
 }
 
+/**
+ * \brief the running child of runProcessGetOutput and its fds
+ *
+ * Closes the fds when it goes out of scope, and unless the child has been
+ * reaped, kills its process group and reaps it first, so that an error
+ * while waiting leaves nothing running behind it.
+ */
+class SpawnedChild {
+    pid_t m_pid;
+    int m_pidfd;
+    int m_out;
+
+ public:
+    SpawnedChild(pid_t pid, int pidfd, int out) : m_pid(pid), m_pidfd(pidfd), m_out(out) {}
+    SpawnedChild(const SpawnedChild&) = delete;
+    SpawnedChild& operator=(const SpawnedChild&) = delete;
+    ~SpawnedChild() {
+        if (m_pid > 0) {
+            kill(-m_pid, SIGKILL);
+            while (waitpid(m_pid, nullptr, 0) < 0 && errno == EINTR) {}
+        }
+        if (m_pidfd >= 0) {
+            close(m_pidfd);
+        }
+        close(m_out);
+    }
+
+    void reaped() { m_pid = -1; }
+};
+
+}  // namespace
+
 /**
  * Runs a child process and returns its stdout output
  * The child will be killed if it doesn't exit after timeout seconds, or if it
  * outputs more than max_output_size bytes, in which case the output string is not guaranteed
  * to hold the complete output.
  *
- * Returns the process exit code.
+ * The child is started with posix_spawn, which does not copy the agent's
+ * page tables, in a process group of its own so that anything it starts
+ * is killed with it.  The calling thread waits on the stdout pipe and on a
+ * pidfd for the child's exit in one poll, against a monotonic deadline;
+ * on kernels without pidfds it checks for the exit between short polls.
+ * No signals are involved, so any thread may call this whatever its
+ * signal mask.
+ *
+ * Returns the process exit code, or 127 if it could not be started.
+ * Throws system_error if the child can't be waited for, once the child's
+ * process group has been killed and the child reaped.
  *
  */
 int runProcessGetOutput(const string &cmd, const char *const argv[], size_t max_output_size,
                         uint32_t timeout_seconds, string &output) {
     int link[2];
-    pid_t pid;
-    char chunk[PROCESS_OUTPUT_CHUNK_SIZE];
-    sigset_t mask;
-    sigset_t orig_mask;
-    struct timespec timeout;
-    size_t total_output_size = 0;
-
-    // The pipe / fork / exec combo was adapted from https://stackoverflow.com/a/7292659
-    // We could just use system() but this should be a bit less insecure.
-    // We also adapt the sigtimedwait example from https://stackoverflow.com/a/20173592 but doing
-    // the sigtimedwait in a separate thread.
-
-    timeout.tv_sec = timeout_seconds;
-    timeout.tv_nsec = 0;
-
-    sigemptyset(&mask);
-    sigaddset(&mask, SIGCHLD);
-
-    // NB: in normal operation we are in a thread; however in unit test we
-    // are in the main process.  Using sigprocmask here is "unspecified" if
-    // we are in a thread, but if the main thread has its mask set correctly
-    // then we inherit it here.
-    // Thus, for the signal handling to work properly SIGCHLD *must* be
-    // blocked at startup in the main thread.
-    if (pthread_sigmask(SIG_BLOCK, &mask, &orig_mask) < 0) {
-        throw system_error(errno, generic_category(), "pthread_sigmask");
-    }
-
-    if (pipe(link) == -1) {
+    if (pipe2(link, O_CLOEXEC) == -1) {
         throw system_error(errno, generic_category(), "creating pipe");
     }
 
-    pid = fork();
-    if (pid == -1) {
-        throw system_error(errno, generic_category(), "forking");
-    } else if (pid == 0) {
-        // Child
-        dup2(link[1], STDOUT_FILENO);
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, link[1], STDOUT_FILENO);
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    sigset_t none;
+    sigemptyset(&none);
+    posix_spawnattr_setsigmask(&attr, &none);
+    posix_spawnattr_setpgroup(&attr, 0);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETPGROUP);
+
+    pid_t pid;
+    int err = posix_spawn(&pid, cmd.c_str(), &actions, &attr,
+                          const_cast<char *const *>(argv), environ);
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    close(link[1]);
+    if (err != 0) {
         close(link[0]);
-        close(link[1]);
-        try {
-            execv(cmd.c_str(), (char* const*) argv);
+        Log::error("Unable to spawn ?: ?", cmd, strerror(err));
+        return RUN_ERROR_STATUS;
+    }
+    fcntl(link[0], F_SETFL, O_NONBLOCK);
+    int pidfd = pidfdOpen(pid);
+    SpawnedChild child(pid, pidfd, link[0]);
+
+    auto deadline = chrono::steady_clock::now() + chrono::seconds(timeout_seconds);
+    bool reading = true;
+    bool overflow = false;
+    bool killed = false;
+    int status = 0;
+    while (true) {
+        pid_t exited = waitpid(pid, &status, WNOHANG);
+        if (exited == pid) {
+            child.reaped();
+            break;
+        } else if (exited < 0 && errno != EINTR) {
+            throw system_error(errno, generic_category(), "waiting for " + cmd);
         }
-        catch (...) {
-            Log::error("Unable to execv ?", cmd);
-            exit(RUN_ERROR_STATUS);
+        if (!killed && (overflow || chrono::steady_clock::now() >= deadline)) {
+            if (!overflow) {
+                Log::info("Child process timeout");
+            }
+            kill(-pid, SIGKILL);
+            killed = true;
         }
-        Log::error("Unable to execv ?", cmd);
-        exit(RUN_ERROR_STATUS);
-    } else {
-        // Parent
-        close(link[1]);
-        thread timeout_signal([&]() {
-            do {
-                if (sigtimedwait(&mask, NULL, &timeout) < 0) {
-                    if (errno == EINTR) {
-                        // Interrupted by a signal other than SIGCHLD.
-                        continue;
-                    } else if (errno == EAGAIN) {
-                        Log::info("Child process timeout");
-                        kill(pid, SIGKILL);
-                        continue;
-                    } else {
-                        throw system_error(errno, generic_category(), "sigtimedwait");
-                    }
-                } else {
-                    break;
-                }
-            } while (1);
-        });
-
-        int status;
-        if (!read_into_string(link[0], chunk, sizeof(chunk),
-                             max_output_size, output)) {
-            kill(pid, SIGKILL);
+        struct pollfd fds[2];
+        nfds_t nfds = 0;
+        if (reading) {
+            fds[nfds++] = {link[0], POLLIN, 0};
         }
+        if (pidfd >= 0) {
+            fds[nfds++] = {pidfd, POLLIN, 0};
+        }
+        // the deadline may have passed since it was checked; poll then
+        // returns straight away and the next pass kills the child
+        int wait_ms = max(0, static_cast<int>(chrono::duration_cast<chrono::milliseconds>(
+            deadline - chrono::steady_clock::now()).count()) + 1);
+        if (killed) {
+            wait_ms = -1;
+        }
+        if (pidfd < 0) {
+            wait_ms = wait_ms < 0 ? 10 : min(wait_ms, 10);
+        }
+        if (poll(fds, nfds, wait_ms) < 0 && errno != EINTR) {
+            throw system_error(errno, generic_category(), "poll");
+        }
+        if (reading && fds[0].revents != 0) {
+            reading = readAvailable(link[0], max_output_size, output, &overflow);
+        }
+    }
+    // whatever the child wrote before it exited; anything it left running
+    // may still hold the pipe open, so don't wait for EOF
+    if (reading) {
+        readAvailable(link[0], max_output_size, output, &overflow);
+    }
 
-        timeout_signal.join();
-        waitpid(pid, &status, 0);
-
-        Log::debug("Child process output: ?", output);
-        Log::debug("Child process status ?", status);
-        close(link[0]);
+    Log::debug("Child process output: ?", output);
+    Log::debug("Child process status ?", status);
 
-        if (WIFSIGNALED(status)) {
-            status = 128 + WTERMSIG(status);
-        } else {
-            status = WEXITSTATUS(status);
-        }
-        return status;
+    if (WIFSIGNALED(status)) {
+        status = 128 + WTERMSIG(status);
+    } else {
+        status = WEXITSTATUS(status);
     }
+    return status;
 }
 
 Semaphore::Semaphore(int n) {
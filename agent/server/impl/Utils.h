@@ -16,6 +16,7 @@
 #include "onion/onion.hpp"
 #include "onion/response.hpp"
 #include "ErrorResponse.h"
+#include "JsonStream.h"
 
 using namespace org::openapitools::server::model;
 
@@ -23,6 +24,8 @@ using namespace org::openapitools::server::model;
 enum class Code {
     Ok = HTTP_OK,
     Bad_Request = HTTP_BAD_REQUEST,
+    Too_Many_Requests = 429,
+    Service_Unavailable = 503,  // onion 0.8 misspells HTTP_SERVICE_UNAVALIABLE
 };
 
 template <class T>
@@ -46,6 +49,17 @@ void from_jsonfile(F &stream, T &obj) {
     from_json(j, obj);
 }
 
+template <class T>
+onion_connection_status deliverError(Onion::Response &rstream, ResponseCode<T> &response) {
+    response.err.setStatus(static_cast<int>(response.code));
+    rstream.setCode(static_cast<int>(response.code));
+    if (response.err.retryAfterIsSet()) {
+        rstream.setHeader("Retry-After", std::to_string(response.err.getRetryAfter()));
+    }
+    rstream << to_jsonstr(response.err);
+    return OCS_PROCESSED;
+}
+
 template <class T>
 onion_connection_status deliverResponse(Onion::Response &rstream, ResponseCode<T> &response) {
     switch (response.code) {
@@ -53,11 +67,24 @@ onion_connection_status deliverResponse(Onion::Response &rstream, ResponseCode<T
             rstream << to_jsonstr(response.result);
             break;
         default:
-            response.err.setStatus(static_cast<int>(response.code));
-            rstream.setCode(static_cast<int>(response.code));
-            rstream << to_jsonstr(response.err);
-            break;
+            return deliverError(rstream, response);
+    }
+    return OCS_PROCESSED;
+}
+
+/**
+ * @brief deliver a response by writing it straight into the response
+ * stream with `writer(JsonStream&, const T&)`, for results that are too
+ * large to build as a json tree first.  Errors are delivered as usual.
+ */
+template <class T, class W>
+onion_connection_status deliverStreamed(Onion::Response &rstream, ResponseCode<T> &response,
+                                        W writer) {
+    if (response.code != Code::Ok) {
+        return deliverError(rstream, response);
     }
+    JsonStream js(rstream);
+    writer(js, response.result);
     return OCS_PROCESSED;
 }
 
@@ -129,12 +156,18 @@ class sync_ofstream : public std::ofstream {
 };
 
 std::string mkUUID();
+std::string mkUUIDv7();
 std::string OSError(const std::string &prefix = "");
 std::string getCrc(const std::string &file);
+std::string crcString(uint32_t crc);
 std::string tailname(const std::string &filepath);
 std::string dirname(const std::string &filepath);
 std::string rootname(const std::string &filepath);
 std::string extension(const std::string &filepath);
+// [-_[:alnum:]]+
+bool isTopicName(const std::string &name);
+// [-[:xdigit:]]+
+bool isHexId(const std::string &id);
 bool ends_with(const std::string &str, const std::string &tail);
 std::string chop(const std::string &str, const std::string &tail);
 bool starts_with(const std::string &str, const std::string &head);
@@ -0,0 +1,239 @@
+/**
+ * VirtualCan.cpp
+ *
+ * An in-memory CAN bus for running UAVCAN nodes in one process.
+ *
+ * Copyright (c) 2023 Spire Global, Inc.
+ */
+
+#include <sys/time.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>  // NOLINT(build/c++11)
+#include <system_error>  // NOLINT(build/c++11)
+
+#include "VirtualCan.h"
+
+using namespace std;
+
+namespace {
+
+/// CLOCK_MONOTONIC in us, the clock libuavcan's deadlines are in
+uint64_t monotonicUs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+uint64_t utcUs() {
+    struct timeval tv;
+    gettimeofday(&tv, nullptr);
+    return static_cast<uint64_t>(tv.tv_sec) * 1000000 + tv.tv_usec;
+}
+
+/// bits on the wire for `frame`, leaving out stuff bits
+unsigned frameBits(const uavcan::CanFrame &frame) {
+    // SOF, arbitration, control, CRC, ACK, EOF and interframe space
+    return (frame.isExtended() ? 67 : 47) + 8 * frame.dlc;
+}
+
+}  // namespace
+
+VirtualCanBus::VirtualCanBus(const VirtualCanConfig &config)
+    : m_config(config), m_random(config.seed), m_lost(config.loss) {
+}
+
+shared_ptr<VirtualCanDriver> VirtualCanBus::connect() {
+    shared_ptr<VirtualCanDriver> driver(new VirtualCanDriver(*this));
+    const lock_guard<mutex> guard{m_lock};
+    m_drivers.push_back(driver.get());
+    return driver;
+}
+
+void VirtualCanBus::disconnect(VirtualCanDriver *driver) {
+    const lock_guard<mutex> guard{m_lock};
+    m_drivers.erase(remove(m_drivers.begin(), m_drivers.end(), driver), m_drivers.end());
+}
+
+uint64_t VirtualCanBus::getFramesSent() {
+    const lock_guard<mutex> guard{m_lock};
+    return m_sent;
+}
+
+uint64_t VirtualCanBus::getFramesLost() {
+    const lock_guard<mutex> guard{m_lock};
+    return m_dropped;
+}
+
+uint64_t VirtualCanBus::transmit(VirtualCanDriver *from, const uavcan::CanFrame &frame,
+                                 uavcan::CanIOFlags flags, uint64_t now) {
+    uint64_t end = max(now, m_busy_until);
+    if (m_config.bitrate > 0) {
+        end += (frameBits(frame) * 1000000ULL + m_config.bitrate - 1) / m_config.bitrate;
+    }
+    m_busy_until = end;
+    m_sent++;
+    for (auto driver : m_drivers) {
+        if (driver == from) {
+            if (flags & uavcan::CanIOFlagLoopback) {
+                driver->queue(VirtualCanDriver::Rx{end, frame, flags});
+            }
+        } else if (m_config.loss > 0 && m_lost(m_random)) {
+            m_dropped++;
+        } else {
+            driver->queue(VirtualCanDriver::Rx{end + m_config.latency_us, frame, 0});
+        }
+    }
+    m_changed.notify_all();
+    return end;
+}
+
+VirtualCanDriver::VirtualCanDriver(VirtualCanBus &bus) : m_bus(bus) {
+    m_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (m_timer_fd < 0) {
+        throw system_error(errno, generic_category(), "virtual can timer");
+    }
+}
+
+VirtualCanDriver::~VirtualCanDriver() {
+    m_bus.disconnect(this);
+    ::close(m_timer_fd);
+}
+
+/**
+ * \brief add a frame for receipt, after any that are received before it;
+ * with the bus lock held
+ */
+void VirtualCanDriver::queue(const Rx &rx) {
+    auto it = m_rx.end();
+    while (it != m_rx.begin() && prev(it)->at > rx.at) {
+        --it;
+    }
+    m_rx.insert(it, rx);
+    rearm();
+}
+
+bool VirtualCanDriver::rxReady(uint64_t now) const {
+    return !m_rx.empty() && m_rx.front().at <= now;
+}
+
+/**
+ * \brief empty the mailboxes of frames sent by `now`
+ * \return whether one is free
+ */
+bool VirtualCanDriver::txReady(uint64_t now) {
+    while (!m_tx.empty() && m_tx.front() <= now) {
+        m_tx.pop_front();
+    }
+    return m_tx.size() < max(m_bus.m_config.mailboxes, 1u);
+}
+
+/**
+ * \brief set the timer for the next frame due, or for a mailbox coming free
+ * if a frame is waiting for one; with the bus lock held.  Setting it also
+ * clears an expiry already read by the event loop.
+ */
+void VirtualCanDriver::rearm() {
+    uint64_t at = m_rx.empty() ? 0 : m_rx.front().at;
+    if (m_tx_waiting && !m_tx.empty() && (at == 0 || m_tx.front() < at)) {
+        at = m_tx.front();
+    }
+    struct itimerspec its = {};
+    if (at != 0) {
+        at = max<uint64_t>(at, 1);
+        its.it_value.tv_sec = at / 1000000;
+        its.it_value.tv_nsec = (at % 1000000) * 1000;
+    }
+    timerfd_settime(m_timer_fd, TFD_TIMER_ABSTIME, &its, nullptr);
+}
+
+int16_t VirtualCanDriver::send(const uavcan::CanFrame &frame, uavcan::MonotonicTime tx_deadline,
+                               uavcan::CanIOFlags flags) {
+    const lock_guard<mutex> guard{m_bus.m_lock};
+    uint64_t now = monotonicUs();
+    if (!txReady(now)) {
+        return 0;
+    }
+    if (!tx_deadline.isZero() && tx_deadline.toUSec() < now) {
+        m_errors++;
+        return 1;  // dropped, as a controller would abort it
+    }
+    m_tx.push_back(m_bus.transmit(this, frame, flags, now));
+    return 1;
+}
+
+int16_t VirtualCanDriver::receive(uavcan::CanFrame &out_frame,
+                                  uavcan::MonotonicTime &out_ts_monotonic,
+                                  uavcan::UtcTime &out_ts_utc, uavcan::CanIOFlags &out_flags) {
+    const lock_guard<mutex> guard{m_bus.m_lock};
+    uint64_t now = monotonicUs();
+    if (!rxReady(now)) {
+        return 0;
+    }
+    const Rx &rx = m_rx.front();
+    out_frame = rx.frame;
+    out_flags = rx.flags;
+    out_ts_monotonic = uavcan::MonotonicTime::fromUSec(rx.at);
+    out_ts_utc = uavcan::UtcTime::fromUSec(utcUs() - (now - rx.at));
+    m_rx.pop_front();
+    rearm();
+    return 1;
+}
+
+int16_t VirtualCanDriver::configureFilters(const uavcan::CanFilterConfig *filter_configs,
+                                           uint16_t num_configs) {
+    (void) filter_configs;
+    (void) num_configs;
+    return 0;
+}
+
+uint64_t VirtualCanDriver::getErrorCount() const {
+    const lock_guard<mutex> guard{m_bus.m_lock};
+    return m_errors;
+}
+
+uavcan::ICanIface *VirtualCanDriver::getIface(uint8_t iface_index) {
+    return iface_index == 0 ? this : nullptr;
+}
+
+int16_t VirtualCanDriver::select(uavcan::CanSelectMasks &inout_masks,
+                                 const uavcan::CanFrame* (&pending_tx)[uavcan::MaxCanIfaces],
+                                 uavcan::MonotonicTime blocking_deadline) {
+    (void) pending_tx;
+    const bool want_read = (inout_masks.read & 1) != 0;
+    const bool want_write = (inout_masks.write & 1) != 0;
+    const auto deadline = chrono::steady_clock::time_point(
+        chrono::microseconds(blocking_deadline.toUSec()));
+
+    unique_lock<mutex> guard{m_bus.m_lock};
+    uint64_t now = monotonicUs();
+    bool readable = want_read && rxReady(now);
+    bool writable = txReady(now);
+    while (!readable && !(want_write && writable) && now < blocking_deadline.toUSec()) {
+        // sleep until the next frame is due, a mailbox comes free, or the deadline
+        auto until = deadline;
+        if (want_read && !m_rx.empty()) {
+            until = min(until, chrono::steady_clock::time_point(
+                chrono::microseconds(m_rx.front().at)));
+        }
+        if (want_write) {
+            until = min(until, chrono::steady_clock::time_point(
+                chrono::microseconds(m_tx.front())));
+        }
+        m_bus.m_changed.wait_until(guard, until);
+        now = monotonicUs();
+        readable = want_read && rxReady(now);
+        writable = txReady(now);
+    }
+
+    m_tx_waiting = want_write && !writable;
+    rearm();
+    inout_masks = uavcan::CanSelectMasks();
+    inout_masks.read = readable ? 1 : 0;
+    inout_masks.write = writable ? 1 : 0;
+    return readable || writable ? 1 : 0;
+}
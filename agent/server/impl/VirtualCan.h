@@ -0,0 +1,141 @@
+/**
+ * VirtualCan.h
+ *
+ * An in-memory CAN bus for running UAVCAN nodes in one process.
+ *
+ * Copyright (c) 2023 Spire Global, Inc.
+ */
+#pragma once
+
+#include <condition_variable>  // NOLINT(build/c++11)
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>  // NOLINT(build/c++11)
+#include <random>
+#include <vector>
+
+#include <uavcan/driver/can.hpp>
+
+class VirtualCanDriver;
+
+/**
+ * \brief bus settings
+ */
+struct VirtualCanConfig {
+    uint32_t bitrate = 1000000;  ///< bits per second; 0 for no time on the wire
+    uint32_t latency_us = 0;  ///< added between a frame leaving the wire and its receipt
+    double loss = 0;  ///< chance each receiver misses each frame
+    unsigned mailboxes = 3;  ///< frames a driver can have waiting for the wire; at least 1
+    uint32_t seed = 1;  ///< for the losses, so that a run can be repeated
+};
+
+/**
+ * \brief An in-memory CAN bus
+ *
+ * Every driver connected to the bus receives the frames the others send,
+ * and its own back when asked for loopback.  The bus is one wire: a frame
+ * occupies it for as long as its bits take at the configured bitrate
+ * (without stuffing).  Like a CAN controller, each driver takes a few
+ * frames into mailboxes while the wire is busy, and no more until they're
+ * sent, so a bus driven too hard queues frames in the senders as a real
+ * one would.  Arbitration isn't modelled; frames go on the wire in the
+ * order they're sent.
+ *
+ * Drivers may be used from different threads.  The bus must outlive them.
+ */
+class VirtualCanBus {
+    friend class VirtualCanDriver;
+
+    const VirtualCanConfig m_config;
+    /// protects everything below, and every driver's queues
+    std::mutex m_lock;
+    /// signalled when a frame is sent
+    std::condition_variable m_changed;
+    std::vector<VirtualCanDriver *> m_drivers;
+    /// CLOCK_MONOTONIC time in us that the last frame leaves the wire
+    uint64_t m_busy_until = 0;
+    std::mt19937 m_random;
+    std::bernoulli_distribution m_lost;
+    uint64_t m_sent = 0;
+    uint64_t m_dropped = 0;
+
+    /// put `frame` on the wire as soon as it's free after `now`, and queue it
+    /// for the receivers
+    /// \return when it has been sent
+    uint64_t transmit(VirtualCanDriver *from, const uavcan::CanFrame &frame,
+                      uavcan::CanIOFlags flags, uint64_t now);
+    void disconnect(VirtualCanDriver *driver);
+
+ public:
+    explicit VirtualCanBus(const VirtualCanConfig &config = VirtualCanConfig());
+    VirtualCanBus(const VirtualCanBus&) = delete;
+    VirtualCanBus& operator=(const VirtualCanBus&) = delete;
+
+    /// a new driver on the bus, for one node
+    std::shared_ptr<VirtualCanDriver> connect();
+
+    /// frames put on the wire
+    uint64_t getFramesSent();
+    /// frames a receiver missed
+    uint64_t getFramesLost();
+};
+
+/**
+ * \brief A driver with one interface on a VirtualCanBus
+ *
+ * getFileDescriptor() gives a timerfd that's readable whenever a frame is
+ * due to be received, or a mailbox has come free for a frame waiting to be
+ * sent, so that an event loop can wait on it as on a CAN socket.
+ */
+class VirtualCanDriver : public uavcan::ICanDriver, public uavcan::ICanIface {
+    friend class VirtualCanBus;
+
+    struct Rx {
+        uint64_t at;  ///< CLOCK_MONOTONIC time in us it is received
+        uavcan::CanFrame frame;
+        uavcan::CanIOFlags flags;
+    };
+
+    VirtualCanBus &m_bus;
+    /// in order of receipt; under the bus lock
+    std::deque<Rx> m_rx;
+    /// when each frame in the mailboxes is sent, in order; under the bus lock
+    std::deque<uint64_t> m_tx;
+    /// whether the node has a frame waiting for a mailbox
+    bool m_tx_waiting = false;
+    uint64_t m_errors = 0;
+    int m_timer_fd = -1;
+
+    explicit VirtualCanDriver(VirtualCanBus &bus);
+    void queue(const Rx &rx);
+    bool rxReady(uint64_t now) const;
+    bool txReady(uint64_t now);
+    void rearm();
+
+ public:
+    ~VirtualCanDriver();
+    VirtualCanDriver(const VirtualCanDriver&) = delete;
+    VirtualCanDriver& operator=(const VirtualCanDriver&) = delete;
+
+    int getFileDescriptor() const { return m_timer_fd; }
+
+    // ICanIface
+    int16_t send(const uavcan::CanFrame &frame, uavcan::MonotonicTime tx_deadline,
+                 uavcan::CanIOFlags flags) override;
+    int16_t receive(uavcan::CanFrame &out_frame, uavcan::MonotonicTime &out_ts_monotonic,
+                    uavcan::UtcTime &out_ts_utc, uavcan::CanIOFlags &out_flags) override;
+    /// every frame is accepted
+    int16_t configureFilters(const uavcan::CanFilterConfig *filter_configs,
+                             uint16_t num_configs) override;
+    uint16_t getNumFilters() const override { return 0; }
+    /// frames dropped for missing their deadline
+    uint64_t getErrorCount() const override;
+
+    // ICanDriver
+    uavcan::ICanIface *getIface(uint8_t iface_index) override;
+    uint8_t getNumIfaces() const override { return 1; }
+    int16_t select(uavcan::CanSelectMasks &inout_masks,
+                   const uavcan::CanFrame* (&pending_tx)[uavcan::MaxCanIfaces],
+                   uavcan::MonotonicTime blocking_deadline) override;
+};
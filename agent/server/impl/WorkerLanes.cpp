@@ -0,0 +1,103 @@
+/**
+ * WorkerLanes.cpp
+ *
+ * Admission control for HTTP worker threads.
+ *
+ * Copyright (c) 2023 Spire Global, Inc.
+ */
+
+#include "WorkerLanes.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "Log.h"
+
+using namespace std;
+
+WorkerLanes::Slot::Slot(Slot &&other) : m_lanes(other.m_lanes), m_lane(other.m_lane) {
+    other.m_lanes = nullptr;
+}
+
+WorkerLanes::Slot& WorkerLanes::Slot::operator=(Slot &&other) {
+    if (this != &other) {
+        release();
+        m_lanes = other.m_lanes;
+        m_lane = other.m_lane;
+        other.m_lanes = nullptr;
+    }
+    return *this;
+}
+
+WorkerLanes::Slot::~Slot() {
+    release();
+}
+
+void WorkerLanes::Slot::release() {
+    if (m_lanes != nullptr) {
+        m_lanes->leave(m_lane);
+        m_lanes = nullptr;
+    }
+}
+
+WorkerLanes::WorkerLanes(int threads, int reserved, int collector_max) {
+    if (threads < 1 || reserved < 0 || reserved >= threads) {
+        throw invalid_argument("worker lanes need at least one non-reserved thread");
+    }
+    m_bulk_limit = threads - reserved;
+    m_limit[Realtime] = threads;
+    m_limit[Sdk] = m_bulk_limit;
+    m_limit[Collector] = m_bulk_limit;
+    if (collector_max > 0) {
+        m_limit[Collector] = min(collector_max, m_bulk_limit);
+    }
+    Log::info("worker lanes: ? threads, ? bulk, ? collector",
+              threads, m_bulk_limit, m_limit[Collector]);
+}
+
+/**
+ * \brief try to admit a request to a lane
+ *
+ * Never blocks.  Returns an empty slot if the lane or the bulk pool
+ * is full.
+ */
+WorkerLanes::Slot WorkerLanes::enter(Lane lane) {
+    if (lane == Realtime) {
+        return Slot(this, lane);
+    }
+    const lock_guard<mutex> guard{m_lock};
+    if (m_bulk_active >= m_bulk_limit || m_active[lane] >= m_limit[lane]) {
+        m_rejected[lane]++;
+        return Slot();
+    }
+    m_bulk_active++;
+    m_active[lane]++;
+    return Slot(this, lane);
+}
+
+bool WorkerLanes::admits(Lane lane) {
+    if (lane == Realtime) {
+        return true;
+    }
+    const lock_guard<mutex> guard{m_lock};
+    return m_bulk_active < m_bulk_limit && m_active[lane] < m_limit[lane];
+}
+
+void WorkerLanes::leave(Lane lane) {
+    if (lane == Realtime) {
+        return;
+    }
+    const lock_guard<mutex> guard{m_lock};
+    m_bulk_active--;
+    m_active[lane]--;
+}
+
+int WorkerLanes::active(Lane lane) {
+    const lock_guard<mutex> guard{m_lock};
+    return m_active[lane];
+}
+
+int WorkerLanes::rejected(Lane lane) {
+    const lock_guard<mutex> guard{m_lock};
+    return m_rejected[lane];
+}
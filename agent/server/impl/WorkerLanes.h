@@ -0,0 +1,86 @@
+/**
+ * WorkerLanes.h
+ *
+ * Admission control for HTTP worker threads.
+ *
+ * Copyright (c) 2023 Spire Global, Inc.
+ */
+#pragma once
+
+#include <mutex>  // NOLINT(build/c++11)
+
+/**
+ * \brief Divides the HTTP worker pool into admission lanes.
+ *
+ * onion serves every route from one thread pool, so a handful of slow
+ * collector listings or file transfers can occupy every worker and
+ * delay the ADCS and TFRS reads that local payloads poll.  Instead of
+ * running separate pools, bulk requests must enter a lane before being
+ * processed: the bulk lanes together may occupy at most
+ * `threads - reserved` workers, which leaves `reserved` workers free
+ * for the realtime routes, which are never gated.  The collector lane can
+ * additionally be capped so that it cannot crowd out SDK file
+ * operations.
+ *
+ * A request that cannot enter its lane is rejected immediately rather
+ * than queued, so the worker is returned to the pool right away.
+ */
+class WorkerLanes {
+ public:
+    enum Lane {
+        Realtime,   ///< adcs, tfrs; always admitted
+        Sdk,        ///< SDK file operations, adcs and tfrs history
+        Collector,  ///< collector requests
+        NumLanes
+    };
+
+    /**
+     * \brief RAII handle for an admitted request.
+     *
+     * An empty slot (request was not admitted) evaluates to false.
+     */
+    class Slot {
+        WorkerLanes *m_lanes = nullptr;
+        Lane m_lane = Realtime;
+
+     public:
+        Slot() = default;
+        Slot(WorkerLanes *lanes, Lane lane) : m_lanes(lanes), m_lane(lane) {}
+        Slot(const Slot&) = delete;
+        Slot& operator=(const Slot&) = delete;
+        Slot(Slot &&other);
+        Slot& operator=(Slot &&other);
+        ~Slot();
+
+        void release();
+        explicit operator bool() const { return m_lanes != nullptr; }
+    };
+
+    /**
+     * \param threads total number of worker threads
+     * \param reserved workers kept free for realtime requests
+     * \param collector_max cap on the collector lane; 0 for no extra cap
+     */
+    WorkerLanes(int threads, int reserved, int collector_max = 0);
+    WorkerLanes(const WorkerLanes&) = delete;
+    WorkerLanes& operator=(const WorkerLanes&) = delete;
+
+    Slot enter(Lane lane);
+    /// whether \ref enter would admit a request now; neither enters nor
+    /// counts a rejection
+    bool admits(Lane lane);
+    int active(Lane lane);
+    int rejected(Lane lane);
+    int bulkLimit() const { return m_bulk_limit; }
+    int limit(Lane lane) const { return m_limit[lane]; }
+
+ private:
+    std::mutex m_lock;
+    int m_bulk_limit;
+    int m_bulk_active = 0;
+    int m_limit[NumLanes];
+    int m_active[NumLanes] = {};
+    int m_rejected[NumLanes] = {};
+
+    void leave(Lane lane);
+};
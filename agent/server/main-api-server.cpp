@@ -20,10 +20,15 @@
 #include "Config.h"
 #include "CollectorApiImpl.h"
 #include "SdkApiImpl.h"
+#include "UploadGate.h"
 #include "Log.h"
 #include "OnionLog.h"
 #include "AgentUAVCANServer.h"
 #include "AgentUAVCANClient.h"
+#include "AgentUAVCANNode.h"
+#include "CanCapture.h"
+#include "StreamServer.h"
+#include "WorkerLanes.h"
 #include "version.h"  // NOLINT
 
 extern const char VERSION[] = "@(#) Release: " RELEASE_VERSION " Build: " BUILD_VERSION;
@@ -70,15 +75,18 @@ static void setUpUnixSignals(std::vector<int> quitSignals, std::vector<int> bloc
 
 int main(int argc, char * const argv[]) {
 #ifdef __linux__
-    setUpUnixSignals({SIGQUIT, SIGINT, SIGTERM, SIGHUP}, {SIGCHLD});
+    setUpUnixSignals({SIGQUIT, SIGINT, SIGTERM, SIGHUP}, {});
 #endif
 
     // set onion library to use our logger
     onion_log = agent_onion_log;
 
     AgentConfig config;
+    AgentUAVCANNode *can_node = nullptr;
+    CanCaptureWriter *can_capture = nullptr;
     AgentUAVCANServer *can_server = nullptr;
     AgentUAVCANClient *can_client = nullptr;
+    StreamServer *stream_server = nullptr;
 
     if (!config.parseOptions(argc, argv)) {
         config.usage(argv[0]);
@@ -90,36 +98,74 @@ int main(int argc, char * const argv[]) {
     Log::info("Workdir = ?",  agent.getWorkdir());
     Log::info("starting up");
 
+    if (config.isCANInterfaceEnabled() && !config.getCANCapture().empty()) {
+        try {
+            can_capture = new CanCaptureWriter(config.getCANCapture());
+        }
+        catch (const std::system_error &e) {
+            Log::error("Fatal error opening CAN capture: ?", e.what());
+            exit(1);
+        }
+        Log::info("Recording received CAN frames to ?", config.getCANCapture());
+    }
+
     if (config.isCANInterfaceEnabled()) {
         try {
+            can_node = new AgentUAVCANNode(config.getCANInterface(), config.getUAVCANNodeID(),
+                                           config.getUAVCANPoolSize());
+            can_node->setCapture(can_capture);
+
             Log::info("Initializing UAVCAN client");
-            can_client = new AgentUAVCANClient(config);
+            can_client = new AgentUAVCANClient(config, *can_node);
             agent.setUavClient(can_client);
 
             Log::info("Starting UAVCAN server");
-            can_server = new AgentUAVCANServer(config.getCANInterface(), config.getUAVCANNodeID());
+            can_server = new AgentUAVCANServer(*can_node);
+            can_server->setHealthcheckFreshness(config.getHealthcheckFreshness());
             can_server->start();
             agent.setAdcsMgr(&can_server->m_mgr);
+            agent.setUavNode(can_node);
+
+            can_node->start();
         }
         catch (uavcan_linux::Exception e) {
             Log::error("Fatal error starting can: ?", e.what());
             if (can_server != nullptr) delete can_server;
             if (can_client != nullptr) delete can_client;
+            if (can_node != nullptr) delete can_node;
+            if (can_capture != nullptr) delete can_capture;
+            exit(1);
+        }
+    }
+
+    if (can_server != nullptr && config.getStreamPort() > 0) {
+        try {
+            stream_server = new StreamServer(&can_server->m_mgr, config.getStreamPort());
+            stream_server->start();
+        }
+        catch (const std::system_error &e) {
+            Log::error("Fatal error starting telemetry stream: ?", e.what());
             exit(1);
         }
     }
 
     server = new Onion::Onion(O_POOL | O_NO_SIGTERM);
     server->setMaxPostSize(8000);
-    server->setMaxThreads(4);
+    server->setMaxThreads(config.getWorkerThreads());
     server->setPort(config.getPort());
     Onion::Url url(server);
 
+    WorkerLanes lanes(config.getWorkerThreads(), config.getReservedThreads(),
+                      config.getCollectorThreads());
+
     CollectorApiImpl collector(&agent);
+    collector.setLanes(&lanes);
     url.add("^collector/", std::move(collector));
 
     SdkApiImpl sdk(&agent);
+    sdk.setLanes(&lanes);
     url.add("^sdk/", std::move(sdk));
+    UploadGate upload_gate(&agent, &lanes);
 
     url.add("^.*", "Method not implemented", HTTP_NOT_IMPLEMENTED);
 
@@ -128,9 +174,13 @@ int main(int argc, char * const argv[]) {
     Log::info("listener stopped");
 
     if (config.isCANInterfaceEnabled()) {
+        delete stream_server;
+        can_node->stop();
         can_server->stop();
         delete can_server;
         delete can_client;
+        delete can_node;
+        delete can_capture;
     }
     delete server;
     Log::info("exiting");
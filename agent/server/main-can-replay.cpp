@@ -0,0 +1,107 @@
+/**
+ * main-can-replay.cpp
+ *
+ * can-replay main(): plays a capture recorded with the agent's -D option
+ * back onto a CAN interface, such as a vcan one the agent is listening on.
+ *
+ * Copyright (c) 2023 Spire Global, Inc.
+ */
+
+#include <unistd.h>
+
+#include <chrono>  // NOLINT(build/c++11)
+#include <exception>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+#include <uavcan_linux/uavcan_linux.hpp>
+
+#include "CanCapture.h"
+
+using namespace std;
+
+static void usage(const char *cmd) {
+    cerr << "Usage:" << endl;
+    cerr << cmd << " [-s speed] [-r repeat] capture-file can-interface" << endl;
+    cerr << " speed - times faster than recorded; 0 for as fast as the interface takes"
+         << " frames (default 1)" << endl;
+    cerr << " repeat - times to play the capture (default 1)" << endl;
+}
+
+int main(int argc, char *argv[]) {
+    double speed = 1;
+    int repeat = 1;
+    int opt;
+    while ((opt = getopt(argc, argv, "s:r:")) != -1) {
+        string str_arg = optarg != NULL ? optarg : "";
+        switch (opt) {
+            case 's':
+                try {
+                    speed = stod(str_arg);
+                }
+                catch (const invalid_argument& e) {
+                    speed = -1;
+                }
+                if (speed < 0) {
+                    cerr << "Invalid speed " << str_arg << endl;
+                    return 1;
+                }
+                break;
+            case 'r':
+                try {
+                    repeat = stoi(str_arg);
+                }
+                catch (const invalid_argument& e) {
+                    repeat = 0;
+                }
+                if (repeat < 1) {
+                    cerr << "Invalid repeat count " << str_arg << endl;
+                    return 1;
+                }
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if (argc - optind != 2) {
+        usage(argv[0]);
+        return 1;
+    }
+    const string path = argv[optind];
+    const string iface = argv[optind + 1];
+
+    try {
+        uavcan_linux::SystemClock clock;
+        uavcan_linux::SocketCanDriver driver(clock);
+        if (driver.addIface(iface) < 0) {
+            cerr << "Can't open CAN interface " << iface << endl;
+            return 1;
+        }
+        for (int i = 0; i < repeat; i++) {
+            CanCaptureReader capture(path);
+            auto start = chrono::steady_clock::now();
+            uint64_t dropped = 0;
+            uint64_t sent = replayCapture(capture, driver, speed, &dropped);
+            chrono::duration<double> took = chrono::steady_clock::now() - start;
+            cout << "sent " << sent << " frames in " << took.count() << "s";
+            if (dropped > 0) {
+                cout << ", dropped " << dropped << " the interface didn't take";
+            }
+            cout << endl;
+        }
+        // the socket may not have taken the last frames yet
+        auto until = clock.getMonotonic() + uavcan::MonotonicDuration::fromMSec(1000);
+        while (driver.getIface(0)->hasReadyTx() && clock.getMonotonic() < until) {
+            uavcan::CanSelectMasks masks;
+            const uavcan::CanFrame *pending[uavcan::MaxCanIfaces] = {};
+            driver.select(masks, pending, until);
+        }
+    }
+    catch (const exception &e) {
+        cerr << "Replay failed: " << e.what() << endl;
+        return 1;
+    }
+    return 0;
+}
@@ -24,25 +24,30 @@ using namespace std;
 
 CollectorApiRouter::CollectorApiRouter() {
     Log::info("setting up collector routes");
-    this->add("v1/ping", [this](Onion::Request &req, Onion::Response &resp) {
+    this->route("v1/ping", [this](Onion::Request &req, Onion::Response &resp, const Captures&) {
         InfoRequest ireq;
         CheckMethod(req, resp, GET);
         this->ping(resp);
         return OCS_PROCESSED;
     });
-    this->add("v1/info", [this](Onion::Request &req, Onion::Response &resp) {
+    this->route("v1/info", [this](Onion::Request &req, Onion::Response &resp, const Captures&) {
         InfoRequest ireq;
         CheckMethod(req, resp, POST);
+        AdmitLane(m_lanes, WorkerLanes::Collector, resp);
         GetPostData(ireq, req);
         this->info(ireq, resp);
         return OCS_PROCESSED;
     });
-    this->add("^v1/meta/([-[:xdigit:]]+)$",
-     [this](Onion::Request &req, Onion::Response &resp) {
+    this->route("v1/meta/{id}",
+     [this](Onion::Request &req, Onion::Response &resp, const Captures &args) {
         CheckMethod(req, resp, GET);
-        string uuid = req.query("1");
-        this->meta(uuid, resp);
+        AdmitLane(m_lanes, WorkerLanes::Collector, resp);
+        this->meta(args[0], resp);
+        return OCS_PROCESSED;
+    });
+    this->route("v1/uavcan", [this](Onion::Request &req, Onion::Response &resp, const Captures&) {
+        CheckMethod(req, resp, GET);
+        this->uavcan(resp);
         return OCS_PROCESSED;
     });
-    this->add("^.*", "Method not implemented", HTTP_NOT_IMPLEMENTED);
 }
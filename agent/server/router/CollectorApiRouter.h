@@ -10,16 +10,24 @@
 #include <string>
 #include "onion/url.hpp"
 #include "onion/handler.hpp"
+#include "PathRouter.h"
 
 #include "InfoRequest.h"
+#include "WorkerLanes.h"
 
 using org::openapitools::server::model::InfoRequest;
 
-class CollectorApiRouter : public Onion::Url {
+class CollectorApiRouter : public PathRouter {
+    WorkerLanes *m_lanes = nullptr;
+
  public:
     CollectorApiRouter();
+
+    /// gate info and meta requests through the Collector lane
+    void setLanes(WorkerLanes *lanes) { m_lanes = lanes; }
     virtual void ping(Onion::Response &response) = 0;
     virtual void info(InfoRequest &request, Onion::Response &response) = 0;
     virtual void meta(
         const std::string &uuid, Onion::Response &response) = 0;
+    virtual void uavcan(Onion::Response &response) = 0;
 };
@@ -0,0 +1,131 @@
+/**
+ * PathRouter.cpp
+ *
+ * Precompiled request path dispatch.
+ *
+ * Copyright (c) 2023 Spire Global, Inc.
+ */
+
+#include "PathRouter.h"
+
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "onion/request.h"
+
+#include "Utils.h"
+
+using namespace std;
+
+namespace {
+
+PathTrie::Segment segmentKind(const string &seg) {
+    if (seg == "{topic}") {
+        return PathTrie::Topic;
+    } else if (seg == "{id}") {
+        return PathTrie::Id;
+    }
+    return PathTrie::Literal;
+}
+
+}  // namespace
+
+void PathTrie::add(const string &pattern, int route) {
+    int node = 0;
+    size_t start = 0;
+    while (true) {
+        size_t end = pattern.find('/', start);
+        string seg = pattern.substr(start, end == string::npos ? string::npos : end - start);
+        Segment kind = segmentKind(seg);
+        int next = -1;
+        if (kind == Literal) {
+            for (const auto &lit : m_nodes[node].literals) {
+                if (lit.first == seg) {
+                    next = lit.second;
+                    break;
+                }
+            }
+            if (next < 0) {
+                next = m_nodes.size();
+                m_nodes.emplace_back();
+                m_nodes[node].literals.emplace_back(seg, next);
+            }
+        } else {
+            if (m_nodes[node].captureChild < 0) {
+                next = m_nodes.size();
+                m_nodes.emplace_back();
+                m_nodes[node].capture = kind;
+                m_nodes[node].captureChild = next;
+            } else if (m_nodes[node].capture != kind) {
+                throw logic_error("conflicting capture in route " + pattern);
+            }
+            next = m_nodes[node].captureChild;
+        }
+        node = next;
+        if (end == string::npos) {
+            break;
+        }
+        start = end + 1;
+    }
+    if (m_nodes[node].route >= 0) {
+        throw logic_error("duplicate route " + pattern);
+    }
+    m_nodes[node].route = route;
+}
+
+int PathTrie::match(const char *path, vector<string> &captures) const {
+    int node = 0;
+    const char *seg = path;
+    while (true) {
+        const char *slash = strchr(seg, '/');
+        size_t len = slash == nullptr ? strlen(seg) : slash - seg;
+        const Node &n = m_nodes[node];
+        int next = -1;
+        for (const auto &lit : n.literals) {
+            if (lit.first.size() == len && memcmp(lit.first.data(), seg, len) == 0) {
+                next = lit.second;
+                break;
+            }
+        }
+        if (next < 0 && n.captureChild >= 0) {
+            string value(seg, len);
+            if (n.capture == Topic ? isTopicName(value) : isHexId(value)) {
+                captures.push_back(move(value));
+                next = n.captureChild;
+            }
+        }
+        if (next < 0) {
+            return -1;
+        }
+        node = next;
+        if (slash == nullptr) {
+            return m_nodes[node].route;
+        }
+        seg = slash + 1;
+    }
+}
+
+PathRouter::PathRouter() {
+    // an anchor matches every path without consuming any of it
+    this->add("^", [this](Onion::Request &req, Onion::Response &resp) {
+        return this->dispatch(req, resp);
+    });
+}
+
+void PathRouter::route(const string &pattern, Route fn) {
+    m_trie.add(pattern, m_routes.size());
+    m_routes.push_back(move(fn));
+}
+
+onion_connection_status PathRouter::dispatch(Onion::Request &req, Onion::Response &resp) {
+    Captures captures;
+    int route = m_trie.match(onion_request_get_path(req.c_handler()), captures);
+    if (route < 0) {
+        resp.setCode(HTTP_NOT_IMPLEMENTED);
+        resp << "Method not implemented";
+        return OCS_PROCESSED;
+    }
+    return m_routes[route](req, resp, captures);
+}
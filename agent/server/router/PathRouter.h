@@ -0,0 +1,74 @@
+/**
+ * PathRouter.h
+ *
+ * Precompiled request path dispatch.
+ *
+ * Copyright (c) 2023 Spire Global, Inc.
+ */
+#pragma once
+
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "onion/url.hpp"
+#include "onion/request.hpp"
+#include "onion/response.hpp"
+
+/**
+ * \brief Trie of literal path segments with typed captures.
+ *
+ * Patterns are '/'-separated segments, each either a literal or one of
+ * the captures `{topic}` (a topic name) or `{id}` (a hex/UUID id).  A path
+ * matches a pattern only if every segment matches and there is nothing
+ * left over, the same as the anchored regexes this replaces.  Literal
+ * segments take precedence over a capture at the same position.
+ */
+class PathTrie {
+ public:
+    enum Segment { Literal, Topic, Id };
+
+    /// add pattern for route number `route`; throws logic_error on a
+    /// duplicate or conflicting pattern
+    void add(const std::string &pattern, int route);
+
+    /// \return the route matching `path`, with captured segments appended
+    /// to `captures`, or -1
+    int match(const char *path, std::vector<std::string> &captures) const;
+
+ private:
+    struct Node {
+        // literal segment -> child node; nodes have few children, so a
+        // linear scan beats hashing
+        std::vector<std::pair<std::string, int>> literals;
+        Segment capture = Literal;  ///< kind of capture child, if any
+        int captureChild = -1;
+        int route = -1;
+    };
+    std::vector<Node> m_nodes{1};
+};
+
+/**
+ * \brief Onion::Url whose routes are matched by a PathTrie rather than
+ * by a list of regexes.
+ *
+ * The only regex registered with onion is an anchor that hands every path
+ * to dispatch().  Unmatched paths get the usual 501.
+ */
+class PathRouter : public Onion::Url {
+ public:
+    typedef std::vector<std::string> Captures;
+    typedef std::function<onion_connection_status(
+        Onion::Request&, Onion::Response&, const Captures&)> Route;
+
+    PathRouter();
+
+    void route(const std::string &pattern, Route fn);
+
+ private:
+    PathTrie m_trie;
+    std::vector<Route> m_routes;
+
+    onion_connection_status dispatch(Onion::Request &req, Onion::Response &resp);
+};
@@ -0,0 +1,133 @@
+/**
+ * RequestParser.cpp
+ *
+ * Direct (SAX) parsing of request bodies into models.
+ *
+ * Copyright (c) 2023 Spire Global, Inc.
+ */
+
+#include "RequestParser.h"
+
+#include <string>
+
+#include "AdcsTarget.h"
+#include "Adcs_quat_t.h"
+#include "Adcs_xyz_float_t.h"
+#include "SendOptions.h"
+#include "TTLParams.h"
+
+using namespace std;
+using namespace org::openapitools::server::model;
+
+namespace {
+
+struct SendFileCtx {
+    SendFileRequest req;
+    SendOptions options;
+    TTLParams ttl;
+};
+
+struct RetrieveFileCtx {
+    RetrieveFileRequest req;
+};
+
+struct AdcsCommandCtx {
+    AdcsCommandRequest req;
+    AdcsTarget target;
+    Adcs_xyz_float_t vector;
+    Adcs_quat_t quat;
+};
+
+const FieldTable<SendFileCtx> &sendFileFields() {
+    typedef FieldTable<SendFileCtx> T;
+    static const T table = [] {
+        T t;
+        t.addString(T::ROOT, "destination",
+            [](SendFileCtx &c, const string &v) { c.req.setDestination(v); }, true);
+        t.addString(T::ROOT, "filepath",
+            [](SendFileCtx &c, const string &v) { c.req.setFilepath(v); }, true);
+        t.addString(T::ROOT, "topic",
+            [](SendFileCtx &c, const string &v) { c.req.setTopic(v); }, true);
+        int options = t.addObject(T::ROOT, "options",
+            [](SendFileCtx &c) { c.req.setOptions(c.options); });
+        t.addBool(options, "reliable",
+            [](SendFileCtx &c, bool v) { c.options.setReliable(v); });
+        int ttl = t.addObject(options, "TTLParams",
+            [](SendFileCtx &c) { c.options.setTTLParams(c.ttl); });
+        t.addInt(ttl, "urgent", [](SendFileCtx &c, int64_t v) { c.ttl.setUrgent(v); });
+        t.addInt(ttl, "bulk", [](SendFileCtx &c, int64_t v) { c.ttl.setBulk(v); });
+        t.addInt(ttl, "surplus", [](SendFileCtx &c, int64_t v) { c.ttl.setSurplus(v); });
+        return t;
+    }();
+    return table;
+}
+
+const FieldTable<RetrieveFileCtx> &retrieveFileFields() {
+    typedef FieldTable<RetrieveFileCtx> T;
+    static const T table = [] {
+        T t;
+        t.addString(T::ROOT, "id",
+            [](RetrieveFileCtx &c, const string &v) { c.req.setId(v); }, true);
+        t.addString(T::ROOT, "save_path",
+            [](RetrieveFileCtx &c, const string &v) { c.req.setSavePath(v); }, true);
+        return t;
+    }();
+    return table;
+}
+
+const FieldTable<AdcsCommandCtx> &adcsCommandFields() {
+    typedef FieldTable<AdcsCommandCtx> T;
+    static const T table = [] {
+        T t;
+        t.addString(T::ROOT, "command",
+            [](AdcsCommandCtx &c, const string &v) { c.req.setCommand(v); }, true);
+        t.addString(T::ROOT, "aperture",
+            [](AdcsCommandCtx &c, const string &v) { c.req.setAperture(v); });
+        t.addNumber(T::ROOT, "angle",
+            [](AdcsCommandCtx &c, double v) { c.req.setAngle(v); });
+
+        int target = t.addObject(T::ROOT, "target",
+            [](AdcsCommandCtx &c) { c.req.setTarget(c.target); });
+        t.addNumber(target, "lat", [](AdcsCommandCtx &c, double v) { c.target.setLat(v); }, true);
+        t.addNumber(target, "lon", [](AdcsCommandCtx &c, double v) { c.target.setLon(v); }, true);
+
+        int vec = t.addObject(T::ROOT, "vector",
+            [](AdcsCommandCtx &c) { c.req.setVector(c.vector); });
+        t.addNumber(vec, "x", [](AdcsCommandCtx &c, double v) { c.vector.setX(v); }, true);
+        t.addNumber(vec, "y", [](AdcsCommandCtx &c, double v) { c.vector.setY(v); }, true);
+        t.addNumber(vec, "z", [](AdcsCommandCtx &c, double v) { c.vector.setZ(v); }, true);
+
+        int quat = t.addObject(T::ROOT, "quat",
+            [](AdcsCommandCtx &c) { c.req.setQuat(c.quat); });
+        t.addNumber(quat, "q1", [](AdcsCommandCtx &c, double v) { c.quat.setQ1(v); }, true);
+        t.addNumber(quat, "q2", [](AdcsCommandCtx &c, double v) { c.quat.setQ2(v); }, true);
+        t.addNumber(quat, "q3", [](AdcsCommandCtx &c, double v) { c.quat.setQ3(v); }, true);
+        t.addNumber(quat, "q4", [](AdcsCommandCtx &c, double v) { c.quat.setQ4(v); }, true);
+        return t;
+    }();
+    return table;
+}
+
+template <class Ctx, class T>
+bool parseInto(const FieldTable<Ctx> &table, T &req, const char *data) {
+    Ctx ctx;
+    if (!FieldSax<Ctx>(table, ctx).parse(data)) {
+        return false;
+    }
+    req = ctx.req;
+    return true;
+}
+
+}  // namespace
+
+bool FastParse(SendFileRequest &req, const char *data) {
+    return parseInto(sendFileFields(), req, data);
+}
+
+bool FastParse(RetrieveFileRequest &req, const char *data) {
+    return parseInto(retrieveFileFields(), req, data);
+}
+
+bool FastParse(AdcsCommandRequest &req, const char *data) {
+    return parseInto(adcsCommandFields(), req, data);
+}
@@ -0,0 +1,247 @@
+/**
+ * RequestParser.h
+ *
+ * Direct (SAX) parsing of request bodies into models.
+ *
+ * Copyright (c) 2023 Spire Global, Inc.
+ */
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "nlohmann/json.hpp"
+
+#include "AdcsCommandRequest.h"
+#include "RetrieveFileRequest.h"
+#include "SendFileRequest.h"
+
+/**
+ * \brief Static description of the fields of a request body.
+ *
+ * Each field has a setter that stores the parsed value into a context
+ * object `Ctx` (the model being built, plus any nested models).  Tables
+ * are built once and shared by all requests.
+ */
+template <class Ctx>
+class FieldTable {
+ public:
+    enum { ROOT = -1 };
+    enum Kind { String, Int, Number, Bool, Object };
+
+    struct Field {
+        Kind kind;
+        bool required;
+        int parent;
+        void (*str)(Ctx&, const std::string&);
+        void (*integer)(Ctx&, int64_t);
+        void (*number)(Ctx&, double);
+        void (*boolean)(Ctx&, bool);
+        void (*object)(Ctx&);  ///< called when a nested object ends
+    };
+
+    int addString(int parent, const std::string &name,
+                  void (*fn)(Ctx&, const std::string&), bool required = false) {
+        Field f = blank(String, parent, required);
+        f.str = fn;
+        return add(parent, name, f);
+    }
+    int addInt(int parent, const std::string &name,
+               void (*fn)(Ctx&, int64_t), bool required = false) {
+        Field f = blank(Int, parent, required);
+        f.integer = fn;
+        return add(parent, name, f);
+    }
+    int addNumber(int parent, const std::string &name,
+                  void (*fn)(Ctx&, double), bool required = false) {
+        Field f = blank(Number, parent, required);
+        f.number = fn;
+        return add(parent, name, f);
+    }
+    int addBool(int parent, const std::string &name,
+                void (*fn)(Ctx&, bool), bool required = false) {
+        Field f = blank(Bool, parent, required);
+        f.boolean = fn;
+        return add(parent, name, f);
+    }
+    int addObject(int parent, const std::string &name,
+                  void (*fn)(Ctx&), bool required = false) {
+        Field f = blank(Object, parent, required);
+        f.object = fn;
+        return add(parent, name, f);
+    }
+
+    /// index of field `name` in object `parent`, or -1
+    int find(int parent, const std::string &name) const {
+        const auto &names = m_children[parent + 1];
+        auto it = names.find(name);
+        return it == names.end() ? -1 : it->second;
+    }
+    const Field &field(int index) const { return m_fields[index]; }
+    int size() const { return m_fields.size(); }
+
+ private:
+    std::vector<Field> m_fields;
+    // name -> index, per object; slot 0 is the root
+    std::vector<std::unordered_map<std::string, int>> m_children{1};
+
+    static Field blank(Kind kind, int parent, bool required) {
+        return Field{kind, required, parent, nullptr, nullptr, nullptr, nullptr, nullptr};
+    }
+    int add(int parent, const std::string &name, const Field &f) {
+        int index = m_fields.size();
+        m_fields.push_back(f);
+        m_children.emplace_back();
+        m_children[parent + 1][name] = index;
+        return index;
+    }
+};
+
+/**
+ * \brief SAX handler that assigns fields from a FieldTable as they are
+ * parsed, with no intermediate DOM.
+ *
+ * Parsing fails - and the caller is expected to fall back to the DOM
+ * path, which produces the usual error messages - on anything the table
+ * doesn't describe: an unknown nested object or any array, a value of
+ * the wrong type, a missing required field, or a syntax error.  Unknown
+ * scalar fields are ignored, as they are by the generated from_json.
+ */
+template <class Ctx>
+class FieldSax {
+    typedef nlohmann::json json;
+    typedef FieldTable<Ctx> Table;
+
+    const Table &m_table;
+    Ctx &m_ctx;
+    std::vector<int> m_objects;
+    int m_current = -1;  ///< field for the next value; -1 if unknown
+    uint64_t m_seen = 0;
+
+    const typename Table::Field *current() {
+        if (m_current < 0) {
+            return nullptr;
+        }
+        m_seen |= (uint64_t{1} << m_current);
+        return &m_table.field(m_current);
+    }
+    bool seen(int index) const {
+        return index == Table::ROOT || (m_seen & (uint64_t{1} << index));
+    }
+
+ public:
+    FieldSax(const Table &table, Ctx &ctx) : m_table(table), m_ctx(ctx) {}
+
+    /// \return false if the body needs the generic parser
+    bool parse(const char *data) {
+        if (m_table.size() > 64 || !json::sax_parse(data, this)) {
+            return false;
+        }
+        for (int i = 0; i < m_table.size(); i++) {
+            const auto &f = m_table.field(i);
+            // a required field of an optional object only counts if the
+            // object was present
+            if (f.required && seen(f.parent) && !seen(i)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool null() {
+        // null is never valid for a known field
+        return current() == nullptr;
+    }
+    bool boolean(bool val) {
+        auto f = current();
+        if (f == nullptr) return true;
+        if (f->kind != Table::Bool) return false;
+        f->boolean(m_ctx, val);
+        return true;
+    }
+    bool number_integer(json::number_integer_t val) {
+        auto f = current();
+        if (f == nullptr) return true;
+        if (f->kind == Table::Int) {
+            f->integer(m_ctx, val);
+        } else if (f->kind == Table::Number) {
+            f->number(m_ctx, static_cast<double>(val));
+        } else {
+            return false;
+        }
+        return true;
+    }
+    bool number_unsigned(json::number_unsigned_t val) {
+        if (val > static_cast<json::number_unsigned_t>(INT64_MAX)) {
+            // leave out-of-range conversions to the generic path
+            return current() == nullptr;
+        }
+        return number_integer(static_cast<json::number_integer_t>(val));
+    }
+    bool number_float(json::number_float_t val, const json::string_t&) {
+        auto f = current();
+        if (f == nullptr) return true;
+        if (f->kind != Table::Number) return false;
+        f->number(m_ctx, val);
+        return true;
+    }
+    bool string(json::string_t &val) {
+        auto f = current();
+        if (f == nullptr) return true;
+        if (f->kind != Table::String) return false;
+        f->str(m_ctx, val);
+        return true;
+    }
+    template <class B>
+    bool binary(B&) {
+        return false;
+    }
+    bool start_object(std::size_t) {
+        if (m_objects.empty()) {
+            m_objects.push_back(Table::ROOT);
+            return true;
+        }
+        auto f = current();
+        if (f == nullptr || f->kind != Table::Object) return false;
+        m_objects.push_back(m_current);
+        return true;
+    }
+    bool key(json::string_t &val) {
+        m_current = m_table.find(m_objects.back(), val);
+        return true;
+    }
+    bool end_object() {
+        int index = m_objects.back();
+        m_objects.pop_back();
+        if (index != Table::ROOT) {
+            m_table.field(index).object(m_ctx);
+        }
+        return true;
+    }
+    bool start_array(std::size_t) {
+        return false;
+    }
+    bool end_array() {
+        return false;
+    }
+    template <class E>
+    bool parse_error(std::size_t, const std::string&, const E&) {
+        return false;
+    }
+};
+
+using org::openapitools::server::model::AdcsCommandRequest;
+using org::openapitools::server::model::RetrieveFileRequest;
+using org::openapitools::server::model::SendFileRequest;
+
+// Parse a request body straight into a model.  Returns false if the body
+// could not be handled, in which case `req` is untouched.
+template <class T>
+bool FastParse(T &req, const char *data) {
+    return false;
+}
+bool FastParse(SendFileRequest &req, const char *data);
+bool FastParse(RetrieveFileRequest &req, const char *data);
+bool FastParse(AdcsCommandRequest &req, const char *data);
@@ -8,6 +8,12 @@
 #pragma once
 
 #include "nlohmann/json.hpp"
+#include "onion/response.hpp"
+
+#include "ErrorResponse.h"
+#include "RequestParser.h"
+#include "Utils.h"
+#include "WorkerLanes.h"
 
 #define GetMethod(REQ) (REQ.flags() & OR_METHODS)
 
@@ -33,6 +39,28 @@
         return OCS_PROCESSED;                  \
     }} while (0)
 
+// seconds a client should wait before retrying a rejected request
+#define BUSY_RETRY_AFTER 1
+
+inline void RejectBusy(Onion::Response &resp) {
+    ErrorResponse err;
+    err.setStatus(static_cast<int>(Code::Service_Unavailable));
+    err.setMessage("Server busy; retry later");
+    resp.setCode(static_cast<int>(Code::Service_Unavailable));
+    resp.setHeader("Retry-After", std::to_string(BUSY_RETRY_AFTER));
+    resp << to_jsonstr(err);
+}
+
+// admit the request to a worker lane, or reject it with a 503 so the
+// worker goes straight back to the pool.  The slot is held until the
+// end of the enclosing scope.
+#define AdmitLane(LANES, LANE, RESP)                              \
+    WorkerLanes::Slot lane_slot;                                  \
+    if (LANES != nullptr && !(lane_slot = LANES->enter(LANE))) {  \
+        RejectBusy(RESP);                                         \
+        return OCS_PROCESSED;                                     \
+    }
+
 
 template<class T>
 void GetPostData(T &var, Onion::Request &req) {
@@ -42,6 +70,11 @@ void GetPostData(T &var, Onion::Request &req) {
         return;
     }
     const char *data = onion_block_data(reqd);
+    // hot request types are parsed without a DOM; anything the direct
+    // parser declines goes through the generic path for the usual errors
+    if (FastParse(var, data)) {
+        return;
+    }
     nlohmann::json req_json = nlohmann::json::parse(data);
     from_json(req_json, var);
 }
@@ -17,32 +17,61 @@
 #include "Log.h"
 
 #include "RouterUtil.h"
+#include "UploadGate.h"
 
 using namespace std;
 
 SdkApiRouter::SdkApiRouter() {
-    this->add("^v1/query_available_files/([-_[:alnum:]]+)$",
-     [this](Onion::Request &req, Onion::Response &resp) {
+    this->route("v1/query_available_files/{topic}",
+     [this](Onion::Request &req, Onion::Response &resp, const Captures &args) {
         CheckMethod(req, resp, GET);
-        string topic = req.query("1");
-        this->query_available_files(topic, resp);
+        AdmitLane(m_lanes, WorkerLanes::Sdk, resp);
+        this->query_available_files(args[0], resp);
         return OCS_PROCESSED;
     });
-    this->add("^v1/send_file$", [this](Onion::Request &req, Onion::Response &resp) {
+    this->route("v1/send_file",
+     [this](Onion::Request &req, Onion::Response &resp, const Captures&) {
         CheckMethod(req, resp, POST);
+        AdmitLane(m_lanes, WorkerLanes::Sdk, resp);
         SendFileRequest sreq;
         ParseRequest(sreq, req, resp);
         this->send_file(sreq, resp);
         return OCS_PROCESSED;
     });
-    this->add("^v1/retrieve_file$", [this](Onion::Request &req, Onion::Response &resp) {
+    // onion spools PUT bodies to a temporary file before the handler runs;
+    // the handler takes that file over rather than re-buffering it.  The
+    // UploadGate has already refused uploads it could tell from their
+    // headers would be refused here, and has the spool's CRC.
+    this->route("v1/upload/{topic}",
+     [this](Onion::Request &req, Onion::Response &resp, const Captures &args) {
+        CheckMethod(req, resp, PUT);
+        string crc = UploadGate::spooledCrc(req.c_handler());
+        AdmitLane(m_lanes, WorkerLanes::Sdk, resp);
+        const char *spool = onion_request_get_file(req.c_handler(), "filename");
+        SendFileRequest sreq;
+        sreq.setTopic(args[0]);
+        sreq.setDestination(req.query("destination", ""));
+        sreq.setFilepath(req.query("filename", ""));
+        this->upload_file(sreq, spool != nullptr ? spool : "", crc, resp);
+        return OCS_PROCESSED;
+    });
+    this->route("v1/retrieve_file",
+     [this](Onion::Request &req, Onion::Response &resp, const Captures&) {
         CheckMethod(req, resp, POST);
+        AdmitLane(m_lanes, WorkerLanes::Sdk, resp);
         RetrieveFileRequest rreq;
         ParseRequest(rreq, req, resp);
         this->retrieve_file(rreq, resp);
         return OCS_PROCESSED;
     });
-    this->add("^v1/adcs$", [this](Onion::Request &req, Onion::Response &resp) {
+    this->route("v1/uploads/{id}",
+     [this](Onion::Request &req, Onion::Response &resp, const Captures &args) {
+        CheckMethod(req, resp, GET);
+        AdmitLane(m_lanes, WorkerLanes::Sdk, resp);
+        string consume = req.query("consume", "false");
+        return this->get_upload(args[0], consume == "true" || consume == "1", req, resp);
+    });
+    this->route("v1/adcs", [this](Onion::Request &req, Onion::Response &resp, const Captures&) {
         if (GetMethod(req) == OR_GET) {
             this->adcs_get(resp);
         } else if (GetMethod(req) == OR_POST) {
@@ -54,11 +83,42 @@ SdkApiRouter::SdkApiRouter() {
         }
         return OCS_PROCESSED;
     });
-    this->add("^v1/tfrs$", [this](Onion::Request &req, Onion::Response &resp) {
+    this->route("v1/adcs/commands",
+     [this](Onion::Request &req, Onion::Response &resp, const Captures&) {
+        CheckMethod(req, resp, POST);
+        AdcsCommandRequest areq;
+        ParseRequest(areq, req, resp);
+        this->adcs_command_submit(areq, resp);
+        return OCS_PROCESSED;
+    });
+    this->route("v1/adcs/commands/{id}",
+     [this](Onion::Request &req, Onion::Response &resp, const Captures &args) {
+        CheckMethod(req, resp, GET);
+        this->adcs_command_get(args[0], req.query("wait", ""), resp);
+        return OCS_PROCESSED;
+    });
+    this->route("v1/tfrs", [this](Onion::Request &req, Onion::Response &resp, const Captures&) {
         CheckMethod(req, resp, GET);
         this->tfrs_get(resp);
         return OCS_PROCESSED;
     });
-    this->add("^.*", "Method not implemented", HTTP_NOT_IMPLEMENTED);
+    this->route("v1/adcs/history",
+     [this](Onion::Request &req, Onion::Response &resp, const Captures&) {
+        CheckMethod(req, resp, GET);
+        AdmitLane(m_lanes, WorkerLanes::Sdk, resp);
+        string interpolate = req.query("interpolate", "false");
+        this->adcs_history(req.query("start", ""), req.query("end", ""), req.query("at", ""),
+                           interpolate == "true" || interpolate == "1", resp);
+        return OCS_PROCESSED;
+    });
+    this->route("v1/tfrs/history",
+     [this](Onion::Request &req, Onion::Response &resp, const Captures&) {
+        CheckMethod(req, resp, GET);
+        AdmitLane(m_lanes, WorkerLanes::Sdk, resp);
+        string interpolate = req.query("interpolate", "false");
+        this->tfrs_history(req.query("start", ""), req.query("end", ""), req.query("at", ""),
+                           interpolate == "true" || interpolate == "1", resp);
+        return OCS_PROCESSED;
+    });
 }
 
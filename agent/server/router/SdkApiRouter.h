@@ -10,29 +10,56 @@
 #include <string>
 
 #include "onion/url.hpp"
+#include "onion/request.hpp"
 #include "onion/response.hpp"
+#include "PathRouter.h"
 #include "RetrieveFileRequest.h"
 #include "SendFileRequest.h"
 #include "AdcsCommandRequest.h"
+#include "WorkerLanes.h"
 
 using org::openapitools::server::model::RetrieveFileRequest;
 using org::openapitools::server::model::SendFileRequest;
 using org::openapitools::server::model::AdcsCommandRequest;
 
-class SdkApiRouter : public Onion::Url {
+class SdkApiRouter : public PathRouter {
+    WorkerLanes *m_lanes = nullptr;
+
  public:
     SdkApiRouter();
 
+    /// gate file operations through the Sdk lane
+    void setLanes(WorkerLanes *lanes) { m_lanes = lanes; }
+
     virtual void query_available_files(
         const std::string &topic, Onion::Response &response) = 0;
     virtual void retrieve_file(
         const RetrieveFileRequest &retrieveFileRequest, Onion::Response &response) = 0;
     virtual void send_file(
         const SendFileRequest &sendFileRequest, Onion::Response &response) = 0;
+    /// `crc` is the spool's CRC if it was taken as onion wrote it, or ""
+    virtual void upload_file(
+        const SendFileRequest &sendFileRequest, const std::string &spool,
+        const std::string &crc, Onion::Response &response) = 0;
+    virtual onion_connection_status get_upload(
+        const std::string &id, bool consume,
+        Onion::Request &request, Onion::Response &response) = 0;
     virtual void adcs_get(
         Onion::Response &response) = 0;
     virtual void adcs_post(
         const AdcsCommandRequest &adcsCommandRequest, Onion::Response &response) = 0;
+    virtual void adcs_command_submit(
+        const AdcsCommandRequest &adcsCommandRequest, Onion::Response &response) = 0;
+    /// `wait` is seconds as given in the query, empty if absent
+    virtual void adcs_command_get(
+        const std::string &id, const std::string &wait, Onion::Response &response) = 0;
     virtual void tfrs_get(
         Onion::Response &response) = 0;
+    /// times are unix epoch seconds as given in the query, empty if absent
+    virtual void adcs_history(
+        const std::string &start, const std::string &end, const std::string &at,
+        bool interpolate, Onion::Response &response) = 0;
+    virtual void tfrs_history(
+        const std::string &start, const std::string &end, const std::string &at,
+        bool interpolate, Onion::Response &response) = 0;
 };
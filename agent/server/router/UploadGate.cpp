@@ -0,0 +1,121 @@
+/**
+ * UploadGate.cpp
+ *
+ * Checks on SDK uploads made before onion reads their bodies.
+ *
+ * Copyright (c) 2023 Spire Global, Inc.
+ */
+
+#include "UploadGate.h"
+
+#include <atomic>
+#include <cstring>
+#include <string>
+
+#include "onion/block.h"
+#include "onion/response.h"
+#include "onion/response.hpp"
+
+#include "Log.h"
+#include "RouterUtil.h"
+#include "Utils.h"
+
+using namespace std;
+
+namespace {
+
+const char UPLOAD_PATH[] = "sdk/v1/upload/";
+
+atomic<UploadGate*> installed{nullptr};
+
+}  // namespace
+
+// called by onion, as patched by patch/onion.patch
+extern "C" {
+
+int onion_put_begin(onion_request *req, size_t length) {
+    UploadGate *gate = installed.load();
+    return gate != nullptr && !gate->begin(req, length);
+}
+
+void onion_put_data(onion_request *req, const char *data, size_t length) {
+    UploadGate *gate = installed.load();
+    if (gate != nullptr) {
+        gate->data(req, data, length);
+    }
+}
+
+}  // extern "C"
+
+UploadGate::UploadGate(Agent *agent, WorkerLanes *lanes) : m_agent(agent), m_lanes(lanes) {
+    installed.store(this);
+}
+
+UploadGate::~UploadGate() {
+    UploadGate *self = this;
+    installed.compare_exchange_strong(self, nullptr);
+}
+
+string UploadGate::spooledCrc(onion_request *req) {
+    UploadGate *gate = installed.load();
+    return gate != nullptr ? gate->take(req) : "";
+}
+
+string UploadGate::take(onion_request *req) {
+    const lock_guard<mutex> guard{m_lock};
+    auto s = m_spooling.find(req);
+    if (s == m_spooling.end()) {
+        return "";
+    }
+    string crc = s->second.seen == s->second.length ? crcString(s->second.crc) : "";
+    m_spooling.erase(s);
+    return crc;
+}
+
+bool UploadGate::begin(onion_request *req, size_t length) {
+    // other PUTs are left to their handlers
+    const char *path = onion_request_get_fullpath(req);
+    while (path != nullptr && *path == '/') {
+        path++;
+    }
+    if (path == nullptr || strncmp(path, UPLOAD_PATH, sizeof(UPLOAD_PATH) - 1) != 0
+        || !isTopicName(path + sizeof(UPLOAD_PATH) - 1)) {
+        return true;
+    }
+    string topic(path + sizeof(UPLOAD_PATH) - 1);
+
+    bool busy = m_lanes != nullptr && !m_lanes->admits(WorkerLanes::Sdk);
+    ResponseCode<SendFileResponse> checked;
+    if (!busy) {
+        checked = m_agent->check_upload(topic, length);
+        if (checked.code == Code::Ok) {
+            const lock_guard<mutex> guard{m_lock};
+            m_spooling[req] = Spooling{crc32(0L, Z_NULL, 0), length, 0};
+            return true;
+        }
+    }
+    Log::info("upload of ? bytes on ? refused before its body was read",
+              static_cast<int64_t>(length), topic);
+    take(req);
+
+    onion_response *res = onion_response_new(req);
+    {
+        Onion::Response resp(res);
+        if (busy) {
+            RejectBusy(resp);
+        } else {
+            deliverError(resp, checked);
+        }
+    }
+    onion_response_free(res);
+    return false;
+}
+
+void UploadGate::data(onion_request *req, const char *data, size_t length) {
+    const lock_guard<mutex> guard{m_lock};
+    auto s = m_spooling.find(req);
+    if (s != m_spooling.end()) {
+        s->second.crc = crc32(s->second.crc, reinterpret_cast<const Bytef*>(data), length);
+        s->second.seen += length;
+    }
+}
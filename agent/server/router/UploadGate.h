@@ -0,0 +1,69 @@
+/**
+ * UploadGate.h
+ *
+ * Checks on SDK uploads made before onion reads their bodies.
+ *
+ * Copyright (c) 2023 Spire Global, Inc.
+ */
+#pragma once
+
+#include <zlib.h>
+
+#include <cstdint>
+#include <mutex>  // NOLINT(build/c++11)
+#include <string>
+#include <unordered_map>
+
+#include "onion/request.h"
+
+#include "Agent.h"
+#include "WorkerLanes.h"
+
+/**
+ * \brief Refuses SDK uploads from their headers, and takes the CRC of
+ * each upload's body as onion spools it.
+ *
+ * onion writes a PUT body to a temporary file before any handler runs, so
+ * an upload refused by its handler has already crossed the link and used
+ * the disk.  With patch/onion.patch, onion calls onion_put_begin() once a
+ * PUT's headers are in, and onion_put_data() with each part of the body
+ * as it is written.  Those hooks are defined here and hand off to the
+ * installed gate, which refuses an upload whose topic is not allowed, is
+ * over its quota or finds the Sdk lane full, before any of its body is
+ * read.  The checks are repeated when the upload is handled.
+ *
+ * One gate is installed at a time, from construction to destruction.
+ */
+class UploadGate {
+ public:
+    UploadGate(Agent *agent, WorkerLanes *lanes);
+    ~UploadGate();
+    UploadGate(const UploadGate&) = delete;
+    UploadGate& operator=(const UploadGate&) = delete;
+
+    /**
+     * \return the CRC of the body spooled for `req`, or "" if the
+     * installed gate did not see all of it; the record is dropped
+     */
+    static std::string spooledCrc(onion_request *req);
+
+    /// \return whether the upload may be read; if not, a response is sent
+    bool begin(onion_request *req, size_t length);
+    void data(onion_request *req, const char *data, size_t length);
+
+ private:
+    struct Spooling {
+        uLong crc;
+        size_t length;  ///< as announced by Content-Length
+        size_t seen;  ///< bytes spooled so far
+    };
+
+    Agent *m_agent;
+    WorkerLanes *m_lanes;
+    std::mutex m_lock;
+    /// bodies being spooled; a request whose connection drops midway is
+    /// dropped when its onion_request is next reused
+    std::unordered_map<onion_request*, Spooling> m_spooling;
+
+    std::string take(onion_request *req);
+};
@@ -0,0 +1,111 @@
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "catch2/catch.hpp"
+
+#include "AdcsCommands.h"
+
+using namespace std;
+using org::openapitools::server::model::AdcsCommandResponse;
+using org::openapitools::server::model::AdcsCommandStatus;
+
+namespace {
+
+AdcsCommandResponse response(const string &reason) {
+    AdcsCommandResponse rsp;
+    rsp.setStatus("FAIL");
+    rsp.setReason(reason);
+    return rsp;
+}
+
+}  // namespace
+
+TEST_CASE("adcs command table", "[adcs]") {
+    AdcsCommandTable table;
+    AdcsCommandStatus status;
+
+    string id = table.add();
+    REQUIRE( !id.empty() );
+    REQUIRE( table.pending() == 1 );
+    REQUIRE( table.get(id, chrono::milliseconds(0), &status) );
+    REQUIRE( status.getId() == id );
+    REQUIRE( status.getState() == "pending" );
+    REQUIRE( !status.resultIsSet() );
+    REQUIRE_FALSE( table.get("nope", chrono::milliseconds(0), &status) );
+
+    SECTION("completion") {
+        table.complete(id, response("first"));
+        // a second completion (e.g. a late reply) is ignored
+        table.complete(id, response("second"));
+        REQUIRE( table.pending() == 0 );
+        REQUIRE( table.get(id, chrono::milliseconds(0), &status) );
+        REQUIRE( status.getState() == "done" );
+        REQUIRE( status.getResult().getReason() == "first" );
+    }
+
+    SECTION("waiting") {
+        thread completer([&table, id] {
+            this_thread::sleep_for(chrono::milliseconds(20));
+            table.complete(id, response("later"));
+        });
+        auto start = chrono::steady_clock::now();
+        REQUIRE( table.get(id, chrono::milliseconds(5000), &status) );
+        completer.join();
+        REQUIRE( chrono::steady_clock::now() - start < chrono::milliseconds(2000) );
+        REQUIRE( status.getState() == "done" );
+        REQUIRE( status.getResult().getReason() == "later" );
+    }
+
+    SECTION("wait times out") {
+        auto start = chrono::steady_clock::now();
+        REQUIRE( table.get(id, chrono::milliseconds(30), &status) );
+        REQUIRE( chrono::steady_clock::now() - start >= chrono::milliseconds(30) );
+        REQUIRE( status.getState() == "pending" );
+    }
+
+    SECTION("waiters are capped") {
+        table.setMaxWaiters(1);
+        auto waiter = table.waiter();
+        REQUIRE( waiter );
+        REQUIRE_FALSE( table.waiter() );
+
+        // past the cap, the state comes back without waiting
+        auto start = chrono::steady_clock::now();
+        REQUIRE( table.get(id, chrono::milliseconds(5000), &status) );
+        REQUIRE( chrono::steady_clock::now() - start < chrono::milliseconds(1000) );
+        REQUIRE( status.getState() == "pending" );
+
+        // the holder of a waiter can still wait with it
+        start = chrono::steady_clock::now();
+        REQUIRE( table.get(id, chrono::milliseconds(30), &status, &waiter) );
+        REQUIRE( chrono::steady_clock::now() - start >= chrono::milliseconds(30) );
+
+        waiter.release();
+        REQUIRE( table.waiter() );
+
+        table.setMaxWaiters(0);
+        REQUIRE_FALSE( table.waiter() );
+    }
+
+    SECTION("limits") {
+        vector<string> ids{id};
+        while (ids.size() < ADCS_COMMAND_MAX_PENDING) {
+            ids.push_back(table.add());
+            REQUIRE( !ids.back().empty() );
+        }
+        REQUIRE( table.add().empty() );
+        table.complete(ids[0], response("0"));
+        string another = table.add();
+        REQUIRE( !another.empty() );
+        table.complete(another, response("another"));
+
+        // only the most recent results are kept; pending commands stay
+        for (int i = 0; i < ADCS_COMMAND_RETAIN; i++) {
+            table.complete(table.add(), response("filler"));
+        }
+        REQUIRE_FALSE( table.get(ids[0], chrono::milliseconds(0), &status) );
+        REQUIRE( table.get(ids[1], chrono::milliseconds(0), &status) );
+    }
+}
@@ -1,10 +1,20 @@
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <limits>
 #include <thread>
+#include <vector>
 
 #include "catch2/catch.hpp"
+#include "nlohmann/json.hpp"
 
 #include "Adcs.h"
+#include "SeqLock.h"
+#include "TelemetryHistory.h"
 
 using namespace Catch::Matchers;
+using org::openapitools::server::model::AdcsResponse;
+using org::openapitools::server::model::TfrsResponse;
 
 TEST_CASE("receive values", "[adcs]") {
     AdcsManager mgr;
@@ -22,6 +32,11 @@ TEST_CASE("receive values", "[adcs]") {
     REQUIRE( result.getHk().getAcsModeActive() == "NO-OP" );
     REQUIRE( result.getHk().getREci().getY() == 1e7 );
     REQUIRE_THAT( result.getHk().getLatDeg(), WithinRel(45.0) );
+
+    // derived fields follow the next message
+    msg.r_eci.z = -1.0e7;
+    mgr.setAdcs(msg);
+    REQUIRE_THAT( mgr.getAdcs().getHk().getLatDeg(), WithinRel(-45.0) );
 }
 
 struct testdata {
@@ -131,3 +146,329 @@ TEST_CASE("TFRS cache", "[adcs]") {
     REQUIRE( result.getAge() < result2.getAge());
     REQUIRE( result.getEcefPosX() == result2.getEcefPosX());
 }
+
+TEST_CASE("telemetry history ring", "[adcs]") {
+    TelemetryHistory<int> history(4);
+    TelemetryHistory<int>::Entry before, after;
+
+    REQUIRE_FALSE( history.bracket(1, &before, &after) );
+    REQUIRE( history.range(0, 100).empty() );
+
+    for (int i = 1; i <= 6; i++) {
+        history.push(i * 10, i);
+    }
+    // the two oldest have been overwritten
+    REQUIRE( history.size() == 4 );
+    auto all = history.range(0, 100);
+    REQUIRE( all.size() == 4 );
+    REQUIRE( all.front().msg == 3 );
+    REQUIRE( all.back().msg == 6 );
+
+    auto some = history.range(35, 50);
+    REQUIRE( some.size() == 2 );
+    REQUIRE( some[0].time == 40 );
+    REQUIRE( some[1].time == 50 );
+    REQUIRE( history.range(51, 59).empty() );
+    REQUIRE( history.range(50, 40).empty() );
+
+    REQUIRE( history.bracket(45, &before, &after) );
+    REQUIRE( before.msg == 4 );
+    REQUIRE( after.msg == 5 );
+    REQUIRE( history.bracket(50, &before, &after) );
+    REQUIRE( before.msg == 5 );
+    REQUIRE( after.msg == 5 );
+    // no extrapolation
+    REQUIRE( history.bracket(0, &before, &after) );
+    REQUIRE( (before.msg == 3 && after.msg == 3) );
+    REQUIRE( history.bracket(1000, &before, &after) );
+    REQUIRE( (before.msg == 6 && after.msg == 6) );
+
+    SECTION("same time replaces the newest") {
+        history.push(60, 7);
+        REQUIRE( history.size() == 4 );
+        REQUIRE( history.range(60, 60)[0].msg == 7 );
+    }
+    SECTION("clock stepped back") {
+        history.push(15, 8);
+        REQUIRE( history.size() == 1 );
+        REQUIRE( history.range(0, 100)[0].msg == 8 );
+    }
+}
+
+TEST_CASE("ADCS history and interpolation", "[adcs]") {
+    AdcsManager mgr;
+    AdcsResponse at;
+
+    REQUIRE_FALSE( mgr.getAdcsAt(0, true, &at) );
+
+    // identity, then a quarter turn about z
+    ussp::payload::PayloadAdcsFeed msg;
+    msg.acs_mode_active.mode = msg.acs_mode_active.NOOP;
+    msg.q_bo_est.q4 = 1;
+    msg.r_eci.x = 7.0e6;
+    msg.unix_timestamp = 100;
+    mgr.setAdcs(msg);
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    msg.q_bo_est.q3 = sin(M_PI / 4);
+    msg.q_bo_est.q4 = cos(M_PI / 4);
+    msg.r_eci.x = 7.2e6;
+    msg.unix_timestamp = 101;
+    mgr.setAdcs(msg);
+
+    auto history = mgr.getAdcsHistory(0, std::numeric_limits<double>::max());
+    REQUIRE( history.size() == 2 );
+    double t0 = history[0].getTime(), t1 = history[1].getTime();
+    REQUIRE( t0 < t1 );
+    REQUIRE( history[0].getHk().getUnixTimestamp() == 100 );
+    REQUIRE( history[1].getHk().getUnixTimestamp() == 101 );
+    REQUIRE( history[0].getAge() > history[1].getAge() );
+    REQUIRE( mgr.getAdcsHistory(t1, t1).size() == 1 );
+
+    SECTION("nearest") {
+        REQUIRE( mgr.getAdcsAt(t0 + (t1 - t0) * 0.4, false, &at) );
+        REQUIRE( at.getTime() == t0 );
+        REQUIRE( mgr.getAdcsAt(t0 + (t1 - t0) * 0.6, false, &at) );
+        REQUIRE( at.getTime() == t1 );
+    }
+    SECTION("interpolated") {
+        double mid = (t0 + t1) / 2;
+        REQUIRE( mgr.getAdcsAt(mid, true, &at) );
+        REQUIRE( at.getTime() == mid );
+        auto hk = at.getHk();
+        // half way is an eighth turn
+        CHECK_THAT( hk.getQBoEst().getQ3(), WithinRel(sin(M_PI / 8), 1e-3) );
+        CHECK_THAT( hk.getQBoEst().getQ4(), WithinRel(cos(M_PI / 8), 1e-3) );
+        CHECK_THAT( hk.getEulerAngles().getYaw(), WithinRel(45.0, 1e-3) );
+        CHECK_THAT( hk.getREci().getX(), WithinRel(7.1e6, 1e-5) );
+        CHECK_THAT( hk.getUnixTimestamp(), WithinRel(100.5, 1e-6) );
+        CHECK( at.getMode() == "NO-OP" );
+    }
+    SECTION("not extrapolated") {
+        REQUIRE( mgr.getAdcsAt(t1 + 10, true, &at) );
+        REQUIRE( at.getTime() == t1 );
+    }
+}
+
+TEST_CASE("TFRS history and interpolation", "[adcs]") {
+    AdcsManager mgr;
+    TfrsResponse at;
+
+    ussp::tfrs::ReceiverNavigationState msg;
+    msg.utc_time = 1000;
+    msg.ecef_pos_x = 1.0;
+    msg.ecef_vel_y = -4.0;
+    mgr.setTfrs(msg);
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    msg.utc_time = 1002;
+    msg.ecef_pos_x = 3.0;
+    msg.ecef_vel_y = -2.0;
+    mgr.setTfrs(msg);
+
+    auto history = mgr.getTfrsHistory(0, std::numeric_limits<double>::max());
+    REQUIRE( history.size() == 2 );
+    double mid = (history[0].getTime() + history[1].getTime()) / 2;
+    REQUIRE( mgr.getTfrsAt(mid, true, &at) );
+    CHECK_THAT( at.getEcefPosX(), WithinRel(2.0, 1e-4) );
+    CHECK_THAT( at.getEcefVelY(), WithinRel(-3.0, 1e-4) );
+    CHECK( at.getUtcTime() == 1001 );
+    REQUIRE( mgr.getTfrsHistory(mid, mid).empty() );
+}
+
+TEST_CASE("serialized responses", "[adcs]") {
+    AdcsManager mgr;
+
+    auto same = [](const std::string &cached, nlohmann::json model) {
+        auto j = nlohmann::json::parse(cached);
+        REQUIRE( j.at("age").get<double>() >= 0 );
+        j.erase("age");
+        model.erase("age");
+        REQUIRE( j == model );
+    };
+
+    // nothing received yet
+    nlohmann::json j;
+    to_json(j, mgr.getAdcs());
+    same(mgr.getAdcsJson(), j);
+    to_json(j, mgr.getTfrs());
+    same(mgr.getTfrsJson(), j);
+
+    ussp::payload::PayloadAdcsFeed adcs;
+    adcs.acs_mode_active.mode = adcs.acs_mode_active.NOOP;
+    adcs.r_eci.x = 7.0e6;
+    mgr.setAdcs(adcs);
+    ussp::tfrs::ReceiverNavigationState tfrs;
+    tfrs.utc_time = 1234;
+    mgr.setTfrs(tfrs);
+
+    auto first = mgr.getAdcsJson();
+    to_json(j, mgr.getAdcs());
+    same(first, j);
+    to_json(j, mgr.getTfrs());
+    same(mgr.getTfrsJson(), j);
+
+    // the age still advances between messages
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    auto again = nlohmann::json::parse(mgr.getAdcsJson());
+    REQUIRE( again.at("age").get<double>() > nlohmann::json::parse(first).at("age").get<double>() );
+
+    // and a new message replaces the body
+    adcs.r_eci.x = 7.1e6;
+    mgr.setAdcs(adcs);
+    auto updated = nlohmann::json::parse(mgr.getAdcsJson());
+    REQUIRE( updated.at("hk").at("r_eci").at("x").get<double>() == 7.1e6 );
+}
+
+TEST_CASE("serialized response benchmark", "[!hide][benchmark]") {
+    AdcsManager mgr;
+    ussp::payload::PayloadAdcsFeed adcs;
+    adcs.r_eci.x = 7.0e6;
+    mgr.setAdcs(adcs);
+
+    BENCHMARK("getAdcs + dump") {
+        nlohmann::json j;
+        to_json(j, mgr.getAdcs());
+        return j.dump();
+    };
+    BENCHMARK("getAdcsJson") {
+        return mgr.getAdcsJson();
+    };
+}
+
+TEST_CASE("seqlock readers never see torn values", "[adcs][stress]") {
+    struct Wide {
+        uint64_t v[32];
+    };
+    SeqLock<Wide> lock;
+    REQUIRE( lock.version() == 0 );
+
+    std::atomic<bool> done{false};
+    std::atomic<int> torn{0};
+    std::atomic<uint64_t> reads{0};
+    std::vector<std::thread> readers;
+    for (int r = 0; r < 3; r++) {
+        readers.emplace_back([&] {
+            uint64_t last = 0;
+            while (!done) {
+                uint64_t version;
+                Wide w = lock.load(&version);
+                for (auto x : w.v) {
+                    if (x != w.v[0]) torn++;
+                }
+                // each value is the version it was stored as
+                if (w.v[0] != version || version < last) torn++;
+                last = version;
+                reads++;
+            }
+        });
+    }
+
+    Wide w;
+    for (uint64_t i = 1; i <= 200000; i++) {
+        for (auto &x : w.v) x = i;
+        lock.store(w);
+    }
+    done = true;
+    for (auto &t : readers) {
+        t.join();
+    }
+    REQUIRE( torn == 0 );
+    REQUIRE( reads > 0 );
+    REQUIRE( lock.version() == 200000 );
+}
+
+TEST_CASE("history readers never see torn samples", "[adcs][stress]") {
+    struct Wide {
+        uint64_t v[32];
+    };
+    TelemetryHistory<Wide> history(64);
+
+    std::atomic<bool> done{false};
+    std::atomic<int> torn{0};
+    std::atomic<uint64_t> reads{0};
+    std::vector<std::thread> readers;
+    for (int r = 0; r < 3; r++) {
+        readers.emplace_back([&, r] {
+            TelemetryHistory<Wide>::Entry before, after;
+            while (!done) {
+                // each sample's values are its time
+                auto check = [&](const TelemetryHistory<Wide>::Entry &e) {
+                    for (auto x : e.msg.v) {
+                        if (x != e.time) torn++;
+                    }
+                };
+                if (r == 0) {
+                    auto all = history.range(0, 1e9);
+                    for (size_t i = 0; i < all.size(); i++) {
+                        check(all[i]);
+                        if (i > 0 && all[i].time <= all[i - 1].time) torn++;
+                    }
+                } else if (history.bracket(reads * 7919 % 200000, &before, &after)) {
+                    check(before);
+                    check(after);
+                    if (after.time < before.time) torn++;
+                }
+                reads++;
+            }
+        });
+    }
+
+    Wide w;
+    for (uint64_t i = 1; i <= 200000; i++) {
+        for (auto &x : w.v) x = i;
+        history.push(i, w);
+    }
+    done = true;
+    for (auto &t : readers) {
+        t.join();
+    }
+    REQUIRE( torn == 0 );
+    REQUIRE( reads > 0 );
+    REQUIRE( history.size() == 64 );
+    REQUIRE( history.range(0, 1e9).front().time == 200000 - 63 );
+}
+
+TEST_CASE("ADCS and TFRS readers run alongside the CAN thread", "[adcs][stress]") {
+    AdcsManager mgr;
+    std::atomic<bool> done{false};
+    std::atomic<int> torn{0};
+
+    // every field of each message carries the same counter
+    std::thread writer([&] {
+        ussp::payload::PayloadAdcsFeed adcs;
+        ussp::tfrs::ReceiverNavigationState tfrs;
+        for (int i = 0; !done; i++) {
+            // small enough to be exact in a float
+            int v = i % (1 << 20) + 1;
+            adcs.r_eci.x = adcs.r_eci.y = adcs.r_eci.z = v;
+            adcs.unix_timestamp = v;
+            tfrs.ecef_pos_x = tfrs.ecef_pos_y = tfrs.ecef_pos_z = v;
+            tfrs.utc_time = v;
+            mgr.setAdcs(adcs);
+            mgr.setTfrs(tfrs);
+        }
+    });
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(200);
+    int reads = 0;
+    while (std::chrono::steady_clock::now() < deadline) {
+        auto a = mgr.getAdcs();
+        if (a.hkIsSet()) {
+            auto eci = a.getHk().getREci();
+            if (eci.getX() != eci.getY() || eci.getY() != eci.getZ()
+                || eci.getX() != a.getHk().getUnixTimestamp()) {
+                torn++;
+            }
+            // age is computed per read
+            if (a.getAge() < 0) torn++;
+        }
+        auto t = mgr.getTfrs();
+        if (t.getEcefPosX() != t.getEcefPosY() || t.getEcefPosY() != t.getEcefPosZ()) {
+            torn++;
+        }
+        reads++;
+    }
+    done = true;
+    writer.join();
+    REQUIRE( torn == 0 );
+    REQUIRE( reads > 0 );
+}
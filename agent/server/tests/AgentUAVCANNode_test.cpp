@@ -0,0 +1,217 @@
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <future>
+#include <thread>
+#include <vector>
+
+#include "AgentUAVCANNode.h"
+#include "VirtualCan.h"
+#include <ussp/payload/PayloadAdcsFeed.hpp>
+
+// Note, Catch2 defines conflict with uavcan defines, so include this last
+#include "catch2/catch.hpp"
+
+using namespace std;
+
+class SecretNode {
+ public:
+    /// make the loop's next epoll_wait fail
+    static void breakEpoll(AgentUAVCANNode &node) {
+        int devnull = open("/dev/null", O_RDONLY | O_CLOEXEC);
+        dup2(devnull, node.epoll_fd);
+        close(devnull);
+    }
+};
+
+namespace {
+
+struct CountingRole : public AgentUAVCANNode::Role {
+    int attached = 0;
+    int detached = 0;
+    void attach(uavcan_linux::Node &) override { attached++; }
+    void detach() override { detached++; }
+    void addStats(UAVCANStats &stats) const override {
+        UAVCANSubscriptionStats sub;
+        sub.name = "counting";
+        sub.messages = attached;
+        stats.subscriptions.push_back(sub);
+    }
+};
+
+struct FeedRole : public AgentUAVCANNode::Role {
+    uavcan_linux::SubscriberPtr<ussp::payload::PayloadAdcsFeed> sub;
+    promise<uint64_t> received;
+    void attach(uavcan_linux::Node &node) override {
+        sub = node.makeSubscriber<ussp::payload::PayloadAdcsFeed>(
+            [this](const uavcan::ReceivedDataStructure<ussp::payload::PayloadAdcsFeed> &msg) {
+                received.set_value(msg.getMonotonicTimestamp().toUSec());
+            });
+    }
+    void detach() override { sub.reset(); }
+    void addPoolDemand(UAVCANPoolDemand &demand) const override {
+        demand.addSubscriber<ussp::payload::PayloadAdcsFeed>();
+    }
+};
+
+uint64_t monotonicUs() {
+    return chrono::duration_cast<chrono::microseconds>(
+        chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+}  // namespace
+
+TEST_CASE("uavcan node without an interface", "[uavcan]") {
+    AgentUAVCANNode node("can0", 101);
+    CountingRole role;
+    node.addRole(&role);
+
+    SECTION("tasks wait for the loop, then run on stop") {
+        int ran = 0;
+        node.post([&ran] { ran++; });
+        REQUIRE(ran == 0);
+        node.stop();
+        REQUIRE(ran == 1);
+        // once stopped, tasks run straight away
+        node.post([&ran] { ran++; });
+        REQUIRE(ran == 2);
+        REQUIRE(role.attached == 0);
+    }
+
+    SECTION("stats of a node that isn't up") {
+        auto stats = node.getStats();
+        REQUIRE_FALSE(stats.up);
+        REQUIRE(stats.transfers_rx == 0);
+        REQUIRE(stats.ifaces.size() == 1);
+        REQUIRE(stats.ifaces[0].name == "can0");
+        REQUIRE(stats.subscriptions.size() == 1);
+        REQUIRE(stats.subscriptions[0].name == "counting");
+        REQUIRE(stats.pool.capacity == 0);
+        REQUIRE(stats.pool.needed == 0);
+    }
+
+    SECTION("roles can be removed") {
+        node.removeRole(&role);
+        node.stop();
+        REQUIRE(role.attached == 0);
+    }
+}
+
+TEST_CASE("uavcan node whose event loop fails", "[uavcan]") {
+    VirtualCanBus bus;
+    AgentUAVCANNode node(bus.connect(), "vcan", 101);
+    CountingRole role;
+    node.addRole(&role);
+    node.start();
+    REQUIRE(role.attached == 1);
+
+    node.post([&node] { SecretNode::breakEpoll(node); });
+    // once the loop has given up, nothing is left waiting on it
+    auto stats = async(launch::async, [&node] {
+        this_thread::sleep_for(chrono::milliseconds(100));
+        return node.getStats();
+    });
+    REQUIRE(stats.wait_for(chrono::seconds(2)) == future_status::ready);
+    REQUIRE_FALSE(stats.get().up);
+    REQUIRE(role.detached == 1);
+
+    int ran = 0;
+    node.post([&ran] { ran++; });
+    REQUIRE(ran == 1);
+    node.removeRole(&role);
+    node.stop();
+}
+
+TEST_CASE("uavcan node event loop", "[!hide][adcs-integration]") {
+    AgentUAVCANNode node("can0", 101);
+    CountingRole first;
+    node.addRole(&first);
+    node.start();
+    REQUIRE(first.attached == 1);
+
+    // everything runs on the one loop thread
+    promise<thread::id> loop_id;
+    node.post([&loop_id] { loop_id.set_value(this_thread::get_id()); });
+    auto posted = loop_id.get_future();
+    REQUIRE(posted.wait_for(chrono::seconds(1)) == future_status::ready);
+    REQUIRE(posted.get() != this_thread::get_id());
+
+    CountingRole second;
+    node.addRole(&second);
+    node.removeRole(&second);
+    REQUIRE(second.attached == 1);
+    REQUIRE(second.detached == 1);
+
+    auto stats = node.getStats();
+    REQUIRE(stats.up);
+    REQUIRE(stats.subscriptions.size() == 1);
+    REQUIRE(stats.subscriptions[0].messages == 1);
+
+    node.stop();
+    REQUIRE(first.detached >= 1);
+    REQUIRE(second.detached == 1);
+}
+
+TEST_CASE("uavcan frames keep their arrival time", "[!hide][adcs-integration]") {
+    AgentUAVCANNode node("can0", 101);
+    FeedRole role;
+    node.addRole(&role);
+    node.start();
+
+    auto peer = uavcan_linux::makeNode(vector<string>{"can0"}, "peer",
+                                       uavcan::protocol::SoftwareVersion(),
+                                       uavcan::protocol::HardwareVersion(), uavcan::NodeID(102));
+    uavcan::Publisher<ussp::payload::PayloadAdcsFeed> pub(*peer);
+    REQUIRE(pub.init() >= 0);
+
+    // hold the loop up while the message arrives; it is timestamped by the
+    // kernel, not when the loop gets around to reading it
+    promise<void> stalled;
+    uint64_t stall_end = 0;
+    node.post([&stalled, &stall_end] {
+        stalled.set_value();
+        this_thread::sleep_for(chrono::milliseconds(200));
+        stall_end = monotonicUs();
+    });
+    stalled.get_future().wait();
+    uint64_t sent = monotonicUs();
+    REQUIRE(pub.broadcast(ussp::payload::PayloadAdcsFeed()) >= 0);
+    peer->spin(uavcan::MonotonicDuration::fromMSec(20));
+
+    auto received = role.received.get_future();
+    REQUIRE(received.wait_for(chrono::seconds(1)) == future_status::ready);
+    uint64_t at = received.get();
+    REQUIRE(at >= sent);
+    REQUIRE(at < stall_end);
+
+    node.stop();
+    node.removeRole(&role);
+}
+
+TEST_CASE("uavcan node memory pool", "[!hide][adcs-integration]") {
+    AgentUAVCANNode node("can0", 101, 16 * 1024);
+    FeedRole role;
+    node.addRole(&role);
+    node.start();
+
+    auto peer = uavcan_linux::makeNode(vector<string>{"can0"}, "peer",
+                                       uavcan::protocol::SoftwareVersion(),
+                                       uavcan::protocol::HardwareVersion(), uavcan::NodeID(102));
+    uavcan::Publisher<ussp::payload::PayloadAdcsFeed> pub(*peer);
+    REQUIRE(pub.init() >= 0);
+    REQUIRE(pub.broadcast(ussp::payload::PayloadAdcsFeed()) >= 0);
+    peer->spin(uavcan::MonotonicDuration::fromMSec(20));
+    REQUIRE(role.received.get_future().wait_for(chrono::seconds(1)) == future_status::ready);
+
+    auto stats = node.getStats();
+    REQUIRE(stats.pool.block_size == uavcan::MemPoolBlockSize);
+    REQUIRE(stats.pool.capacity == 16 * 1024 / uavcan::MemPoolBlockSize);
+    // the feed was reassembled in the pool, and given back
+    REQUIRE(stats.pool.peak > stats.pool.used);
+    REQUIRE(stats.pool.needed > 0);
+    REQUIRE(stats.pool.needed <= stats.pool.capacity);
+
+    node.stop();
+    node.removeRole(&role);
+}
@@ -1,12 +1,16 @@
+#include <sys/stat.h>
 #include <unistd.h>
 #include <fstream>
+#include <memory>
 #include <thread>
 #include <chrono>
 #include "Config.h"
 #include "Agent.h"
 #include "Log.h"
+#include "AgentUAVCANNode.h"
 #include "AgentUAVCANServer.h"
 #include "Adaptor.h"
+#include "VirtualCan.h"
 
 // Note, Catch2 defines conflict with uavcan defines, so include this last
 #include "catch2/catch.hpp"
@@ -292,6 +296,217 @@ TEST_CASE("setup, send -> [fake collect/transfer/deliver] -> query -> retrieve",
     }
 }
 
+TEST_CASE("receive_file", "[agent][api]") {
+    stringstream dummy_out;
+    Log::setOut(dummy_out);
+
+    AgentConfig cfg;
+    char worktmpl[] = "/tmp/unittest_agentXXXXXX";
+    char *dtmp = mkdtemp(worktmpl);
+    char *argv[] = {strdup("UNITTEST"), strdup("-w"), dtmp, NULL};
+    int argc = (sizeof(argv) / sizeof(argv[0])) - 1;
+    REQUIRE(cfg.parseOptions(argc, argv) == true);
+    Agent a(cfg);
+    string transfers = string(dtmp) + "/transfers/";
+
+    auto spool = [](const string &dir) {
+        string tmpl = dir + "/onion-XXXXXX";
+        char *name = strdup(tmpl.c_str());
+        FILE *f = fdopen(mkstemp(name), "wb");
+        fputs("The quick brown fox jumps over the lazy dog", f);
+        fclose(f);
+        string result(name);
+        free(name);
+        return result;
+    };
+
+    SendFileRequest req;
+    req.setTopic("test");
+    req.setDestination("ground");
+    req.setFilepath("/payload/fox.txt");
+
+    auto check_received = [&](const string &spoolfile) {
+        auto resp = a.receive_file(req, spoolfile);
+        REQUIRE(resp.code == Code::Ok);
+        string id = resp.result.getUUID();
+        string data = transfers + id + ".data.oort";
+        REQUIRE(access(data.c_str(), F_OK) == 0);
+        REQUIRE(access(spoolfile.c_str(), F_OK) != 0);
+
+        auto meta = a.meta(id);
+        REQUIRE(meta.code == Code::Ok);
+        REQUIRE(meta.result.getFileInfo().getCrc32() == "414fa339");
+        REQUIRE(meta.result.getFileInfo().getSize() == 43);
+        REQUIRE(meta.result.getFileInfo().getPath() == "/payload/fox.txt");
+        REQUIRE(meta.result.getDestination() == "ground");
+    };
+
+    SECTION("same filesystem") {
+        check_received(spool(dtmp));
+    }
+
+    SECTION("cross-device copy") {
+        // /dev/shm is usually a separate tmpfs; skip quietly if not
+        struct stat shm, work;
+        if (stat("/dev/shm", &shm) == 0 && stat(dtmp, &work) == 0 && shm.st_dev != work.st_dev) {
+            check_received(spool("/dev/shm"));
+        }
+    }
+
+    SECTION("bad requests") {
+        REQUIRE(a.receive_file(req, "").code == Code::Bad_Request);
+        REQUIRE(a.receive_file(req, string(dtmp) + "/nonexistent").code == Code::Bad_Request);
+        SendFileRequest nodest(req);
+        nodest.setDestination("");
+        string f = spool(dtmp);
+        REQUIRE(a.receive_file(nodest, f).code == Code::Bad_Request);
+        unlink(f.c_str());
+        // nothing left behind in the transfer directory
+        REQUIRE(Files::list_files(transfers).empty());
+    }
+}
+
+TEST_CASE("topic quotas", "[agent][api][quota]") {
+    stringstream dummy_out;
+    Log::setOut(dummy_out);
+
+    AgentConfig cfg;
+    char worktmpl[] = "/tmp/unittest_agentXXXXXX";
+    char *dtmp = mkdtemp(worktmpl);
+    // room for two 43-byte files on "test"
+    char *argv[] = {strdup("UNITTEST"), strdup("-w"), dtmp, strdup("-q"), strdup("test:100::"),
+                    NULL};
+    int argc = (sizeof(argv) / sizeof(argv[0])) - 1;
+    REQUIRE(cfg.parseOptions(argc, argv) == true);
+
+    auto send = [dtmp](Agent &a, const string &topic) {
+        string spool = string(dtmp) + "/spool";
+        ofstream(spool) << "The quick brown fox jumps over the lazy dog";
+        SendFileRequest req;
+        req.setTopic(topic);
+        req.setDestination("ground");
+        auto resp = a.receive_file(req, spool);
+        unlink(spool.c_str());
+        return resp;
+    };
+
+    {
+        Agent a(cfg);
+        REQUIRE(send(a, "test").code == Code::Ok);
+        REQUIRE(send(a, "test").code == Code::Ok);
+        auto refused = send(a, "test");
+        REQUIRE(refused.code == Code::Too_Many_Requests);
+        REQUIRE(refused.err.getRetryAfter() == QUOTA_RETRY_AFTER);
+        // other topics are not affected
+        REQUIRE(send(a, "other").code == Code::Ok);
+    }
+
+    // files already queued count after a restart
+    Agent restarted(cfg);
+    REQUIRE(send(restarted, "test").code == Code::Too_Many_Requests);
+    auto queued = Files::list_files(string(dtmp) + "/transfers", ".meta.oort");
+    REQUIRE(queued.size() == 3);
+
+    // once the collector takes one, the topic has room again
+    for (const auto &name : queued) {
+        string id = chop(name, ".meta.oort");
+        for (string ext : {".data.oort", ".meta.oort"}) {
+            rename((string(dtmp) + "/transfers/" + id + ext).c_str(),
+                   (string(dtmp) + "/uploads/" + id + ext).c_str());
+        }
+    }
+    auto sent = send(restarted, "test");
+    for (int i = 0; i < 100 && sent.code != Code::Ok; i++) {
+        std::this_thread::sleep_for(chrono::milliseconds(10));
+        sent = send(restarted, "test");
+    }
+    REQUIRE(sent.code == Code::Ok);
+}
+
+TEST_CASE("upload_info and consume_upload", "[agent][api]") {
+    stringstream dummy_out;
+    Log::setOut(dummy_out);
+
+    AgentConfig cfg;
+    char worktmpl[] = "/tmp/unittest_agentXXXXXX";
+    char *dtmp = mkdtemp(worktmpl);
+    char *argv[] = {strdup("UNITTEST"), strdup("-w"), dtmp, NULL};
+    int argc = (sizeof(argv) / sizeof(argv[0])) - 1;
+    REQUIRE(cfg.parseOptions(argc, argv) == true);
+    Agent a(cfg);
+
+    // queue a file, then move it to uploads as the collector would
+    string spool = string(dtmp) + "/spool";
+    ofstream(spool) << "The quick brown fox jumps over the lazy dog";
+    SendFileRequest req;
+    req.setTopic("test");
+    req.setDestination("ground");
+    auto sent = a.receive_file(req, spool);
+    REQUIRE(sent.code == Code::Ok);
+    string id = sent.result.getUUID();
+    for (string ext : {".data.oort", ".meta.oort"}) {
+        rename((string(dtmp) + "/transfers/" + id + ext).c_str(),
+               (string(dtmp) + "/uploads/" + id + ext).c_str());
+    }
+
+    string datafile;
+    auto info = a.upload_info(id, &datafile);
+    REQUIRE(info.code == Code::Ok);
+    REQUIRE(info.result.getCrc32() == "414fa339");
+    REQUIRE(datafile == string(dtmp) + "/uploads/" + id + ".data.oort");
+
+    REQUIRE(a.upload_info("0123-abcd", &datafile).code == Code::Bad_Request);
+
+    // serialized fragments match the model
+    auto frags = a.query_available_fragments("test");
+    REQUIRE(frags.result.files.size() == 1);
+    REQUIRE(frags.result.overflow == false);
+    REQUIRE(*frags.result.files[0] == to_jsonstr(a.query_available("test").result.getFiles()[0]));
+
+    a.consume_upload(id);
+    REQUIRE(access(datafile.c_str(), F_OK) != 0);
+    REQUIRE(a.upload_info(id, &datafile).code == Code::Bad_Request);
+}
+
+TEST_CASE("adcs command with the fewest workers", "[agent][adcs]") {
+    stringstream dummy_out;
+    Log::setOut(dummy_out);
+
+    AgentConfig cfg;
+    char worktmpl[] = "/tmp/unittest_agentXXXXXX";
+    char *dtmp = mkdtemp(worktmpl);
+    char *argv[] = {strdup("UNITTEST"), strdup("-w"), dtmp,
+                    strdup("-W"), strdup("2"), strdup("-R"), strdup("1"), NULL};
+    int argc = (sizeof(argv) / sizeof(argv[0])) - 1;
+    REQUIRE(cfg.parseOptions(argc, argv) == true);
+    Agent a(cfg);
+
+    AdcsCommandRequest cmd;
+    cmd.setCommand("IDLE");
+    auto resp = a.adcs_command(cmd);
+    REQUIRE(resp.code == Code::Bad_Request);
+    REQUIRE_THAT(resp.err.getMessage(), Contains("unavailable"));
+
+    // nothing answers on the bus, so each command times out
+    VirtualCanBus bus;
+    AgentUAVCANNode node(bus.connect(), "vcan", 101);
+    node.start();
+    AgentUAVCANClient client(cfg, node);
+    a.setUavClient(&client);
+
+    ResponseCode<AdcsCommandResponse> first;
+    thread waiting([&a, &cmd, &first] { first = a.adcs_command(cmd); });
+    this_thread::sleep_for(chrono::milliseconds(200));
+    // one caller may wait; a second is turned away rather than taking a worker
+    auto second = a.adcs_command(cmd);
+    waiting.join();
+    node.stop();
+
+    REQUIRE(second.code == Code::Too_Many_Requests);
+    REQUIRE(first.code == Code::Bad_Request);
+    REQUIRE_THAT(first.result.getReason(), Contains("timeout"));
+}
+
 TEST_CASE("adcs/tfrs get", "[!hide][adcs-integration]") {
     AgentConfig cfg;
     char *argv[] = {strdup("UNITTEST"),
@@ -328,10 +543,10 @@ TEST_CASE("adcs/tfrs get", "[!hide][adcs-integration]") {
     }
 
     INFO("Starting UAVCAN server");
-    auto can_server = new AgentUAVCANServer(
-      cfg.getCANInterface(), cfg.getUAVCANNodeID());
-    can_server->start();
-    a.setAdcsMgr(&can_server->m_mgr);
+    AgentUAVCANNode can_node(cfg.getCANInterface(), cfg.getUAVCANNodeID());
+    AgentUAVCANServer can_server(can_node);
+    can_node.start();
+    a.setAdcsMgr(&can_server.m_mgr);
 
     SECTION("wait for feed") {
       std::this_thread::sleep_for(chrono::seconds(5));
@@ -436,8 +651,9 @@ TEST_CASE("adcs/tfrs get", "[!hide][adcs-integration]") {
     }
 
     INFO("Starting UAVCAN client");
-    auto can_client = new AgentUAVCANClient(cfg);
-    a.setUavClient(can_client);
+    // on the server's node, which is already running
+    unique_ptr<AgentUAVCANClient> can_client(new AgentUAVCANClient(cfg, can_node));
+    a.setUavClient(can_client.get());
 
     SECTION("adcs command enabled") {
       auto cmd = AdcsCommandRequest();
@@ -460,6 +676,23 @@ TEST_CASE("adcs/tfrs get", "[!hide][adcs-integration]") {
         REQUIRE_THAT(resp.result.getReason(), StartsWith("Invalid aperture"));
       }
       cmd.setAperture("GOPRO");
+      SECTION("pipelined") {
+        vector<string> ids;
+        for (int i = 0; i < 4; i++) {
+          auto resp = a.adcs_command_submit(cmd);
+          REQUIRE(resp.code == Code::Ok);
+          REQUIRE(resp.result.getState() == "pending");
+          ids.push_back(resp.result.getId());
+        }
+        for (auto &id : ids) {
+          auto resp = a.adcs_command_status(id, "5");
+          REQUIRE(resp.code == Code::Ok);
+          REQUIRE(resp.result.getState() == "done");
+          CHECK_THAT(resp.result.getResult().getReason(), StartsWith("Aperture"));
+        }
+        REQUIRE(a.adcs_command_status("nope", "").code == Code::Bad_Request);
+        REQUIRE(a.adcs_command_status(ids[0], "soon").code == Code::Bad_Request);
+      }
       SECTION("basic ok") {
         auto resp = a.adcs_command(cmd);
         INFO(resp.err.getMessage());
@@ -0,0 +1,259 @@
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+#include <system_error>
+#include <string>
+#include <vector>
+
+#include "AgentUAVCANNode.h"
+#include "AgentUAVCANServer.h"
+#include "CanCapture.h"
+#include "VirtualCan.h"
+#include "nlohmann/json.hpp"
+#include <ussp/payload/PayloadAdcsFeed.hpp>
+
+// Note, Catch2 defines conflict with uavcan defines, so include this last
+#include "catch2/catch.hpp"
+
+using namespace std;
+
+namespace {
+
+uint64_t monotonicUs() {
+    return chrono::duration_cast<chrono::microseconds>(
+        chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/// a capture file in a fresh temporary directory, removed afterwards
+struct TempCapture {
+    string dir;
+    string path;
+
+    TempCapture() {
+        char tmpl[] = "/tmp/unittest_capXXXXXX";
+        dir = mkdtemp(tmpl);
+        path = dir + "/can.cap";
+    }
+    ~TempCapture() {
+        unlink(path.c_str());
+        rmdir(dir.c_str());
+    }
+};
+
+/// a feed message like those in adcs_telem_sample.txt
+ussp::payload::PayloadAdcsFeed sampleFeed(unsigned i) {
+    ussp::payload::PayloadAdcsFeed msg;
+    msg.unix_timestamp = 1636051202.13 + i * 0.25;
+    msg.r_eci.x = -6825570;
+    msg.r_eci.y = -945956.7;
+    msg.r_eci.z = 560650.2;
+    msg.control_error_q.q1 = 0.0058;
+    msg.control_error_q.q2 = 0.000248;
+    msg.control_error_q.q3 = 0.015588;
+    msg.control_error_q.q4 = 0.999862;
+    msg.q_bo_est.q1 = 0.000735;
+    msg.q_bo_est.q2 = 0.005759;
+    msg.q_bo_est.q3 = 0.988149;
+    msg.q_bo_est.q4 = 0.153391;
+    return msg;
+}
+
+/**
+ * \brief record, with the agent's capture, `count` feed messages broadcast
+ * by a peer every `interval_us`
+ */
+void recordFeed(const string &path, const VirtualCanConfig &config, unsigned count,
+                uint64_t interval_us) {
+    CanCaptureWriter writer(path);
+    VirtualCanBus bus(config);
+    AgentUAVCANNode node(bus.connect(), "vcan", 101);
+    AgentUAVCANServer server(node);
+    node.setCapture(&writer);
+    node.start();
+
+    auto peer = uavcan_linux::makeNode(bus.connect(), "peer",
+                                       uavcan::protocol::SoftwareVersion(),
+                                       uavcan::protocol::HardwareVersion(), uavcan::NodeID(102));
+    uavcan::Publisher<ussp::payload::PayloadAdcsFeed> pub(*peer);
+    REQUIRE(pub.init() >= 0);
+    const uint64_t start = monotonicUs();
+    for (unsigned i = 0; i < count; i++) {
+        REQUIRE(pub.broadcast(sampleFeed(i)) >= 0);
+        peer->spin(uavcan::MonotonicTime::fromUSec(start + (i + 1) * interval_us));
+    }
+    for (int i = 0; i < 500 && server.m_mgr.adcsVersion() < count; i++) {
+        peer->spin(uavcan::MonotonicDuration::fromMSec(10));
+    }
+    node.stop();
+    REQUIRE(server.m_mgr.adcsVersion() == count);
+    REQUIRE(writer.flush());
+}
+
+/// a driver whose one interface never takes a frame
+struct StalledCanDriver : uavcan::ICanDriver, uavcan::ICanIface {
+    int16_t send(const uavcan::CanFrame&, uavcan::MonotonicTime, uavcan::CanIOFlags) override {
+        return 0;
+    }
+    int16_t receive(uavcan::CanFrame&, uavcan::MonotonicTime&, uavcan::UtcTime&,
+                    uavcan::CanIOFlags&) override {
+        return 0;
+    }
+    int16_t configureFilters(const uavcan::CanFilterConfig*, uint16_t) override { return 0; }
+    uint16_t getNumFilters() const override { return 0; }
+    uint64_t getErrorCount() const override { return 0; }
+
+    uavcan::ICanIface *getIface(uint8_t) override { return this; }
+    uint8_t getNumIfaces() const override { return 1; }
+    int16_t select(uavcan::CanSelectMasks &masks, const uavcan::CanFrame *(&)[uavcan::MaxCanIfaces],
+                   uavcan::MonotonicTime deadline) override {
+        // reports the interface writable about every 100ms, but it still refuses
+        const uint64_t now = monotonicUs();
+        usleep(min<uint64_t>(deadline.toUSec() > now ? deadline.toUSec() - now : 0, 100000));
+        masks.read = 0;
+        return 1;
+    }
+};
+
+}  // namespace
+
+TEST_CASE("can capture round trip", "[uavcan]") {
+    TempCapture cap;
+    const uint8_t data[8] = {1, 2, 3, 4, 5, 6, 7, 8};
+    const vector<uavcan::CanFrame> frames{
+        uavcan::CanFrame(0x123, data, 0),
+        uavcan::CanFrame(0x1abcdef | uavcan::CanFrame::FlagEFF, data, 8),
+        uavcan::CanFrame(0x7ff, data, 3),
+    };
+    // 3 hours between the last two, for a long varint
+    const uint64_t gap = 3ULL * 3600 * 1000000;
+    {
+        CanCaptureWriter writer(cap.path);
+        const uint64_t t0 = monotonicUs() + 1000;
+        REQUIRE(writer.write(t0, frames[0], 0));
+        REQUIRE(writer.write(t0 + 5, frames[1], 1));
+        REQUIRE(writer.write(t0 + 5 + gap, frames[2], 0));
+        REQUIRE(writer.getFrames() == 3);
+    }
+
+    SECTION("frames read back as written") {
+        CanCaptureReader reader(cap.path);
+        REQUIRE(reader.getStartUtc() > 1600000000ULL * 1000000);
+        CanCaptureFrame f;
+        REQUIRE(reader.next(f));
+        REQUIRE(f.frame == frames[0]);
+        REQUIRE(f.iface == 0);
+        REQUIRE(f.at_us >= 1000);
+        const uint64_t first = f.at_us;
+        REQUIRE(reader.next(f));
+        REQUIRE(f.frame == frames[1]);
+        REQUIRE(f.frame.isExtended());
+        REQUIRE(f.iface == 1);
+        REQUIRE(f.at_us == first + 5);
+        REQUIRE(reader.next(f));
+        REQUIRE(f.frame == frames[2]);
+        REQUIRE(f.at_us == first + 5 + gap);
+        REQUIRE_FALSE(reader.next(f));
+    }
+
+    SECTION("a record cut short is dropped") {
+        const auto size = ifstream(cap.path, ios::binary | ios::ate).tellg();
+        REQUIRE(truncate(cap.path.c_str(), size - 1) == 0);
+        CanCaptureReader reader(cap.path);
+        CanCaptureFrame f;
+        REQUIRE(reader.next(f));
+        REQUIRE(reader.next(f));
+        REQUIRE(f.frame == frames[1]);
+        REQUIRE_FALSE(reader.next(f));
+    }
+
+    SECTION("other files are refused") {
+        ofstream(cap.path) << "not a capture, but long enough to have a header";
+        REQUIRE_THROWS_AS(CanCaptureReader(cap.path), runtime_error);
+    }
+
+    SECTION("a capture can't be written where there's no directory") {
+        REQUIRE_THROWS_AS(CanCaptureWriter(cap.dir + "/missing/can.cap"), system_error);
+    }
+}
+
+TEST_CASE("captured ADCS feed replays through the agent", "[uavcan]") {
+    TempCapture cap;
+    const unsigned count = 20;
+    const uint64_t interval_us = 10000;
+    recordFeed(cap.path, VirtualCanConfig(), count, interval_us);
+
+    VirtualCanBus bus;
+    AgentUAVCANNode node(bus.connect(), "vcan", 101);
+    AgentUAVCANServer server(node);
+    node.start();
+    auto replay = bus.connect();
+    CanCaptureReader reader(cap.path);
+    const uint64_t start = monotonicUs();
+    REQUIRE(replayCapture(reader, *replay, 10) > count);
+    // spaced as recorded, 10 times faster
+    REQUIRE(monotonicUs() - start >= (count - 1) * interval_us / 10);
+    for (int i = 0; i < 100 && server.m_mgr.adcsVersion() < count; i++) {
+        usleep(10000);
+    }
+    node.stop();
+
+    REQUIRE(server.m_mgr.adcsVersion() == count);
+    auto body = nlohmann::json::parse(server.m_mgr.getAdcsJson());
+    REQUIRE(body.at("hk").at("unix_timestamp").get<double>()
+            == Approx(sampleFeed(count - 1).unix_timestamp));
+}
+
+TEST_CASE("replay drops frames the interface won't take", "[uavcan]") {
+    TempCapture cap;
+    const uint8_t data[1] = {1};
+    {
+        CanCaptureWriter writer(cap.path);
+        REQUIRE(writer.write(monotonicUs(), uavcan::CanFrame(0x123, data, 1), 0));
+    }
+    StalledCanDriver driver;
+    CanCaptureReader reader(cap.path);
+    uint64_t dropped = 0;
+    const uint64_t start = monotonicUs();
+    REQUIRE(replayCapture(reader, driver, 0, &dropped) == 0);
+    REQUIRE(dropped == 1);
+    // given up on after CAN_REPLAY_TX_TIMEOUT_US
+    const uint64_t took = monotonicUs() - start;
+    REQUIRE(took >= 1000000);
+    REQUIRE(took < 2000000);
+}
+
+TEST_CASE("ADCS capture replay benchmark", "[!hide][benchmark]") {
+    TempCapture cap;
+    VirtualCanConfig config;
+    config.bitrate = 0;
+    const unsigned count = 5000;
+    recordFeed(cap.path, config, count, 0);
+
+    for (double speed : {0.0, 1.0}) {
+        VirtualCanBus bus(config);
+        AgentUAVCANNode node(bus.connect(), "vcan", 101);
+        AgentUAVCANServer server(node);
+        node.start();
+        auto replay = bus.connect();
+        CanCaptureReader reader(cap.path);
+        const uint64_t start = monotonicUs();
+        const uint64_t frames = replayCapture(reader, *replay, speed);
+        for (int i = 0; i < 1000 && server.m_mgr.adcsVersion() < count; i++) {
+            usleep(1000);
+        }
+        const double seconds = (monotonicUs() - start) / 1e6;
+        node.stop();
+
+        ostringstream s;
+        s << fixed << setprecision(3) << "speed " << speed << ": " << frames << " frames, "
+          << server.m_mgr.adcsVersion() << "/" << count << " messages decoded in " << seconds
+          << "s, " << frames / seconds << " frames/s, "
+          << server.m_mgr.adcsVersion() / seconds << " messages/s";
+        WARN(s.str());
+    }
+}
@@ -0,0 +1,119 @@
+#include <sys/statvfs.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "catch2/catch.hpp"
+
+#include "DiskLedger.h"
+
+using namespace std;
+
+namespace {
+    int64_t avail(const struct statvfs &vfs) {
+        return static_cast<int64_t>(vfs.f_bavail) * vfs.f_frsize;
+    }
+}
+
+TEST_CASE( "reservations reduce available space", "[ledger]") {
+    char worktmpl[] = "/tmp/unittest_ledgerXXXXXX";
+    string dtmp = string(mkdtemp(worktmpl));
+    DiskLedger ledger(60000);
+
+    auto base = avail(ledger.vfs(dtmp));
+    REQUIRE( base > 0 );
+    int64_t seen = -1;
+    auto check = [&seen](int64_t sz, const struct statvfs &vfs) {
+        seen = avail(vfs);
+        return avail(vfs) >= sz;
+    };
+
+    INFO("first reservation sees the full filesystem") {
+        auto r1 = ledger.reserve(dtmp, base / 2, check);
+        REQUIRE( static_cast<bool>(r1) );
+        REQUIRE( seen == base );
+        REQUIRE( ledger.reserved(dtmp) == base / 2 );
+
+        // second one sees what remains, and cannot take it all
+        auto r2 = ledger.reserve(dtmp, base, check);
+        REQUIRE_FALSE( static_cast<bool>(r2) );
+        REQUIRE( seen <= base - base / 2 );
+        REQUIRE( ledger.reserved(dtmp) == base / 2 );
+
+        r1.release();
+        REQUIRE( ledger.reserved(dtmp) == 0 );
+    }
+
+    INFO("scope exit releases") {
+        {
+            auto r = ledger.reserve(dtmp, 4096, check);
+            REQUIRE( static_cast<bool>(r) );
+            REQUIRE( ledger.reserved(dtmp) == 4096 );
+            auto moved = std::move(r);
+            REQUIRE_FALSE( static_cast<bool>(r) );
+            REQUIRE( ledger.reserved(dtmp) == 4096 );
+        }
+        REQUIRE( ledger.reserved(dtmp) == 0 );
+    }
+
+    INFO("written bytes leave the reservation, but count until the next refresh") {
+        auto r = ledger.reserve(dtmp, 8192, check);
+        REQUIRE( static_cast<bool>(r) );
+        r.wrote(3000);
+        REQUIRE( r.size() == 5192 );
+        REQUIRE( ledger.reserved(dtmp) == 5192 );
+        // more than is left only uses up what is left
+        r.wrote(10000);
+        REQUIRE( r.size() == 0 );
+        REQUIRE( ledger.reserved(dtmp) == 0 );
+
+        REQUIRE( static_cast<bool>(ledger.reserve(dtmp, 1, check)) );
+        REQUIRE( seen <= base - 8192 );
+        ledger.invalidate();
+        REQUIRE( static_cast<bool>(ledger.reserve(dtmp, 1, check)) );
+        REQUIRE( seen == avail(ledger.vfs(dtmp)) );
+    }
+
+    INFO("missing directory") {
+        REQUIRE_THROWS( ledger.reserve(dtmp + "/nodir", 1, check) );
+    }
+
+    rmdir(dtmp.c_str());
+}
+
+TEST_CASE( "concurrent reservations never overcommit", "[ledger]") {
+    char worktmpl[] = "/tmp/unittest_ledgerXXXXXX";
+    string dtmp = string(mkdtemp(worktmpl));
+    DiskLedger ledger(60000);
+
+    // pretend only 10 units of 1MB are available
+    const int64_t unit = 1024 * 1024;
+    auto base = avail(ledger.vfs(dtmp));
+    REQUIRE( base > 10 * unit );
+    auto check = [&](int64_t sz, const struct statvfs &vfs) {
+        return avail(vfs) - (base - 10 * unit) >= sz;
+    };
+
+    atomic<int> granted{0};
+    vector<DiskLedger::Reservation> held(32);
+    vector<thread> threads;
+    for (int i = 0; i < 32; i++) {
+        threads.emplace_back([&, i]() {
+            held[i] = ledger.reserve(dtmp, unit, check);
+            if (held[i]) {
+                granted++;
+            }
+        });
+    }
+    for (auto &t : threads) {
+        t.join();
+    }
+    REQUIRE( granted == 10 );
+    REQUIRE( ledger.reserved(dtmp) == 10 * unit );
+    held.clear();
+    REQUIRE( ledger.reserved(dtmp) == 0 );
+
+    rmdir(dtmp.c_str());
+}
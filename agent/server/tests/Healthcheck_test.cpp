@@ -1,9 +1,14 @@
 #include "catch2/catch.hpp"
 
 #include <unistd.h>
+#include <atomic>
+#include <chrono>
 #include <fstream>
+#include <thread>
 
+#include "AgentUAVCANNode.h"
 #include "AgentUAVCANServer.h"
+#include "Healthcheck.h"
 #include "Log.h"
 
 #include <uavcan_linux/uavcan_linux.hpp>
@@ -48,12 +53,15 @@ TEST_CASE("healthcheck response") {
     Log::setLevel(Log::Info);
     Log::setOut(cout);
 
-    AgentUAVCANServer server("can0", 101);
+    // the node isn't started, so no CAN interface is needed
+    AgentUAVCANNode node("can0", 101);
+    AgentUAVCANServer server(node);
 
     SECTION("successful output") {
         ReceivedDataStructureSpec<ussp::payload::PayloadHealthCheck::Request> req;
         ussp::payload::PayloadHealthCheck::Response rsp;
         server.setPayloadHealthcheckCommand("./build/server/tests/utils/hk_success.sh");
+        server.refreshHealthcheck();
         server.healthCheckHandler(req, rsp);
         REQUIRE(rsp.response_code == 0);
         REQUIRE(rsp.health_state == 0);
@@ -64,6 +72,7 @@ TEST_CASE("healthcheck response") {
         ReceivedDataStructureSpec<ussp::payload::PayloadHealthCheck::Request> req;
         ussp::payload::PayloadHealthCheck::Response rsp;
         server.setPayloadHealthcheckCommand("./build/server/tests/utils/hk_error.sh");
+        server.refreshHealthcheck();
         server.healthCheckHandler(req, rsp);
         REQUIRE(rsp.response_code == 0);
         REQUIRE(rsp.health_state == 122);
@@ -74,6 +83,7 @@ TEST_CASE("healthcheck response") {
         ReceivedDataStructureSpec<ussp::payload::PayloadHealthCheck::Request> req;
         ussp::payload::PayloadHealthCheck::Response rsp;
         server.setPayloadHealthcheckCommand("./build/server/tests/utils/hk_invalid_json.sh");
+        server.refreshHealthcheck();
         server.healthCheckHandler(req, rsp);
         REQUIRE(rsp.response_code == 22);
         REQUIRE(rsp.health_state == 0);
@@ -83,6 +93,7 @@ TEST_CASE("healthcheck response") {
         ReceivedDataStructureSpec<ussp::payload::PayloadHealthCheck::Request> req;
         ussp::payload::PayloadHealthCheck::Response rsp;
         server.setPayloadHealthcheckCommand("./foo/bar/baz/payload_healthcheck");
+        server.refreshHealthcheck();
         server.healthCheckHandler(req, rsp);
         REQUIRE(rsp.response_code == 22);
         REQUIRE(rsp.health_state == 127);
@@ -92,6 +103,7 @@ TEST_CASE("healthcheck response") {
         ReceivedDataStructureSpec<ussp::payload::PayloadHealthCheck::Request> req;
         ussp::payload::PayloadHealthCheck::Response rsp;
         server.setPayloadHealthcheckCommand("./build/server/tests/utils/hk_long_response.sh");
+        server.refreshHealthcheck();
         server.healthCheckHandler(req, rsp);
         REQUIRE(rsp.response_code == 22);
         REQUIRE(rsp.health_state == 137);
@@ -101,6 +113,7 @@ TEST_CASE("healthcheck response") {
         ReceivedDataStructureSpec<ussp::payload::PayloadHealthCheck::Request> req;
         ussp::payload::PayloadHealthCheck::Response rsp;
         server.setPayloadHealthcheckCommand("./build/server/tests/utils/hk_hanging.sh");
+        server.refreshHealthcheck();
         server.healthCheckHandler(req, rsp);
         REQUIRE(rsp.response_code == 0);
         REQUIRE(rsp.health_state == 137); // Because of the SIGKILL
@@ -108,10 +121,11 @@ TEST_CASE("healthcheck response") {
     }
 
     SECTION("timeout, again") {
-        // Should confirm that a SIGCHLD from the previous section wasn't left pending
+        // Should confirm that the killed child from the previous section was reaped
         ReceivedDataStructureSpec<ussp::payload::PayloadHealthCheck::Request> req;
         ussp::payload::PayloadHealthCheck::Response rsp;
         server.setPayloadHealthcheckCommand("./build/server/tests/utils/hk_hanging.sh");
+        server.refreshHealthcheck();
         server.healthCheckHandler(req, rsp);
         REQUIRE(rsp.response_code == 0);
         REQUIRE(rsp.health_state == 137); // Because of the SIGKILL
@@ -122,6 +136,7 @@ TEST_CASE("healthcheck response") {
         ReceivedDataStructureSpec<ussp::payload::PayloadHealthCheck::Request> req;
         ussp::payload::PayloadHealthCheck::Response rsp;
         server.setPayloadHealthcheckCommand("./build/server/tests/utils/hk_invalid_int_metrics.sh");
+        server.refreshHealthcheck();
         server.healthCheckHandler(req, rsp);
         REQUIRE(rsp.response_code == 50);
         REQUIRE(rsp.health_state == 0);
@@ -131,6 +146,7 @@ TEST_CASE("healthcheck response") {
         ReceivedDataStructureSpec<ussp::payload::PayloadHealthCheck::Request> req;
         ussp::payload::PayloadHealthCheck::Response rsp;
         server.setPayloadHealthcheckCommand("./build/server/tests/utils/hk_long_array.sh");
+        server.refreshHealthcheck();
         server.healthCheckHandler(req, rsp);
         REQUIRE(rsp.response_code == 50);
         REQUIRE(rsp.health_state == 0);
@@ -140,6 +156,7 @@ TEST_CASE("healthcheck response") {
         ReceivedDataStructureSpec<ussp::payload::PayloadHealthCheck::Request> req;
         ussp::payload::PayloadHealthCheck::Response rsp;
         server.setPayloadHealthcheckCommand("./build/server/tests/utils/hk_garbage.sh");
+        server.refreshHealthcheck();
         server.healthCheckHandler(req, rsp);
         REQUIRE(rsp.response_code == 22);
         REQUIRE(rsp.health_state == 0);
@@ -149,8 +166,82 @@ TEST_CASE("healthcheck response") {
         ReceivedDataStructureSpec<ussp::payload::PayloadHealthCheck::Request> req;
         ussp::payload::PayloadHealthCheck::Response rsp;
         server.setPayloadHealthcheckCommand("./build/server/tests/utils/hk_trailing_garbage.sh");
+        server.refreshHealthcheck();
         server.healthCheckHandler(req, rsp);
         REQUIRE(rsp.response_code == 22);
         REQUIRE(rsp.health_state == 0);
     }
 }
+
+TEST_CASE("healthcheck runs in the background") {
+    Healthcheck hc("./build/server/tests/utils/hk_success.sh", 2);
+    ussp::payload::PayloadHealthCheck::Response rsp;
+
+    SECTION("nothing to answer with yet") {
+        hc.respond(rsp);
+        REQUIRE(rsp.response_code == STALE_RESPONSE_CODE);
+        REQUIRE_FALSE(hc.latest().valid);
+        auto stats = hc.stats();
+        REQUIRE_FALSE(stats.fresh);
+        REQUIRE(stats.age_ms == -1);
+    }
+
+    SECTION("answered from the latest result") {
+        hc.start();
+        for (int i = 0; i < 100 && !hc.latest().valid; i++) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        }
+        hc.respond(rsp);
+        REQUIRE(rsp.response_code == 0);
+        REQUIRE_VALID_OUTPUT();
+        REQUIRE(hc.latest().error.empty());
+        hc.stop();
+    }
+
+    SECTION("a refresh can be asked for between periods") {
+        hc.setFreshness(30);
+        std::atomic<int> runs{0};
+        hc.setListener([&runs] { runs++; });
+        hc.start();
+        for (int i = 0; i < 100 && runs == 0; i++) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        }
+        REQUIRE(runs == 1);
+        REQUIRE(hc.fresh());
+        hc.requestRefresh();
+        for (int i = 0; i < 100 && runs == 1; i++) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        }
+        REQUIRE(runs == 2);
+        hc.stop();
+    }
+
+    SECTION("errors are kept with the result") {
+        hc.setCommand("./build/server/tests/utils/hk_invalid_json.sh");
+        hc.refresh();
+        auto result = hc.latest();
+        REQUIRE(result.valid);
+        REQUIRE(result.rsp.response_code == INVALID_OUTPUT_RESPONSE_CODE);
+        REQUIRE(!result.error.empty());
+
+        // and reported with its age
+        auto stats = hc.stats();
+        REQUIRE(stats.fresh);
+        REQUIRE(stats.age_ms >= 0);
+        REQUIRE(stats.age_ms < 1000);
+        REQUIRE(stats.response_code == INVALID_OUTPUT_RESPONSE_CODE);
+        REQUIRE(stats.error == result.error);
+    }
+
+    SECTION("a result outside the freshness window is not served") {
+        hc.setFreshness(1);
+        hc.refresh();
+        std::this_thread::sleep_for(std::chrono::milliseconds(1100));
+        hc.respond(rsp);
+        REQUIRE(rsp.response_code == STALE_RESPONSE_CODE);
+        auto stats = hc.stats();
+        REQUIRE_FALSE(stats.fresh);
+        REQUIRE(stats.age_ms >= 1100);
+        REQUIRE(stats.response_code == 0);
+    }
+}
@@ -0,0 +1,64 @@
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "catch2/catch.hpp"
+#include "nlohmann/json.hpp"
+
+#include "JsonStream.h"
+
+using namespace std;
+
+TEST_CASE( "JsonStream matches nlohmann dump", "[json]") {
+    stringstream out;
+    JsonStream js(out);
+
+    SECTION("empty containers") {
+        js.beginObject();
+        js.key("a").beginArray().endArray();
+        js.key("b").beginObject().endObject();
+        js.endObject();
+        nlohmann::json expected = {{"a", nlohmann::json::array()}, {"b", nlohmann::json::object()}};
+        REQUIRE( out.str() == expected.dump() );
+    }
+
+    SECTION("scalars and nesting") {
+        vector<string> names {"one", "two", "three"};
+        js.beginObject();
+        js.key("count").value(static_cast<int64_t>(-42));
+        js.key("flag").value(false);
+        js.key("names").stringArray(names);
+        js.key("nested").beginArray();
+        js.beginObject().key("x").value("y").endObject();
+        js.value(true);
+        js.endArray();
+        js.endObject();
+
+        nlohmann::json expected = {
+            {"count", -42},
+            {"flag", false},
+            {"names", names},
+            {"nested", {{{"x", "y"}}, true}},
+        };
+        REQUIRE( out.str() == expected.dump() );
+        REQUIRE( nlohmann::json::parse(out.str()) == expected );
+    }
+
+    SECTION("string escapes") {
+        string s = "quote\" backslash\\ newline\n tab\t bell\x07 utf8 \xc3\xa9";
+        js.beginArray().value(s).endArray();
+        REQUIRE( out.str() == nlohmann::json::array({s}).dump() );
+    }
+
+    SECTION("raw fragments") {
+        nlohmann::json frag = {{"id", "abc"}, {"size", 10}};
+        js.beginObject();
+        js.key("files").beginArray();
+        js.raw(frag.dump());
+        js.raw(frag.dump());
+        js.endArray();
+        js.endObject();
+        nlohmann::json expected = {{"files", {frag, frag}}};
+        REQUIRE( out.str() == expected.dump() );
+    }
+}
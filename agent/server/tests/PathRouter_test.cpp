@@ -0,0 +1,130 @@
+#include <regex.h>
+
+#include <regex>  // NOLINT(build/c++11)
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "catch2/catch.hpp"
+
+#include "PathRouter.h"
+#include "Utils.h"
+
+using namespace std;
+
+namespace {
+    PathTrie sdkRoutes() {
+        PathTrie t;
+        t.add("v1/query_available_files/{topic}", 0);
+        t.add("v1/send_file", 1);
+        t.add("v1/upload/{topic}", 2);
+        t.add("v1/retrieve_file", 3);
+        t.add("v1/uploads/{id}", 4);
+        t.add("v1/adcs", 5);
+        t.add("v1/tfrs", 6);
+        return t;
+    }
+}
+
+TEST_CASE( "path trie matches whole paths", "[router]") {
+    PathTrie t = sdkRoutes();
+    vector<string> caps;
+
+    REQUIRE( t.match("v1/send_file", caps) == 1 );
+    REQUIRE( t.match("v1/tfrs", caps) == 6 );
+    REQUIRE( caps.empty() );
+
+    REQUIRE( t.match("v1/query_available_files/some-topic_1", caps) == 0 );
+    REQUIRE( caps == vector<string>{"some-topic_1"} );
+
+    caps.clear();
+    REQUIRE( t.match("v1/uploads/0123abcd-ef01", caps) == 4 );
+    REQUIRE( caps == vector<string>{"0123abcd-ef01"} );
+
+    SECTION("partial and extended paths don't match") {
+        caps.clear();
+        REQUIRE( t.match("", caps) == -1 );
+        REQUIRE( t.match("v1", caps) == -1 );
+        REQUIRE( t.match("v1/", caps) == -1 );
+        REQUIRE( t.match("v1/send_file/", caps) == -1 );
+        REQUIRE( t.match("v1/send_filex", caps) == -1 );
+        REQUIRE( t.match("v1/send_file/x", caps) == -1 );
+        REQUIRE( t.match("v2/send_file", caps) == -1 );
+        REQUIRE( t.match("v1/query_available_files/", caps) == -1 );
+    }
+
+    SECTION("captures are validated") {
+        caps.clear();
+        REQUIRE( t.match("v1/query_available_files/bad.topic", caps) == -1 );
+        REQUIRE( t.match("v1/uploads/not-hex", caps) == -1 );
+        REQUIRE( t.match("v1/uploads/abc/def", caps) == -1 );
+    }
+}
+
+TEST_CASE( "path trie literals win over captures", "[router]") {
+    PathTrie t;
+    t.add("v1/files/{topic}", 0);
+    t.add("v1/files/all", 1);
+    vector<string> caps;
+    REQUIRE( t.match("v1/files/all", caps) == 1 );
+    REQUIRE( caps.empty() );
+    REQUIRE( t.match("v1/files/other", caps) == 0 );
+    REQUIRE( caps == vector<string>{"other"} );
+
+    REQUIRE_THROWS_AS( t.add("v1/files/all", 2), logic_error );
+    REQUIRE_THROWS_AS( t.add("v1/files/{id}", 2), logic_error );
+}
+
+// compares the onion route walk (POSIX regexes tried in order, as
+// onion_url does) with the trie, for the first and last SDK routes and a
+// miss
+TEST_CASE( "path routing benchmark", "[!hide][benchmark]") {
+    vector<string> patterns {
+        "^v1/query_available_files/([-_[:alnum:]]+)$",
+        "^v1/send_file$",
+        "^v1/upload/([-_[:alnum:]]+)$",
+        "^v1/retrieve_file$",
+        "^v1/uploads/([-[:xdigit:]]+)$",
+        "^v1/adcs$",
+        "^v1/tfrs$",
+        "^.*",
+    };
+    vector<regex_t> compiled(patterns.size());
+    for (size_t i = 0; i < patterns.size(); i++) {
+        REQUIRE( regcomp(&compiled[i], patterns[i].c_str(), REG_EXTENDED) == 0 );
+    }
+    auto regexRoute = [&compiled](const char *path) {
+        regmatch_t match[4];
+        for (size_t i = 0; i < compiled.size(); i++) {
+            if (regexec(&compiled[i], path, 4, match, 0) == 0) {
+                return static_cast<int>(i);
+            }
+        }
+        return -1;
+    };
+    PathTrie t = sdkRoutes();
+
+    for (const char *path : {"v1/query_available_files/images", "v1/tfrs", "v1/nothing"}) {
+        BENCHMARK(string("regex ") + path) {
+            return regexRoute(path);
+        };
+        BENCHMARK(string("trie ") + path) {
+            vector<string> caps;
+            return t.match(path, caps);
+        };
+    }
+
+    for (auto &re : compiled) {
+        regfree(&re);
+    }
+
+    // Agent::checkTopic used to run this before its allowed-topic lookup
+    std::regex topic_re("^[-_[:alnum:]]+$", std::regex_constants::extended);
+    string topic = "some-topic_name";
+    BENCHMARK("topic std::regex") {
+        return regex_match(topic, topic_re);
+    };
+    BENCHMARK("topic isTopicName") {
+        return isTopicName(topic);
+    };
+}
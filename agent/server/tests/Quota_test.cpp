@@ -0,0 +1,172 @@
+#include <chrono>
+#include <string>
+#include <thread>
+
+#include "catch2/catch.hpp"
+
+#include "Quota.h"
+
+using namespace std;
+
+TEST_CASE( "quota spec parsing", "[quota]") {
+    string topic;
+    QuotaLimits limits;
+
+    REQUIRE( parseQuota("images:10M:100:0.5:4", &topic, &limits) );
+    REQUIRE( topic == "images" );
+    REQUIRE( limits.maxBytes == 10 << 20 );
+    REQUIRE( limits.maxFiles == 100 );
+    REQUIRE( limits.rate == 0.5 );
+    REQUIRE( limits.burst == 4 );
+
+    REQUIRE( parseQuota("*:::2", &topic, &limits) );
+    REQUIRE( topic == "*" );
+    REQUIRE( limits.maxBytes == 0 );
+    REQUIRE( limits.maxFiles == 0 );
+    REQUIRE( limits.rate == 2 );
+
+    for (auto bad : {"images", "images:1:2", "bad/topic:1:2:3", "t:1X::", "t::x:", "t:-1::",
+                     "t:1:2:3:4:5", "t::::z"}) {
+        INFO(bad);
+        REQUIRE_FALSE( parseQuota(bad, &topic, &limits) );
+    }
+}
+
+TEST_CASE( "byte and file quotas", "[quota]") {
+    TopicQuotas quotas;
+    QuotaLimits limits;
+    limits.maxBytes = 100;
+    limits.maxFiles = 3;
+    quotas.setLimits("t", limits);
+
+    SECTION("bytes") {
+        auto a1 = quotas.admit("t", 60);
+        REQUIRE( static_cast<bool>(a1) );
+        REQUIRE( quotas.usage("t").bytes == 60 );
+        a1.commit("one");
+
+        auto a2 = quotas.admit("t", 60);
+        REQUIRE_FALSE( static_cast<bool>(a2) );
+        REQUIRE( a2.verdict() == TopicQuotas::OverBytes );
+        REQUIRE( a2.retryAfter() == QUOTA_RETRY_AFTER );
+
+        // an uncommitted admission gives its bytes back
+        {
+            auto a3 = quotas.admit("t", 40);
+            REQUIRE( static_cast<bool>(a3) );
+            REQUIRE( quotas.usage("t").bytes == 100 );
+        }
+        REQUIRE( quotas.usage("t").bytes == 60 );
+
+        // once the collector takes the file, the topic has room again
+        quotas.remove("one");
+        REQUIRE( quotas.usage("t").bytes == 0 );
+        REQUIRE( static_cast<bool>(quotas.admit("t", 60)) );
+    }
+
+    SECTION("files") {
+        for (auto id : {"a", "b", "c"}) {
+            auto a = quotas.admit("t", 1);
+            REQUIRE( static_cast<bool>(a) );
+            a.commit(id);
+        }
+        REQUIRE( quotas.admit("t", 1).verdict() == TopicQuotas::OverFiles );
+        REQUIRE( quotas.usage("t").files == 3 );
+    }
+
+    SECTION("topics are independent, and * is the default") {
+        REQUIRE( static_cast<bool>(quotas.admit("other", 1000)) );
+        QuotaLimits small;
+        small.maxBytes = 10;
+        quotas.setLimits("*", small);
+        REQUIRE_FALSE( static_cast<bool>(quotas.admit("another", 11)) );
+        REQUIRE( static_cast<bool>(quotas.admit("t", 50)) );
+        // all-zero limits remove the quota
+        quotas.setLimits("*", QuotaLimits());
+        REQUIRE( static_cast<bool>(quotas.admit("another", 1000)) );
+    }
+
+    SECTION("files queued at startup") {
+        quotas.add("t", "old", 90);
+        quotas.add("t", "old", 90);
+        REQUIRE( quotas.usage("t").bytes == 90 );
+        REQUIRE( quotas.admit("t", 20).verdict() == TopicQuotas::OverBytes );
+    }
+}
+
+TEST_CASE( "departures are counted as they happen", "[quota]") {
+    TopicQuotas quotas;
+    quotas.admit("a", 10).commit("x");
+    quotas.admit("b", 20).commit("y");
+    quotas.add("b", "z", 30);
+    REQUIRE( quotas.queued().size() == 3 );
+
+    quotas.remove("y");
+    REQUIRE( quotas.usage("a").files == 1 );
+    REQUIRE( quotas.usage("b").files == 1 );
+    REQUIRE( quotas.usage("b").bytes == 30 );
+    // twice, or a file that was never counted, changes nothing
+    quotas.remove("y");
+    quotas.remove("unknown");
+    REQUIRE( quotas.usage("b").bytes == 30 );
+    REQUIRE( quotas.queued().size() == 2 );
+}
+
+TEST_CASE( "rate limit", "[quota]") {
+    TopicQuotas quotas;
+    QuotaLimits limits;
+    limits.rate = 20;
+    limits.burst = 2;
+    quotas.setLimits("t", limits);
+
+    auto a1 = quotas.admit("t", 1);
+    auto a2 = quotas.admit("t", 1);
+    REQUIRE( static_cast<bool>(a1) );
+    REQUIRE( static_cast<bool>(a2) );
+    auto refused = quotas.admit("t", 1);
+    REQUIRE( refused.verdict() == TopicQuotas::OverRate );
+    REQUIRE( refused.retryAfter() >= 1 );
+    // refused files are not counted
+    REQUIRE( quotas.usage("t").files == 2 );
+
+    SECTION("the same limits again don't refill the bucket") {
+        // as the collector pushes them with every handshake
+        quotas.setLimits("t", limits);
+        quotas.setLimits("*", limits);
+        REQUIRE( quotas.admit("t", 1).verdict() == TopicQuotas::OverRate );
+    }
+
+    SECTION("new limits do") {
+        limits.burst = 3;
+        quotas.setLimits("t", limits);
+        REQUIRE( static_cast<bool>(quotas.admit("t", 1)) );
+    }
+
+    SECTION("the bucket refills over time") {
+        this_thread::sleep_for(chrono::milliseconds(100));
+        REQUIRE( static_cast<bool>(quotas.admit("t", 1)) );
+    }
+}
+
+TEST_CASE( "checking a file against the quota counts nothing", "[quota]") {
+    TopicQuotas quotas;
+    QuotaLimits limits;
+    limits.maxBytes = 100;
+    limits.rate = 0.01;
+    limits.burst = 1;
+    quotas.setLimits("t", limits);
+
+    REQUIRE( quotas.check("t", 101).verdict() == TopicQuotas::OverBytes );
+    for (int i = 0; i < 3; i++) {
+        REQUIRE( static_cast<bool>(quotas.check("t", 60)) );
+    }
+    REQUIRE( quotas.usage("t").bytes == 0 );
+
+    // the checks took no rate token, so the one in the bucket admits
+    auto a = quotas.admit("t", 60);
+    REQUIRE( static_cast<bool>(a) );
+    REQUIRE( quotas.check("t", 10).verdict() == TopicQuotas::OverRate );
+    REQUIRE( quotas.check("t", 50).verdict() == TopicQuotas::OverBytes );
+    REQUIRE( quotas.check("t", 40).retryAfter() >= 1 );
+    REQUIRE( quotas.usage("t").bytes == 60 );
+}
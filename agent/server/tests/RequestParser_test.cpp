@@ -0,0 +1,129 @@
+#include <string>
+#include <vector>
+
+#include "catch2/catch.hpp"
+#include "nlohmann/json.hpp"
+
+#include "RequestParser.h"
+
+using namespace std;
+using nlohmann::json;
+
+namespace {
+    // parse with the DOM path, as GetPostData did before
+    template <class T>
+    json viaDom(const string &body) {
+        T req;
+        from_json(json::parse(body), req);
+        json j;
+        to_json(j, req);
+        return j;
+    }
+
+    template <class T>
+    json viaSax(const string &body) {
+        T req;
+        REQUIRE( FastParse(req, body.c_str()) );
+        json j;
+        to_json(j, req);
+        return j;
+    }
+}
+
+TEST_CASE( "direct parse matches DOM parse", "[parser]") {
+    SECTION("send_file") {
+        vector<string> bodies {
+            R"({"destination": "ground", "filepath": "/tmp/x", "topic": "t"})",
+            R"({"topic": "t", "filepath": "/tmp/x", "destination": "ground", "extra": [1, 2]})",
+            R"({"destination": "ground", "filepath": "/tmp/x", "topic": "t",
+                "options": {"reliable": false,
+                            "TTLParams": {"urgent": 1, "bulk": 2, "surplus": 3}}})",
+            R"({"destination": "g\"r\\ound", "filepath": "/tmp/é", "topic": "t",
+                "options": {}})",
+        };
+        for (const auto &body : bodies) {
+            INFO(body);
+            // unknown arrays are left to the DOM path
+            SendFileRequest req;
+            if (body.find('[') != string::npos) {
+                REQUIRE_FALSE( FastParse(req, body.c_str()) );
+            } else {
+                REQUIRE( viaSax<SendFileRequest>(body) == viaDom<SendFileRequest>(body) );
+            }
+        }
+    }
+
+    SECTION("retrieve_file") {
+        string body = R"({"id": "0123-abcd", "save_path": "/tmp/dest", "ignored": 7})";
+        REQUIRE( viaSax<RetrieveFileRequest>(body) == viaDom<RetrieveFileRequest>(body) );
+    }
+
+    SECTION("adcs command") {
+        vector<string> bodies {
+            R"({"command": "IDLE"})",
+            R"({"command": "TRACK", "aperture": "X", "target": {"lat": 10, "lon": -20.5}})",
+            R"({"command": "NADIR", "angle": 1.5, "vector": {"x": 1, "y": 2, "z": 3.25},
+                "quat": {"q1": 0.5, "q2": 0.5, "q3": 0.5, "q4": 0.5}})",
+        };
+        for (const auto &body : bodies) {
+            INFO(body);
+            REQUIRE( viaSax<AdcsCommandRequest>(body) == viaDom<AdcsCommandRequest>(body) );
+        }
+    }
+}
+
+TEST_CASE( "direct parse declines what the DOM path reports", "[parser]") {
+    vector<string> bodies {
+        R"({"destination": "ground", "filepath": "/tmp/x"})",           // missing
+        R"({"destination": 7, "filepath": "/tmp/x", "topic": "t"})",    // wrong type
+        R"({"destination": null, "filepath": "/tmp/x", "topic": "t"})",
+        R"({"destination": "ground", "filepath": "/tmp/x", "topic": "t",
+            "options": {"TTLParams": {"urgent": "soon"}}})",
+        R"({"destination": "ground", "filepath": "/tmp/x", "topic": "t")",  // syntax
+        R"([])",
+        "",
+    };
+    for (const auto &body : bodies) {
+        INFO(body);
+        SendFileRequest req;
+        req.setTopic("untouched");
+        REQUIRE_FALSE( FastParse(req, body.c_str()) );
+        REQUIRE( req.getTopic() == "untouched" );
+        REQUIRE_THROWS_AS( viaDom<SendFileRequest>(body), json::exception );
+    }
+
+    // required fields of an optional object
+    AdcsCommandRequest areq;
+    REQUIRE_FALSE( FastParse(areq, R"({"command": "TRACK", "target": {"lat": 1}})") );
+    REQUIRE_THROWS_AS( viaDom<AdcsCommandRequest>(R"({"command": "TRACK", "target": {"lat": 1}})"),
+                       json::exception );
+}
+
+TEST_CASE( "request parse benchmark", "[!hide][benchmark]") {
+    string body = R"({"destination": "ground", "filepath": "/data/outgoing/image-000123.png",
+        "topic": "images", "options": {"reliable": true,
+        "TTLParams": {"urgent": 9000, "bulk": 43200, "surplus": 172800}}})";
+
+    BENCHMARK("send_file DOM") {
+        SendFileRequest req;
+        from_json(json::parse(body), req);
+        return req.getTopic().size();
+    };
+    BENCHMARK("send_file direct") {
+        SendFileRequest req;
+        FastParse(req, body.c_str());
+        return req.getTopic().size();
+    };
+
+    string adcs = R"({"command": "TRACK", "aperture": "main", "target": {"lat": 47.6, "lon": -122.3}})";
+    BENCHMARK("adcs DOM") {
+        AdcsCommandRequest req;
+        from_json(json::parse(adcs), req);
+        return req.getCommand().size();
+    };
+    BENCHMARK("adcs direct") {
+        AdcsCommandRequest req;
+        FastParse(req, adcs.c_str());
+        return req.getCommand().size();
+    };
+}
@@ -0,0 +1,233 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include "nlohmann/json.hpp"
+#include "onion/onion.hpp"
+#include "onion/url.hpp"
+
+#include "Agent.h"
+#include "Config.h"
+#include "Log.h"
+#include "SdkApiImpl.h"
+#include "UploadGate.h"
+
+// Note, Catch2 defines conflict with uavcan defines, so include this last
+#include "catch2/catch.hpp"
+
+using namespace std;
+using Catch::Matchers::StartsWith;
+
+namespace {
+
+int freePort() {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    REQUIRE( bind(fd, reinterpret_cast<struct sockaddr*>(&addr), len) == 0 );
+    REQUIRE( getsockname(fd, reinterpret_cast<struct sockaddr*>(&addr), &len) == 0 );
+    close(fd);
+    return ntohs(addr.sin_port);
+}
+
+/// connect to `port`, retrying while the listener starts, and send `request`
+int sendRequest(int port, const string &request) {
+    int fd = -1;
+    for (int i = 0; i < 200; i++) {
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        struct sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = htons(port);
+        if (connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) == 0) {
+            break;
+        }
+        close(fd);
+        fd = -1;
+        this_thread::sleep_for(chrono::milliseconds(10));
+    }
+    REQUIRE( fd >= 0 );
+    REQUIRE( write(fd, request.data(), request.size()) == static_cast<ssize_t>(request.size()) );
+    return fd;
+}
+
+/// read until the connection closes or `ms` pass
+string readAll(int fd, int ms = 5000) {
+    string got;
+    auto deadline = chrono::steady_clock::now() + chrono::milliseconds(ms);
+    while (true) {
+        auto left = chrono::duration_cast<chrono::milliseconds>(
+            deadline - chrono::steady_clock::now()).count();
+        struct pollfd p = {fd, POLLIN, 0};
+        if (left <= 0 || poll(&p, 1, left) <= 0) {
+            break;
+        }
+        char buf[65536];
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n <= 0) {
+            break;
+        }
+        got.append(buf, n);
+    }
+    return got;
+}
+
+string get(int port, const string &target, const string &headers = "") {
+    int fd = sendRequest(port, "GET " + target + " HTTP/1.1\r\nHost: localhost\r\n"
+                         "Connection: close\r\n" + headers + "\r\n");
+    string got = readAll(fd);
+    close(fd);
+    return got;
+}
+
+string body(const string &response) {
+    size_t end = response.find("\r\n\r\n");
+    return end == string::npos ? "" : response.substr(end + 4);
+}
+
+/// a client hanging up mid-response must not take the test down with it
+struct IgnoreSigpipe {
+    void (*old)(int) = signal(SIGPIPE, SIG_IGN);
+    ~IgnoreSigpipe() { signal(SIGPIPE, old); }
+};
+
+/// the SDK API served by onion on a loopback port, on a thread of its own
+class SdkServer {
+    Onion::Onion m_onion{O_POOL | O_NO_SIGTERM};
+    Onion::Url m_url{&m_onion};
+    UploadGate m_gate;
+    thread m_thread;
+
+ public:
+    const int port;
+
+    explicit SdkServer(Agent *agent) : m_gate(agent, nullptr), port(freePort()) {
+        // a single worker, so each request is finished before the next starts
+        m_onion.setMaxThreads(1);
+        m_onion.setHostname("127.0.0.1");
+        m_onion.setPort(port);
+        m_url.add("^sdk/", SdkApiImpl(agent));
+        m_thread = thread([this] { m_onion.listen(); });
+    }
+    ~SdkServer() {
+        m_onion.listenStop();
+        m_thread.join();
+    }
+};
+
+}  // namespace
+
+TEST_CASE("consumed uploads are deleted only once sent in full", "[agent][http]") {
+    stringstream dummy_out;
+    Log::setOut(dummy_out);
+    IgnoreSigpipe ignore;
+
+    AgentConfig cfg;
+    char worktmpl[] = "/tmp/unittest_agentXXXXXX";
+    char *dtmp = mkdtemp(worktmpl);
+    char *argv[] = {strdup("UNITTEST"), strdup("-w"), dtmp, NULL};
+    int argc = (sizeof(argv) / sizeof(argv[0])) - 1;
+    REQUIRE(cfg.parseOptions(argc, argv) == true);
+    Agent a(cfg);
+
+    // larger than the socket buffers, so a client that hangs up is noticed
+    string data;
+    for (int i = 0; data.size() < 8 * 1024 * 1024; i++) {
+        data += to_string(i) + "\n";
+    }
+    string spool = string(dtmp) + "/spool";
+    ofstream(spool) << data;
+    SendFileRequest req;
+    req.setTopic("test");
+    auto sent = a.receive_file(req, spool);
+    REQUIRE(sent.code == Code::Ok);
+    string id = sent.result.getUUID();
+    for (string ext : {".data.oort", ".meta.oort"}) {
+        rename((string(dtmp) + "/transfers/" + id + ext).c_str(),
+               (string(dtmp) + "/uploads/" + id + ext).c_str());
+    }
+    string datafile = string(dtmp) + "/uploads/" + id + ".data.oort";
+    string target = "/sdk/v1/uploads/" + id;
+
+    SdkServer server(&a);
+
+    SECTION("a range is served without consuming the upload") {
+        string got = get(server.port, target, "Range: bytes=0-9\r\n");
+        REQUIRE_THAT( got, StartsWith("HTTP/1.1 206") );
+        REQUIRE( body(got) == data.substr(0, 10) );
+        REQUIRE( access(datafile.c_str(), F_OK) == 0 );
+    }
+
+    SECTION("a consumed upload is sent whole, even when a range is asked for") {
+        string got = get(server.port, target + "?consume=true", "Range: bytes=0-9\r\n");
+        REQUIRE_THAT( got, StartsWith("HTTP/1.1 200") );
+        REQUIRE( body(got) == data );
+        REQUIRE( access(datafile.c_str(), F_OK) != 0 );
+    }
+
+    SECTION("an upload is kept if the client hangs up before it is sent") {
+        int fd = sendRequest(server.port, "GET " + target + "?consume=true HTTP/1.1\r\n"
+                             "Host: localhost\r\n\r\n");
+        char buf[1024];
+        REQUIRE( read(fd, buf, sizeof(buf)) > 0 );
+        close(fd);
+
+        // served after the first request has finished, by the single worker
+        string got = get(server.port, target);
+        REQUIRE_THAT( got, StartsWith("HTTP/1.1 200") );
+        REQUIRE( body(got) == data );
+        REQUIRE( access(datafile.c_str(), F_OK) == 0 );
+    }
+}
+
+TEST_CASE("uploads are refused from their headers", "[agent][http][quota]") {
+    stringstream dummy_out;
+    Log::setOut(dummy_out);
+    IgnoreSigpipe ignore;
+
+    AgentConfig cfg;
+    char worktmpl[] = "/tmp/unittest_agentXXXXXX";
+    char *dtmp = mkdtemp(worktmpl);
+    char *argv[] = {strdup("UNITTEST"), strdup("-w"), dtmp, strdup("-q"), strdup("test:100::"),
+                    NULL};
+    int argc = (sizeof(argv) / sizeof(argv[0])) - 1;
+    REQUIRE(cfg.parseOptions(argc, argv) == true);
+    Agent a(cfg);
+    SdkServer server(&a);
+
+    auto put = [&server](const string &topic, const string &data, size_t length) {
+        int fd = sendRequest(server.port, "PUT /sdk/v1/upload/" + topic + "?destination=ground"
+                             " HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n"
+                             "Content-Length: " + to_string(length) + "\r\n\r\n" + data);
+        string got = readAll(fd, 2000);
+        close(fd);
+        return got;
+    };
+
+    SECTION("over quota, with none of the body sent") {
+        string got = put("test", "", 1000);
+        REQUIRE_THAT( got, StartsWith("HTTP/1.1 429") );
+        REQUIRE( got.find("Retry-After: ") != string::npos );
+    }
+
+    SECTION("within quota, with the CRC taken as it was spooled") {
+        string fox = "The quick brown fox jumps over the lazy dog";
+        string got = put("test", fox, fox.size());
+        REQUIRE_THAT( got, StartsWith("HTTP/1.1 200") );
+        string id = nlohmann::json::parse(body(got))["UUID"];
+        auto meta = a.meta(id);
+        REQUIRE( meta.code == Code::Ok );
+        REQUIRE( meta.result.getFileInfo().getCrc32() == "414fa339" );
+    }
+}
@@ -0,0 +1,185 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "catch2/catch.hpp"
+
+#include "Adcs.h"
+#include "StreamServer.h"
+
+using namespace std;
+
+namespace {
+
+int connectTo(int port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    REQUIRE( connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) == 0 );
+    return fd;
+}
+
+int subscribe(int port, const string &target) {
+    int fd = connectTo(port);
+    string req = "GET " + target + " HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    REQUIRE( write(fd, req.data(), req.size()) == static_cast<ssize_t>(req.size()) );
+    return fd;
+}
+
+/// read until `until` has been seen, the connection closes, or `ms` pass
+string readUntil(int fd, const string &until, int ms = 2000) {
+    string got;
+    auto deadline = chrono::steady_clock::now() + chrono::milliseconds(ms);
+    while (got.find(until) == string::npos) {
+        auto left = chrono::duration_cast<chrono::milliseconds>(
+            deadline - chrono::steady_clock::now()).count();
+        struct pollfd p = {fd, POLLIN, 0};
+        if (left <= 0 || poll(&p, 1, left) <= 0) {
+            break;
+        }
+        char buf[4096];
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n <= 0) {
+            break;
+        }
+        got.append(buf, n);
+    }
+    return got;
+}
+
+size_t count(const string &s, const string &what) {
+    size_t n = 0;
+    for (size_t pos = s.find(what); pos != string::npos; pos = s.find(what, pos + 1)) {
+        n++;
+    }
+    return n;
+}
+
+}  // namespace
+
+TEST_CASE("telemetry event stream", "[stream]") {
+    AdcsManager mgr;
+    StreamServer server(&mgr, 0);
+    server.start();
+    REQUIRE( server.getPort() > 0 );
+
+    ussp::payload::PayloadAdcsFeed adcs;
+    adcs.acs_mode_active.mode = adcs.acs_mode_active.NOOP;
+    ussp::tfrs::ReceiverNavigationState tfrs;
+    tfrs.utc_time = 1234;
+
+    SECTION("samples are pushed as they arrive") {
+        mgr.setAdcs(adcs);
+        int fd = subscribe(server.getPort(), "/sdk/v1/adcs/stream");
+        // the current sample comes straight away
+        string got = readUntil(fd, "\n\n", 2000);
+        got += readUntil(fd, "id: 1\n");
+        REQUIRE_THAT( got, Catch::StartsWith("HTTP/1.1 200 OK\r\n") );
+        REQUIRE_THAT( got, Catch::Contains("Content-Type: text/event-stream") );
+        REQUIRE_THAT( got, Catch::Contains("event: adcs\nid: 1\ndata: {") );
+        REQUIRE_THAT( got, Catch::Contains("\"NO-OP\"") );
+
+        mgr.setTfrs(tfrs);
+        mgr.setAdcs(adcs);
+        got = readUntil(fd, "id: 2\n");
+        REQUIRE_THAT( got, Catch::Contains("event: adcs\nid: 2\n") );
+        REQUIRE_THAT( got, !Catch::Contains("tfrs") );
+        close(fd);
+    }
+
+    SECTION("both feeds") {
+        int fd = subscribe(server.getPort(), "/sdk/v1/stream");
+        REQUIRE_THAT( readUntil(fd, "\r\n\r\n"), Catch::Contains("200 OK") );
+        mgr.setTfrs(tfrs);
+        string got = readUntil(fd, "event: tfrs");
+        mgr.setAdcs(adcs);
+        got += readUntil(fd, "event: adcs");
+        got += readUntil(fd, "\n\n", 100);
+        REQUIRE_THAT( got, Catch::Contains("event: tfrs\nid: 1\ndata: {") );
+        REQUIRE_THAT( got, Catch::Contains("\"utc_time\":1234") );
+        REQUIRE_THAT( got, Catch::Contains("event: adcs\nid: 1\ndata: {") );
+        close(fd);
+    }
+
+    SECTION("decimation") {
+        // other parameters may come before and after
+        int fd = subscribe(server.getPort(), "/sdk/v1/adcs/stream?since=0&rate=2&x");
+        REQUIRE_THAT( readUntil(fd, "\r\n\r\n"), Catch::Contains("200 OK") );
+        for (int i = 0; i < 5; i++) {
+            mgr.setAdcs(adcs);
+        }
+        string got = readUntil(fd, "never", 300);
+        REQUIRE( count(got, "event: adcs") == 1 );
+        // the next interval passes on the next sample
+        std::this_thread::sleep_for(chrono::milliseconds(250));
+        mgr.setAdcs(adcs);
+        got = readUntil(fd, "id: 6\n");
+        REQUIRE( count(got, "event: adcs") == 1 );
+        close(fd);
+    }
+
+    SECTION("bad requests") {
+        int fd = subscribe(server.getPort(), "/sdk/v1/nothing");
+        REQUIRE_THAT( readUntil(fd, "\r\n\r\n"), Catch::StartsWith("HTTP/1.1 404") );
+        close(fd);
+        for (string query : {"?rate=0", "?x=1&rate=2hz", "?rate="}) {
+            fd = subscribe(server.getPort(), "/sdk/v1/tfrs/stream" + query);
+            REQUIRE_THAT( readUntil(fd, "\r\n\r\n"), Catch::StartsWith("HTTP/1.1 400") );
+            close(fd);
+        }
+    }
+
+    SECTION("subscribers that go away are dropped") {
+        for (int i = 0; i < STREAM_MAX_CLIENTS * 2; i++) {
+            int fd = subscribe(server.getPort(), "/sdk/v1/adcs/stream");
+            REQUIRE_THAT( readUntil(fd, "\r\n\r\n"), Catch::Contains("200 OK") );
+            close(fd);
+            mgr.setAdcs(adcs);
+        }
+        int fd = subscribe(server.getPort(), "/sdk/v1/adcs/stream");
+        REQUIRE_THAT( readUntil(fd, "\r\n\r\n"), Catch::Contains("200 OK") );
+        close(fd);
+    }
+    server.stop();
+}
+
+TEST_CASE("stream clients must send their request in time", "[stream]") {
+    AdcsManager mgr;
+    StreamServer server(&mgr, 0, 200);
+    server.start();
+
+    // enough idle connections to take every client slot, one of them
+    // having sent part of its request
+    vector<int> idle{connectTo(server.getPort())};
+    string partial = "GET /sdk/v1/adcs/stream HTTP/1.1\r\n";
+    REQUIRE( write(idle[0], partial.data(), partial.size()) ==
+             static_cast<ssize_t>(partial.size()) );
+    while (idle.size() < STREAM_MAX_CLIENTS) {
+        idle.push_back(connectTo(server.getPort()));
+    }
+
+    // they are closed once the header timeout passes
+    for (int fd : idle) {
+        REQUIRE( readUntil(fd, "never", 2000).empty() );
+        char c;
+        REQUIRE( read(fd, &c, 1) == 0 );
+        close(fd);
+    }
+    int fd = subscribe(server.getPort(), "/sdk/v1/adcs/stream");
+    REQUIRE_THAT( readUntil(fd, "\r\n\r\n"), Catch::Contains("200 OK") );
+    // and subscribers are not
+    std::this_thread::sleep_for(chrono::milliseconds(400));
+    mgr.setAdcs(ussp::payload::PayloadAdcsFeed());
+    REQUIRE_THAT( readUntil(fd, "id: 1\n"), Catch::Contains("event: adcs") );
+    close(fd);
+    server.stop();
+}
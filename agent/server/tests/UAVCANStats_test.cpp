@@ -0,0 +1,95 @@
+#include <cstdint>
+
+#include "catch2/catch.hpp"
+
+#include "UAVCANStats.h"
+
+using namespace std;
+
+TEST_CASE("subscription arrival statistics", "[uavcan]") {
+    MessageRate rate;
+
+    SECTION("nothing received") {
+        auto s = rate.stats("feed", 5000000);
+        REQUIRE(s.name == "feed");
+        REQUIRE(s.messages == 0);
+        REQUIRE(s.age_ms == -1);
+        REQUIRE(s.rate == 0);
+    }
+
+    SECTION("a steady 10Hz feed") {
+        for (unsigned i = 0; i < 50; i++) {
+            rate.add(1000000 + i * 100000, 10, i % 32);
+        }
+        auto s = rate.stats("feed", 1000000 + 49 * 100000 + 20000);
+        REQUIRE(s.messages == 50);
+        REQUIRE(s.lost == 0);
+        REQUIRE(s.interval_us == 100000);
+        REQUIRE(s.jitter_us == 0);
+        REQUIRE(s.rate == Approx(10));
+        REQUIRE(s.age_ms == 20);
+
+        // once it stops, the rate falls with the silence
+        s = rate.stats("feed", 1000000 + 49 * 100000 + 2000000);
+        REQUIRE(s.rate == Approx(0.5));
+    }
+
+    SECTION("uneven arrivals show as jitter") {
+        uint64_t t = 1000000;
+        for (unsigned i = 0; i < 100; i++) {
+            t += i % 2 ? 80000 : 120000;
+            rate.add(t, 10, i % 32);
+        }
+        auto s = rate.stats("feed", t);
+        REQUIRE(s.interval_us > 90000);
+        REQUIRE(s.interval_us < 110000);
+        REQUIRE(s.jitter_us > 10000);
+        REQUIRE(s.jitter_us < 30000);
+    }
+
+    SECTION("gaps in the transfer IDs count as lost") {
+        rate.add(1000000, 10, 30);
+        rate.add(1100000, 10, 31);
+        rate.add(1400000, 10, 2);  // 0 and 1 missing, across the wrap
+        rate.add(1500000, 10, 3);
+        REQUIRE(rate.stats("feed", 1500000).lost == 2);
+
+        // another publisher starts its own sequence
+        rate.add(1600000, 11, 17);
+        rate.add(1700000, 11, 18);
+        REQUIRE(rate.stats("feed", 1700000).lost == 2);
+    }
+
+    SECTION("decode errors of past subscribers are kept") {
+        rate.addDecodeErrors(3);
+        REQUIRE(rate.stats("feed", 0).decode_errors == 3);
+    }
+}
+
+TEST_CASE("memory pool demand", "[uavcan]") {
+    UAVCANPoolDemand demand;
+
+    SECTION("single-frame transfers take no buffers") {
+        demand.addRx(7);
+        REQUIRE(demand.blocks(1) == 1);
+        demand.addTx(7);
+        // a queued frame is two blocks
+        REQUIRE(demand.blocks(1) == 4);
+        REQUIRE(demand.blocks(2) == 6);
+    }
+
+    SECTION("multi-frame transfers are buffered until complete") {
+        demand.addRx(40);
+        REQUIRE(demand.blocks(1) == 3);
+        demand.addRx(40);
+        REQUIRE(demand.blocks(1) == 6);
+    }
+
+    SECTION("the largest transfer sent must fit an interface's share of the pool") {
+        demand.addRx(7);
+        demand.addTx(7);
+        demand.addTx(4095);  // 586 frames
+        REQUIRE(demand.blocks(1) == 1171 * 2);
+        REQUIRE(demand.blocks(2) == 1171 * 3);
+    }
+}
@@ -1,6 +1,17 @@
 
+#include <signal.h>
 #include <unistd.h>
 
+#include <chrono>  // NOLINT(build/c++11)
+#include <fstream>
+#include <iomanip>
+#include <regex>  // NOLINT(build/c++11)
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>  // NOLINT(build/c++11)
+#include <vector>
+
 #include "catch2/catch.hpp"
 
 #include "Utils.h"
@@ -16,6 +27,87 @@ TEST_CASE( "UUID uniqueness", "[uuid]") {
     REQUIRE( mkUUID() != mkUUID() );
 }
 
+TEST_CASE( "UUID format", "[uuid]") {
+    for (int i = 0; i < 100; i++) {
+        for (string u : {mkUUID(), mkUUIDv7()}) {
+            INFO(u);
+            REQUIRE( u.size() == 36 );
+            REQUIRE( isHexId(u) );
+            REQUIRE( u[8] == '-' );
+            REQUIRE( u[13] == '-' );
+            REQUIRE( u[18] == '-' );
+            REQUIRE( u[23] == '-' );
+            REQUIRE( string("89ab").find(u[19]) != string::npos );
+        }
+        REQUIRE( mkUUID()[14] == '4' );
+        REQUIRE( mkUUIDv7()[14] == '7' );
+    }
+}
+
+TEST_CASE( "UUIDv7 is time ordered", "[uuid]") {
+    auto ms = [](const string &u) {
+        return stoull(u.substr(0, 8) + u.substr(9, 4), nullptr, 16);
+    };
+    auto before = chrono::duration_cast<chrono::milliseconds>(
+        chrono::system_clock::now().time_since_epoch()).count();
+    string prev = mkUUIDv7();
+    REQUIRE( ms(prev) >= static_cast<uint64_t>(before) );
+    // many per millisecond still come out strictly increasing
+    for (int i = 0; i < 10000; i++) {
+        string next = mkUUIDv7();
+        REQUIRE( next > prev );
+        prev = next;
+    }
+    REQUIRE( ms(prev) - before < 10000 );
+}
+
+TEST_CASE( "UUIDs from many threads are unique", "[uuid]") {
+    const int per_thread = 5000;
+    vector<vector<string>> made(4);
+    vector<thread> threads;
+    for (auto &ids : made) {
+        threads.emplace_back([&ids, per_thread] {
+            for (int i = 0; i < per_thread; i++) {
+                ids.push_back(i % 2 ? mkUUID() : mkUUIDv7());
+            }
+        });
+    }
+    for (auto &t : threads) {
+        t.join();
+    }
+    set<string> all;
+    for (auto &ids : made) {
+        all.insert(ids.begin(), ids.end());
+    }
+    REQUIRE( all.size() == made.size() * per_thread );
+}
+
+TEST_CASE( "UUID benchmark", "[!hide][benchmark]") {
+    // the previous implementation, for comparison
+    auto streamed = [] {
+        char rand_dat[16];
+        ifstream urand("/dev/urandom");
+        urand.read(rand_dat, sizeof(rand_dat));
+        urand.close();
+        stringstream uuid;
+        uuid << hex << setfill('0');
+        for (int i = 0; i < 16; i++) {
+            if (i == 4 || i == 6 || i == 8 || i == 10) uuid << '-';
+            uuid << setw(2) << (0xFF & rand_dat[i]);
+        }
+        return uuid.str();
+    };
+    BENCHMARK("ifstream + stringstream") {
+        return streamed();
+    };
+    BENCHMARK("mkUUID") {
+        return mkUUID();
+    };
+    BENCHMARK("mkUUIDv7") {
+        return mkUUIDv7();
+    };
+}
+
 /**
  * path utility tests
  */
@@ -122,6 +214,26 @@ TEST_CASE("behead", "[paths]") {
     }
 }
 
+// the validators replace these regexes, so they must agree on every
+// single character and on the edge cases
+TEST_CASE( "topic and id validators", "[validate]") {
+    regex topic_re("^[-_[:alnum:]]+$", regex_constants::extended);
+    regex id_re("^[-[:xdigit:]]+$", regex_constants::extended);
+    for (int c = 1; c < 256; c++) {
+        string s(1, static_cast<char>(c));
+        INFO("char " << c);
+        CHECK( isTopicName(s) == regex_match(s, topic_re) );
+        CHECK( isHexId(s) == regex_match(s, id_re) );
+    }
+    CHECK_FALSE( isTopicName("") );
+    CHECK_FALSE( isHexId("") );
+    CHECK( isTopicName("some-topic_01") );
+    CHECK_FALSE( isTopicName("some/topic") );
+    CHECK_FALSE( isTopicName("../topic") );
+    CHECK( isHexId(mkUUID()) );
+    CHECK_FALSE( isHexId("0123-abcg") );
+}
+
 // fragile, because the messages could change
 TEST_CASE( "OSError - fragile test!", "[log]") {
     GIVEN( "errno = EACCES" ) {
@@ -165,3 +277,80 @@ TEST_CASE( "check crc 'Check_42'" ) {
 
     unlink(ftmp);
 }
+
+TEST_CASE( "runProcessGetOutput", "[process]") {
+    string output;
+
+    SECTION("output and exit status") {
+        const char *argv[] = {"sh", "-c", "echo hello; exit 3", nullptr};
+        REQUIRE( runProcessGetOutput("/bin/sh", argv, 100, 1, output) == 3 );
+        REQUIRE( output == "hello\n" );
+    }
+
+    SECTION("output limit") {
+        const char *argv[] = {"sh", "-c", "while echo 0123456789; do :; done", nullptr};
+        REQUIRE( runProcessGetOutput("/bin/sh", argv, 100, 1, output) == 128 + SIGKILL );
+        REQUIRE( output.length() <= 100 );
+    }
+
+    SECTION("timeout kills whatever the child started") {
+        const char *argv[] = {"sh", "-c", "echo started; sleep 10 & wait", nullptr};
+        auto start = chrono::steady_clock::now();
+        REQUIRE( runProcessGetOutput("/bin/sh", argv, 100, 1, output) == 128 + SIGKILL );
+        REQUIRE( chrono::steady_clock::now() - start < chrono::seconds(3) );
+        REQUIRE( output == "started\n" );
+    }
+
+    SECTION("timeout of a child that writes nothing") {
+        const char *argv[] = {"sh", "-c", "exec sleep 10", nullptr};
+        auto start = chrono::steady_clock::now();
+        REQUIRE( runProcessGetOutput("/bin/sh", argv, 100, 1, output) == 128 + SIGKILL );
+        REQUIRE( chrono::steady_clock::now() - start < chrono::seconds(3) );
+        REQUIRE( output.empty() );
+    }
+
+    SECTION("a child that can't be waited for") {
+        // with SIGCHLD ignored, the kernel reaps the child itself
+        auto old = signal(SIGCHLD, SIG_IGN);
+        const char *argv[] = {"true", nullptr};
+        bool threw = false;
+        try {
+            runProcessGetOutput("/bin/true", argv, 100, 1, output);
+        }
+        catch (const system_error &e) {
+            threw = true;
+        }
+        signal(SIGCHLD, old);
+        REQUIRE( threw );
+    }
+
+    SECTION("no such command") {
+        const char *argv[] = {"nonexistent", nullptr};
+        REQUIRE( runProcessGetOutput("/nonexistent", argv, 100, 1, output) == 127 );
+        REQUIRE( output.empty() );
+    }
+
+    SECTION("from several threads at once") {
+        vector<thread> threads;
+        vector<int> status(4, -1);
+        for (size_t i = 0; i < status.size(); i++) {
+            threads.emplace_back([&status, i] {
+                const char *argv[] = {"true", nullptr};
+                string out;
+                status[i] = runProcessGetOutput("/bin/true", argv, 100, 1, out);
+            });
+        }
+        for (auto &t : threads) {
+            t.join();
+        }
+        REQUIRE( status == vector<int>(status.size(), 0) );
+    }
+}
+
+TEST_CASE( "spawn latency benchmark", "[!hide][benchmark]") {
+    const char *argv[] = {"true", nullptr};
+    BENCHMARK("runProcessGetOutput /bin/true") {
+        string output;
+        return runProcessGetOutput("/bin/true", argv, 100, 1, output);
+    };
+}
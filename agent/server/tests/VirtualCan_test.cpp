@@ -0,0 +1,310 @@
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include "AgentUAVCANNode.h"
+#include "AgentUAVCANServer.h"
+#include "VirtualCan.h"
+#include "nlohmann/json.hpp"
+#include <ussp/payload/PayloadAdcsFeed.hpp>
+
+// Note, Catch2 defines conflict with uavcan defines, so include this last
+#include "catch2/catch.hpp"
+
+using namespace std;
+
+namespace {
+
+uint64_t monotonicUs() {
+    return chrono::duration_cast<chrono::microseconds>(
+        chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+uavcan::CanFrame makeFrame(uint32_t id) {
+    const uint8_t data[8] = {1, 2, 3, 4, 5, 6, 7, 8};
+    return uavcan::CanFrame(id | uavcan::CanFrame::FlagEFF, data, sizeof(data));
+}
+
+/// select() for reading, waiting up to `timeout_ms`
+bool waitReadable(VirtualCanDriver &driver, unsigned timeout_ms) {
+    uavcan::CanSelectMasks masks;
+    masks.read = 1;
+    const uavcan::CanFrame *pending[uavcan::MaxCanIfaces] = {};
+    driver.select(masks, pending, uavcan::MonotonicTime::fromUSec(
+        monotonicUs() + timeout_ms * 1000));
+    return masks.read == 1;
+}
+
+bool fdReadable(int fd, int timeout_ms) {
+    struct pollfd pfd = {fd, POLLIN, 0};
+    return poll(&pfd, 1, timeout_ms) == 1;
+}
+
+/// frames `driver` has ready now
+int drain(VirtualCanDriver &driver) {
+    int n = 0;
+    uavcan::CanFrame frame;
+    uavcan::MonotonicTime mono;
+    uavcan::UtcTime utc;
+    uavcan::CanIOFlags flags;
+    while (driver.receive(frame, mono, utc, flags) == 1) {
+        n++;
+    }
+    return n;
+}
+
+uavcan_linux::NodePtr makePeer(VirtualCanBus &bus) {
+    return uavcan_linux::makeNode(bus.connect(), "peer", uavcan::protocol::SoftwareVersion(),
+                                  uavcan::protocol::HardwareVersion(), uavcan::NodeID(102));
+}
+
+struct FeedResult {
+    unsigned sent = 0;
+    uint64_t received = 0;
+    vector<double> latency_ms;  ///< of the responses read, from broadcast
+};
+
+/**
+ * \brief broadcast PayloadAdcsFeed at `rate` Hz for `seconds` from a peer
+ * to the agent's server, and time each message from its broadcast to the
+ * /sdk/v1/adcs response that carries it
+ */
+FeedResult runFeed(const VirtualCanConfig &config, unsigned rate, double seconds) {
+    VirtualCanBus bus(config);
+    AgentUAVCANNode node(bus.connect(), "vcan", 101);
+    AgentUAVCANServer server(node);
+    int notify_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    server.m_mgr.setNotifyFd(notify_fd);
+    node.start();
+
+    auto peer = makePeer(bus);
+    uavcan::Publisher<ussp::payload::PayloadAdcsFeed> pub(*peer);
+    REQUIRE(pub.init() >= 0);
+
+    FeedResult result;
+    const unsigned count = static_cast<unsigned>(rate * seconds);
+    // the message's unix_timestamp is its index
+    vector<atomic<uint64_t>> sent_at(count);
+    atomic<bool> done{false};
+    thread reader([&] {
+        vector<bool> seen(count);
+        while (!done) {
+            if (!fdReadable(notify_fd, 10)) {
+                continue;
+            }
+            uint64_t n;
+            ssize_t r = ::read(notify_fd, &n, sizeof(n));
+            (void) r;
+            auto body = nlohmann::json::parse(server.m_mgr.getAdcsJson());
+            uint64_t now = monotonicUs();
+            auto i = body.at("hk").at("unix_timestamp").get<unsigned>();
+            if (i < count && !seen[i]) {
+                seen[i] = true;
+                result.latency_ms.push_back((now - sent_at[i]) / 1000.0);
+            }
+        }
+    });
+
+    ussp::payload::PayloadAdcsFeed msg;
+    const uint64_t start = monotonicUs();
+    for (unsigned i = 0; i < count; i++) {
+        msg.unix_timestamp = i;
+        sent_at[i] = monotonicUs();
+        if (pub.broadcast(msg) >= 0) {
+            result.sent++;
+        }
+        // send what's queued until the next one is due
+        peer->spin(uavcan::MonotonicTime::fromUSec(start + (i + 1) * 1000000ULL / rate));
+    }
+    peer->spin(uavcan::MonotonicDuration::fromMSec(200));
+    done = true;
+    reader.join();
+
+    node.stop();
+    server.m_mgr.setNotifyFd(-1);
+    ::close(notify_fd);
+    result.received = server.m_mgr.adcsVersion();
+    return result;
+}
+
+double percentile(vector<double> v, double p) {
+    if (v.empty()) {
+        return 0;
+    }
+    sort(v.begin(), v.end());
+    return v[min(v.size() - 1, static_cast<size_t>(p * v.size()))];
+}
+
+}  // namespace
+
+TEST_CASE("virtual can bus", "[uavcan]") {
+    VirtualCanConfig config;
+    config.latency_us = 2000;
+    VirtualCanBus bus(config);
+    auto a = bus.connect();
+    auto b = bus.connect();
+    // 131 bits of an extended frame with 8 bytes at 1Mbit/s
+    const uint64_t on_wire = 131;
+
+    const uint64_t before = monotonicUs();
+    REQUIRE(a->send(makeFrame(1), uavcan::MonotonicTime(), uavcan::CanIOFlagLoopback) == 1);
+    REQUIRE(bus.getFramesSent() == 1);
+
+    SECTION("frames arrive after their time on the wire and the latency") {
+        REQUIRE(waitReadable(*b, 1000));
+        REQUIRE(monotonicUs() >= before + on_wire + config.latency_us);
+        uavcan::CanFrame frame;
+        uavcan::MonotonicTime mono;
+        uavcan::UtcTime utc;
+        uavcan::CanIOFlags flags = 0xFF;
+        REQUIRE(b->receive(frame, mono, utc, flags) == 1);
+        REQUIRE(frame == makeFrame(1));
+        REQUIRE(flags == 0);
+        REQUIRE(mono.toUSec() >= before + on_wire + config.latency_us);
+        REQUIRE(!utc.isZero());
+        REQUIRE(b->receive(frame, mono, utc, flags) == 0);
+    }
+
+    SECTION("the sender gets its own back when it asks") {
+        REQUIRE(waitReadable(*a, 1000));
+        uavcan::CanFrame frame;
+        uavcan::MonotonicTime mono;
+        uavcan::UtcTime utc;
+        uavcan::CanIOFlags flags = 0;
+        REQUIRE(a->receive(frame, mono, utc, flags) == 1);
+        REQUIRE(flags == uavcan::CanIOFlagLoopback);
+        // without the latency
+        REQUIRE(mono.toUSec() < before + on_wire + config.latency_us);
+        REQUIRE(drain(*a) == 0);
+        REQUIRE(waitReadable(*b, 1000));
+        REQUIRE(drain(*b) == 1);
+    }
+
+    SECTION("the driver's descriptor is readable while a frame is due") {
+        REQUIRE_FALSE(fdReadable(b->getFileDescriptor(), 0));
+        REQUIRE(fdReadable(b->getFileDescriptor(), 1000));
+        REQUIRE(drain(*b) == 1);
+        REQUIRE_FALSE(fdReadable(b->getFileDescriptor(), 10));
+    }
+
+    SECTION("frames past their deadline are dropped") {
+        waitReadable(*b, 1000);
+        REQUIRE(a->send(makeFrame(2), uavcan::MonotonicTime::fromUSec(1), 0) == 1);
+        REQUIRE(a->getErrorCount() == 1);
+        REQUIRE(bus.getFramesSent() == 1);
+    }
+}
+
+TEST_CASE("virtual can bus wire time", "[uavcan]") {
+    VirtualCanConfig config;
+    config.bitrate = 10000;  // 13.1ms a frame
+    config.mailboxes = 1;
+    VirtualCanBus bus(config);
+    auto a = bus.connect();
+    auto b = bus.connect();
+
+    const uint64_t before = monotonicUs();
+    REQUIRE(a->send(makeFrame(1), uavcan::MonotonicTime(), 0) == 1);
+    // the mailbox is full until the frame is sent
+    REQUIRE(a->send(makeFrame(2), uavcan::MonotonicTime(), 0) == 0);
+    // another driver's frame goes on the wire after it
+    REQUIRE(b->send(makeFrame(3), uavcan::MonotonicTime(), 0) == 1);
+    REQUIRE(waitReadable(*a, 1000));
+    REQUIRE(monotonicUs() >= before + 2 * 13100);
+    REQUIRE(drain(*a) == 1);
+
+    // a frame waiting for a mailbox wakes the driver when one comes free
+    REQUIRE(a->send(makeFrame(4), uavcan::MonotonicTime(), 0) == 1);
+    uavcan::CanSelectMasks masks;
+    masks.write = 1;
+    const uavcan::CanFrame *pending[uavcan::MaxCanIfaces] = {};
+    a->select(masks, pending, uavcan::MonotonicTime());
+    REQUIRE(masks.write == 0);
+    REQUIRE(fdReadable(a->getFileDescriptor(), 1000));
+    REQUIRE(monotonicUs() >= before + 3 * 13100);
+
+    masks.write = 1;
+    a->select(masks, pending, uavcan::MonotonicTime::fromUSec(monotonicUs() + 1000000));
+    REQUIRE(masks.write == 1);
+    REQUIRE(a->send(makeFrame(5), uavcan::MonotonicTime(), 0) == 1);
+}
+
+TEST_CASE("virtual can bus losses repeat with the seed", "[uavcan]") {
+    auto run = [](uint32_t seed) {
+        VirtualCanConfig config;
+        config.bitrate = 0;
+        config.loss = 0.5;
+        config.seed = seed;
+        VirtualCanBus bus(config);
+        auto tx = bus.connect();
+        auto rx1 = bus.connect();
+        auto rx2 = bus.connect();
+        for (uint32_t i = 0; i < 100; i++) {
+            REQUIRE(tx->send(makeFrame(i), uavcan::MonotonicTime(), 0) == 1);
+        }
+        vector<int> received{drain(*rx1), drain(*rx2)};
+        REQUIRE(received[0] + received[1] + bus.getFramesLost() == 200);
+        return received;
+    };
+    auto first = run(7);
+    REQUIRE(first[0] > 20);
+    REQUIRE(first[0] < 80);
+    REQUIRE(run(7) == first);
+    REQUIRE(run(8) != first);
+}
+
+TEST_CASE("agent node on a virtual bus", "[uavcan]") {
+    VirtualCanConfig config;
+    config.latency_us = 500;
+    VirtualCanBus bus(config);
+    AgentUAVCANNode node(bus.connect(), "vcan", 101);
+    AgentUAVCANServer server(node);
+    node.start();
+
+    auto peer = makePeer(bus);
+    uavcan::Publisher<ussp::payload::PayloadAdcsFeed> pub(*peer);
+    REQUIRE(pub.init() >= 0);
+    ussp::payload::PayloadAdcsFeed msg;
+    msg.unix_timestamp = 1636051202;
+    REQUIRE(pub.broadcast(msg) >= 0);
+    for (int i = 0; i < 100 && server.m_mgr.adcsVersion() == 0; i++) {
+        peer->spin(uavcan::MonotonicDuration::fromMSec(10));
+    }
+    REQUIRE(server.m_mgr.adcsVersion() == 1);
+    auto body = nlohmann::json::parse(server.m_mgr.getAdcsJson());
+    REQUIRE(body.at("hk").at("unix_timestamp").get<double>() == 1636051202);
+
+    auto stats = node.getStats();
+    REQUIRE(stats.up);
+    REQUIRE(stats.ifaces[0].name == "vcan");
+    REQUIRE(stats.ifaces[0].frames_rx > 1);
+    node.stop();
+}
+
+TEST_CASE("ADCS feed latency benchmark", "[!hide][benchmark]") {
+    const double seconds = 2;
+    for (double loss : {0.0, 0.001}) {
+        VirtualCanConfig config;
+        config.latency_us = 100;
+        config.loss = loss;
+        for (unsigned rate : {10, 50, 100, 200, 300, 400, 800}) {
+            auto result = runFeed(config, rate, seconds);
+            ostringstream s;
+            s << fixed << setprecision(3) << "1Mbit/s, loss " << loss << ", " << rate << "Hz: "
+              << result.received << "/" << result.sent << " received, drop rate "
+              << 1 - static_cast<double>(result.received) / max(result.sent, 1u)
+              << ", latency ms p50 " << percentile(result.latency_ms, 0.5)
+              << " p99 " << percentile(result.latency_ms, 0.99)
+              << " max " << percentile(result.latency_ms, 1);
+            WARN(s.str());
+        }
+    }
+}
@@ -0,0 +1,81 @@
+#include <utility>
+#include <vector>
+
+#include "catch2/catch.hpp"
+
+#include "WorkerLanes.h"
+
+using namespace std;
+
+TEST_CASE( "lane limits", "[lanes]") {
+    WorkerLanes lanes(4, 1);
+    REQUIRE( lanes.bulkLimit() == 3 );
+
+    INFO("bulk lanes share the non-reserved workers") {
+        auto s1 = lanes.enter(WorkerLanes::Sdk);
+        auto s2 = lanes.enter(WorkerLanes::Collector);
+        auto s3 = lanes.enter(WorkerLanes::Collector);
+        REQUIRE( static_cast<bool>(s1) );
+        REQUIRE( static_cast<bool>(s2) );
+        REQUIRE( static_cast<bool>(s3) );
+
+        // a full lane is seen without counting a rejection
+        REQUIRE_FALSE( lanes.admits(WorkerLanes::Sdk) );
+        REQUIRE( lanes.admits(WorkerLanes::Realtime) );
+        REQUIRE( lanes.rejected(WorkerLanes::Sdk) == 0 );
+
+        auto s4 = lanes.enter(WorkerLanes::Sdk);
+        REQUIRE_FALSE( static_cast<bool>(s4) );
+        REQUIRE( lanes.rejected(WorkerLanes::Sdk) == 1 );
+
+        // realtime requests are always admitted
+        auto rt1 = lanes.enter(WorkerLanes::Realtime);
+        auto rt2 = lanes.enter(WorkerLanes::Realtime);
+        REQUIRE( static_cast<bool>(rt1) );
+        REQUIRE( static_cast<bool>(rt2) );
+
+        s2.release();
+        REQUIRE( lanes.active(WorkerLanes::Collector) == 1 );
+        REQUIRE( lanes.admits(WorkerLanes::Sdk) );
+        s4 = lanes.enter(WorkerLanes::Sdk);
+        REQUIRE( static_cast<bool>(s4) );
+        REQUIRE( lanes.active(WorkerLanes::Sdk) == 2 );
+    }
+
+    INFO("slots are released at scope exit") {
+        REQUIRE( lanes.active(WorkerLanes::Sdk) == 0 );
+        REQUIRE( lanes.active(WorkerLanes::Collector) == 0 );
+        vector<WorkerLanes::Slot> held;
+        for (int i = 0; i < 3; i++) {
+            held.push_back(lanes.enter(WorkerLanes::Sdk));
+        }
+        REQUIRE( lanes.active(WorkerLanes::Sdk) == 3 );
+        held.clear();
+        REQUIRE( lanes.active(WorkerLanes::Sdk) == 0 );
+    }
+}
+
+TEST_CASE( "collector cap", "[lanes]") {
+    WorkerLanes lanes(6, 2, 1);
+    REQUIRE( lanes.limit(WorkerLanes::Collector) == 1 );
+
+    auto c1 = lanes.enter(WorkerLanes::Collector);
+    auto c2 = lanes.enter(WorkerLanes::Collector);
+    REQUIRE( static_cast<bool>(c1) );
+    REQUIRE_FALSE( static_cast<bool>(c2) );
+
+    // sdk still has the rest of the bulk workers
+    auto s1 = lanes.enter(WorkerLanes::Sdk);
+    auto s2 = lanes.enter(WorkerLanes::Sdk);
+    auto s3 = lanes.enter(WorkerLanes::Sdk);
+    REQUIRE( static_cast<bool>(s1) );
+    REQUIRE( static_cast<bool>(s2) );
+    REQUIRE( static_cast<bool>(s3) );
+    REQUIRE_FALSE( static_cast<bool>(lanes.enter(WorkerLanes::Sdk)) );
+}
+
+TEST_CASE( "invalid lane configuration", "[lanes]") {
+    REQUIRE_THROWS( WorkerLanes(2, 2) );
+    REQUIRE_THROWS( WorkerLanes(0, 0) );
+    REQUIRE_NOTHROW( WorkerLanes(1, 0) );
+}
@@ -4,14 +4,17 @@
 
 #pragma once
 
+#include <algorithm>
 #include <memory>
 #include <string>
 #include <vector>
 #include <chrono>
 #include <iostream>
 #include <sstream>
+#include <unistd.h>
 #include <uavcan/uavcan.hpp>
 #include <uavcan/node/sub_node.hpp>
+#include <uavcan/helpers/heap_based_pool_allocator.hpp>
 
 namespace uavcan_linux
 {
@@ -163,6 +166,13 @@ using BlockingServiceClientPtr = std::shared_ptr<BlockingServiceClient<T>>;
 
 static constexpr std::size_t NodeMemPoolSize = 1024 * 512;  ///< This shall be enough for any possible use case
 
+/**
+ * Memory pool of a @ref Node, sized at run time.
+ * Blocks are taken from the heap as the node first needs them, up to the capacity, and are kept for reuse
+ * rather than freed; so the number of blocks taken from the heap is also the peak number used at once.
+ */
+typedef uavcan::HeapBasedPoolAllocator<uavcan::MemPoolBlockSize> NodeMemPoolAllocator;
+
 /**
  * Generic wrapper for node objects with some additional convenience functions.
  */
@@ -204,6 +214,21 @@ public:
         , driver_pack_(driver_pack)
     { }
 
+    /**
+     * Forwarding constructor for node types that take their memory pool from outside.
+     */
+    NodeBase(uavcan::ICanDriver& can_driver, uavcan::ISystemClock& clock, uavcan::IPoolAllocator& allocator) :
+        NodeType(can_driver, clock, allocator)
+    { }
+
+    /**
+     * Takes ownership of the driver container via the shared pointer; the memory pool is provided from outside.
+     */
+    NodeBase(DriverPackPtr driver_pack, uavcan::IPoolAllocator& allocator)
+        : NodeType(*driver_pack->can, driver_pack->clock, allocator)
+        , driver_pack_(driver_pack)
+    { }
+
     /**
      * Allocates @ref uavcan::Subscriber in the heap using shared pointer.
      * The subscriber will be started immediately.
@@ -300,14 +325,36 @@ public:
     DriverPackPtr& getDriverPack() { return driver_pack_; }
 };
 
+/**
+ * Owner of a node's memory pool; a base class of @ref Node, so that the pool is created before the node
+ * and destroyed after it.
+ */
+class NodeMemPool
+{
+    static uint16_t getNumBlocks(std::size_t pool_size)
+    {
+        const std::size_t blocks = pool_size / uavcan::MemPoolBlockSize;
+        return static_cast<uint16_t>(std::max<std::size_t>(1, std::min<std::size_t>(blocks, 0xFFFFU)));
+    }
+
+protected:
+    NodeMemPoolAllocator mem_pool_;
+
+    explicit NodeMemPool(std::size_t pool_size) :
+        mem_pool_(getNumBlocks(pool_size), getNumBlocks(pool_size))
+    { }
+};
+
 /**
  * Wrapper for uavcan::Node with some additional convenience functions.
  * Note that this wrapper adds stderr log sink to @ref uavcan::Logger, which can be removed if needed.
+ * The memory pool is limited to the given size in bytes, @ref NodeMemPoolSize by default, and is taken
+ * from the heap as needed.
  * Do not instantiate this class directly; instead use the factory functions defined below.
  */
-class Node : public NodeBase<uavcan::Node<NodeMemPoolSize>>
+class Node : private NodeMemPool, public NodeBase<uavcan::Node<>>
 {
-    typedef NodeBase<uavcan::Node<NodeMemPoolSize>> Base;
+    typedef NodeBase<uavcan::Node<>> Base;
 
     DefaultLogSink log_sink_;
 
@@ -315,8 +362,10 @@ public:
     /**
      * Simple forwarding constructor, compatible with uavcan::Node.
      */
-    Node(uavcan::ICanDriver& can_driver, uavcan::ISystemClock& clock) :
-        Base(can_driver, clock)
+    Node(uavcan::ICanDriver& can_driver, uavcan::ISystemClock& clock,
+         std::size_t mem_pool_size = NodeMemPoolSize) :
+        NodeMemPool(mem_pool_size),
+        Base(can_driver, clock, mem_pool_)
     {
         getLogger().setExternalSink(&log_sink_);
     }
@@ -324,11 +373,17 @@ public:
     /**
      * Takes ownership of the driver container via the shared pointer.
      */
-    explicit Node(DriverPackPtr driver_pack) :
-        Base(driver_pack)
+    explicit Node(DriverPackPtr driver_pack, std::size_t mem_pool_size = NodeMemPoolSize) :
+        NodeMemPool(mem_pool_size),
+        Base(driver_pack, mem_pool_)
     {
         getLogger().setExternalSink(&log_sink_);
     }
+
+    /**
+     * The memory pool, for its block capacity and usage.
+     */
+    const NodeMemPoolAllocator& getMemPool() const { return mem_pool_; }
 };
 
 /**
@@ -358,27 +413,31 @@ typedef std::shared_ptr<SubNode> SubNodePtr;
  * Use this function to create a node instance with default SocketCAN driver.
  * It accepts the list of interface names to use for the new node, e.g. "can1", "vcan2", "slcan0".
  * Clock adjustment mode will be detected automatically unless provided explicitly.
+ * The memory pool is limited to mem_pool_size bytes.
  * @throws uavcan_linux::Exception.
  */
 static inline NodePtr makeNode(const std::vector<std::string>& iface_names,
                                ClockAdjustmentMode clock_adjustment_mode =
-                                   SystemClock::detectPreferredClockAdjustmentMode())
+                                   SystemClock::detectPreferredClockAdjustmentMode(),
+                               std::size_t mem_pool_size = NodeMemPoolSize)
 {
     DriverPackPtr dp(new DriverPack(clock_adjustment_mode, iface_names));
-    return NodePtr(new Node(dp));
+    return NodePtr(new Node(dp, mem_pool_size));
 }
 
 /**
  * Use this function to create a node instance with a custom driver.
  * Clock adjustment mode will be detected automatically unless provided explicitly.
+ * The memory pool is limited to mem_pool_size bytes.
  * @throws uavcan_linux::Exception.
  */
 static inline NodePtr makeNode(const std::shared_ptr<uavcan::ICanDriver>& can_driver,
                                ClockAdjustmentMode clock_adjustment_mode =
-                                   SystemClock::detectPreferredClockAdjustmentMode())
+                                   SystemClock::detectPreferredClockAdjustmentMode(),
+                               std::size_t mem_pool_size = NodeMemPoolSize)
 {
     DriverPackPtr dp(new DriverPack(clock_adjustment_mode, can_driver));
-    return NodePtr(new Node(dp));
+    return NodePtr(new Node(dp, mem_pool_size));
 }
 
 /**
@@ -390,6 +449,7 @@ static inline NodePtr makeNode(const std::shared_ptr<uavcan::ICanDriver>& can_dr
  * later time by calling setNodeID() explicitly. Read the Node class docs for more info.
  *
  * Clock adjustment mode will be detected automatically unless provided explicitly.
+ * The memory pool is limited to mem_pool_size bytes.
  *
  * @throws uavcan_linux::Exception, uavcan_linux::LibuavcanErrorException.
  */
@@ -402,9 +462,11 @@ static inline NodePtr makeNode(const DriverType& driver,
                                const uavcan::TransferPriority node_status_transfer_priority =
                                    uavcan::TransferPriority::Default,
                                ClockAdjustmentMode clock_adjustment_mode =
-                                   SystemClock::detectPreferredClockAdjustmentMode())
+                                   SystemClock::detectPreferredClockAdjustmentMode(),
+                               std::size_t mem_pool_size = NodeMemPoolSize)
 {
-    NodePtr node = makeNode(driver, clock_adjustment_mode);
+    NodePtr node = makeNode(driver, clock_adjustment_mode, mem_pool_size);
+    const uavcan::MonotonicTime created = node->getMonotonicTime();
 
     node->setName(name);
     node->setSoftwareVersion(software_version);
@@ -415,6 +477,14 @@ static inline NodePtr makeNode(const DriverType& driver,
         node->setNodeID(node_id);
     }
 
+    // The first NodeStatus must report a positive uptime (libuavcan asserts it), so don't start
+    // within the microsecond the node was created in; with a fast driver that can happen.  Sleep
+    // rather than spin, and give up after a few tries so a clock that doesn't advance can't hang.
+    for (int i = 0; i < 100 && node->getMonotonicTime() <= created; i++)
+    {
+        ::usleep(1);
+    }
+
     const auto res = node->start(node_status_transfer_priority);
     if (res < 0)
     {
@@ -15,6 +15,7 @@
 #include <algorithm>
 
 #include <fcntl.h>
+#include <time.h>
 #include <sys/socket.h>
 #include <sys/ioctl.h>
 #include <net/if.h>
@@ -139,6 +140,24 @@ class SocketCanIface : public uavcan::ICanIface
         { }
     };
 
+    /*
+     * Frames are read RxBatchSize at a time with recvmmsg() into the batch buffers, and staged in a fixed ring
+     * for the library to drain. Nothing is read while the ring is full; the frames wait in the socket instead.
+     */
+    static constexpr unsigned RxBatchSize = 32;
+    static constexpr unsigned RxRingSize = 256;
+    static constexpr size_t RxControlSize = CMSG_SPACE(sizeof(::timeval)) + CMSG_SPACE(sizeof(std::uint32_t));
+    /// Kernel timestamps further in the past than this are taken to be from before a clock step
+    static constexpr std::int64_t MaxRxTimestampAgeUSec = 1000000;
+
+    struct RxBatch
+    {
+        ::mmsghdr msgs[RxBatchSize];
+        ::iovec iovs[RxBatchSize];
+        ::can_frame frames[RxBatchSize];
+        typename std::aligned_storage<RxControlSize, alignof(::cmsghdr)>::type control[RxBatchSize];
+    };
+
     const SystemClock& clock_;
     const int fd_;
 
@@ -148,13 +167,18 @@ class SocketCanIface : public uavcan::ICanIface
     std::uint64_t tx_frame_counter_ = 0;        ///< Increments with every frame pushed into the TX queue
 
     std::map<SocketCanError, std::uint64_t> errors_;
+    std::uint32_t rx_queue_overflows_ = 0;     ///< Frames dropped by the kernel, from SO_RXQ_OVFL
 
     std::priority_queue<TxItem> tx_queue_;                          // TODO: Use pool allocator
-    std::queue<RxItem> rx_queue_;                                   // TODO: Use pool allocator
     std::unordered_multiset<std::uint32_t> pending_loopback_ids_;   // TODO: Use pool allocator
 
     std::vector<::can_filter> hw_filters_container_;
 
+    std::unique_ptr<RxBatch> rx_batch_;
+    RxItem rx_ring_[RxRingSize];
+    unsigned rx_ring_head_ = 0;
+    unsigned rx_ring_count_ = 0;
+
     void registerError(SocketCanError e) { errors_[e]++; }
 
     void incrementNumFramesInSocketTxQueue()
@@ -208,60 +232,83 @@ class SocketCanIface : public uavcan::ICanIface
     }
 
     /**
+     * Reads up to max_frames frames without blocking.
+     * Returns the number of messages in the batch buffers, or negative on error.
+     */
+    int readBatch(unsigned max_frames)
+    {
+        RxBatch& b = *rx_batch_;
+        for (unsigned i = 0; i < max_frames; i++)
+        {
+            b.iovs[i].iov_base = &b.frames[i];
+            b.iovs[i].iov_len  = sizeof(b.frames[i]);
+            b.msgs[i] = ::mmsghdr();
+            b.msgs[i].msg_hdr.msg_iov    = &b.iovs[i];
+            b.msgs[i].msg_hdr.msg_iovlen = 1;
+            b.msgs[i].msg_hdr.msg_control    = &b.control[i];
+            b.msgs[i].msg_hdr.msg_controllen = RxControlSize;
+        }
+        const int res = ::recvmmsg(fd_, b.msgs, max_frames, MSG_DONTWAIT, nullptr);
+        if (res < 0)
+        {
+            return (errno == EWOULDBLOCK) ? 0 : res;
+        }
+        return res;
+    }
+
+    /**
+     * Converts message i of the batch.
+     * Returns 1 if it is a frame for the library, 0 if it is to be skipped, negative on error.
+     *
      * SocketCAN git show 1e55659ce6ddb5247cee0b1f720d77a799902b85
      *    MSG_DONTROUTE is set for any packet from localhost,
      *    MSG_CONFIRM is set for any pakcet of your socket.
      * Diff: https://git.ucsd.edu/abuss/linux/commit/1e55659ce6ddb5247cee0b1f720d77a799902b85
      * Man: https://www.kernel.org/doc/Documentation/networking/can.txt (chapter 4.1.6).
      */
-    int read(uavcan::CanFrame& frame, uavcan::UtcTime& ts_utc, bool& loopback) const
+    int parseBatchFrame(unsigned i, RxItem& rx, std::uint64_t& ts_kernel_usec)
     {
-        auto iov = ::iovec();
-        auto sockcan_frame = ::can_frame();
-        iov.iov_base = &sockcan_frame;
-        iov.iov_len  = sizeof(sockcan_frame);
-
-        static constexpr size_t ControlSize = sizeof(cmsghdr) + sizeof(::timeval);
-        using ControlStorage = typename std::aligned_storage<ControlSize>::type;
-        ControlStorage control_storage;
-        auto control = reinterpret_cast<std::uint8_t *>(&control_storage);
-        std::fill(control, control + ControlSize, 0x00);
-
-        auto msg = ::msghdr();
-        msg.msg_iov    = &iov;
-        msg.msg_iovlen = 1;
-        msg.msg_control = control;
-        msg.msg_controllen = ControlSize;
-
-        const int res = ::recvmsg(fd_, &msg, MSG_DONTWAIT);
-        if (res <= 0)
+        ::msghdr& msg = rx_batch_->msgs[i].msg_hdr;
+        const ::can_frame& sockcan_frame = rx_batch_->frames[i];
+        if (rx_batch_->msgs[i].msg_len != sizeof(sockcan_frame))
         {
-            return (res < 0 && errno == EWOULDBLOCK) ? 0 : res;
+            return -1;
         }
         /*
          * Flags
          */
-        loopback = (msg.msg_flags & static_cast<int>(MSG_CONFIRM)) != 0;
+        const bool loopback = (msg.msg_flags & static_cast<int>(MSG_CONFIRM)) != 0;
 
         if (!loopback && !checkHWFilters(sockcan_frame))
         {
             return 0;
         }
 
-        frame = makeUavcanFrame(sockcan_frame);
+        rx.frame = makeUavcanFrame(sockcan_frame);
+        if (loopback)
+        {
+            rx.flags |= uavcan::CanIOFlagLoopback;
+        }
         /*
-         * Timestamp
+         * Timestamp, and the socket's drop count if the kernel reports it
          */
-        const ::cmsghdr* const cmsg = CMSG_FIRSTHDR(&msg);
-        assert(cmsg != nullptr);
-        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_TIMESTAMP)
+        bool have_timestamp = false;
+        for (::cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg))
         {
-            auto tv = ::timeval();
-            (void)std::memcpy(&tv, CMSG_DATA(cmsg), sizeof(tv));  // Copy to avoid alignment problems
-            assert(tv.tv_sec >= 0 && tv.tv_usec >= 0);
-            ts_utc = uavcan::UtcTime::fromUSec(std::uint64_t(tv.tv_sec) * 1000000ULL + tv.tv_usec);
+            if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_TIMESTAMP)
+            {
+                auto tv = ::timeval();
+                (void)std::memcpy(&tv, CMSG_DATA(cmsg), sizeof(tv));  // Copy to avoid alignment problems
+                assert(tv.tv_sec >= 0 && tv.tv_usec >= 0);
+                ts_kernel_usec = std::uint64_t(tv.tv_sec) * 1000000ULL + tv.tv_usec;
+                have_timestamp = true;
+            }
+            else if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_RXQ_OVFL)
+            {
+                (void)std::memcpy(&rx_queue_overflows_, CMSG_DATA(cmsg), sizeof(rx_queue_overflows_));
+            }
         }
-        else
+        if (!have_timestamp)
         {
             assert(0);
             return -1;
@@ -307,36 +354,63 @@ class SocketCanIface : public uavcan::ICanIface
 
     void pollRead()
     {
-        while (true)
+        while (rx_ring_count_ < RxRingSize)
         {
-            RxItem rx;
-            rx.ts_mono = clock_.getMonotonic();  // Monotonic timestamp is not required to be precise (unlike UTC)
-            bool loopback = false;
-            const int res = read(rx.frame, rx.ts_utc, loopback);
-            if (res == 1)
+            const unsigned room = RxRingSize - rx_ring_count_;
+            const unsigned batch = (room < RxBatchSize) ? room : RxBatchSize;
+            const int res = readBatch(batch);
+            if (res < 0)
             {
-                assert(!rx.ts_utc.isZero());
-                bool accept = true;
-                if (loopback)                   // We receive loopback for all CAN frames
+                registerError(SocketCanError::SocketReadFailure);
+                break;
+            }
+            if (res == 0)
+            {
+                break;
+            }
+
+            /*
+             * The kernel's timestamps are taken when the frames arrive, so the monotonic timestamps are derived
+             * from them too rather than from the time they were read; one reading of each clock does the batch.
+             */
+            const uavcan::MonotonicTime mono_now = clock_.getMonotonic();
+            auto real_now = ::timespec();
+            (void)::clock_gettime(CLOCK_REALTIME, &real_now);
+            const std::uint64_t real_now_usec = std::uint64_t(real_now.tv_sec) * 1000000ULL + real_now.tv_nsec / 1000;
+
+            for (unsigned i = 0; i < unsigned(res); i++)
+            {
+                RxItem rx;
+                std::uint64_t ts_kernel_usec = 0;
+                const int parsed = parseBatchFrame(i, rx, ts_kernel_usec);
+                if (parsed < 0)
                 {
-                    confirmSentFrame();
-                    rx.flags |= uavcan::CanIOFlagLoopback;
-                    accept = wasInPendingLoopbackSet(rx.frame); // Do we need to send this loopback into the lib?
+                    registerError(SocketCanError::SocketReadFailure);
+                    continue;
                 }
-                if (accept)
+                if (parsed == 0)
                 {
-                    rx.ts_utc += clock_.getPrivateAdjustment();
-                    rx_queue_.push(rx);
+                    continue;
                 }
+                if (rx.flags & uavcan::CanIOFlagLoopback)   // We receive loopback for all CAN frames
+                {
+                    confirmSentFrame();
+                    if (!wasInPendingLoopbackSet(rx.frame)) // Do we need to send this loopback into the lib?
+                    {
+                        continue;
+                    }
+                }
+                const std::int64_t age_usec = std::int64_t(real_now_usec - ts_kernel_usec);
+                rx.ts_mono = (age_usec >= 0 && age_usec < MaxRxTimestampAgeUSec)
+                             ? mono_now - uavcan::MonotonicDuration::fromUSec(age_usec) : mono_now;
+                rx.ts_utc = uavcan::UtcTime::fromUSec(ts_kernel_usec) + clock_.getPrivateAdjustment();
+                rx_ring_[(rx_ring_head_ + rx_ring_count_) % RxRingSize] = rx;
+                rx_ring_count_++;
             }
-            else if (res == 0)
-            {
-                break;
-            }
-            else
+
+            if (unsigned(res) < batch)
             {
-                registerError(SocketCanError::SocketReadFailure);
-                break;
+                break;                  // The socket has been drained
             }
         }
     }
@@ -373,6 +447,7 @@ public:
         : clock_(clock)
         , fd_(socket_fd)
         , max_frames_in_socket_tx_queue_(max_frames_in_socket_tx_queue)
+        , rx_batch_(new RxBatch)
     {
         assert(fd_ >= 0);
     }
@@ -406,22 +481,23 @@ public:
     std::int16_t receive(uavcan::CanFrame& out_frame, uavcan::MonotonicTime& out_ts_monotonic,
                          uavcan::UtcTime& out_ts_utc, uavcan::CanIOFlags& out_flags) override
     {
-        if (rx_queue_.empty())
+        if (rx_ring_count_ == 0)
         {
             pollRead();            // This allows to use the socket not calling poll() explicitly.
-            if (rx_queue_.empty())
+            if (rx_ring_count_ == 0)
             {
                 return 0;
             }
         }
         {
-            const RxItem& rx = rx_queue_.front();
+            const RxItem& rx = rx_ring_[rx_ring_head_];
             out_frame        = rx.frame;
             out_ts_monotonic = rx.ts_mono;
             out_ts_utc       = rx.ts_utc;
             out_flags        = rx.flags;
         }
-        rx_queue_.pop();
+        rx_ring_head_ = (rx_ring_head_ + 1) % RxRingSize;
+        rx_ring_count_--;
         return 1;
     }
 
@@ -442,7 +518,7 @@ public:
         }
     }
 
-    bool hasReadyRx() const { return !rx_queue_.empty(); }
+    bool hasReadyRx() const { return rx_ring_count_ > 0; }
     bool hasReadyTx() const
     {
         return !tx_queue_.empty() && (frames_in_socket_tx_queue_ < max_frames_in_socket_tx_queue_);
@@ -508,6 +584,12 @@ public:
      */
     const decltype(errors_) & getErrors() const { return errors_; }
 
+    /**
+     * Returns number of frames the kernel dropped because the socket's receive queue was full.
+     * Always zero if the kernel doesn't support SO_RXQ_OVFL.
+     */
+    std::uint32_t getRxQueueOverflowCount() const { return rx_queue_overflows_; }
+
     int getFileDescriptor() const { return fd_; }
 
     /**
@@ -576,6 +658,8 @@ public:
             {
                 return -1;
             }
+            // Count of frames dropped on a full receive queue; optional
+            (void)::setsockopt(s, SOL_SOCKET, SO_RXQ_OVFL, &on, sizeof(on));
             // Socket loopback
             if (::setsockopt(s, SOL_CAN_RAW, CAN_RAW_RECV_OWN_MSGS, &on, sizeof(on)) < 0)
             {
@@ -0,0 +1,89 @@
+# measure sdk/v1/tfrs latency while collector and sdk file requests
+# keep the server busy.
+#
+# usage: bash tests/bench-mixed-load.sh [extra agent args]
+#   e.g. bash tests/bench-mixed-load.sh -W 4 -R 0   (no reserved worker)
+#
+# environment:
+#   FILES   - number of files queued for the collector listing (default 200)
+#   CLIENTS - number of concurrent bulk clients (default 8)
+#   SAMPLES - number of timed tfrs requests (default 200)
+
+set -e
+
+FILES=${FILES-200}
+CLIENTS=${CLIENTS-8}
+SAMPLES=${SAMPLES-200}
+
+BASE=/tmp/bench.$$
+WORKDIR=$BASE/workdir
+OUTPUT=$BASE/app.out
+PORT=2005
+URL=http://localhost:$PORT
+
+APP=build/oort-server
+
+mkdir -p $WORKDIR $BASE/src
+
+cleanup() {
+    for pid in $LOAD_PIDS; do
+        kill $pid 2> /dev/null || true
+    done
+    if [ -n "$APP_PID" ]; then
+        kill -INT $APP_PID
+        wait $APP_PID 2> /dev/null || true
+    fi
+    rm -rf $BASE
+}
+trap cleanup 0
+
+$APP -w $WORKDIR -m 1M -p $PORT "$@" > $OUTPUT 2>&1 &
+APP_PID=$!
+
+while ! nc -z localhost $PORT ; do
+    sleep 0.25
+done
+
+echo queueing $FILES files
+for i in $(seq $FILES); do
+    f=$BASE/src/file.$i
+    head -c 4096 /dev/urandom > $f
+    curl -Ss -o /dev/null $URL/sdk/v1/send_file -H "Content-type: application/json" \
+        -d "{\"filepath\": \"$f\", \"destination\": \"ground\", \"topic\": \"bench\"}"
+done
+
+echo starting $CLIENTS bulk clients
+for i in $(seq $CLIENTS); do
+    (
+        while true; do
+            if [ $((i % 2)) -eq 0 ]; then
+                curl -s -o /dev/null $URL/collector/v1/info -X POST \
+                    -H "Content-type: application/json" -d '{"topics": []}'
+            else
+                curl -s -o /dev/null $URL/sdk/v1/query_available_files/bench
+            fi
+        done
+    ) &
+    LOAD_PIDS="$LOAD_PIDS $!"
+done
+sleep 1
+
+echo timing $SAMPLES tfrs requests
+for i in $(seq $SAMPLES); do
+    curl -s -o /dev/null -w '%{time_total}\n' $URL/sdk/v1/tfrs
+done | sort -n | awk '
+    { t[NR] = $1 * 1000 }
+    END {
+        printf "tfrs latency ms: p50 %.1f  p95 %.1f  p99 %.1f  max %.1f\n",
+            t[int(NR * 0.50)], t[int(NR * 0.95)], t[int(NR * 0.99)], t[NR]
+    }'
+
+busy=0
+for i in $(seq 20); do
+    code=$(curl -s -o /dev/null -w '%{http_code}' $URL/collector/v1/info -X POST \
+        -H "Content-type: application/json" -d '{"topics": []}')
+    if [ "$code" = 503 ]; then
+        busy=$((busy + 1))
+    fi
+done
+echo "collector requests rejected as busy: $busy/20"